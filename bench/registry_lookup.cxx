@@ -0,0 +1,52 @@
+// Times the dynamic algorithm lookups that deserialisation goes through
+//
+// Usage: bench_registry_lookup [lookups]
+
+#include "c3/upsilon/identity.hpp"
+#include "c3/upsilon/kdf.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+template<typename Func>
+double ns_per_op(size_t n, Func f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i)
+    f(i);
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(n);
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? std::stoul(argv[1]) : 10000000;
+
+  constexpr hash_algorithm hash_algs[] = { hash_algorithm::SHA2_256, hash_algorithm::SHA3_256, hash_algorithm::BLAKE2b_256 };
+  constexpr kdf_algorithm kdf_algs[] = { kdf_algorithm::Shake256, kdf_algorithm::HKDF_SHA2_256, kdf_algorithm::BLAKE2b };
+
+  // Stops the compiler from throwing the lookups away
+  volatile uintptr_t sink = 0;
+
+  std::cout << std::setw(24) << "lookup" << std::setw(12) << "ns/op" << std::endl;
+
+  auto hash_ns = ns_per_op(n, [&](size_t i) {
+    sink = sink + reinterpret_cast<uintptr_t>(get_hash_function(hash_algs[i % 3]));
+  });
+  std::cout << std::setw(24) << "get_hash_function" << std::setw(12) << std::fixed << std::setprecision(2) << hash_ns << std::endl;
+
+  auto kdf_ns = ns_per_op(n, [&](size_t i) {
+    sink = sink + reinterpret_cast<uintptr_t>(get_kdf(kdf_algs[i % 3]));
+  });
+  std::cout << std::setw(24) << "get_kdf" << std::setw(12) << kdf_ns << std::endl;
+
+  auto props_ns = ns_per_op(n, [&](size_t i) {
+    sink = sink + get_hash_properties(hash_algs[i % 3]).max_output;
+  });
+  std::cout << std::setw(24) << "get_hash_properties" << std::setw(12) << props_ns << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+// Signs and verifies with one shared identity from an increasing number of threads
+//
+// Usage: bench_signer_scaling [ops per thread]
+
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+template<typename Func>
+double ops_per_sec(size_t n_threads, size_t ops_per_thread, Func f) {
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < n_threads; ++i)
+    threads.emplace_back([&]() {
+      for (size_t j = 0; j < ops_per_thread; ++j)
+        f();
+    });
+  for (auto& i : threads)
+    i.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(n_threads * ops_per_thread) / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  size_t ops_per_thread = argc > 1 ? std::stoul(argv[1]) : 2000;
+  size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  auto me = owned_identity::gen<sig_alg, hash_alg>();
+  auto me_pub = static_cast<identity>(me);
+
+  auto msg = nu::serialise("Hello, world!");
+  auto sig = me.sign(msg);
+
+  std::cout << std::setw(8) << "threads"
+            << std::setw(16) << "sign/s"
+            << std::setw(16) << "verify/s"
+            << std::setw(12) << "speedup" << std::endl;
+
+  double base = 0;
+  for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+    auto sign_rate = ops_per_sec(n_threads, ops_per_thread, [&]() { me.sign(msg); });
+    auto verify_rate = ops_per_sec(n_threads, ops_per_thread, [&]() {
+      if (!me_pub.verify(msg, sig))
+        throw std::runtime_error("Failed to verify own signature");
+    });
+
+    if (n_threads == 1)
+      base = sign_rate;
+
+    std::cout << std::setw(8) << n_threads
+              << std::setw(16) << std::fixed << std::setprecision(0) << sign_rate
+              << std::setw(16) << verify_rate
+              << std::setw(12) << std::setprecision(2) << sign_rate / base << std::endl;
+
+    // Make sure the full core count is always measured
+    if (n_threads < max_threads && n_threads * 2 > max_threads)
+      n_threads = max_threads / 2;
+  }
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Just enough JSON to write the results and read them back in compare mode
+#pragma once
+
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace c3::upsilon::bench {
+  struct json {
+    enum class kind { null, number, string, array, object } type = kind::null;
+    double number = 0;
+    std::string string;
+    std::vector<json> array;
+    std::map<std::string, json> object;
+
+    inline const json& operator[](const std::string& key) const {
+      auto iter = object.find(key);
+      if (iter == object.end())
+        throw std::runtime_error("Missing JSON field " + key);
+      return iter->second;
+    }
+  };
+
+  inline void write_json_string(std::ostream& os, const std::string& s) {
+    os << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        os << '\\' << c;
+      else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        os << buf;
+      }
+      else
+        os << c;
+    }
+    os << '"';
+  }
+
+  class json_parser {
+  private:
+    const std::string& _s;
+    size_t _pos = 0;
+
+  private:
+    inline void _skip_ws() {
+      while (_pos < _s.size() && std::isspace(static_cast<unsigned char>(_s[_pos])))
+        ++_pos;
+    }
+    inline char _peek() {
+      _skip_ws();
+      if (_pos >= _s.size())
+        throw std::runtime_error("Unexpected end of JSON");
+      return _s[_pos];
+    }
+    inline void _expect(char c) {
+      if (_peek() != c)
+        throw std::runtime_error(std::string{"Expected '"} + c + "' in JSON at " + std::to_string(_pos));
+      ++_pos;
+    }
+
+    inline std::string _parse_string() {
+      _expect('"');
+      std::string ret;
+      while (_pos < _s.size() && _s[_pos] != '"') {
+        if (_s[_pos] == '\\') {
+          ++_pos;
+          if (_pos >= _s.size())
+            break;
+          if (_s[_pos] == 'u') {
+            ret.push_back(static_cast<char>(std::stoi(_s.substr(_pos + 1, 4), nullptr, 16)));
+            _pos += 5;
+            continue;
+          }
+          switch (_s[_pos]) {
+            case 'n': ret.push_back('\n'); break;
+            case 't': ret.push_back('\t'); break;
+            default: ret.push_back(_s[_pos]);
+          }
+          ++_pos;
+        }
+        else
+          ret.push_back(_s[_pos++]);
+      }
+      _expect('"');
+      return ret;
+    }
+
+  public:
+    inline json parse_value() {
+      json ret;
+      auto c = _peek();
+      if (c == '{') {
+        ret.type = json::kind::object;
+        ++_pos;
+        if (_peek() == '}') { ++_pos; return ret; }
+        while (true) {
+          auto key = _parse_string();
+          _expect(':');
+          ret.object.emplace(std::move(key), parse_value());
+          if (_peek() == ',') { ++_pos; continue; }
+          _expect('}');
+          return ret;
+        }
+      }
+      if (c == '[') {
+        ret.type = json::kind::array;
+        ++_pos;
+        if (_peek() == ']') { ++_pos; return ret; }
+        while (true) {
+          ret.array.push_back(parse_value());
+          if (_peek() == ',') { ++_pos; continue; }
+          _expect(']');
+          return ret;
+        }
+      }
+      if (c == '"') {
+        ret.type = json::kind::string;
+        ret.string = _parse_string();
+        return ret;
+      }
+      if (_s.compare(_pos, 4, "null") == 0) {
+        _pos += 4;
+        return ret;
+      }
+      if (_s.compare(_pos, 4, "true") == 0 || _s.compare(_pos, 5, "false") == 0) {
+        ret.type = json::kind::number;
+        ret.number = _s[_pos] == 't';
+        _pos += _s[_pos] == 't' ? 4 : 5;
+        return ret;
+      }
+
+      size_t len;
+      ret.type = json::kind::number;
+      ret.number = std::stod(_s.substr(_pos, 32), &len);
+      _pos += len;
+      return ret;
+    }
+
+  public:
+    inline json_parser(const std::string& s) : _s{s} {}
+  };
+
+  inline json parse_json(const std::string& s) { return json_parser{s}.parse_value(); }
+}
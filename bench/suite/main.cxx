@@ -0,0 +1,485 @@
+// Benchmarks every registered algorithm, and writes the results as JSON
+//
+// Usage: c3-upsilon-bench [options]
+//   --output FILE        write the JSON here rather than to stdout
+//   --filter TEXT        only run benchmarks whose name contains TEXT
+//   --max-size BYTES     largest message size, 64 MiB by default
+//   --min-time SECONDS   how long each measurement runs for, 0.2 by default
+//   --threads N          the all-core thread count, all hardware threads by default
+//   --compare BASELINE   compare against an earlier run, exiting with 1 on a regression
+//   --current FILE       with --compare, read the current results rather than running them
+//   --threshold PERCENT  how much slower counts as a regression, 10 by default
+
+#include "c3/upsilon/agreement.hpp"
+#include "c3/upsilon/argon2.hpp"
+#include "c3/upsilon/handshake.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/identity.hpp"
+#include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/mac.hpp"
+#include "c3/upsilon/static_hasher.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+#include "json.hpp"
+#include "runner.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+using namespace c3::upsilon;
+using namespace c3::upsilon::bench;
+using namespace c3;
+
+namespace {
+  std::string hex_name(uint16_t alg) {
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "0x%04x", alg);
+    return buf;
+  }
+
+  // Anything missing from these still gets benchmarked, just with a less helpful name
+  std::string name_of(hash_algorithm alg) {
+    switch (alg) {
+      case hash_algorithm::SHA2_224: return "SHA2_224";
+      case hash_algorithm::SHA2_256: return "SHA2_256";
+      case hash_algorithm::SHA2_384: return "SHA2_384";
+      case hash_algorithm::SHA2_512: return "SHA2_512";
+      case hash_algorithm::SHA3_224: return "SHA3_224";
+      case hash_algorithm::SHA3_256: return "SHA3_256";
+      case hash_algorithm::SHA3_384: return "SHA3_384";
+      case hash_algorithm::SHA3_512: return "SHA3_512";
+      case hash_algorithm::BLAKE2b_128: return "BLAKE2b_128";
+      case hash_algorithm::BLAKE2b_256: return "BLAKE2b_256";
+      case hash_algorithm::BLAKE2b_512: return "BLAKE2b_512";
+      case hash_algorithm::BLAKE2s_128: return "BLAKE2s_128";
+      case hash_algorithm::BLAKE2s_256: return "BLAKE2s_256";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+  std::string name_of(symmetric_algorithm alg) {
+    switch (alg) {
+      case symmetric_algorithm::AES128: return "AES128";
+      case symmetric_algorithm::AES256: return "AES256";
+      case symmetric_algorithm::ChaCha20_8: return "ChaCha20_8";
+      case symmetric_algorithm::ChaCha20_12: return "ChaCha20_12";
+      case symmetric_algorithm::ChaCha20_20: return "ChaCha20_20";
+      case symmetric_algorithm::XChaCha20_8: return "XChaCha20_8";
+      case symmetric_algorithm::XChaCha20_12: return "XChaCha20_12";
+      case symmetric_algorithm::XChaCha20_20: return "XChaCha20_20";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+  std::string name_of(kdf_algorithm alg) {
+    switch (alg) {
+      case kdf_algorithm::Shake128: return "Shake128";
+      case kdf_algorithm::Shake256: return "Shake256";
+      case kdf_algorithm::HKDF_SHA2_256: return "HKDF_SHA2_256";
+      case kdf_algorithm::HKDF_SHA2_512: return "HKDF_SHA2_512";
+      case kdf_algorithm::BLAKE2b: return "BLAKE2b";
+      case kdf_algorithm::Argon2id: return "Argon2id";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+  std::string name_of(mac_algorithm alg) {
+    switch (alg) {
+      case mac_algorithm::HMAC_SHA2_256: return "HMAC_SHA2_256";
+      case mac_algorithm::BLAKE2b_128: return "BLAKE2b_128";
+      case mac_algorithm::BLAKE2b_256: return "BLAKE2b_256";
+      case mac_algorithm::BLAKE2b_512: return "BLAKE2b_512";
+      case mac_algorithm::BLAKE2s_128: return "BLAKE2s_128";
+      case mac_algorithm::BLAKE2s_256: return "BLAKE2s_256";
+      case mac_algorithm::Poly1305: return "Poly1305";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+  std::string name_of(signature_algorithm alg) {
+    switch (alg) {
+      case signature_algorithm::Curve25519: return "Curve25519";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+  std::string name_of(agreement_algorithm alg) {
+    switch (alg) {
+      case agreement_algorithm::Curve25519: return "Curve25519";
+      default: return hex_name(static_cast<uint16_t>(alg));
+    }
+  }
+
+  struct bench_case {
+    std::string name;
+    std::vector<size_t> sizes;
+    std::function<op_factory(size_t)> make;
+  };
+
+  std::vector<size_t> message_sizes(size_t max_size) {
+    std::vector<size_t> ret;
+    for (size_t i = 16; i <= max_size; i *= 4)
+      ret.push_back(i);
+    return ret;
+  }
+
+  // As hash/, but with the algorithm fixed at compile time
+  template<hash_algorithm Alg>
+  bench_case static_hash_case(const std::vector<size_t>& sizes) {
+    return { "hash_static/" + name_of(Alg), sizes, [](size_t size) -> op_factory {
+      return [size]() -> std::function<void()> {
+        auto input = std::make_shared<nu::data>(size, 0x5c);
+        auto output = std::make_shared<nu::data>(std::min<size_t>(get_hash_properties<Alg>().max_output, 64));
+        return [input, output]() { static_hash<Alg>(*input, {}, *output); };
+      };
+    }};
+  }
+
+  std::vector<bench_case> all_cases(size_t max_size) {
+    std::vector<bench_case> ret;
+    auto sizes = message_sizes(max_size);
+
+    _hash_funcs.for_each([&](hash_algorithm alg, const hash_function* f) {
+      ret.push_back({ "hash/" + name_of(alg), sizes, [f](size_t size) -> op_factory {
+        return [f, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x5c);
+          auto output = std::make_shared<nu::data>(std::min<size_t>(f->properties()->max_output, 64));
+          return [f, input, output]() { f->compute_hash(*input, *output); };
+        };
+      }});
+    });
+
+    // Set against hash/ at the small sizes, this is what the virtual call and Botan object cost
+    for (auto& i : { static_hash_case<hash_algorithm::SHA2_224>(sizes), static_hash_case<hash_algorithm::SHA2_256>(sizes),
+                     static_hash_case<hash_algorithm::SHA2_384>(sizes), static_hash_case<hash_algorithm::SHA2_512>(sizes),
+                     static_hash_case<hash_algorithm::SHA3_224>(sizes), static_hash_case<hash_algorithm::SHA3_256>(sizes),
+                     static_hash_case<hash_algorithm::SHA3_384>(sizes), static_hash_case<hash_algorithm::SHA3_512>(sizes),
+                     static_hash_case<hash_algorithm::BLAKE2b_128>(sizes),
+                     static_hash_case<hash_algorithm::BLAKE2b_256>(sizes),
+                     static_hash_case<hash_algorithm::BLAKE2b_512>(sizes) })
+      ret.push_back(i);
+
+    // Scatter-gather cases split the size over this many equal fragments
+    static constexpr size_t symmetric_fragments = 8;
+    _symmetric_functions.for_each([&](symmetric_algorithm alg, auto make) {
+      ret.push_back({ "symmetric/" + name_of(alg), sizes, [alg, make](size_t size) -> op_factory {
+        return [alg, make, size]() -> std::function<void()> {
+          auto props = get_symmetric_properties(alg);
+          nu::data key(props.key_size, 0x36), iv(props.iv_size, 0x5c);
+          std::shared_ptr<symmetric_function> fn = make(key, iv);
+          auto buf = std::make_shared<nu::data>(size, 0x00);
+          return [fn, buf]() { fn->encrypt(nu::data_ref{*buf}); };
+        };
+      }});
+
+      // The same bytes as a scatter-gather list, to set against the contiguous case
+      ret.push_back({ "symmetric_v/" + name_of(alg), sizes, [alg, make](size_t size) -> op_factory {
+        return [alg, make, size]() -> std::function<void()> {
+          auto props = get_symmetric_properties(alg);
+          nu::data key(props.key_size, 0x36), iv(props.iv_size, 0x5c);
+          std::shared_ptr<symmetric_function> fn = make(key, iv);
+          auto buf = std::make_shared<nu::data>(size, 0x00);
+          auto frags = std::make_shared<std::vector<nu::data_ref>>();
+          for (size_t i = 0; i < symmetric_fragments; ++i)
+            frags->push_back(nu::data_ref{*buf}.subspan(i * (size / symmetric_fragments), size / symmetric_fragments));
+          return [fn, buf, frags]() { fn->encryptv(*frags); };
+        };
+      }});
+    });
+
+    _kdfs.for_each([&](kdf_algorithm alg, const kdf* k) {
+      ret.push_back({ "kdf/" + name_of(alg), sizes, [k](size_t size) -> op_factory {
+        return [k, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x36);
+          auto output = std::make_shared<nu::data>(32);
+          return [k, input, output]() { k->expand(*input, *output); };
+        };
+      }});
+    });
+
+    // Not in the registry, and costs the same whatever it is given, so a sweep would just waste time
+    std::shared_ptr<kdf> argon2 = make_argon2id_kdf(nu::data(16, 0x5c));
+    ret.push_back({ "kdf/" + name_of(kdf_algorithm::Argon2id), { 16 }, [argon2](size_t size) -> op_factory {
+      return [argon2, size]() -> std::function<void()> {
+        auto input = std::make_shared<nu::data>(size, 0x36);
+        auto output = std::make_shared<nu::data>(32);
+        return [argon2, input, output]() { argon2->expand(*input, *output); };
+      };
+    }});
+
+    // Batches split the size over this many equal messages
+    static constexpr size_t mac_batch = 16;
+    _mac_functions.for_each([&](mac_algorithm alg, const mac_function* f) {
+      auto props = f->properties();
+      nu::data key(std::min<size_t>(32, props->max_key), 0x36);
+      std::shared_ptr<mac_key> k = f->make_key(key);
+
+      // One-time keys refuse a second message, so each op pays for its own key
+      if (props->one_time) {
+        ret.push_back({ "mac/" + name_of(alg), sizes, [f, key, props](size_t size) -> op_factory {
+          return [f, key, props, size]() -> std::function<void()> {
+            auto input = std::make_shared<nu::data>(size, 0x5c);
+            auto output = std::make_shared<nu::data>(props->tag_size);
+            return [f, key, input, output]() { f->make_key(key)->tag(*input, *output); };
+          };
+        }});
+        return;
+      }
+
+      ret.push_back({ "mac/" + name_of(alg), sizes, [k, props](size_t size) -> op_factory {
+        return [k, props, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x5c);
+          auto output = std::make_shared<nu::data>(props->tag_size);
+          return [k, input, output]() { k->tag(*input, *output); };
+        };
+      }});
+
+      std::vector<size_t> batch_sizes;
+      for (auto i : sizes)
+        if (i >= mac_batch * 16)
+          batch_sizes.push_back(i);
+      ret.push_back({ "mac_batch/" + name_of(alg), batch_sizes, [k, props](size_t size) -> op_factory {
+        return [k, props, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x5c);
+          auto msgs = std::make_shared<std::vector<nu::data_const_ref>>();
+          for (size_t i = 0; i < mac_batch; ++i)
+            msgs->push_back(nu::data_const_ref{*input}.subspan(i * (size / mac_batch), size / mac_batch));
+          auto output = std::make_shared<nu::data>(mac_batch * props->tag_size);
+          return [k, msgs, output]() { k->tag_batch(*msgs, *output); };
+        };
+      }});
+    });
+
+    // Both sign the same pre-hashed message, so only one size makes sense
+    _signers.for_each([&](signature_algorithm alg, auto) {
+      std::shared_ptr<signer> s = gen_signer(alg);
+      ret.push_back({ "sign/" + name_of(alg), { 32 }, [s](size_t size) -> op_factory {
+        return [s, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x5c);
+          return [s, input]() { s->sign(*input); };
+        };
+      }});
+    });
+    _verifiers.for_each([&](signature_algorithm alg, auto) {
+      std::shared_ptr<signer> s = gen_signer(alg);
+      std::shared_ptr<verifier> v = get_verifier(alg, s->serialise_pub());
+      ret.push_back({ "verify/" + name_of(alg), { 32 }, [s, v](size_t size) -> op_factory {
+        return [s, v, size]() -> std::function<void()> {
+          auto input = std::make_shared<nu::data>(size, 0x5c);
+          auto sig = std::make_shared<nu::data>(s->sign(*input));
+          return [v, input, sig]() {
+            if (!v->verify(*input, *sig))
+              throw std::runtime_error("Failed to verify own signature");
+          };
+        };
+      }});
+    });
+
+    _agreement_functions.for_each([&](agreement_algorithm alg, auto) {
+      std::shared_ptr<agreement_function> a = gen_agreement_function(alg);
+      auto other = std::make_shared<nu::data>(gen_agreement_function(alg)->serialise_public());
+      ret.push_back({ "agree/" + name_of(alg), { other->size() }, [a, other](size_t) -> op_factory {
+        return [a, other]() -> std::function<void()> {
+          return [a, other]() { a->agree(*other); };
+        };
+      }});
+    });
+
+    // Both sides of a handshake run in one thread, so each op is a whole handshake and split
+    for (auto pattern : { handshake_pattern::XX, handshake_pattern::IK }) {
+      std::shared_ptr<agreement_function> is = gen_agreement_function(agreement_algorithm::Curve25519);
+      std::shared_ptr<agreement_function> rs = gen_agreement_function(agreement_algorithm::Curve25519);
+      auto name = pattern == handshake_pattern::XX ? "XX" : "IK";
+      ret.push_back({ std::string{"noise/handshake_"} + name, { 0 }, [pattern, is, rs](size_t) -> op_factory {
+        return [pattern, is, rs]() -> std::function<void()> {
+          auto rs_public = std::make_shared<nu::data>(rs->serialise_public());
+          auto buf = std::make_shared<nu::data>(256);
+          return [pattern, is, rs, rs_public, buf]() {
+            auto i = noise_handshake::initiator(pattern, *is, *rs_public);
+            auto r = noise_handshake::responder(pattern, *rs);
+            while (!i.finished()) {
+              auto& from = i.is_my_turn() ? i : r;
+              auto& to = i.is_my_turn() ? r : i;
+              auto len = from.write_message({}, *buf);
+              to.read_message(nu::data_const_ref{*buf}.first(len), {});
+            }
+            i.split();
+            r.split();
+          };
+        };
+      }});
+    }
+
+    // Set against symmetric/ChaCha20_20, this is what the Poly1305 tag and nonce handling cost
+    std::vector<size_t> record_sizes;
+    for (auto i : sizes)
+      if (i + noise_session::record_overhead <= noise_session::max_record_size)
+        record_sizes.push_back(i);
+    ret.push_back({ "noise/record", record_sizes, [](size_t size) -> op_factory {
+      return [size]() -> std::function<void()> {
+        auto is = gen_agreement_function(agreement_algorithm::Curve25519);
+        auto rs = gen_agreement_function(agreement_algorithm::Curve25519);
+        auto i = noise_handshake::initiator(handshake_pattern::IK, *is, rs->serialise_public());
+        auto r = noise_handshake::responder(handshake_pattern::IK, *rs);
+        nu::data msg(256);
+        r.read_message(nu::data_const_ref{msg}.first(i.write_message({}, msg)), {});
+        i.read_message(nu::data_const_ref{msg}.first(r.write_message({}, msg)), {});
+
+        auto sessions = std::make_shared<std::pair<noise_session, noise_session>>(i.split(), r.split());
+        auto plaintext = std::make_shared<nu::data>(size, 0x5c);
+        auto record = std::make_shared<nu::data>(size + noise_session::record_overhead);
+        return [sessions, plaintext, record]() {
+          sessions->first.encrypt(*plaintext, *record);
+          sessions->second.decrypt(*record, *plaintext);
+        };
+      };
+    }});
+
+    return ret;
+  }
+
+  void write_results(std::ostream& os, const std::vector<result>& results, const run_options& opts) {
+    os << "{\n"
+       << "  \"timestamp\": " << std::time(nullptr) << ",\n"
+       << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+       << "  \"min_time\": " << opts.min_time.count() << ",\n"
+       << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+      auto& r = results[i];
+      os << (i ? ",\n" : "\n") << "    {\"name\": ";
+      write_json_string(os, r.name);
+      os << std::setprecision(6)
+         << ", \"size\": " << r.size
+         << ", \"threads\": " << r.threads
+         << ", \"ops_per_sec\": " << r.ops_per_sec
+         << ", \"bytes_per_sec\": " << r.bytes_per_sec
+         << ", \"p50_ns\": " << r.p50_ns
+         << ", \"p90_ns\": " << r.p90_ns
+         << ", \"p99_ns\": " << r.p99_ns
+         << ", \"samples\": " << r.samples << "}";
+    }
+    os << "\n  ]\n}\n";
+  }
+
+  std::vector<result> read_results(const std::string& path) {
+    std::ifstream in{path};
+    if (!in)
+      throw std::runtime_error("Could not open " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+
+    std::vector<result> ret;
+    for (auto& i : parse_json(ss.str())["results"].array) {
+      result r;
+      r.name = i["name"].string;
+      r.size = static_cast<size_t>(i["size"].number);
+      r.threads = static_cast<size_t>(i["threads"].number);
+      r.ops_per_sec = i["ops_per_sec"].number;
+      r.bytes_per_sec = i["bytes_per_sec"].number;
+      r.p50_ns = i["p50_ns"].number;
+      r.p90_ns = i["p90_ns"].number;
+      r.p99_ns = i["p99_ns"].number;
+      r.samples = static_cast<size_t>(i["samples"].number);
+      ret.push_back(std::move(r));
+    }
+    return ret;
+  }
+
+  /// Prints every result that got slower by more than threshold, and returns how many did
+  size_t compare(const std::vector<result>& baseline, const std::vector<result>& current, double threshold) {
+    std::map<std::tuple<std::string, size_t, size_t>, const result*> old;
+    for (auto& i : baseline)
+      old.emplace(std::make_tuple(i.name, i.size, i.threads), &i);
+
+    size_t n_regressions = 0;
+    std::cerr << std::left << std::setw(32) << "benchmark" << std::right
+              << std::setw(10) << "size" << std::setw(8) << "threads"
+              << std::setw(12) << "ops/s" << std::setw(12) << "p99" << std::endl;
+    for (auto& i : current) {
+      auto iter = old.find(std::make_tuple(i.name, i.size, i.threads));
+      if (iter == old.end())
+        continue;
+      auto& o = *iter->second;
+
+      // Positive is worse for both
+      auto throughput = o.ops_per_sec / i.ops_per_sec - 1;
+      auto tail = o.p99_ns > 0 ? i.p99_ns / o.p99_ns - 1 : 0;
+      bool regressed = throughput > threshold || tail > threshold;
+      n_regressions += regressed;
+
+      std::cerr << std::left << std::setw(32) << i.name << std::right
+                << std::setw(10) << i.size << std::setw(8) << i.threads
+                << std::fixed << std::setprecision(1)
+                << std::setw(11) << -throughput * 100 << '%'
+                << std::setw(11) << tail * 100 << '%'
+                << (regressed ? "  REGRESSED" : "") << std::endl;
+    }
+    return n_regressions;
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string output_path, filter, baseline_path, current_path;
+  size_t max_size = 64 * 1024 * 1024;
+  size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  double threshold = 0.10;
+  run_options opts;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+      throw std::invalid_argument("Missing value for " + arg);
+    std::string value = argv[++i];
+
+    if (arg == "--output") output_path = value;
+    else if (arg == "--filter") filter = value;
+    else if (arg == "--max-size") max_size = std::stoull(value);
+    else if (arg == "--min-time") opts.min_time = std::chrono::duration<double>{std::stod(value)};
+    else if (arg == "--threads") max_threads = std::max<size_t>(std::stoul(value), 1);
+    else if (arg == "--compare") baseline_path = value;
+    else if (arg == "--current") current_path = value;
+    else if (arg == "--threshold") threshold = std::stod(value) / 100;
+    else
+      throw std::invalid_argument("Unknown option " + arg);
+  }
+
+  std::vector<result> results;
+  if (!current_path.empty())
+    results = read_results(current_path);
+  else {
+    for (auto& c : all_cases(max_size)) {
+      if (c.name.find(filter) == std::string::npos)
+        continue;
+      for (auto size : c.sizes) {
+        auto factory = c.make(size);
+        // Single-threaded, then every core at once
+        for (size_t n_threads : { size_t{1}, max_threads }) {
+          results.push_back(measure(c.name, size, n_threads, factory, opts));
+          auto& r = results.back();
+          std::cerr << std::left << std::setw(32) << r.name << std::right
+                    << std::setw(10) << r.size << std::setw(4) << r.threads
+                    << std::setw(16) << std::fixed << std::setprecision(0) << r.ops_per_sec << " op/s"
+                    << std::setw(12) << r.p50_ns << " ns p50" << std::endl;
+          if (max_threads == 1)
+            break;
+        }
+      }
+    }
+
+    if (output_path.empty())
+      write_results(std::cout, results, opts);
+    else {
+      std::ofstream out{output_path};
+      write_results(out, results, opts);
+    }
+  }
+
+  if (!baseline_path.empty())
+    return compare(read_results(baseline_path), results, threshold) ? 1 : 0;
+
+  return 0;
+}
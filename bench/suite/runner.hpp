@@ -0,0 +1,111 @@
+// Times one operation from one or more threads at once
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace c3::upsilon::bench {
+  using clock = std::chrono::steady_clock;
+
+  struct result {
+    std::string name;
+    size_t size;
+    size_t threads;
+    double ops_per_sec;
+    double bytes_per_sec;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    size_t samples;
+  };
+
+  /// Called once on each thread, so that every thread gets its own buffers and state
+  using op_factory = std::function<std::function<void()>()>;
+
+  struct run_options {
+    std::chrono::duration<double> min_time = std::chrono::milliseconds{200};
+    /// Cheap ops are timed in batches of about this long, so the clock doesn't dominate
+    std::chrono::nanoseconds batch_time = std::chrono::microseconds{10};
+  };
+
+  inline double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+      return 0;
+    auto i = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+  }
+
+  /// Latencies are per op, averaged over each batch
+  inline result measure(std::string name, size_t size, size_t n_threads,
+                        const op_factory& factory, const run_options& opts) {
+    std::vector<std::vector<double>> samples(n_threads);
+    std::vector<size_t> ops(n_threads);
+    std::atomic<size_t> n_ready = 0;
+    std::atomic<bool> go = false;
+
+    auto worker = [&](size_t id) {
+      auto op = factory();
+
+      // One untimed run warms the caches and tells us how big a batch should be
+      auto warmup_start = clock::now();
+      op();
+      auto op_time = std::max<clock::duration>(clock::now() - warmup_start, std::chrono::nanoseconds{1});
+      size_t batch = std::max<size_t>(1, opts.batch_time / op_time);
+
+      ++n_ready;
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+      auto& s = samples[id];
+      auto start = clock::now();
+      auto now = start;
+      do {
+        for (size_t i = 0; i < batch; ++i)
+          op();
+        auto prev = now;
+        now = clock::now();
+        std::chrono::duration<double, std::nano> elapsed = now - prev;
+        s.push_back(elapsed.count() / static_cast<double>(batch));
+        ops[id] += batch;
+      } while (now - start < opts.min_time);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_threads; ++i)
+      threads.emplace_back(worker, i);
+
+    // The clock only starts once everyone is warm
+    while (n_ready.load() < n_threads)
+      std::this_thread::yield();
+    auto start = clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& i : threads)
+      i.join();
+    std::chrono::duration<double> wall = clock::now() - start;
+
+    std::vector<double> all;
+    size_t total_ops = 0;
+    for (size_t i = 0; i < n_threads; ++i) {
+      all.insert(all.end(), samples[i].begin(), samples[i].end());
+      total_ops += ops[i];
+    }
+    std::sort(all.begin(), all.end());
+
+    result ret;
+    ret.name = std::move(name);
+    ret.size = size;
+    ret.threads = n_threads;
+    ret.ops_per_sec = static_cast<double>(total_ops) / wall.count();
+    ret.bytes_per_sec = ret.ops_per_sec * static_cast<double>(size);
+    ret.p50_ns = percentile(all, 0.5);
+    ret.p90_ns = percentile(all, 0.9);
+    ret.p99_ns = percentile(all, 0.99);
+    ret.samples = all.size();
+    return ret;
+  }
+}
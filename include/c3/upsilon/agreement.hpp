@@ -1,10 +1,17 @@
 #pragma once
 
 #include <memory>
+#include <chrono>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <string_view>
+#include <atomic>
 
 #include "c3/upsilon/hash.hpp"
 #include "c3/upsilon/kdf.hpp"
 #include "c3/upsilon/symmetric.hpp"
+#include "c3/upsilon/nuker.hpp"
 
 #include <c3/nu/data.hpp>
 #include <c3/nu/data/collections.hpp>
@@ -20,9 +27,21 @@ namespace c3::upsilon {
   public:
     /// SHOULD NOT BE USED DIRECTLY!!!
     /// Hash or kdf the result
-    virtual nu::data agree(nu::data_const_ref other_public) const = 0;
+    virtual nuking_data agree(nu::data_const_ref other_public) const = 0;
     virtual nu::data serialise_public() const = 0;
-    virtual nu::data serialise_private() const  = 0;
+    virtual nuking_data serialise_private() const  = 0;
+
+    /// The size of serialise_private's output, which implementations should know without encoding the key
+    virtual size_t serialised_private_size() const {
+      return serialise_private().size();
+    }
+    /// Writes serialise_private's output into b, which must be exactly serialised_private_size() long
+    virtual void serialise_private_into(nu::data_ref b) const {
+      auto tmp = serialise_private();
+      if (tmp.size() != static_cast<size_t>(b.size()))
+        throw std::invalid_argument("Private key is not the size of the buffer");
+      std::copy(tmp.begin(), tmp.end(), b.begin());
+    }
   public:
     virtual ~agreement_function() = default;
   };
@@ -33,29 +52,68 @@ namespace c3::upsilon {
   template<agreement_algorithm Alg>
   std::unique_ptr<agreement_function> gen_agreement_function();
 
-  extern std::map<agreement_algorithm,
-                  std::function<std::unique_ptr<agreement_function>(nu::data_const_ref)>> _agreement_functions;
+  extern const registry<agreement_algorithm,
+                        std::unique_ptr<agreement_function>(*)(nu::data_const_ref)> _agreement_functions;
 
-  extern std::map<agreement_algorithm,
-                  std::function<std::unique_ptr<agreement_function>()>> _ag_gens;
+  extern const registry<agreement_algorithm, std::unique_ptr<agreement_function>(*)()> _ag_gens;
 
   inline std::unique_ptr<agreement_function> get_agreement_function(agreement_algorithm alg,
                                                                     nu::data_const_ref b) {
-    auto iter = _agreement_functions.find(alg);
-    if (iter == _agreement_functions.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second)(b);
+    return _agreement_functions.get(alg)(b);
   }
 
   inline std::unique_ptr<agreement_function> gen_agreement_function(agreement_algorithm alg) {
-    auto iter = _ag_gens.find(alg);
-    if (iter == _ag_gens.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second)();
+    return _ag_gens.get(alg)();
   }
 
+  class remote_agreer;
+  class agreer;
+
+  /// A serialised remote_agreer, parsed in place without copying the public value
+  ///
+  /// Only valid for as long as the buffer it was parsed from
+  struct remote_agreer_view {
+    kdf_algorithm kdf_alg;
+    agreement_algorithm agreement_alg;
+    nu::data_const_ref public_value;
+
+    /// Throws if either algorithm is not implemented
+    static inline remote_agreer_view parse(nu::data_const_ref b) {
+      remote_agreer_view ret;
+      nu::expand(b, ret.kdf_alg, ret.agreement_alg, ret.public_value);
+      if (!_kdfs.contains(ret.kdf_alg))
+        throw algorithm_not_implemented<kdf_algorithm>{ret.kdf_alg};
+      if (!_agreement_functions.contains(ret.agreement_alg))
+        throw algorithm_not_implemented<agreement_algorithm>{ret.agreement_alg};
+      if (ret.public_value.empty())
+        throw nu::serialisation_failure("Empty public value");
+      return ret;
+    }
+
+    inline remote_agreer to_remote_agreer() const;
+  };
+
+  /// As remote_agreer_view, for a serialised agreer
+  struct agreer_view {
+    kdf_algorithm kdf_alg;
+    agreement_algorithm agreement_alg;
+    nu::data_const_ref private_key;
+
+    static inline agreer_view parse(nu::data_const_ref b) {
+      agreer_view ret;
+      nu::expand(b, ret.kdf_alg, ret.agreement_alg, ret.private_key);
+      if (!_kdfs.contains(ret.kdf_alg))
+        throw algorithm_not_implemented<kdf_algorithm>{ret.kdf_alg};
+      if (!_agreement_functions.contains(ret.agreement_alg))
+        throw algorithm_not_implemented<agreement_algorithm>{ret.agreement_alg};
+      if (ret.private_key.empty())
+        throw nu::serialisation_failure("Empty private key");
+      return ret;
+    }
+
+    inline agreer to_agreer() const;
+  };
+
   class remote_agreer : public nu::serialisable<remote_agreer> {
   public:
     kdf_algorithm kdf_alg;
@@ -69,46 +127,144 @@ namespace c3::upsilon {
                          decltype(shared_secret) _shared_secret) :
       kdf_alg{_kdf_alg}, agreement_alg{_agreement_alg}, shared_secret{_shared_secret} {}
 
+  public:
+    /// Size of the buffer serialise_into needs
+    inline size_t serialised_size() const {
+      return squashed_size(shared_secret.size(), kdf_alg, agreement_alg);
+    }
+    /// Writes the same bytes as serialise, returning how many were written
+    inline size_t serialise_into(nu::data_ref b) const {
+      return squash_into(b, shared_secret.size(), [&](nu::data_ref out) {
+        std::copy(shared_secret.begin(), shared_secret.end(), out.begin());
+      }, kdf_alg, agreement_alg);
+    }
+
   public:
     inline nu::data _serialise() const override {
       return nu::squash(kdf_alg, agreement_alg, shared_secret);
     }
     C3_NU_DEFINE_DESERIALISE(remote_agreer, b) {
-      remote_agreer ret;
-      nu::expand(b, ret.kdf_alg, ret.agreement_alg, ret.shared_secret);
-      return ret;
+      return remote_agreer_view::parse(b).to_remote_agreer();
     }
   };
 
+  inline remote_agreer remote_agreer_view::to_remote_agreer() const {
+    return { kdf_alg, agreement_alg, { public_value.begin(), public_value.end() } };
+  }
+
+  /// A bounded LRU cache of raw agreement results, keyed by the other party's public key
+  ///
+  /// Entries expire after the ttl, and are nuked when evicted.
+  /// Thread-safe: the keyspace is split over independently locked shards
+  class agreement_cache {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct stats {
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t evictions;
+    };
+
+  private:
+    struct entry {
+      std::string key;
+      nuking_data value;
+      clock::time_point expiry;
+    };
+    struct shard {
+      std::mutex lock;
+      // Front is the most recently used
+      std::list<entry> lru;
+      // Keys point into the entries, which std::list never moves
+      std::unordered_map<std::string_view, std::list<entry>::iterator> index;
+    };
+
+  private:
+    size_t _n_shards;
+    size_t _shard_capacity;
+    clock::duration _ttl;
+    std::unique_ptr<shard[]> _shards;
+
+    std::atomic<uint64_t> _hits = 0;
+    std::atomic<uint64_t> _misses = 0;
+    std::atomic<uint64_t> _evictions = 0;
+
+  private:
+    shard& _get_shard(std::string_view key);
+    void _evict(shard& s, std::list<entry>::iterator iter);
+
+  public:
+    /// Returns true and fills output if a live entry exists
+    bool get(nu::data_const_ref other_public, nuking_data& output);
+    void put(nu::data_const_ref other_public, nu::data_const_ref raw_result);
+    /// Nukes every entry
+    void clear();
+
+    stats get_stats() const noexcept;
+
+  public:
+    agreement_cache(size_t capacity,
+                    clock::duration ttl = std::chrono::minutes{10},
+                    size_t n_shards = 16);
+    ~agreement_cache();
+
+    agreement_cache(const agreement_cache&) = delete;
+    agreement_cache& operator=(const agreement_cache&) = delete;
+  };
+
   class agreer : public nu::serialisable<agreer> {
   private:
     agreement_algorithm _agreement_alg;
     std::unique_ptr<agreement_function> _agreement_func;
     const kdf* _kdf;
+    std::shared_ptr<agreement_cache> _cache;
+
+  private:
+    inline nuking_data _agree(nu::data_const_ref other) {
+      nuking_data ret;
+      if (_cache && _cache->get(other, ret))
+        return ret;
+
+      ret = _agreement_func->agree(other);
+      if (_cache)
+        _cache->put(other, ret);
+      return ret;
+    }
 
   public:
     template<symmetric_algorithm SymAlg>
     inline symmetric_key<SymAlg> derive_shared_key(nu::data_const_ref other) {
-      nu::data raw_result = _agreement_func->agree(other);
+      auto raw_result = _agree(other);
       symmetric_key<SymAlg> ret;
       _kdf->expand(raw_result, ret);
       return ret;
     }
     inline void derive_shared_secret(nu::data_const_ref other, nu::data_ref output) {
-      _kdf->expand(_agreement_func->agree(other), output);
+      _kdf->expand(_agree(other), output);
     }
-    inline nu::data derive_shared_secret(nu::data_const_ref other, size_t output_len) {
-      nu::data ret(output_len);
-      derive_shared_secret(_agreement_func->agree(other), ret);
+    inline nuking_data derive_shared_secret(nu::data_const_ref other, size_t output_len) {
+      nuking_data ret(output_len);
+      derive_shared_secret(other, ret);
       return ret;
     }
     template<size_t OutputLen>
     inline nu::static_data<OutputLen> derive_shared_secret(nu::data_const_ref other) {
       nu::static_data<OutputLen> ret;
-      derive_shared_secret(_agreement_func->agree(other), ret);
+      derive_shared_secret(other, ret);
       return ret;
     }
 
+  public:
+    /// Remembers the raw agreement with up to `capacity` peers, so repeat peers skip the curve operation
+    inline void enable_cache(size_t capacity,
+                             agreement_cache::clock::duration ttl = std::chrono::minutes{10}) {
+      _cache = std::make_shared<agreement_cache>(capacity, ttl);
+    }
+    inline void disable_cache() { _cache.reset(); }
+    /// nullptr if the cache is disabled
+    inline const agreement_cache* cache() const { return _cache.get(); }
+
   public:
     inline agreer() : _kdf{nullptr} {}
     inline agreer(agreement_algorithm agreement_alg,
@@ -137,18 +293,31 @@ namespace c3::upsilon {
       return gen(base.kdf_alg, base.agreement_alg);
     }
 
+  public:
+    /// Size of the buffer serialise_into needs, worked out without encoding the private key
+    inline size_t serialised_size() const {
+      return squashed_size(_agreement_func->serialised_private_size(), _kdf->alg(), _agreement_alg);
+    }
+    /// Writes the same bytes as serialise, returning how many were written
+    ///
+    /// The private key is written straight into b
+    inline size_t serialise_into(nu::data_ref b) const {
+      return squash_into(b, _agreement_func->serialised_private_size(), [&](nu::data_ref out) {
+        _agreement_func->serialise_private_into(out);
+      }, _kdf->alg(), _agreement_alg);
+    }
+
   public:
     nu::data _serialise() const override {
-      return nu::squash(_kdf->alg(), _agreement_alg, _agreement_func->serialise_private());
+      auto priv = _agreement_func->serialise_private();
+      return nu::squash(_kdf->alg(), _agreement_alg, nu::data_const_ref{priv});
     }
     C3_NU_DEFINE_DESERIALISE(agreer, b) {
-      kdf_algorithm kdf_alg;
-      agreement_algorithm agreement_alg;
-      nu::data_const_ref pub;
-
-      nu::expand(b, kdf_alg, agreement_alg, pub);
-
-      return {kdf_alg, agreement_alg, pub};
+      return agreer_view::parse(b).to_agreer();
     }
   };
+
+  inline agreer agreer_view::to_agreer() const {
+    return { kdf_alg, agreement_alg, private_key };
+  }
 }
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include "c3/upsilon/kdf.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// Cost parameters for Argon2id (RFC 9106)
+  struct argon2_params {
+    /// In KiB, rounded down to a multiple of 4 * lanes
+    uint32_t memory = 64 * 1024;
+    uint32_t iterations = 3;
+    uint32_t lanes = 4;
+    /// How many lanes are filled at once, where 0 means all of them
+    ///
+    /// Only changes the speed, not the output
+    uint32_t threads = 0;
+  };
+
+  /// Stretches a password into output.size() bytes
+  ///
+  /// The salt must be at least 8 bytes. The memory is mapped fresh for each call,
+  /// backed by huge pages where the kernel allows, and nuked before it is unmapped
+  void argon2id(nu::data_const_ref password, nu::data_const_ref salt, nu::data_ref output,
+                const argon2_params& params = {},
+                nu::data_const_ref secret = {}, nu::data_const_ref associated = {});
+  /// As above, but calls cancelled at the start of each slice, and gives up once it returns true
+  ///
+  /// Returns false if it gave up, leaving output untouched
+  bool argon2id(nu::data_const_ref password, nu::data_const_ref salt, nu::data_ref output,
+                const argon2_params& params,
+                nu::data_const_ref secret, nu::data_const_ref associated,
+                const std::function<bool()>& cancelled);
+  inline nu::data argon2id(nu::data_const_ref password, nu::data_const_ref salt, size_t output_len,
+                           const argon2_params& params = {}) {
+    nu::data ret(output_len);
+    argon2id(password, salt, ret, params);
+    return ret;
+  }
+
+  /// Times Argon2id on this machine, and picks parameters that take roughly target to run
+  ///
+  /// Memory is preferred over iterations, as per RFC 9106, so this uses as much of
+  /// max_memory (in KiB) as fits in target, and then adds iterations to fill the rest
+  argon2_params argon2_calibrate(std::chrono::milliseconds target,
+                                 uint32_t max_memory = 1024 * 1024, uint32_t lanes = 4);
+
+  /// A kdf running Argon2id with the given costs, over salt unless extract is given another
+  ///
+  /// Not in the kdf registry, so a peer naming kdf_algorithm::Argon2id can't make an agreer run
+  /// it on every handshake. The salt must be at least 8 bytes, and should be unique to the user
+  std::unique_ptr<kdf> make_argon2id_kdf(nu::data_const_ref salt, const argon2_params& params = {});
+}
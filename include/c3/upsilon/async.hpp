@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "c3/upsilon/argon2.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/identity.hpp"
+#include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// A fixed set of threads that run submitted jobs in the order they were submitted
+  ///
+  /// Jobs must not throw
+  class worker_pool {
+  private:
+    std::mutex _lock;
+    std::condition_variable _not_empty;
+    std::deque<std::function<void()>> _queue;
+    bool _stopping = false;
+
+    std::vector<std::thread> _workers;
+
+  private:
+    void _work();
+
+  public:
+    void submit(std::function<void()> job);
+
+    inline size_t size() const noexcept { return _workers.size(); }
+
+    /// Used by anything not given a pool of its own, with a thread per core
+    ///
+    /// Never destroyed, so that work still queued at exit is not waited on
+    static worker_pool& shared();
+
+  public:
+    worker_pool(size_t n_workers = std::max(std::thread::hardware_concurrency(), 1u));
+    /// Finishes every queued job before returning
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+  };
+}
+
+// The awaitables need C++20 from whoever includes this, but nothing from the library itself
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>) && __has_include(<stop_token>)
+
+#include <coroutine>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <type_traits>
+#include <variant>
+
+namespace c3::upsilon {
+  class operation_cancelled : public std::runtime_error {
+  public:
+    operation_cancelled() : std::runtime_error{"Operation cancelled"} {}
+  };
+
+  struct async_options {
+    /// Work on fewer bytes than this runs inline, as handing it over would cost more than it saves
+    size_t inline_threshold = 64 * 1024;
+    /// The shared pool if null
+    worker_pool* pool = nullptr;
+    /// Checked before the work starts, and between chunks of work that comes in chunks
+    std::stop_token stop;
+    /// Resumes the caller, e.g. by posting the handle to its event loop;
+    /// without one, the caller resumes on the worker that did the work
+    std::function<void(std::coroutine_handle<>)> resume_on;
+  };
+
+  /// How much is done between checks for cancellation
+  constexpr size_t async_chunk_size = 1024 * 1024;
+
+  /// Runs work when awaited, on a worker if size reaches the inline threshold
+  ///
+  /// Buffers are referenced rather than copied, so they must outlive the co_await, as they do
+  /// when they live in the awaiting coroutine. Throws operation_cancelled if stopped first
+  template<typename T>
+  class [[nodiscard]] async_op {
+  private:
+    using _stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  private:
+    std::function<T(const std::stop_token&)> _work;
+    size_t _size;
+    async_options _opts;
+
+    std::optional<_stored> _result;
+    std::exception_ptr _error;
+
+  private:
+    void _run() noexcept {
+      try {
+        if (_opts.stop.stop_requested())
+          throw operation_cancelled{};
+        if constexpr (std::is_void_v<T>) {
+          _work(_opts.stop);
+          _result.emplace();
+        }
+        else {
+          _result.emplace(_work(_opts.stop));
+        }
+      }
+      catch (...) {
+        _error = std::current_exception();
+      }
+    }
+
+  public:
+    inline bool await_ready() {
+      if (_size >= _opts.inline_threshold)
+        return false;
+      _run();
+      return true;
+    }
+
+    inline void await_suspend(std::coroutine_handle<> caller) {
+      auto& pool = _opts.pool ? *_opts.pool : worker_pool::shared();
+      pool.submit([this, caller]() {
+        // The caller may destroy this as soon as it resumes, so nothing here can outlive that
+        auto resume_on = std::move(_opts.resume_on);
+        _run();
+        if (resume_on)
+          resume_on(caller);
+        else
+          caller.resume();
+      });
+    }
+
+    inline T await_resume() {
+      if (_error)
+        std::rethrow_exception(_error);
+      if constexpr (!std::is_void_v<T>)
+        return std::move(*_result);
+    }
+
+  public:
+    async_op(std::function<T(const std::stop_token&)> work, size_t size, async_options opts) :
+      _work{std::move(work)}, _size{size}, _opts{std::move(opts)} {}
+  };
+
+  /// Offloads any work, which is passed the stop token to check as it sees fit
+  template<typename Func>
+  inline auto async_run(size_t size, Func&& f, async_options opts = {}) {
+    using ret_t = std::invoke_result_t<Func, const std::stop_token&>;
+    return async_op<ret_t>{std::forward<Func>(f), size, std::move(opts)};
+  }
+
+  inline void _async_process(partial_hasher& h, nu::data_const_ref input, const std::stop_token& stop) {
+    for (size_t pos = 0; pos < static_cast<size_t>(input.size()); pos += async_chunk_size) {
+      if (stop.stop_requested())
+        throw operation_cancelled{};
+      h.process(input.subspan(pos, std::min(async_chunk_size, static_cast<size_t>(input.size()) - pos)));
+    }
+  }
+
+  inline async_op<hash<>> async_hash(hasher h, nu::data_const_ref input, async_options opts = {}) {
+    return async_run(input.size(), [h, input](const std::stop_token& stop) {
+      auto partial = h.begin_hash();
+      _async_process(partial, input, stop);
+      return partial.finish();
+    }, std::move(opts));
+  }
+
+  /// Hashes and then signs, where cancelling part way through the hash leaves nothing signed
+  inline async_op<nu::data> async_sign(owned_identity id, nu::data_const_ref msg, async_options opts = {}) {
+    return async_run(msg.size(), [id = std::move(id), msg](const std::stop_token& stop) {
+      auto partial = id.begin_message();
+      _async_process(partial, msg, stop);
+      return id.sign(std::move(partial));
+    }, std::move(opts));
+  }
+
+  /// Cancelling part way through leaves the buffer partly encrypted, and f's position to match
+  inline async_op<void> async_encrypt(symmetric_function& f, nu::data_ref input_output, async_options opts = {}) {
+    return async_run(input_output.size(), [&f, input_output](const std::stop_token& stop) {
+      for (size_t pos = 0; pos < static_cast<size_t>(input_output.size()); pos += async_chunk_size) {
+        if (stop.stop_requested())
+          throw operation_cancelled{};
+        f.encrypt(input_output.subspan(pos, std::min(async_chunk_size,
+                                                     static_cast<size_t>(input_output.size()) - pos)));
+      }
+    }, std::move(opts));
+  }
+
+  /// As async_encrypt
+  inline async_op<void> async_decrypt(symmetric_function& f, nu::data_ref input_output, async_options opts = {}) {
+    return async_run(input_output.size(), [&f, input_output](const std::stop_token& stop) {
+      for (size_t pos = 0; pos < static_cast<size_t>(input_output.size()); pos += async_chunk_size) {
+        if (stop.stop_requested())
+          throw operation_cancelled{};
+        f.decrypt(input_output.subspan(pos, std::min(async_chunk_size,
+                                                     static_cast<size_t>(input_output.size()) - pos)));
+      }
+    }, std::move(opts));
+  }
+
+  /// Argon2id is always offloaded, whatever the sizes, as it is slow by design
+  ///
+  /// A kdf can't be stopped part way, so stop is only checked before it starts;
+  /// async_argon2id checks it throughout
+  inline async_op<void> async_expand(const kdf& k, nu::data_const_ref input, nu::data_ref output,
+                                     async_options opts = {}) {
+    auto size = k.alg() == kdf_algorithm::Argon2id ? std::numeric_limits<size_t>::max()
+                                                   : static_cast<size_t>(input.size() + output.size());
+    return async_run(size, [&k, input, output](const std::stop_token&) { k.expand(input, output); }, std::move(opts));
+  }
+
+  /// Always offloaded, as async_expand with Argon2id, and stop is checked at every slice
+  /// of every pass, leaving output untouched if it is cancelled
+  inline async_op<void> async_argon2id(nu::data_const_ref password, nu::data_const_ref salt, nu::data_ref output,
+                                       argon2_params params = {}, async_options opts = {}) {
+    return async_run(std::numeric_limits<size_t>::max(), [password, salt, output, params](const std::stop_token& stop) {
+      if (!argon2id(password, salt, output, params, {}, {}, [&stop]() { return stop.stop_requested(); }))
+        throw operation_cancelled{};
+    }, std::move(opts));
+  }
+}
+
+#endif
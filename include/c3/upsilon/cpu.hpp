@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace c3::upsilon {
+  enum class cpu_feature : uint8_t {
+    sse2,
+    ssse3,
+    sse4_1,
+    avx2,
+    avx512f,
+    bmi2,
+    aes_ni,
+    clmul,
+    sha_ni,
+
+    neon,
+    arm_aes,
+    arm_pmull,
+    arm_sha2,
+  };
+
+  class cpu_features {
+  private:
+    uint64_t _bits = 0;
+
+  public:
+    constexpr bool has(cpu_feature f) const noexcept { return _bits & (uint64_t{1} << static_cast<uint8_t>(f)); }
+    /// True if every feature in other is here too
+    constexpr bool has(cpu_features other) const noexcept { return (_bits & other._bits) == other._bits; }
+
+    constexpr cpu_features& set(cpu_feature f, bool on = true) noexcept {
+      if (on)
+        _bits |= uint64_t{1} << static_cast<uint8_t>(f);
+      else
+        _bits &= ~(uint64_t{1} << static_cast<uint8_t>(f));
+      return *this;
+    }
+
+    /// Space separated
+    std::string to_string() const;
+
+  public:
+    constexpr cpu_features() = default;
+    constexpr cpu_features(std::initializer_list<cpu_feature> features) {
+      for (auto f : features)
+        set(f);
+    }
+  };
+
+  const char* cpu_feature_name(cpu_feature f) noexcept;
+
+  /// The CPU's brand string where it has one, otherwise whatever identifies the model, or "unknown"
+  const std::string& cpu_model_name();
+
+  /// What this CPU and OS support, worked out once at load
+  const cpu_features& detected_cpu_features() noexcept;
+
+  /// detected_cpu_features, less anything named in C3_UPSILON_DISABLE_CPU
+  ///
+  /// That variable takes a comma separated list of cpu_feature_names, which are hidden
+  /// from Botan as well as from upsilon's own code, e.g. C3_UPSILON_DISABLE_CPU=avx2,sha_ni
+  const cpu_features& enabled_cpu_features() noexcept;
+
+  enum class algorithm_family : uint8_t {
+    hash,
+    symmetric,
+    kdf,
+    signature,
+    agreement,
+    mac,
+    /// The non-cryptographic helpers with more than one implementation, as utility_algorithm
+    utility,
+  };
+
+  enum class utility_algorithm : uint16_t {
+    jump_shard = 0x0001,
+    bloom_filter = 0x0002,
+  };
+
+  const char* algorithm_family_name(algorithm_family f) noexcept;
+
+  struct backend_info {
+    algorithm_family family;
+    /// From the family's *_algorithm enum
+    uint16_t alg;
+    /// Botan's provider string for Botan-backed algorithms (e.g. "base", "aesni", "shani", "openssl"),
+    /// otherwise the name of the upsilon implementation (e.g. "avx2", "portable")
+    std::string backend;
+  };
+
+  /// The implementation each registered algorithm runs on
+  ///
+  /// Implementations are picked on first use, and this makes sure every algorithm has been,
+  /// so the first call builds one of everything.
+  ///
+  /// C3_UPSILON_BACKEND overrides the pick, as a comma separated list of family=backend or
+  /// family/alg=backend, where alg is the hex value of the algorithm,
+  /// e.g. C3_UPSILON_BACKEND=hash=openssl,kdf/0x0800=portable
+  ///
+  /// A family=backend entry only moves the algorithms that have a backend of that name, and the
+  /// rest keep their usual pick. A family/alg=backend entry naming a backend the algorithm doesn't
+  /// have makes it throw std::invalid_argument on first use. Malformed entries are ignored
+  std::vector<backend_info> active_backends();
+
+  /// Empty if the algorithm has not been used yet
+  std::string active_backend(algorithm_family family, uint16_t alg);
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gsl/span>
+
+#include "c3/upsilon/hash.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// The probe a filter takes from a digest: its first 16 bytes as two big-endian words
+  ///
+  /// Digests are already uniform, so filters take their positions from these bits as they are
+  struct filter_key {
+    uint64_t hi;
+    uint64_t lo;
+
+    template<size_t HashSize>
+    static inline filter_key of(const hash<HashSize>& h) {
+      if (static_cast<size_t>(h.value.size()) < 16)
+        throw std::invalid_argument("Hash too short to filter on");
+      filter_key ret{0, 0};
+      for (size_t i = 0; i < 8; ++i) {
+        ret.hi = (ret.hi << 8) | h.value[i];
+        ret.lo = (ret.lo << 8) | h.value[i + 8];
+      }
+      return ret;
+    }
+  };
+
+  /// A read-only blocked Bloom filter over a serialised one, such as a mapped_file
+  ///
+  /// Only valid for as long as the buffer it was parsed from
+  class bloom_filter_view {
+    friend class bloom_filter;
+
+  private:
+    const uint8_t* _blocks = nullptr;
+    size_t _n_blocks = 0;
+
+  private:
+    // Picks the probe on first call, so an override it can't honour throws here rather than from contains
+    static void _choose_backend();
+
+  public:
+    /// True if the key may have been inserted, false if it certainly was not
+    bool contains(filter_key k) const noexcept;
+    template<size_t HashSize>
+    inline bool contains(const hash<HashSize>& h) const { return contains(filter_key::of(h)); }
+
+    /// contains for each key, prefetching ahead; results must be at least as long as keys
+    ///
+    /// Returns how many may have been inserted
+    size_t contains(gsl::span<const filter_key> keys, gsl::span<bool> results) const;
+    template<size_t HashSize>
+    inline size_t contains(gsl::span<const hash<HashSize>> hashes, gsl::span<bool> results) const {
+      std::vector<filter_key> keys;
+      keys.reserve(hashes.size());
+      for (auto& i : hashes)
+        keys.push_back(filter_key::of(i));
+      return contains(keys, results);
+    }
+
+    inline size_t n_blocks() const noexcept { return _n_blocks; }
+
+    /// Throws nu::serialisation_failure if b is not a serialised bloom_filter
+    static bloom_filter_view parse(nu::data_const_ref b);
+
+  public:
+    bloom_filter_view() = default;
+    bloom_filter_view(const uint8_t* blocks, size_t n_blocks) : _blocks{blocks}, _n_blocks{n_blocks} {
+      _choose_backend();
+    }
+  };
+
+  /// A split block Bloom filter: each key sets one bit in each of the eight 32 bit words
+  /// of a single 32 byte block, so a probe touches one cache line and is one SIMD test
+  ///
+  /// insert is safe to call from many threads at once, including alongside contains
+  class bloom_filter {
+  public:
+    static constexpr size_t block_size = 32;
+
+  private:
+    struct alignas(64) _line {
+      uint8_t bytes[64];
+    };
+    std::vector<_line> _lines;
+    size_t _n_blocks;
+
+  public:
+    /// Returns true if the key was not already (possibly) present
+    bool insert(filter_key k) noexcept;
+    template<size_t HashSize>
+    inline bool insert(const hash<HashSize>& h) { return insert(filter_key::of(h)); }
+
+    inline bloom_filter_view view() const noexcept {
+      return { reinterpret_cast<const uint8_t*>(_lines.data()), _n_blocks };
+    }
+    inline bool contains(filter_key k) const noexcept { return view().contains(k); }
+    template<size_t HashSize>
+    inline bool contains(const hash<HashSize>& h) const { return view().contains(h); }
+    template<size_t HashSize>
+    inline size_t contains(gsl::span<const hash<HashSize>> hashes, gsl::span<bool> results) const {
+      return view().contains(hashes, results);
+    }
+
+    inline size_t n_blocks() const noexcept { return _n_blocks; }
+
+    /// Size of the buffer serialise_into needs
+    size_t serialised_size() const noexcept;
+    /// A 32 byte header then the blocks as they are, so that a view can probe them in place
+    ///
+    /// Returns how many bytes were written. Not to be called during inserts
+    size_t serialise_into(nu::data_ref b) const;
+    inline nu::data serialise() const {
+      nu::data ret(serialised_size());
+      serialise_into(ret);
+      return ret;
+    }
+    /// Copies a serialised filter, so that it can be inserted into again
+    static bloom_filter deserialise(nu::data_const_ref b);
+
+  public:
+    /// Sized so that holding expected_items keeps the false positive rate near the one given
+    ///
+    /// Throws std::invalid_argument unless 0 < false_positive_rate < 1
+    bloom_filter(size_t expected_items, double false_positive_rate = 0.01);
+  };
+
+  /// A read-only cuckoo filter over a serialised one, as bloom_filter_view
+  class cuckoo_filter_view {
+  private:
+    const uint8_t* _buckets = nullptr;
+    size_t _n_buckets = 0;
+    const std::atomic<uint64_t>* _version = nullptr;
+
+  public:
+    bool contains(filter_key k) const noexcept;
+    template<size_t HashSize>
+    inline bool contains(const hash<HashSize>& h) const { return contains(filter_key::of(h)); }
+
+    inline size_t n_buckets() const noexcept { return _n_buckets; }
+
+    static cuckoo_filter_view parse(nu::data_const_ref b);
+
+  public:
+    cuckoo_filter_view() = default;
+    /// version is the writer's sequence count, if the buckets may be changing underneath
+    cuckoo_filter_view(const uint8_t* buckets, size_t n_buckets, const std::atomic<uint64_t>* version = nullptr) :
+      _buckets{buckets}, _n_buckets{n_buckets}, _version{version} {}
+  };
+
+  /// A cuckoo filter with four 16 bit fingerprints per 8 byte bucket, which unlike a Bloom filter
+  /// can forget keys
+  ///
+  /// Writers take turns, but contains never waits for them: items are copied to their new bucket
+  /// before leaving the old one, and a miss during a move is retried
+  class cuckoo_filter {
+  public:
+    static constexpr size_t slots_per_bucket = 4;
+    static constexpr size_t bucket_size = slots_per_bucket * sizeof(uint16_t);
+
+  private:
+    struct alignas(64) _line {
+      uint8_t bytes[64];
+    };
+    std::vector<_line> _lines;
+    size_t _n_buckets;
+
+    std::mutex _write_lock;
+    // Odd while items are being moved between buckets
+    std::atomic<uint64_t> _version = 0;
+    std::atomic<size_t> _size = 0;
+
+  private:
+    inline uint16_t* _slots() noexcept { return reinterpret_cast<uint16_t*>(_lines.data()); }
+
+  public:
+    /// Returns false if there was no room, in which case the filter is unchanged
+    ///
+    /// Inserting a key twice stores it twice, and it must then be erased twice
+    bool insert(filter_key k);
+    template<size_t HashSize>
+    inline bool insert(const hash<HashSize>& h) { return insert(filter_key::of(h)); }
+
+    /// Removes one copy of the key, returning false if there was none
+    ///
+    /// Erasing a key that was never inserted may remove one that shares its fingerprint
+    bool erase(filter_key k);
+    template<size_t HashSize>
+    inline bool erase(const hash<HashSize>& h) { return erase(filter_key::of(h)); }
+
+    inline cuckoo_filter_view view() const noexcept {
+      return { reinterpret_cast<const uint8_t*>(_lines.data()), _n_buckets, &_version };
+    }
+    inline bool contains(filter_key k) const noexcept { return view().contains(k); }
+    template<size_t HashSize>
+    inline bool contains(const hash<HashSize>& h) const { return view().contains(h); }
+
+    inline size_t size() const noexcept { return _size; }
+    inline size_t capacity() const noexcept { return _n_buckets * slots_per_bucket; }
+    inline size_t n_buckets() const noexcept { return _n_buckets; }
+
+    size_t serialised_size() const noexcept;
+    /// As bloom_filter::serialise_into
+    size_t serialise_into(nu::data_ref b) const;
+    inline nu::data serialise() const {
+      nu::data ret(serialised_size());
+      serialise_into(ret);
+      return ret;
+    }
+    static cuckoo_filter deserialise(nu::data_const_ref b);
+
+  public:
+    /// Has room for at least expected_items, rounded up to a power of two number of buckets
+    cuckoo_filter(size_t expected_items);
+
+    cuckoo_filter(cuckoo_filter&& other) noexcept;
+  };
+
+  /// A whole file mapped read-only, for loading a serialised filter without reading it in
+  class mapped_file {
+  private:
+    void* _base = nullptr;
+    size_t _len = 0;
+
+  public:
+    inline nu::data_const_ref data() const noexcept {
+      return { static_cast<const uint8_t*>(_base), static_cast<std::ptrdiff_t>(_len) };
+    }
+
+  public:
+    /// Throws std::system_error if the file cannot be opened or mapped
+    mapped_file(const std::string& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+  };
+}
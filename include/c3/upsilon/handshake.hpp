@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdexcept>
+
+#include "c3/upsilon/agreement.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// A handshake message or record that failed to authenticate, or a peer breaking the protocol
+  class noise_error : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  /// Patterns from the Noise framework (noiseprotocol.org)
+  ///
+  /// XX learns both static keys during the handshake, taking 1.5 round trips.
+  /// IK needs the responder's static key up front, but finishes in one round trip, and the
+  /// initiator's first payload is already encrypted to the responder
+  enum class handshake_pattern : uint8_t {
+    XX,
+    IK,
+  };
+
+  /// Which registered algorithms fill Noise's DH, cipher and hash roles
+  ///
+  /// The hash is the one HKDF is built on. The cipher must be a ChaCha, which gets RFC 8439's
+  /// Poly1305 AEAD around it
+  struct noise_suite {
+    agreement_algorithm dh = agreement_algorithm::Curve25519;
+    symmetric_algorithm cipher = symmetric_algorithm::ChaCha20;
+    kdf_algorithm kdf = kdf_algorithm::HKDF_SHA2_256;
+  };
+
+  /// Noise's CipherState: a key, and a counter that is the nonce of the next message
+  ///
+  /// The cipher is made on the first key, and only rekeyed in place after that
+  class noise_cipher_state {
+  public:
+    static constexpr size_t key_size = 32;
+    static constexpr size_t tag_size = 16;
+    /// Reserved for rekey, so never used to encrypt a message
+    static constexpr uint64_t max_nonce = ~uint64_t{0};
+
+  private:
+    std::unique_ptr<symmetric_function> _cipher;
+    bool _has_key = false;
+    uint64_t _n = 0;
+
+  private:
+    void _start(uint64_t n, uint8_t* poly_key);
+
+  public:
+    inline bool has_key() const noexcept { return _has_key; }
+    inline uint64_t nonce() const noexcept { return _n; }
+    inline void set_nonce(uint64_t n) noexcept { _n = n; }
+
+    /// Sets the key, and the nonce back to 0
+    void initialise_key(symmetric_algorithm alg, nu::data_const_ref key);
+
+    /// Writes input.size() + tag_size bytes into output, or just input if there is no key yet,
+    /// returning how many were written. input and output may be the same buffer
+    size_t encrypt_with_ad(nu::data_const_ref ad, nu::data_const_ref input, nu::data_ref output);
+    /// The reverse of encrypt_with_ad. Throws noise_error if the tag is wrong,
+    /// in which case the nonce stays where it was
+    size_t decrypt_with_ad(nu::data_const_ref ad, nu::data_const_ref input, nu::data_ref output);
+
+    /// Replaces the key with one derived from it, leaving the nonce alone
+    void rekey();
+
+  public:
+    noise_cipher_state() = default;
+    noise_cipher_state(noise_cipher_state&&) = default;
+    noise_cipher_state& operator=(noise_cipher_state&&) = default;
+  };
+
+  /// Both directions of a finished handshake, sealing records with counter nonces
+  ///
+  /// Records must be read in the order they were written. Both sides rekey every rekey_interval
+  /// records in each direction, so no key sees more than that. Nothing here allocates
+  class noise_session {
+  public:
+    static constexpr size_t record_overhead = noise_cipher_state::tag_size;
+    static constexpr size_t max_record_size = 65535;
+    static constexpr uint64_t default_rekey_interval = uint64_t{1} << 20;
+
+  private:
+    noise_cipher_state _send;
+    noise_cipher_state _receive;
+    uint64_t _rekey_interval;
+    std::array<uint8_t, 64> _handshake_hash;
+    size_t _hash_len;
+
+  private:
+    void _maybe_rekey(noise_cipher_state& cs);
+
+  public:
+    /// record must have room for plaintext.size() + record_overhead bytes.
+    /// Returns the size of the record
+    size_t encrypt(nu::data_const_ref plaintext, nu::data_ref record, nu::data_const_ref ad = {});
+    /// Throws noise_error if the record has been tampered with, reordered or replayed.
+    /// Returns the size of the plaintext
+    size_t decrypt(nu::data_const_ref record, nu::data_ref plaintext, nu::data_const_ref ad = {});
+
+    /// Rekeys one direction early. The peer must do the reverse at the same point in the stream
+    inline void rekey_send() { _send.rekey(); }
+    inline void rekey_receive() { _receive.rekey(); }
+
+    inline uint64_t n_sent() const noexcept { return _send.nonce(); }
+    inline uint64_t n_received() const noexcept { return _receive.nonce(); }
+
+    /// The same on both sides, so can be signed to bind the session to an identity
+    inline nu::data_const_ref handshake_hash() const noexcept {
+      return nu::data_const_ref{_handshake_hash}.first(_hash_len);
+    }
+
+  public:
+    noise_session(noise_cipher_state&& send, noise_cipher_state&& receive, uint64_t rekey_interval,
+                  nu::data_const_ref handshake_hash);
+    noise_session(noise_session&&) = default;
+    noise_session& operator=(noise_session&&) = default;
+    ~noise_session();
+  };
+
+  /// Noise's HandshakeState, writing and reading messages in caller buffers
+  ///
+  /// Sides take turns, starting with the initiator, until finished(); then split() gives the
+  /// session. A noise_error leaves the handshake unusable, so it should be dropped
+  class noise_handshake {
+  public:
+    static constexpr size_t max_message_size = 65535;
+
+  private:
+    handshake_pattern _pattern;
+    symmetric_algorithm _cipher_alg;
+    const hash_function* _hash;
+    const kdf* _kdf;
+    size_t _hash_len;
+    bool _initiator;
+    size_t _message = 0;
+
+    std::array<uint8_t, 64> _h;
+    std::array<uint8_t, 64> _ck;
+    noise_cipher_state _cs;
+
+    agreement_algorithm _dh_alg;
+    const agreement_function* _s;
+    nu::data _s_public;
+    std::unique_ptr<agreement_function> _e;
+    nu::data _e_public;
+    nu::data _rs;
+    nu::data _re;
+
+  private:
+    void _mix_hash(nu::data_const_ref data);
+    void _mix_key(nu::data_const_ref ikm);
+    void _hkdf(nu::data_const_ref ikm, nu::data_ref out_1, nu::data_ref out_2);
+    size_t _encrypt_and_hash(nu::data_const_ref input, nu::data_ref output);
+    size_t _decrypt_and_hash(nu::data_const_ref input, nu::data_ref output);
+    void _dh(const agreement_function& local, nu::data_const_ref remote);
+    size_t _n_messages() const noexcept;
+
+  public:
+    /// s is this side's static key, and must outlive the handshake.
+    /// remote_static is the responder's public key, which IK needs and XX ignores
+    static noise_handshake initiator(handshake_pattern pattern, const agreement_function& s,
+                                     nu::data_const_ref remote_static = {},
+                                     nu::data_const_ref prologue = {}, noise_suite suite = {});
+    static noise_handshake responder(handshake_pattern pattern, const agreement_function& s,
+                                     nu::data_const_ref prologue = {}, noise_suite suite = {});
+
+    /// Bytes the next message adds around its payload
+    size_t message_overhead() const;
+
+    /// out must have room for payload.size() + message_overhead() bytes.
+    /// Returns the size of the message
+    size_t write_message(nu::data_const_ref payload, nu::data_ref out);
+    /// payload_out must have room for msg.size() - message_overhead() bytes.
+    /// Returns the size of the payload
+    size_t read_message(nu::data_const_ref msg, nu::data_ref payload_out);
+
+    inline bool finished() const noexcept { return _message >= _n_messages(); }
+    inline bool is_my_turn() const noexcept { return !finished() && (_message % 2 == 0) == _initiator; }
+
+    /// Empty until the peer's static key has been received, or given for IK
+    inline nu::data_const_ref remote_static() const noexcept { return _rs; }
+    inline nu::data_const_ref handshake_hash() const noexcept {
+      return nu::data_const_ref{_h}.first(_hash_len);
+    }
+
+    /// Only once finished
+    noise_session split(uint64_t rekey_interval = noise_session::default_rekey_interval);
+
+  private:
+    noise_handshake(handshake_pattern pattern, bool initiator, const agreement_function& s,
+                    nu::data_const_ref remote_static, nu::data_const_ref prologue, noise_suite suite);
+
+  public:
+    noise_handshake(noise_handshake&&) = default;
+    noise_handshake& operator=(noise_handshake&&) = default;
+    ~noise_handshake();
+  };
+}
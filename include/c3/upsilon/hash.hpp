@@ -10,11 +10,16 @@
 #include <gsl/span>
 
 #include "c3/upsilon/except.hpp"
+#include "c3/upsilon/registry.hpp"
+#include "c3/upsilon/squash_layout.hpp"
 
 #include <c3/nu/data.hpp>
 #include <c3/nu/data/collections.hpp>
 #include <c3/nu/data/helpers.hpp>
 
+// From <sys/uio.h>
+struct iovec;
+
 namespace c3::upsilon {
   template<size_t HashSize = nu::dynamic_size>
   class hash;
@@ -186,6 +191,16 @@ namespace c3::upsilon {
     inline safe_hash(decltype(value) _value, decltype(algorithm) _algorithm) :
       value{std::move(_value)}, algorithm{_algorithm} {}
 
+  public:
+    /// Size of the buffer serialise_into needs
+    inline size_t serialised_size() const { return squashed_size(value.value.size(), algorithm); }
+    /// Writes the same bytes as serialise, returning how many were written
+    inline size_t serialise_into(nu::data_ref b) const {
+      return squash_into(b, value.value.size(), [&](nu::data_ref out) {
+        std::copy(value.value.begin(), value.value.end(), out.begin());
+      }, algorithm);
+    }
+
   private:
     nu::data _serialise() const override {
       return nu::squash(algorithm, value);
@@ -196,6 +211,23 @@ namespace c3::upsilon {
       return ret;
     }
   };
+
+  /// A serialised safe_hash<nu::dynamic_size>, parsed in place without copying the hash
+  ///
+  /// Only valid for as long as the buffer it was parsed from
+  struct safe_hash_view {
+    hash_algorithm algorithm;
+    nu::data_const_ref value;
+
+    /// Throws if the algorithm is unknown, or the hash is empty or longer than it can produce
+    static inline safe_hash_view parse(nu::data_const_ref b);
+
+    inline safe_hash<nu::dynamic_size> to_safe_hash() const {
+      hash<nu::dynamic_size> h;
+      h.value.assign(value.begin(), value.end());
+      return { std::move(h), algorithm };
+    }
+  };
   template<size_t HashSizeA, size_t HashSizeB>
   bool operator==(const safe_hash<HashSizeA>& a, const safe_hash<HashSizeB>& b) {
     return a.algorithm == b.algorithm && a.value == b.value;
@@ -229,6 +261,7 @@ namespace c3::upsilon {
     size_t max_salt;
 
   public:
+    constexpr hash_properties() : hash_properties{hash_algorithm{}, 0} {}
     constexpr hash_properties(hash_algorithm alg,
                               size_t max_output,
                               size_t min_salt = 0,
@@ -237,18 +270,15 @@ namespace c3::upsilon {
   };
   template<hash_algorithm Alg>
   constexpr hash_properties get_hash_properties();
-  extern std::map<hash_algorithm, hash_properties> _hash_properties;
-  inline hash_properties get_hash_properties(hash_algorithm alg) {
-    auto iter = _hash_properties.find(alg);
-    if (iter == _hash_properties.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second);
-  }
 
   class partial_hash_function {
   public:
     virtual void process(nu::data_const_ref input) = 0;
+    /// Processes each input in turn, as one call
+    virtual void processv(gsl::span<const nu::data_const_ref> inputs) {
+      for (auto& i : inputs)
+        process(i);
+    }
     /// Invalidates the partial_hash function
     virtual void finish(nu::data_ref output) = 0;
     /// Resets the partial hash to its initial state
@@ -268,6 +298,7 @@ namespace c3::upsilon {
 
   public:
     void process(nu::data_const_ref input) override { _base->process(std::move(input)); }
+    void processv(gsl::span<const nu::data_const_ref> inputs) override { _base->processv(inputs); }
     void finish(nu::data_ref output) override { _base->finish(std::move(output)); }
     void reset() override { _base->reset(); _base->process(_salt); }
 
@@ -300,13 +331,9 @@ namespace c3::upsilon {
   template<hash_algorithm Alg>
   const hash_function* get_hash_function();
 
-  extern std::map<hash_algorithm, const hash_function*> _hash_funcs;
+  extern const registry<hash_algorithm, const hash_function*> _hash_funcs;
   inline const hash_function* get_hash_function(hash_algorithm alg) {
-    auto iter = _hash_funcs.find(alg);
-    if (iter == _hash_funcs.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second);
+    return _hash_funcs.get(alg);
   }
 
   class partial_hasher {
@@ -315,7 +342,25 @@ namespace c3::upsilon {
     std::unique_ptr<partial_hash_function> _impl;
 
   public:
+    inline const hash_properties* properties() const noexcept { return props; }
+
     inline void process(nu::data_const_ref input) { _impl->process(input); }
+    /// Processes each chunk in turn, for messages that aren't contiguous
+    template<typename Iter>
+    inline void process(Iter begin, Iter end) {
+      for (; begin != end; ++begin)
+        _impl->process(*begin);
+    }
+    /// As process(begin, end), but with one virtual call for the lot
+    inline void processv(gsl::span<const nu::data_const_ref> inputs) { _impl->processv(inputs); }
+    /// As above, for buffers as given to writev or sendmsg
+    void processv(const iovec* iov, size_t n);
+    /// Processes everything from the file descriptor's current position to its end
+    ///
+    /// Regular files are mapped a window at a time, so memory use stays bounded;
+    /// anything else is read through a small buffer. Returns the number of bytes processed
+    uint64_t process_fd(int fd);
+
     template<size_t HashSize = nu::dynamic_size>
     inline hash<HashSize> finish() {
       hash<HashSize> ret;
@@ -408,6 +453,41 @@ namespace c3::upsilon {
   C3_UPSILON_HASH_ALG(hash_algorithm::BLAKE2s_256, 32);
 
 #undef C3_UPSILON_HASH_ALG
+
+#define C3_UPSILON_HASH_PROPS(ALG) { ALG, get_hash_properties<ALG>() }
+  inline constexpr registry<hash_algorithm, hash_properties> _hash_properties = {
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA2_224),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA2_256),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA2_384),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA2_512),
+
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA3_224),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA3_256),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA3_384),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::SHA3_512),
+
+    C3_UPSILON_HASH_PROPS(hash_algorithm::BLAKE2b_128),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::BLAKE2b_256),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::BLAKE2b_512),
+
+    C3_UPSILON_HASH_PROPS(hash_algorithm::BLAKE2s_128),
+    C3_UPSILON_HASH_PROPS(hash_algorithm::BLAKE2s_256),
+  };
+#undef C3_UPSILON_HASH_PROPS
+
+  inline hash_properties get_hash_properties(hash_algorithm alg) {
+    return _hash_properties.get(alg);
+  }
+
+  inline safe_hash_view safe_hash_view::parse(nu::data_const_ref b) {
+    safe_hash_view ret;
+    nu::expand(b, ret.algorithm, ret.value);
+    if (ret.value.empty())
+      throw nu::serialisation_failure("Empty hash");
+    if (static_cast<size_t>(ret.value.size()) > get_hash_properties(ret.algorithm).max_output)
+      throw nu::serialisation_failure("Hash is longer than its algorithm allows");
+    return ret;
+  }
 }
 
 #include <c3/nu/data/clean_helpers.hpp>
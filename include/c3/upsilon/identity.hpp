@@ -1,6 +1,15 @@
 #pragma once
 
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <string_view>
+#include <atomic>
+
 #include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/nuker.hpp"
+#include "c3/upsilon/registry.hpp"
+#include "c3/upsilon/squash_layout.hpp"
 #include <c3/nu/data.hpp>
 #include <c3/nu/data/collections.hpp>
 
@@ -11,10 +20,24 @@ namespace c3::upsilon {
     Curve25519 = 0x0000
   };
 
+  struct verify_batch_entry {
+    nu::data_const_ref input_hashed;
+    nu::data_const_ref sig;
+  };
+
   /// MUST be thread-safe
   class verifier {
   public:
     virtual bool verify(nu::data_const_ref input_hashed, nu::data_const_ref sig) const = 0;
+    /// Writes the validity of each entry into results, which must be at least as long as entries
+    ///
+    /// Returns true iff every signature is valid
+    virtual bool verify_batch(gsl::span<const verify_batch_entry> entries, gsl::span<bool> results) const {
+      bool ret = true;
+      for (decltype(entries.size()) i = 0; i < entries.size(); ++i)
+        ret &= (results[i] = verify(entries[i].input_hashed, entries[i].sig));
+      return ret;
+    }
     virtual nu::data serialise_pub() const = 0;
 
   public:
@@ -26,7 +49,19 @@ namespace c3::upsilon {
     virtual bool verify(nu::data_const_ref input_hashed, nu::data_const_ref sig) const override = 0;
     virtual nu::data sign(nu::data_const_ref input) const = 0;
     virtual nu::data serialise_pub() const override = 0;
-    virtual nu::data serialise_priv() const = 0;
+    virtual nuking_data serialise_priv() const = 0;
+
+    /// The size of serialise_priv's output, which implementations should know without encoding the key
+    virtual size_t serialised_priv_size() const {
+      return serialise_priv().size();
+    }
+    /// Writes serialise_priv's output into b, which must be exactly serialised_priv_size() long
+    virtual void serialise_priv_into(nu::data_ref b) const {
+      auto tmp = serialise_priv();
+      if (tmp.size() != static_cast<size_t>(b.size()))
+        throw std::invalid_argument("Private key is not the size of the buffer");
+      std::copy(tmp.begin(), tmp.end(), b.begin());
+    }
 
   public:
     virtual ~signer() override = default;
@@ -36,15 +71,10 @@ namespace c3::upsilon {
   template<signature_algorithm Alg>
   inline std::unique_ptr<verifier> get_verifier(nu::data_const_ref serialised_verifier);
 
-  extern std::map<signature_algorithm,
-                  std::function<std::unique_ptr<verifier>(nu::data_const_ref)>> _verifiers;
+  extern const registry<signature_algorithm, std::unique_ptr<verifier>(*)(nu::data_const_ref)> _verifiers;
 
   inline std::unique_ptr<verifier> get_verifier(signature_algorithm alg, nu::data_const_ref b) {
-    auto iter = _verifiers.find(alg);
-    if (iter == _verifiers.end())
-      throw c3::upsilon::algorithm_not_implemented<signature_algorithm>{alg};
-    else
-      return (iter->second)(b);
+    return _verifiers.get(alg)(b);
   }
   template<signature_algorithm Alg>
   std::unique_ptr<signer> get_signer(nu::data_const_ref serialised_signer);
@@ -52,37 +82,279 @@ namespace c3::upsilon {
   template<signature_algorithm Alg>
   std::unique_ptr<signer> gen_signer();
 
-  extern std::map<signature_algorithm,
-                  std::function<std::unique_ptr<signer>(nu::data_const_ref)>> _signers;
+  extern const registry<signature_algorithm, std::unique_ptr<signer>(*)(nu::data_const_ref)> _signers;
 
-  extern std::map<signature_algorithm, std::function<std::unique_ptr<signer>()>> _sig_gens;
+  extern const registry<signature_algorithm, std::unique_ptr<signer>(*)()> _sig_gens;
 
   inline std::unique_ptr<signer> get_signer(signature_algorithm alg, nu::data_const_ref b) {
-    auto iter = _signers.find(alg);
-    if (iter == _signers.end())
-      throw c3::upsilon::algorithm_not_implemented<signature_algorithm>{alg};
-    else
-      return (iter->second)(b);
+    return _signers.get(alg)(b);
   }
 
   inline std::unique_ptr<signer> gen_signer(signature_algorithm alg) {
-    auto iter = _sig_gens.find(alg);
-    if (iter == _sig_gens.end())
-      throw c3::upsilon::algorithm_not_implemented<signature_algorithm>{alg};
-    else
-      return (iter->second)();
+    return _sig_gens.get(alg)();
   }
 
+  /// A bounded, thread-safe cache interning verifiers by (signature_algorithm, public key)
+  ///
+  /// The message hasher is a static lookup, so sharing the verifier is all an identity needs.
+  /// Memory use is tracked per entry, and the least recently used entries are dropped
+  /// once max_bytes is exceeded. Evicted verifiers stay alive for as long as an identity uses them
+  class verifier_cache {
+  public:
+    struct stats {
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t evictions;
+      size_t bytes;
+    };
+
+    /// Rough footprint of a verifier and its operation state, used for accounting
+    static constexpr size_t verifier_cost = 256;
+
+  private:
+    struct entry {
+      std::string key;
+      std::shared_ptr<verifier> value;
+      size_t cost;
+    };
+    struct shard {
+      std::mutex lock;
+      // Front is the most recently used
+      std::list<entry> lru;
+      // Keys point into the entries, which std::list never moves
+      std::unordered_map<std::string_view, std::list<entry>::iterator> index;
+      size_t bytes = 0;
+    };
+
+  private:
+    size_t _n_shards;
+    size_t _shard_max_bytes;
+    std::unique_ptr<shard[]> _shards;
+
+    std::atomic<uint64_t> _hits = 0;
+    std::atomic<uint64_t> _misses = 0;
+    std::atomic<uint64_t> _evictions = 0;
+    std::atomic<size_t> _bytes = 0;
+
+  private:
+    shard& _get_shard(std::string_view key);
+    void _evict(shard& s, std::list<entry>::iterator iter);
+
+  public:
+    /// Returns the interned verifier, constructing it on a miss
+    std::shared_ptr<verifier> get(signature_algorithm alg, nu::data_const_ref serialised_verifier);
+    void clear();
+
+    stats get_stats() const noexcept;
+
+  public:
+    verifier_cache(size_t max_bytes, size_t n_shards = 16);
+
+    verifier_cache(const verifier_cache&) = delete;
+    verifier_cache& operator=(const verifier_cache&) = delete;
+  };
+
+  /// Sets the cache used when deserialising identities, or disables it if given nullptr (the default)
+  void set_verifier_cache(std::shared_ptr<verifier_cache> cache);
+  std::shared_ptr<verifier_cache> get_verifier_cache();
+
+  /// As get_verifier, but goes through the verifier cache if one is set
+  std::shared_ptr<verifier> get_verifier_cached(signature_algorithm alg, nu::data_const_ref b);
+
+  /// A bounded, thread-safe set of (algorithms, public key, message hash, signature) tuples
+  /// that have already been verified
+  ///
+  /// Only valid signatures are remembered. Each entry is a 32 byte digest, salted per cache so that
+  /// collisions cannot be precomputed, stored in a 4-way set-associative table. A full set replaces
+  /// its oldest entry. Sets are spread over independently locked stripes
+  class signature_cache {
+  public:
+    using key = hash<32>;
+
+    struct stats {
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t insertions;
+      uint64_t evictions;
+    };
+
+    static constexpr size_t ways = 4;
+
+  private:
+    struct alignas(64) stripe {
+      std::mutex lock;
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      uint64_t insertions = 0;
+      uint64_t evictions = 0;
+    };
+
+  private:
+    size_t _n_sets;
+    size_t _n_stripes;
+    std::unique_ptr<key[]> _slots;
+    std::unique_ptr<uint8_t[]> _next_victim;
+    std::unique_ptr<stripe[]> _stripes;
+    nu::static_data<32> _salt;
+
+  private:
+    size_t _get_set(const key& k) const;
+
+  public:
+    key make_key(signature_algorithm sig_alg, hash_algorithm hash_alg, nu::data_const_ref pub,
+                 nu::data_const_ref input_hashed, nu::data_const_ref sig) const;
+
+    bool contains(const key& k);
+    void insert(const key& k);
+    void clear();
+
+    stats get_stats() const;
+
+  public:
+    signature_cache(size_t capacity, size_t n_stripes = 64);
+
+    signature_cache(const signature_cache&) = delete;
+    signature_cache& operator=(const signature_cache&) = delete;
+  };
+
+  /// Sets the cache consulted by identity verification, or disables it if given nullptr (the default)
+  void set_signature_cache(std::shared_ptr<signature_cache> cache);
+  std::shared_ptr<signature_cache> get_signature_cache();
+
+  class identity;
+  class owned_identity;
+
+  /// A serialised identity, parsed in place without copying the key
+  ///
+  /// Only valid for as long as the buffer it was parsed from
+  struct identity_view {
+    signature_algorithm sig_alg;
+    hash_algorithm hash_alg;
+    nu::data_const_ref public_key;
+
+    /// Throws if either algorithm is not implemented
+    static inline identity_view parse(nu::data_const_ref b) {
+      identity_view ret;
+      nu::expand(b, ret.sig_alg, ret.hash_alg, ret.public_key);
+      if (!_verifiers.contains(ret.sig_alg))
+        throw algorithm_not_implemented<signature_algorithm>{ret.sig_alg};
+      if (!_hash_funcs.contains(ret.hash_alg))
+        throw algorithm_not_implemented<hash_algorithm>{ret.hash_alg};
+      if (ret.public_key.empty())
+        throw nu::serialisation_failure("Empty public key");
+      return ret;
+    }
+
+    /// Goes through the verifier cache if one is set
+    inline identity to_identity() const;
+  };
+
+  /// As identity_view, for a serialised owned_identity
+  struct owned_identity_view {
+    signature_algorithm sig_alg;
+    hash_algorithm hash_alg;
+    nu::data_const_ref private_key;
+
+    static inline owned_identity_view parse(nu::data_const_ref b) {
+      owned_identity_view ret;
+      nu::expand(b, ret.sig_alg, ret.hash_alg, ret.private_key);
+      if (!_signers.contains(ret.sig_alg))
+        throw algorithm_not_implemented<signature_algorithm>{ret.sig_alg};
+      if (!_hash_funcs.contains(ret.hash_alg))
+        throw algorithm_not_implemented<hash_algorithm>{ret.hash_alg};
+      if (ret.private_key.empty())
+        throw nu::serialisation_failure("Empty private key");
+      return ret;
+    }
+
+    inline owned_identity to_owned_identity() const;
+  };
+
+  struct identity_batch_entry {
+    const identity* id;
+    nu::data_const_ref msg;
+    nu::data_const_ref sig;
+  };
+
+  /// Verifies many (identity, message, signature) tuples at once
+  ///
+  /// Consecutive entries with the same identity are handed to its verifier as one batch,
+  /// so grouping entries by sender gives the verifier the most to work with.
+  /// Writes the validity of each entry into results, and returns true iff all are valid
+  bool verify_batch(gsl::span<const identity_batch_entry> entries, gsl::span<bool> results);
+  /// As verify_batch, but each msg is the output of the identity's hash_message
+  bool verify_batch_hashed(gsl::span<const identity_batch_entry> entries, gsl::span<bool> results);
+
   class identity : public nu::serialisable<identity> {
+    friend bool verify_batch_hashed(gsl::span<const identity_batch_entry>, gsl::span<bool>);
+
   private:
     signature_algorithm _sig_alg;
     hasher _msg_hasher;
     std::shared_ptr<verifier> _impl;
+    // Identities never change, so the wire form is worked out the first time it is needed,
+    // and shared between copies made after that. Only ever touched atomically
+    mutable std::shared_ptr<const nu::data> _serialised;
+
+  private:
+    inline const nu::data& _get_serialised() const {
+      auto ret = std::atomic_load(&_serialised);
+      if (!ret) {
+        if (!_impl)
+          throw std::logic_error("Cannot serialise an empty identity");
+        auto built = std::make_shared<const nu::data>(nu::squash(_sig_alg, _msg_hasher.properties()->alg,
+                                                                 _impl->serialise_pub()));
+        // Whichever thread gets there first wins, and the rest use its copy
+        if (std::atomic_compare_exchange_strong(&_serialised, &ret, built))
+          ret = std::move(built);
+      }
+      // Never replaced once set, so lives as long as this identity
+      return *ret;
+    }
 
   public:
-    inline decltype(_sig_alg) alg() { return _sig_alg; }
-    inline bool verify(nu::data_const_ref b, nu::data_const_ref sig) {
-      return _impl->verify(_msg_hasher.get_hash<nu::dynamic_size>(b), sig);
+    inline decltype(_sig_alg) alg() const { return _sig_alg; }
+    inline bool verify(nu::data_const_ref b, nu::data_const_ref sig) const {
+      return verify_hashed(_msg_hasher.get_hash<nu::dynamic_size>(b), sig);
+    }
+
+    /// Hashes a message as verify would, for callers that want to do the two steps separately
+    inline hash<> hash_message(nu::data_const_ref b) const {
+      return _msg_hasher.get_hash<nu::dynamic_size>(b);
+    }
+    /// Goes through the signature cache if one is set
+    bool verify_hashed(nu::data_const_ref input_hashed, nu::data_const_ref sig) const;
+
+    /// Starts a message hash that can be fed piecemeal and then passed to verify
+    inline partial_hasher begin_message() const { return _msg_hasher.begin_hash(); }
+    inline bool verify(partial_hasher&& message, nu::data_const_ref sig) const {
+      if (message.properties()->alg != _msg_hasher.properties()->alg)
+        throw std::invalid_argument("Message was hashed with the wrong algorithm");
+      return verify_hashed(message.finish(), sig);
+    }
+    /// Verifies a message made of every chunk from begin to end, without joining them
+    template<typename Iter>
+    inline bool verify(Iter begin, Iter end, nu::data_const_ref sig) const {
+      auto message = begin_message();
+      message.process(begin, end);
+      return verify(std::move(message), sig);
+    }
+    /// Verifies everything from the file descriptor's current position to its end
+    inline bool verify_fd(int fd, nu::data_const_ref sig) const {
+      auto message = begin_message();
+      message.process_fd(fd);
+      return verify(std::move(message), sig);
+    }
+
+    /// Size of the buffer serialise_into needs
+    inline size_t serialised_size() const { return _get_serialised().size(); }
+    /// Writes the same bytes as serialise, returning how many were written
+    inline size_t serialise_into(nu::data_ref b) const {
+      auto& serialised = _get_serialised();
+      if (static_cast<size_t>(b.size()) < serialised.size())
+        throw std::invalid_argument("Buffer too small to serialise into");
+      std::copy(serialised.begin(), serialised.end(), b.begin());
+      return serialised.size();
     }
 
   public:
@@ -90,22 +362,35 @@ namespace c3::upsilon {
     inline identity(signature_algorithm sig_alg, hasher msg_hasher, decltype(_impl)&& impl) :
       _sig_alg{sig_alg}, _msg_hasher{std::move(msg_hasher)}, _impl{std::forward<decltype(impl)>(impl)} {}
 
+    // The source may be serialising on another thread as it is copied
+    inline identity(const identity& other) :
+      _sig_alg{other._sig_alg}, _msg_hasher{other._msg_hasher}, _impl{other._impl},
+      _serialised{std::atomic_load(&other._serialised)} {}
+    inline identity& operator=(const identity& other) {
+      _sig_alg = other._sig_alg;
+      _msg_hasher = other._msg_hasher;
+      _impl = other._impl;
+      std::atomic_store(&_serialised, std::atomic_load(&other._serialised));
+      return *this;
+    }
+    inline identity(identity&&) = default;
+    inline identity& operator=(identity&&) = default;
+
   private:
     inline nu::data _serialise() const override {
-      return nu::squash(_sig_alg, _msg_hasher.properties()->alg, _impl->serialise_pub());
+      return _get_serialised();
     }
 
     C3_NU_DEFINE_DESERIALISE(identity, b) {
-      signature_algorithm sig_alg;
-      hash_algorithm hash_alg;
-      nu::data_const_ref buf;
-
-      nu::expand(b, sig_alg, hash_alg, buf);
-
-      return { sig_alg, get_hasher(hash_alg), get_verifier(sig_alg, buf) };
+      return identity_view::parse(b).to_identity();
     }
   };
 
+  inline identity identity_view::to_identity() const {
+    // The wire form is left for serialise to build, as most identities are only ever verified against
+    return { sig_alg, get_hasher(hash_alg), get_verifier_cached(sig_alg, public_key) };
+  }
+
   class owned_identity : public nu::serialisable<owned_identity> {
   private:
     signature_algorithm _sig_alg;
@@ -119,11 +404,54 @@ namespace c3::upsilon {
     inline bool verify(nu::data_const_ref b, nu::data_const_ref sig) const {
       return _impl->verify(_msg_hasher.get_hash<nu::dynamic_size>(b), sig);
     }
-    inline decltype(_sig_alg) alg() { return _sig_alg; }
-    inline nu::data serialise_public() {
+
+    /// Hashes a message as sign would, for callers that want to do the two steps separately
+    inline hash<> hash_message(nu::data_const_ref b) const {
+      return _msg_hasher.get_hash<nu::dynamic_size>(b);
+    }
+    inline nu::data sign_hashed(nu::data_const_ref input_hashed) const {
+      return _impl->sign(input_hashed);
+    }
+
+    /// Starts a message hash that can be fed piecemeal and then passed to sign
+    inline partial_hasher begin_message() const { return _msg_hasher.begin_hash(); }
+    inline nu::data sign(partial_hasher&& message) const {
+      if (message.properties()->alg != _msg_hasher.properties()->alg)
+        throw std::invalid_argument("Message was hashed with the wrong algorithm");
+      return _impl->sign(message.finish());
+    }
+    /// Signs a message made of every chunk from begin to end, without joining them
+    template<typename Iter>
+    inline nu::data sign(Iter begin, Iter end) const {
+      auto message = begin_message();
+      message.process(begin, end);
+      return sign(std::move(message));
+    }
+    /// Signs everything from the file descriptor's current position to its end
+    inline nu::data sign_fd(int fd) const {
+      auto message = begin_message();
+      message.process_fd(fd);
+      return sign(std::move(message));
+    }
+
+    inline decltype(_sig_alg) alg() const { return _sig_alg; }
+    inline nu::data serialise_public() const {
       return nu::squash(_sig_alg, _msg_hasher.properties()->alg, _impl->serialise_pub());
     }
 
+    /// Size of the buffer serialise_into needs, worked out without encoding the private key
+    inline size_t serialised_size() const {
+      return squashed_size(_impl->serialised_priv_size(), _sig_alg, _msg_hasher.properties()->alg);
+    }
+    /// Writes the same bytes as serialise, returning how many were written
+    ///
+    /// The private key is written straight into b
+    inline size_t serialise_into(nu::data_ref b) const {
+      return squash_into(b, _impl->serialised_priv_size(), [&](nu::data_ref out) {
+        _impl->serialise_priv_into(out);
+      }, _sig_alg, _msg_hasher.properties()->alg);
+    }
+
   public:
     inline owned_identity() = default;
     inline owned_identity(signature_algorithm sig_alg, hasher msg_hasher, decltype(_impl)&& impl) :
@@ -132,8 +460,10 @@ namespace c3::upsilon {
       _impl{std::forward<decltype(impl)>(impl)} {}
 
   public:
+    /// Goes through the verifier cache like a deserialised identity, so the public identity never
+    /// holds on to the signer and its private key
     explicit operator identity() const {
-      return {_sig_alg, _msg_hasher, get_verifier(_sig_alg, _impl->serialise_pub()) };
+      return { _sig_alg, _msg_hasher, get_verifier_cached(_sig_alg, _impl->serialise_pub()) };
     }
 
   public:
@@ -150,23 +480,19 @@ namespace c3::upsilon {
     nu::data inline _serialise() const override {
       signature_algorithm sig_alg = _sig_alg;
       hash_algorithm msg_hash_alg = _msg_hasher.properties()->alg;
-      nu::data buf = _impl->serialise_priv();
-
-      auto ret = nu::squash(sig_alg, msg_hash_alg, buf);
+      nuking_data buf = _impl->serialise_priv();
 
-      return ret;
+      return nu::squash(sig_alg, msg_hash_alg, nu::data_const_ref{buf});
     }
 
     C3_NU_DEFINE_DESERIALISE(owned_identity, b) {
-      signature_algorithm sig_alg;
-      hash_algorithm msg_hash_alg;
-      nu::data_const_ref buf;
-
-      nu::expand(b, sig_alg, msg_hash_alg, buf);
-
-      return { sig_alg, get_hasher(msg_hash_alg), get_signer(sig_alg, buf) };
+      return owned_identity_view::parse(b).to_owned_identity();
     }
   };
+
+  inline owned_identity owned_identity_view::to_owned_identity() const {
+    return { sig_alg, get_hasher(hash_alg), get_signer(sig_alg, private_key) };
+  }
 }
 
 #include <c3/nu/data/clean_helpers.hpp>
@@ -1,20 +1,85 @@
 #pragma once
 
 #include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/nuker.hpp"
+#include "c3/upsilon/registry.hpp"
 #include <c3/nu/data.hpp>
 
 #include <c3/nu/data/helpers.hpp>
 
+#include <string_view>
+
 namespace c3::upsilon {
   enum class kdf_algorithm : uint16_t {
     Shake128 = 0x0010,
     Shake256 = 0x0020,
+
+    HKDF_SHA2_256 = 0x0220,
+    HKDF_SHA2_512 = 0x0240,
+
+    BLAKE2b = 0x0440,
+
+    // Deliberately slow, and only from make_argon2id_kdf, see argon2.hpp
+    Argon2id = 0x0800,
+  };
+
+  /// Produces a kdf's output a piece at a time, for when the total length isn't known up front
+  ///
+  /// Absorb all of the input first; once squeezing has started, absorbing throws until reset
+  class xof_reader {
+  public:
+    virtual void absorb(nu::data_const_ref input) = 0;
+    virtual void squeeze(nu::data_ref output) = 0;
+    /// Returns to the freshly constructed state, reusing the existing buffers
+    virtual void reset() = 0;
+
+  public:
+    virtual ~xof_reader() = default;
+  };
+
+  /// A secret that has been through a kdf's extract step, ready to have subkeys expanded from it
+  ///
+  /// Each expand reuses the keyed state set up by extract. Not thread safe
+  class kdf_prk {
+  public:
+    /// Different info gives independent outputs
+    virtual void expand(nu::data_const_ref info, nu::data_ref output) = 0;
+    /// The subkey is nuked when it is freed
+    inline nuking_data expand(nu::data_const_ref info, size_t output_len) {
+      nuking_data ret(output_len);
+      expand(info, ret);
+      return ret;
+    }
+
+  public:
+    virtual ~kdf_prk() = default;
   };
 
   class kdf {
   public:
     virtual void expand(nu::data_const_ref input, nu::data_ref output) const = 0;
-    nu::data expand(nu::data_const_ref input, size_t output_len);
+    /// The output is nuked when it is freed
+    inline nuking_data expand(nu::data_const_ref input, size_t output_len) const {
+      nuking_data ret(output_len);
+      expand(input, ret);
+      return ret;
+    }
+
+    /// Squeezing n bytes in total gives the same bytes as expand with an n byte output
+    virtual std::unique_ptr<xof_reader> begin_expand() const = 0;
+    inline std::unique_ptr<xof_reader> begin_expand(nu::data_const_ref input) const {
+      auto ret = begin_expand();
+      ret->absorb(input);
+      return ret;
+    }
+
+    /// Does the expensive work on the input once, for when many subkeys come from the same secret
+    ///
+    /// extract(input)->expand({}, output) gives the same bytes as expand(input, output)
+    virtual std::unique_ptr<kdf_prk> extract(nu::data_const_ref input, nu::data_const_ref salt) const = 0;
+    inline std::unique_ptr<kdf_prk> extract(nu::data_const_ref input) const {
+      return extract(input, {});
+    }
 
     virtual kdf_algorithm alg() const noexcept = 0;
 
@@ -25,13 +90,15 @@ namespace c3::upsilon {
   template<kdf_algorithm Alg>
   const kdf* get_kdf();
 
-  extern std::map<kdf_algorithm, const kdf*> _kdfs;
+  extern const registry<kdf_algorithm, const kdf*> _kdfs;
 
   inline const kdf* get_kdf(kdf_algorithm alg) {
-    auto iter = _kdfs.find(alg);
-    if (iter == _kdfs.end())
-      throw c3::upsilon::algorithm_not_implemented<kdf_algorithm>{alg};
-    else
-      return (iter->second);
+    return _kdfs.get(alg);
   }
+
+  /// cSHAKE from NIST SP 800-185 with an empty function name, on the sponge of Shake128 or Shake256
+  ///
+  /// Different customisations give independent outputs for the same input. This is what the SHAKE
+  /// kdfs' extract is built on
+  std::unique_ptr<xof_reader> begin_cshake(kdf_algorithm alg, std::string_view customisation);
 }
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <gsl/span>
+
+#include "c3/upsilon/except.hpp"
+#include "c3/upsilon/registry.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  enum class mac_algorithm : uint16_t {
+    HMAC_SHA2_256 = 0x0220,
+
+    BLAKE2b_128 = 0x0410,
+    BLAKE2b_256 = 0x0420,
+    BLAKE2b_512 = 0x0440,
+
+    BLAKE2s_128 = 0x0510,
+    BLAKE2s_256 = 0x0520,
+
+    // One-time: see mac_properties::one_time
+    Poly1305 = 0x0610,
+  };
+
+  struct mac_properties {
+  public:
+    mac_algorithm alg;
+    size_t tag_size;
+    size_t min_key;
+    size_t max_key;
+    /// A key must never authenticate more than one message, or forging becomes easy, so after
+    /// the first tag or verify, and for batches of more than one message, std::logic_error is thrown
+    bool one_time;
+
+  public:
+    constexpr mac_properties() : mac_properties{mac_algorithm{}, 0, 0, 0} {}
+    constexpr mac_properties(mac_algorithm alg, size_t tag_size, size_t min_key, size_t max_key,
+                             bool one_time = false) :
+      alg{alg}, tag_size{tag_size}, min_key{min_key}, max_key{max_key}, one_time{one_time} {}
+  };
+
+  struct mac_batch_entry {
+    nu::data_const_ref msg;
+    nu::data_const_ref tag;
+  };
+
+  /// True iff a and b hold the same bytes, taking time that depends only on their lengths
+  bool constant_time_equal(nu::data_const_ref a, nu::data_const_ref b) noexcept;
+
+  /// A key with its work done up front, so that each message only pays for itself
+  ///
+  /// MUST be thread-safe: each call starts from a copy of the keyed state. Nuked when destroyed
+  class mac_key {
+  public:
+    /// output must be exactly tag_size bytes
+    virtual void tag(nu::data_const_ref msg, nu::data_ref output) const = 0;
+    inline nu::data tag(nu::data_const_ref msg) const {
+      nu::data ret(properties()->tag_size);
+      tag(msg, ret);
+      return ret;
+    }
+
+    /// Compares tags in constant time, and rejects tags of the wrong length
+    bool verify(nu::data_const_ref msg, nu::data_const_ref expected) const;
+
+    /// Writes tag_size bytes per message into output, in order
+    ///
+    /// Where there is a multi-lane implementation, messages are run through it several at once
+    virtual void tag_batch(gsl::span<const nu::data_const_ref> msgs, nu::data_ref output) const;
+
+    /// Writes the validity of each entry into results, which must be at least as long as entries
+    ///
+    /// Returns true iff every tag is valid
+    bool verify_batch(gsl::span<const mac_batch_entry> entries, gsl::span<bool> results) const;
+
+    virtual const mac_properties* properties() const noexcept = 0;
+
+  public:
+    virtual ~mac_key() = default;
+  };
+
+  class mac_function {
+  public:
+    /// Throws std::range_error if the key is too short or too long
+    virtual std::unique_ptr<mac_key> make_key(nu::data_const_ref key) const = 0;
+
+    virtual const mac_properties* properties() const noexcept = 0;
+
+  public:
+    virtual ~mac_function() = default;
+  };
+
+  extern const registry<mac_algorithm, const mac_function*> _mac_functions;
+
+  inline const mac_function* get_mac_function(mac_algorithm alg) {
+    return _mac_functions.get(alg);
+  }
+
+  inline std::unique_ptr<mac_key> get_mac_key(mac_algorithm alg, nu::data_const_ref key) {
+    return get_mac_function(alg)->make_key(key);
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace c3::upsilon::metrics {
+  /// The instrumented calls
+  ///
+  /// The algorithm that goes with each is from the matching *_algorithm enum
+  enum class operation : uint8_t {
+    /// hash_function::compute_hash
+    hash,
+    /// partial_hash_function::process
+    hash_process,
+    /// symmetric_function::encrypt
+    encrypt,
+    /// symmetric_function::decrypt
+    decrypt,
+    /// signer::sign
+    sign,
+    /// verifier::verify and verify_batch, where a failed verification counts as an error
+    verify,
+    /// agreement_function::agree
+    agree,
+    /// kdf::expand
+    kdf_expand,
+    /// mac_key::tag and tag_batch
+    mac,
+  };
+
+  /// Bucket i counts calls that took [2^i, 2^(i+1)) ns, and the last one everything slower
+  constexpr size_t n_latency_buckets = 40;
+
+  struct counters {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    std::array<uint64_t, n_latency_buckets> latency = {};
+  };
+
+  struct entry {
+    operation op;
+    uint16_t alg;
+    counters value;
+  };
+
+  /// False unless the library was built with C3_UPSILON_METRICS, in which case nothing is counted
+  bool enabled() noexcept;
+
+  /// Adds up every thread's counters, including those of threads that have since exited
+  ///
+  /// Counters are updated without locks, so a call in flight on another thread may be half-counted
+  std::vector<entry> snapshot();
+
+  /// The upper bound in ns of the given latency quantile, from a histogram
+  uint64_t latency_quantile(const counters& c, double q) noexcept;
+
+  const char* name(operation op) noexcept;
+}
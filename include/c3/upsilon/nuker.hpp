@@ -1,37 +1,49 @@
-//! An allocator that destroys the nu::data on free
+//! An allocator that keeps data locked in memory, and destroys it on free
 #pragma once
 
+#include <limits>
 #include <memory>
+#include <new>
 #include <type_traits>
 #include <vector>
 
+#include "c3/upsilon/secure_arena.hpp"
+
 namespace c3::upsilon {
   void nuke(uint8_t*, size_t);
 
+  /// Allocates from secure_arena::standard(), which nukes each block as it is freed
   template<typename T>
   class nuker {
     static_assert (std::is_integral_v<T>, "Cannot safely nuke non-integral types");
 
-  private:
-    std::allocator<T> alloc;
-
   public:
-    using value_type = typename std::allocator<T>::value_type;
-    using size_type = typename std::allocator<T>::size_type;
-    using difference_type = typename std::allocator<T>::difference_type;
-    using propagate_on_container_move_assignment = typename std::allocator<T>::propagate_on_container_move_assignment;
-    using is_always_equal = typename std::allocator<T>::is_always_equal;
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
 
   public:
-    inline T* allocate(size_type len) { alloc.allocate(len); }
+    inline T* allocate(size_type len) {
+      if (len > std::numeric_limits<size_type>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+      return static_cast<T*>(secure_arena::standard().allocate(len * sizeof(T)));
+    }
     inline void deallocate(T* p, size_type len) {
-      nuke(p, sizeof(T) * len);
-      alloc.deallocate(p, len);
+      secure_arena::standard().deallocate(p, len * sizeof(T));
     }
 
   public:
     nuker() = default;
+    template<typename U>
+    inline nuker(const nuker<U>&) noexcept {}
   };
 
+  template<typename T, typename U>
+  constexpr bool operator==(const nuker<T>&, const nuker<U>&) noexcept { return true; }
+  template<typename T, typename U>
+  constexpr bool operator!=(const nuker<T>&, const nuker<U>&) noexcept { return false; }
+
   using nuking_data = std::vector<uint8_t, nuker<uint8_t>>;
 }
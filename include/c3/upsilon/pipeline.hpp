@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// Fans sign and verify jobs out over a pool of worker threads
+  ///
+  /// Jobs go into a bounded queue shared by all workers. Each worker takes
+  /// whatever is waiting (up to max_batch jobs) and processes it as one batch,
+  /// so verifications from the same identity reach its verifier together.
+  /// Submitting blocks while the queue is full; the try_ variants refuse instead.
+  ///
+  /// Callbacks run on the worker threads and must not throw.
+  /// Without an error callback, a verification that throws reports false,
+  /// and a signature that throws is dropped
+  class pipeline {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct config {
+      size_t n_workers = std::max(std::thread::hardware_concurrency(), 1u);
+      size_t queue_capacity = 4096;
+      size_t max_batch = 64;
+    };
+
+    /// queue_wait is summed over jobs, and hash_time and crypto_time over batches,
+    /// so divide by jobs_completed or batches respectively for the mean
+    struct stats {
+      size_t queue_depth;
+      uint64_t jobs_completed;
+      uint64_t batches;
+      std::chrono::nanoseconds queue_wait;
+      std::chrono::nanoseconds hash_time;
+      std::chrono::nanoseconds crypto_time;
+    };
+
+    using verify_callback = std::function<void(bool)>;
+    using sign_callback = std::function<void(nu::data)>;
+    using error_callback = std::function<void(std::exception_ptr)>;
+
+  private:
+    struct job {
+      bool is_sign;
+      identity verify_id;
+      owned_identity sign_id;
+      nu::data msg;
+      nu::data sig;
+      verify_callback on_verified;
+      sign_callback on_signed;
+      error_callback on_error;
+      clock::time_point enqueued;
+    };
+
+  private:
+    config _conf;
+
+    std::mutex _lock;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<job> _queue;
+    bool _stopping = false;
+
+    std::vector<std::thread> _workers;
+
+    std::atomic<uint64_t> _jobs_completed = 0;
+    std::atomic<uint64_t> _batches = 0;
+    std::atomic<uint64_t> _queue_wait_ns = 0;
+    std::atomic<uint64_t> _hash_ns = 0;
+    std::atomic<uint64_t> _crypto_ns = 0;
+
+  private:
+    bool _submit(job&& j, bool block);
+    void _work();
+    void _process(std::vector<job>& batch);
+
+  public:
+    std::future<bool> verify(identity id, nu::data msg, nu::data sig);
+    void verify(identity id, nu::data msg, nu::data sig,
+                verify_callback on_verified, error_callback on_error = {});
+    /// Returns false without queueing if the queue is full
+    bool try_verify(identity id, nu::data msg, nu::data sig,
+                    verify_callback on_verified, error_callback on_error = {});
+
+    std::future<nu::data> sign(owned_identity id, nu::data msg);
+    void sign(owned_identity id, nu::data msg,
+              sign_callback on_signed, error_callback on_error = {});
+    /// Returns false without queueing if the queue is full
+    bool try_sign(owned_identity id, nu::data msg,
+                  sign_callback on_signed, error_callback on_error = {});
+
+    stats get_stats();
+
+  public:
+    pipeline() : pipeline(config{}) {}
+    pipeline(config conf);
+    /// Finishes every queued job before returning
+    ~pipeline();
+
+    pipeline(const pipeline&) = delete;
+    pipeline& operator=(const pipeline&) = delete;
+  };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+#include "c3/upsilon/except.hpp"
+
+namespace c3::upsilon {
+  /// A fixed table from an *_algorithm enum to its implementation, built entirely at compile time
+  ///
+  /// The algorithm enums keep the family in the high byte and the variant in the low one,
+  /// so adding the two picks a slot. Define these constexpr: a clash between two algorithms
+  /// then fails to compile rather than silently shadowing one of them
+  template<typename Alg, typename Entry, size_t Size = 64>
+  class registry {
+    static_assert((Size & (Size - 1)) == 0, "Registry size must be a power of two");
+
+  private:
+    struct slot {
+      Alg alg = {};
+      Entry entry = {};
+      bool present = false;
+    };
+
+  private:
+    std::array<slot, Size> _slots = {};
+
+  private:
+    static constexpr size_t _index(Alg alg) noexcept {
+      auto v = static_cast<size_t>(alg);
+      return (v + (v >> 8)) & (Size - 1);
+    }
+
+  public:
+    /// Returns nullptr if the algorithm is not in the table
+    constexpr const Entry* find(Alg alg) const noexcept {
+      auto& s = _slots[_index(alg)];
+      return s.present && s.alg == alg ? &s.entry : nullptr;
+    }
+
+    inline const Entry& get(Alg alg) const {
+      auto& s = _slots[_index(alg)];
+      if (!s.present || s.alg != alg)
+        throw c3::upsilon::algorithm_not_implemented<Alg>{alg};
+      return s.entry;
+    }
+
+    constexpr bool contains(Alg alg) const noexcept { return find(alg) != nullptr; }
+
+    /// Calls f(alg, entry) for each algorithm in the table
+    template<typename Func>
+    void for_each(Func&& f) const {
+      for (auto& s : _slots)
+        if (s.present)
+          f(s.alg, s.entry);
+    }
+
+  public:
+    constexpr registry(std::initializer_list<std::pair<Alg, Entry>> entries) {
+      for (auto& i : entries) {
+        auto& s = _slots[_index(i.first)];
+        if (s.present)
+          throw std::logic_error("Two algorithms share a registry slot; increase the registry size");
+        s.alg = i.first;
+        s.entry = i.second;
+        s.present = true;
+      }
+    }
+  };
+}
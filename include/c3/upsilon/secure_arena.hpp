@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace c3::upsilon {
+  /// A locked region for key material, carved into one-page slabs of equally sized blocks
+  ///
+  /// The address space is reserved once, with a guard page after every slab, and kept out of
+  /// core dumps. A slab is mlocked the first time it is handed out, so many small secrets share
+  /// each lock and each page. Blocks are nuked as they are freed, and once a slab is empty the
+  /// whole page is scrubbed and goes back to the pool for any size class.
+  ///
+  /// Requests larger than max_block, or made once the region is full, get their own guarded,
+  /// locked mapping. Thread-safe
+  class secure_arena {
+  public:
+    static constexpr size_t min_block = 16;
+    static constexpr size_t n_classes = 8;
+    static constexpr size_t max_block = min_block << (n_classes - 1);
+
+    struct stats {
+      /// Address space held for slabs, guard pages included
+      size_t reserved;
+      size_t slabs_in_use;
+      size_t live_blocks;
+      /// Allocations that got a mapping of their own
+      size_t live_large;
+      /// False once any mlock has failed, usually due to RLIMIT_MEMLOCK
+      bool locked;
+    };
+
+  private:
+    struct slab {
+      // -1 if the slab is in the free pool
+      int8_t size_class = -1;
+      bool available = false;
+      uint32_t n_live = 0;
+      // Blocks below this have been handed out at least once
+      uint32_t n_carved = 0;
+      // Freed blocks, linked through their first bytes
+      void* free_list = nullptr;
+    };
+
+  private:
+    size_t _page;
+    size_t _n_slabs;
+    uint8_t* _base;
+
+    mutable std::mutex _lock;
+    std::unique_ptr<slab[]> _slabs;
+    // Slabs that have never been touched start at _n_touched
+    size_t _n_touched = 0;
+    std::vector<size_t> _free_slabs;
+    std::vector<size_t> _available[n_classes];
+
+    size_t _live_blocks = 0;
+    size_t _live_large = 0;
+    bool _locked = true;
+
+  private:
+    inline uint8_t* _slab_data(size_t i) const { return _base + _page + i * 2 * _page; }
+    bool _owns(const void* p) const;
+    bool _new_slab(size_t size_class, size_t& out);
+    void* _allocate_large(size_t len);
+    void _deallocate_large(void* p, size_t len);
+
+  public:
+    /// Never returns nullptr; throws std::bad_alloc if the memory can't be had
+    void* allocate(size_t len);
+    /// len must be what was passed to allocate
+    void deallocate(void* p, size_t len);
+
+    stats get_stats() const;
+
+    /// The arena behind nuker
+    static secure_arena& standard();
+
+  public:
+    /// Reserves room for n_slabs pages of blocks; nothing is locked until it is used
+    explicit secure_arena(size_t n_slabs = 256);
+    /// Scrubs every slab, whether or not it still has live blocks
+    ~secure_arena();
+
+    secure_arena(const secure_arena&) = delete;
+    secure_arena& operator=(const secure_arena&) = delete;
+  };
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#include <gsl/span>
+
+#include "c3/upsilon/hash.hpp"
+
+namespace c3::upsilon {
+  /// The first 8 bytes of the digest, big-endian, so that routing uses the digest's own bits
+  ///
+  /// Content addresses are already uniform, so there is nothing to gain from hashing them again
+  template<size_t HashSize>
+  inline uint64_t shard_key(const hash<HashSize>& h) {
+    if (static_cast<size_t>(h.value.size()) < 8)
+      throw std::invalid_argument("Hash too short to shard on");
+    uint64_t ret = 0;
+    for (size_t i = 0; i < 8; ++i)
+      ret = (ret << 8) | h.value[i];
+    return ret;
+  }
+
+  /// Lamping and Veach's jump consistent hash, in [0, n_shards)
+  ///
+  /// Going from n to n + 1 shards moves only the keys that land on the new one, but shards can
+  /// only be added or removed at the end; use rendezvous_ring where any node may leave.
+  /// Throws std::invalid_argument if n_shards is 0
+  uint32_t jump_shard(uint64_t key, uint32_t n_shards);
+
+  template<size_t HashSize>
+  inline uint32_t jump_shard(const hash<HashSize>& h, uint32_t n_shards) {
+    return jump_shard(shard_key(h), n_shards);
+  }
+
+  /// jump_shard for each key, four at a time with AVX2 where it is enabled
+  ///
+  /// output must be at least as long as keys
+  void jump_shard(gsl::span<const uint64_t> keys, uint32_t n_shards, gsl::span<uint32_t> output);
+
+  template<size_t HashSize>
+  inline void jump_shard(gsl::span<const hash<HashSize>> hashes, uint32_t n_shards, gsl::span<uint32_t> output) {
+    if (output.size() < hashes.size())
+      throw std::invalid_argument("Output too small for the number of hashes");
+
+    constexpr size_t chunk = 256;
+    uint64_t keys[chunk];
+    for (size_t pos = 0; pos < static_cast<size_t>(hashes.size()); pos += chunk) {
+      size_t n = std::min(chunk, static_cast<size_t>(hashes.size()) - pos);
+      for (size_t i = 0; i < n; ++i)
+        keys[i] = shard_key(hashes[pos + i]);
+      jump_shard(gsl::span<const uint64_t>{keys, keys + n}, n_shards, output.subspan(pos, n));
+    }
+  }
+
+  struct shard_node {
+    /// Chosen by the caller, and must be stable: it is what keys are scored against
+    uint64_t id;
+    /// Relative share of the keys, which must be positive
+    double weight = 1.0;
+  };
+
+  /// Weighted rendezvous (highest random weight) hashing
+  ///
+  /// Each key goes to the node scoring highest against it, so when a node joins it takes only
+  /// its share of keys, and when one leaves only its keys move, whichever node it is.
+  /// Scores mix the key with the node id rather than rehashing the digest
+  class rendezvous_ring {
+  private:
+    std::vector<shard_node> _nodes;
+
+  public:
+    /// Throws std::invalid_argument if the id is already present or the weight is not positive
+    void add(shard_node node);
+    /// Throws std::invalid_argument if there is no such node
+    void remove(uint64_t id);
+
+    inline const std::vector<shard_node>& nodes() const noexcept { return _nodes; }
+    inline bool empty() const noexcept { return _nodes.empty(); }
+
+    /// The id of the node the key belongs to
+    ///
+    /// O(nodes); use shard_table to route without scoring. Throws std::logic_error if empty
+    uint64_t route(uint64_t key) const;
+    template<size_t HashSize>
+    inline uint64_t route(const hash<HashSize>& h) const { return route(shard_key(h)); }
+
+  public:
+    rendezvous_ring() = default;
+    rendezvous_ring(std::initializer_list<shard_node> nodes) {
+      for (auto& i : nodes)
+        add(i);
+    }
+  };
+
+  /// A rendezvous_ring flattened into 2^bits slots, routing by the top bits of the key in O(1)
+  ///
+  /// Slots are routed as the ring would route them, so rebuilding after a node joins or leaves
+  /// moves only the slots that node gains or loses
+  class shard_table {
+  private:
+    std::vector<uint64_t> _slots;
+    unsigned _bits;
+
+  public:
+    inline unsigned bits() const noexcept { return _bits; }
+    inline const std::vector<uint64_t>& slots() const noexcept { return _slots; }
+
+    inline uint64_t route(uint64_t key) const noexcept { return _slots[key >> (64 - _bits)]; }
+    template<size_t HashSize>
+    inline uint64_t route(const hash<HashSize>& h) const { return route(shard_key(h)); }
+
+    /// output must be at least as long as hashes
+    template<size_t HashSize>
+    inline void route(gsl::span<const hash<HashSize>> hashes, gsl::span<uint64_t> output) const {
+      if (output.size() < hashes.size())
+        throw std::invalid_argument("Output too small for the number of hashes");
+      for (size_t i = 0; i < static_cast<size_t>(hashes.size()); ++i)
+        output[i] = route(hashes[i]);
+    }
+
+    /// Reassigns every slot from ring, returning how many changed node
+    size_t rebuild(const rendezvous_ring& ring);
+
+  public:
+    /// Throws std::invalid_argument unless 1 <= bits <= 24, or std::logic_error if ring is empty
+    shard_table(const rendezvous_ring& ring, unsigned bits = 16);
+  };
+}
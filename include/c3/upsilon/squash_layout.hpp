@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+
+#include <c3/nu/data.hpp>
+
+#include <c3/nu/data/helpers.hpp>
+
+namespace c3::upsilon {
+  /// Where nu::squash(leading..., bytes) puts each part, for a given length of bytes
+  struct squash_layout {
+    /// The squashed form with bytes all zero, which everything but bytes is copied from
+    nu::data skeleton;
+    /// Where bytes starts in skeleton
+    size_t offset;
+  };
+
+  /// nu keeps its layout to itself, so this squashes zeros once for each set of leading fields
+  /// and length, and remembers where they landed
+  ///
+  /// The cache is per thread and direct mapped, so lookups take no locks and it never grows.
+  /// The layout returned is only good until the next call on the same thread
+  template<typename... Leading>
+  inline const squash_layout& get_squash_layout(const Leading&... leading, size_t len) {
+    struct slot {
+      std::tuple<Leading..., size_t> key;
+      squash_layout layout;
+      bool used = false;
+    };
+    thread_local std::array<slot, 8> cache;
+
+    auto key = std::make_tuple(leading..., len);
+    size_t h = len;
+    ((h = h * 31 + std::hash<Leading>{}(leading)), ...);
+    auto& s = cache[h % cache.size()];
+    if (s.used && s.key == key)
+      return s.layout;
+
+    squash_layout layout;
+    nu::data zeros(len);
+    layout.skeleton = nu::squash(leading..., nu::data_const_ref{zeros});
+
+    std::tuple<Leading...> leading_out;
+    nu::data_const_ref bytes;
+    std::apply([&](auto&... i) { nu::expand(layout.skeleton, i..., bytes); }, leading_out);
+    layout.offset = len ? static_cast<size_t>(bytes.data() - layout.skeleton.data()) : 0;
+
+    s.key = key;
+    s.layout = std::move(layout);
+    s.used = true;
+    return s.layout;
+  }
+
+  /// The size of nu::squash(leading..., bytes) when bytes is len long
+  template<typename... Leading>
+  inline size_t squashed_size(size_t len, const Leading&... leading) {
+    return get_squash_layout<Leading...>(leading..., len).skeleton.size();
+  }
+
+  /// Writes the same as nu::squash(leading..., bytes) into b, where fill writes the len bytes of
+  /// bytes into the span it is given, so they need never be copied anywhere else.
+  /// Returns how many bytes were written
+  template<typename Fill, typename... Leading>
+  inline size_t squash_into(nu::data_ref b, size_t len, Fill&& fill, const Leading&... leading) {
+    auto& layout = get_squash_layout<Leading...>(leading..., len);
+    if (static_cast<size_t>(b.size()) < layout.skeleton.size())
+      throw std::invalid_argument("Buffer too small to serialise into");
+
+    std::copy(layout.skeleton.begin(), layout.skeleton.end(), b.begin());
+    // fill may serialise something else on this thread, which can evict the layout
+    auto offset = layout.offset;
+    auto size = layout.skeleton.size();
+    fill(b.subspan(offset, len));
+    return size;
+  }
+}
+
+#include <c3/nu/data/clean_helpers.hpp>
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "c3/upsilon/hash.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// Hashes salt then input with Alg's implementation called directly, keeping all state on the stack
+  ///
+  /// Gives the same bytes as hash_function::compute_hash, and output may likewise be shorter than
+  /// max_output. Defined for every algorithm get_hasher has
+  template<hash_algorithm Alg>
+  void static_hash(nu::data_const_ref input, nu::data_const_ref salt, nu::data_ref output);
+
+  /// A hasher for an algorithm fixed at compile time, which costs one direct call per hash
+  /// rather than a virtual one into a thread's Botan object
+  ///
+  /// Converts to a hasher wherever the algorithm has to be chosen at runtime. Runs upsilon's own
+  /// BLAKE2b and Botan's SHA-2 and Keccak primitives, so C3_UPSILON_BACKEND does not apply
+  template<hash_algorithm Alg>
+  class static_hasher {
+  public:
+    static constexpr hash_properties props = get_hash_properties<Alg>();
+
+  public:
+    inline const hash_properties* properties() const noexcept { return &props; }
+
+    template<size_t HashSize = props.max_output, typename T>
+    inline hash<HashSize> get_hash(const T& t) const {
+      return get_hash<HashSize>(t, nu::data_const_ref{});
+    }
+
+    template<size_t HashSize = props.max_output, typename T>
+    inline hash<HashSize> get_hash(const T& t, nu::data_const_ref salt) const {
+      hash<HashSize> ret;
+      if constexpr (HashSize == nu::dynamic_size)
+        ret.value.resize(props.max_output);
+      else
+        static_assert(HashSize <= props.max_output, "Too many bytes requested from hash");
+
+      if constexpr (std::is_same_v<T, nu::data>)
+        static_hash<Alg>(t, salt, ret.value);
+      else
+        static_hash<Alg>(nu::serialise(t), salt, ret.value);
+      return ret;
+    }
+
+    /// Streaming goes through the runtime hasher, as it needs state that outlives the call
+    inline partial_hasher begin_hash() const { return get_hasher<Alg>().begin_hash(); }
+    inline partial_hasher begin_hash(nu::data_const_ref salt) const { return get_hasher<Alg>().begin_hash(salt); }
+
+    inline operator hasher() const { return get_hasher<Alg>(); }
+  };
+
+  template<hash_algorithm Alg>
+  inline static_hasher<Alg> get_static_hasher() { return {}; }
+}
@@ -7,11 +7,15 @@
 
 #include "c3/upsilon/except.hpp"
 #include "c3/upsilon/nuker.hpp"
+#include "c3/upsilon/registry.hpp"
 
 #include <c3/nu/data.hpp>
 
 #include <c3/nu/data/helpers.hpp>
 
+// From <sys/uio.h>
+struct iovec;
+
 namespace c3::upsilon {
   struct symmetric_properties {
   public:
@@ -19,6 +23,7 @@ namespace c3::upsilon {
     size_t iv_size;
 
   public:
+    constexpr symmetric_properties() : symmetric_properties{0, 0} {}
     constexpr symmetric_properties(size_t key_size, size_t iv_size) :
       key_size{key_size}, iv_size{iv_size} {};
   };
@@ -50,14 +55,6 @@ namespace c3::upsilon {
 
   template<symmetric_algorithm Alg>
   constexpr symmetric_properties get_symmetric_properties();
-  extern std::map<symmetric_algorithm, symmetric_properties> _symmetric_properties;
-  inline symmetric_properties get_symmetric_properties(symmetric_algorithm alg) {
-    auto iter = _symmetric_properties.find(alg);
-    if (iter == _symmetric_properties.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second);
-  }
 
   template<symmetric_algorithm Alg>
   using symmetric_key = std::array<uint8_t, get_symmetric_properties<Alg>().key_size>;
@@ -89,11 +86,31 @@ namespace c3::upsilon {
       return ret;
     }
 
+    /// Encrypts the buffers in place as if they were one, so the keystream runs on from
+    /// each into the next without skipping any of it
+    virtual void encryptv(gsl::span<const nu::data_ref> input_output);
+    /// Encrypts input into output as if each list were one buffer, so they need not be split
+    /// in the same places. Stops at the end of the shorter, returning the bytes encrypted
+    virtual uint64_t encryptv(gsl::span<const nu::data_const_ref> input, gsl::span<const nu::data_ref> output);
+    /// As encryptv above, for buffers as given to writev or sendmsg
+    void encryptv(const iovec* iov, size_t n);
+
+    virtual void decryptv(gsl::span<const nu::data_ref> input_output);
+    virtual uint64_t decryptv(gsl::span<const nu::data_const_ref> input, gsl::span<const nu::data_ref> output);
+    void decryptv(const iovec* iov, size_t n);
+
     /// Acts as if n bytes have been encrypted
     virtual void seek(uint64_t n) = 0;
     /// Returns the position of the stream cipher
     virtual uint64_t pos() const noexcept = 0;
 
+    /// Restarts the stream at position 0 under a new IV, keeping the key
+    ///
+    /// Neither this nor rekey allocates, so one function can serve a whole stream of messages
+    virtual void set_iv(nu::data_const_ref iv) = 0;
+    /// Restarts the stream at position 0 under a new key and IV
+    virtual void rekey(nu::data_const_ref key, nu::data_const_ref iv) = 0;
+
     virtual symmetric_algorithm alg() const noexcept = 0;
 
   public:
@@ -103,17 +120,13 @@ namespace c3::upsilon {
   template<symmetric_algorithm Alg>
   inline auto get_symmetric_function(key_const_ref<Alg> key, iv_const_ref<Alg> iv);
 
-  extern std::map<symmetric_algorithm,
-                  std::function<std::unique_ptr<symmetric_function>(nu::data_const_ref, nu::data_const_ref)>> _symmetric_functions;
+  extern const registry<symmetric_algorithm,
+                        std::unique_ptr<symmetric_function>(*)(nu::data_const_ref, nu::data_const_ref)> _symmetric_functions;
 
   inline std::unique_ptr<symmetric_function> get_symmetric_function(symmetric_algorithm alg,
                                                                     nu::data_const_ref key,
                                                                     nu::data_const_ref iv) {
-    auto iter = _symmetric_functions.find(alg);
-    if (iter == _symmetric_functions.end())
-      throw c3::upsilon::algorithm_not_implemented{alg};
-    else
-      return (iter->second)(key, iv);
+    return _symmetric_functions.get(alg)(key, iv);
   }
 
   ////////////////////////////////////////////////////////////////
@@ -136,6 +149,25 @@ namespace c3::upsilon {
   C3_UPSILON_SYM_ALG(symmetric_algorithm::XChaCha20_8 , (256 / 8), (192 / 8));
   C3_UPSILON_SYM_ALG(symmetric_algorithm::XChaCha20_12, (256 / 8), (192 / 8));
   C3_UPSILON_SYM_ALG(symmetric_algorithm::XChaCha20_20, (256 / 8), (192 / 8));
+
+  #define C3_UPSILON_SYM_PROPS(ALG) { ALG, get_symmetric_properties<ALG>() }
+  inline constexpr registry<symmetric_algorithm, symmetric_properties> _symmetric_properties = {
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::AES128),
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::AES256),
+
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::ChaCha20_8),
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::ChaCha20_12),
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::ChaCha20_20),
+
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::XChaCha20_8),
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::XChaCha20_12),
+    C3_UPSILON_SYM_PROPS(symmetric_algorithm::XChaCha20_20),
+  };
+  #undef C3_UPSILON_SYM_PROPS
+
+  inline symmetric_properties get_symmetric_properties(symmetric_algorithm alg) {
+    return _symmetric_properties.get(alg);
+  }
 }
 
 #include <c3/nu/data/clean_helpers.hpp>
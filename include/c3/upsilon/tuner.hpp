@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+namespace c3::upsilon {
+  /// Every registered algorithm of each family, fastest first on this host
+  ///
+  /// This only ranks speed: which of them are strong enough is still up to the caller
+  struct algorithm_ranking {
+    std::vector<hash_algorithm> hash;
+    std::vector<symmetric_algorithm> symmetric;
+  };
+
+  /// Times every registered hash and symmetric algorithm, which takes a few tens of ms
+  algorithm_ranking tune_algorithms();
+
+  /// tune_algorithms, run at most once per process and cached on disk per CPU
+  ///
+  /// The cache is the file named by C3_UPSILON_TUNING_CACHE (set it empty to turn caching off),
+  /// otherwise $XDG_CACHE_HOME/c3-upsilon/tuning or ~/.cache/c3-upsilon/tuning.
+  /// Entries are keyed by cpu_model_name, enabled_cpu_features and any C3_UPSILON_BACKEND overrides
+  /// on hashes and ciphers, and are retuned if the registered algorithms have changed since they
+  /// were written
+  const algorithm_ranking& tuned_algorithms();
+
+  /// Our fastest out of the offered algorithms, e.g. those a peer accepts
+  ///
+  /// Throws std::invalid_argument if none of them are registered
+  hash_algorithm preferred_algorithm(const std::vector<hash_algorithm>& offered);
+  symmetric_algorithm preferred_algorithm(const std::vector<symmetric_algorithm>& offered);
+}
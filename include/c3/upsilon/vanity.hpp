@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <thread>
+
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+namespace c3::upsilon {
+  /// The digest of an identity's bare public key under alg, independent of its message hash
+  hash<> fingerprint(const identity& id, hash_algorithm alg);
+  inline hash<> fingerprint(const owned_identity& id, hash_algorithm alg) {
+    return fingerprint(static_cast<identity>(id), alg);
+  }
+
+  struct vanity_progress {
+    uint64_t attempts;
+    double attempts_per_sec;
+    /// 2^prefix_bits, the mean number of attempts a match takes
+    double expected_attempts;
+    /// Until attempts reaches expected_attempts at the current rate, or 0 once past it.
+    /// Each attempt is independent, so running long is no nearer a match
+    std::chrono::duration<double> eta;
+  };
+
+  struct vanity_config {
+    hash_algorithm fingerprint_alg = hash_algorithm::SHA2_256;
+    size_t n_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    std::chrono::milliseconds report_interval{1000};
+    /// Called on the searching thread every report_interval. Returning false cancels the search
+    std::function<bool(const vanity_progress&)> on_progress;
+  };
+
+  /// Generates identities until one's fingerprint starts with the first prefix_bits bits of prefix,
+  /// most significant bit first
+  ///
+  /// Each worker derives keys from its own stream of seeds, hashed from a counter and a key drawn
+  /// from the csprng once, so nothing is allocated per attempt. Blocks until a match is found,
+  /// returning nothing if on_progress cancels first. Throws std::invalid_argument if prefix is
+  /// shorter than prefix_bits or prefix_bits is longer than the fingerprint
+  std::optional<owned_identity> vanity_search(signature_algorithm sig_alg, hash_algorithm msg_hash_alg,
+                                              nu::data_const_ref prefix, size_t prefix_bits,
+                                              const vanity_config& conf = {});
+  inline std::optional<owned_identity> vanity_search(signature_algorithm sig_alg, hash_algorithm msg_hash_alg,
+                                                     nu::data_const_ref prefix, const vanity_config& conf = {}) {
+    return vanity_search(sig_alg, msg_hash_alg, prefix, static_cast<size_t>(prefix.size()) * 8, conf);
+  }
+}
@@ -1,6 +1,8 @@
 #include "c3/upsilon/agreement.hpp"
 
 #include "botan_common.hpp"
+#include "dispatch.hpp"
+#include "instrument.hpp"
 
 #include <botan/curve25519.h>
 #include <botan/pubkey.h>
@@ -14,24 +16,18 @@
   template<> \
   std::unique_ptr<agreement_function> gen_agreement_function<ALG>() { \
     return std::make_unique<CLASS_NAME>(); \
-  } \
-  static auto __##CLASS_NAME##_gen_registered = \
-    _ag_gens.emplace(ALG, [](){ return std::make_unique<CLASS_NAME>(); }); \
-  static auto __##CLASS_NAME##_get_registered = \
-    _agreement_functions.emplace(ALG, [](auto a){ return std::make_unique<CLASS_NAME>(a); });
+  }
 
 namespace c3::upsilon {
-  std::map<agreement_algorithm,
-           std::function<std::unique_ptr<agreement_function>(nu::data_const_ref)>> _agreement_functions;
-
-  std::map<agreement_algorithm, std::function<std::unique_ptr<agreement_function>()>> _ag_gens;
-
   class curve25519 : public agreement_function {
     Botan::Curve25519_PrivateKey priv;
 
   public:
-    virtual nu::data agree(nu::data_const_ref other_public) const override {
-      Botan::PK_Key_Agreement op(priv, csprng_wrapper::standard, "Raw");
+    virtual nuking_data agree(nu::data_const_ref other_public) const override {
+      C3_UPSILON_MEASURE(agree, agreement_algorithm::Curve25519, other_public.size());
+      static const std::string& provider =
+        botan_pk_provider(algorithm_family::agreement, static_cast<uint16_t>(agreement_algorithm::Curve25519));
+      Botan::PK_Key_Agreement op(priv, csprng_wrapper::standard, "Raw", provider);
 
       // Looked up size on cr.yp.to
       auto k = op.derive_key(32, other_public.data(), other_public.size());
@@ -43,11 +39,24 @@ namespace c3::upsilon {
       return priv.public_value();
     }
 
-    virtual nu::data serialise_private() const  override {
+    virtual nuking_data serialise_private() const  override {
       auto ret = Botan::PKCS8::BER_encode(priv);
       return { ret.begin(), ret.end() };
     }
 
+    // The PKCS#8 wrapping of a Curve25519 key is the same length for every key, so one encoding will do
+    virtual size_t serialised_private_size() const override {
+      static const size_t ret = Botan::PKCS8::BER_encode(priv).size();
+      return ret;
+    }
+
+    virtual void serialise_private_into(nu::data_ref b) const override {
+      auto ret = Botan::PKCS8::BER_encode(priv);
+      if (ret.size() != static_cast<size_t>(b.size()))
+        throw std::invalid_argument("Private key is not the size of the buffer");
+      std::copy(ret.begin(), ret.end(), b.begin());
+    }
+
   public:
     inline curve25519() : priv{csprng_wrapper::standard} {};
     inline curve25519(nu::data_const_ref b) : priv{Botan::SecureVector<uint8_t>{b.begin(), b.end()}} {};
@@ -55,4 +64,98 @@ namespace c3::upsilon {
 
   C3_UPSILON_AGREEMENT_BOILERPLATE(curve25519, agreement_algorithm::Curve25519);
 
+  constexpr registry<agreement_algorithm,
+                     std::unique_ptr<agreement_function>(*)(nu::data_const_ref)> _agreement_functions = {
+    { agreement_algorithm::Curve25519, get_agreement_function<agreement_algorithm::Curve25519> },
+  };
+  constexpr registry<agreement_algorithm, std::unique_ptr<agreement_function>(*)()> _ag_gens = {
+    { agreement_algorithm::Curve25519, gen_agreement_function<agreement_algorithm::Curve25519> },
+  };
+
+  agreement_cache::agreement_cache(size_t capacity, clock::duration ttl, size_t n_shards) :
+    _n_shards{std::max<size_t>(n_shards, 1)},
+    _shard_capacity{std::max<size_t>((capacity + _n_shards - 1) / _n_shards, 1)},
+    _ttl{ttl},
+    _shards{std::make_unique<shard[]>(_n_shards)} {}
+
+  agreement_cache::~agreement_cache() { clear(); }
+
+  agreement_cache::shard& agreement_cache::_get_shard(std::string_view key) {
+    return _shards[std::hash<std::string_view>{}(key) % _n_shards];
+  }
+
+  void agreement_cache::_evict(shard& s, std::list<entry>::iterator iter) {
+    s.index.erase(iter->key);
+    // The value nukes itself as it goes
+    s.lru.erase(iter);
+    ++_evictions;
+  }
+
+  static std::string_view as_key(nu::data_const_ref b) {
+    return { reinterpret_cast<const char*>(b.data()), static_cast<size_t>(b.size()) };
+  }
+
+  bool agreement_cache::get(nu::data_const_ref other_public, nuking_data& output) {
+    auto key = as_key(other_public);
+    auto& s = _get_shard(key);
+    std::lock_guard lock{s.lock};
+
+    auto iter = s.index.find(key);
+    if (iter == s.index.end()) {
+      ++_misses;
+      return false;
+    }
+
+    if (iter->second->expiry <= clock::now()) {
+      _evict(s, iter->second);
+      ++_misses;
+      return false;
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, iter->second);
+    output.assign(iter->second->value.begin(), iter->second->value.end());
+    ++_hits;
+    return true;
+  }
+
+  void agreement_cache::put(nu::data_const_ref other_public, nu::data_const_ref raw_result) {
+    auto key = as_key(other_public);
+    auto& s = _get_shard(key);
+    auto now = clock::now();
+    std::lock_guard lock{s.lock};
+
+    auto iter = s.index.find(key);
+    if (iter != s.index.end()) {
+      auto& e = *iter->second;
+      // Assigning may reuse the old buffer without freeing it
+      nuke(e.value.data(), e.value.size());
+      e.value.assign(raw_result.begin(), raw_result.end());
+      e.expiry = now + _ttl;
+      s.lru.splice(s.lru.begin(), s.lru, iter->second);
+      return;
+    }
+
+    // Drop anything stale from the cold end first, then make room
+    while (!s.lru.empty() && s.lru.back().expiry <= now)
+      _evict(s, std::prev(s.lru.end()));
+    while (s.lru.size() >= _shard_capacity)
+      _evict(s, std::prev(s.lru.end()));
+
+    s.lru.push_front({ std::string{key}, { raw_result.begin(), raw_result.end() }, now + _ttl });
+    s.index.emplace(s.lru.front().key, s.lru.begin());
+  }
+
+  void agreement_cache::clear() {
+    for (size_t i = 0; i < _n_shards; ++i) {
+      auto& s = _shards[i];
+      std::lock_guard lock{s.lock};
+      s.index.clear();
+      s.lru.clear();
+    }
+  }
+
+  agreement_cache::stats agreement_cache::get_stats() const noexcept {
+    return { _hits.load(), _misses.load(), _evictions.load() };
+  }
+
 }
@@ -0,0 +1,608 @@
+#include "c3/upsilon/argon2.hpp"
+#include "c3/upsilon/nuker.hpp"
+
+#include "blake2.hpp"
+#include "dispatch.hpp"
+#include "endian.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define C3_UPSILON_ARGON2_AVX2
+#endif
+
+namespace c3::upsilon {
+  namespace {
+    constexpr uint32_t argon2_version = 0x13;
+    constexpr uint32_t argon2id_type = 2;
+    constexpr uint32_t sync_points = 4;
+    constexpr size_t block_words = 128;
+    constexpr size_t block_bytes = block_words * 8;
+
+    struct alignas(64) block {
+      uint64_t v[block_words];
+    };
+
+    void store_le32(uint8_t* b, uint32_t x) {
+      x = htole32(x);
+      std::memcpy(b, &x, 4);
+    }
+
+    void blake2b_update_le32(blake2::blake2b& h, uint32_t x) {
+      uint8_t b[4];
+      store_le32(b, x);
+      h.update(b, 4);
+    }
+
+    void blake2b_update_prefixed(blake2::blake2b& h, nu::data_const_ref input) {
+      blake2b_update_le32(h, static_cast<uint32_t>(input.size()));
+      h.update(input.data(), input.size());
+    }
+
+    // H' from RFC 9106 section 3.3, for outputs longer than BLAKE2b can manage on its own
+    void hash_long(const uint8_t* input, size_t input_len, uint8_t* output, size_t output_len) {
+      blake2::blake2b h{std::min<size_t>(output_len, 64)};
+      blake2b_update_le32(h, static_cast<uint32_t>(output_len));
+      h.update(input, input_len);
+
+      if (output_len <= 64) {
+        h.final(output);
+        return;
+      }
+
+      uint8_t v[64];
+      h.final(v);
+      std::copy(v, v + 32, output);
+      output += 32;
+      output_len -= 32;
+
+      while (output_len > 64) {
+        blake2::blake2b next;
+        next.update(v, 64);
+        next.final(v);
+        std::copy(v, v + 32, output);
+        output += 32;
+        output_len -= 32;
+      }
+
+      blake2::blake2b last{output_len};
+      last.update(v, 64);
+      last.final(output);
+      nuke(v, sizeof(v));
+    }
+
+    void block_from_bytes(block& b, const uint8_t* bytes) {
+      for (size_t i = 0; i < block_words; ++i) {
+        uint64_t w;
+        std::memcpy(&w, bytes + i * 8, 8);
+        b.v[i] = le64toh(w);
+      }
+    }
+
+    void block_to_bytes(uint8_t* bytes, const block& b) {
+      for (size_t i = 0; i < block_words; ++i) {
+        uint64_t w = htole64(b.v[i]);
+        std::memcpy(bytes + i * 8, &w, 8);
+      }
+    }
+
+    inline uint64_t rotr64(uint64_t x, unsigned n) { return (x >> n) | (x << (64 - n)); }
+
+    // BLAKE2b's G, but with the additions swapped for BlaMka's multiply-hardened ones
+    inline uint64_t blamka(uint64_t x, uint64_t y) {
+      return x + y + 2 * static_cast<uint64_t>(static_cast<uint32_t>(x)) * static_cast<uint32_t>(y);
+    }
+
+    inline void blamka_g(uint64_t& a, uint64_t& b, uint64_t& c, uint64_t& d) {
+      a = blamka(a, b); d = rotr64(d ^ a, 32);
+      c = blamka(c, d); b = rotr64(b ^ c, 24);
+      a = blamka(a, b); d = rotr64(d ^ a, 16);
+      c = blamka(c, d); b = rotr64(b ^ c, 63);
+    }
+
+    inline void blamka_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3,
+                             uint64_t& v4, uint64_t& v5, uint64_t& v6, uint64_t& v7,
+                             uint64_t& v8, uint64_t& v9, uint64_t& v10, uint64_t& v11,
+                             uint64_t& v12, uint64_t& v13, uint64_t& v14, uint64_t& v15) {
+      blamka_g(v0, v4, v8, v12);
+      blamka_g(v1, v5, v9, v13);
+      blamka_g(v2, v6, v10, v14);
+      blamka_g(v3, v7, v11, v15);
+      blamka_g(v0, v5, v10, v15);
+      blamka_g(v1, v6, v11, v12);
+      blamka_g(v2, v7, v8, v13);
+      blamka_g(v3, v4, v9, v14);
+    }
+
+    // G from RFC 9106 section 3.5: next (^)= P(prev ^ ref) ^ prev ^ ref
+    void fill_block_portable(const block& prev, const block& ref, block& next, bool with_xor) {
+      block r, tmp;
+      for (size_t i = 0; i < block_words; ++i)
+        r.v[i] = prev.v[i] ^ ref.v[i];
+      tmp = r;
+      if (with_xor)
+        for (size_t i = 0; i < block_words; ++i)
+          tmp.v[i] ^= next.v[i];
+
+      auto* v = r.v;
+      for (size_t i = 0; i < 8; ++i) {
+        auto* row = v + 16 * i;
+        blamka_round(row[0], row[1], row[2], row[3], row[4], row[5], row[6], row[7],
+                     row[8], row[9], row[10], row[11], row[12], row[13], row[14], row[15]);
+      }
+      for (size_t i = 0; i < 8; ++i) {
+        auto* col = v + 2 * i;
+        blamka_round(col[0], col[1], col[16], col[17], col[32], col[33], col[48], col[49],
+                     col[64], col[65], col[80], col[81], col[96], col[97], col[112], col[113]);
+      }
+
+      for (size_t i = 0; i < block_words; ++i)
+        next.v[i] = tmp.v[i] ^ r.v[i];
+    }
+
+#ifdef C3_UPSILON_ARGON2_AVX2
+    // Each round holds its 16 words as four rows of four, the same layout BLAKE2b's AVX2 code uses
+
+    __attribute__((target("avx2")))
+    inline __m256i blamka_avx2(__m256i x, __m256i y) {
+      auto xy = _mm256_mul_epu32(x, y);
+      return _mm256_add_epi64(_mm256_add_epi64(x, y), _mm256_add_epi64(xy, xy));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i rotr64_avx2(__m256i x, int n) {
+      const auto rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                          3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+      const auto rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                          2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+      switch (n) {
+        case 32: return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+        case 24: return _mm256_shuffle_epi8(x, rot24);
+        case 16: return _mm256_shuffle_epi8(x, rot16);
+        // 63
+        default: return _mm256_xor_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x));
+      }
+    }
+
+    __attribute__((target("avx2")))
+    inline void blamka_g_avx2(__m256i& a, __m256i& b, __m256i& c, __m256i& d) {
+      a = blamka_avx2(a, b); d = rotr64_avx2(_mm256_xor_si256(d, a), 32);
+      c = blamka_avx2(c, d); b = rotr64_avx2(_mm256_xor_si256(b, c), 24);
+      a = blamka_avx2(a, b); d = rotr64_avx2(_mm256_xor_si256(d, a), 16);
+      c = blamka_avx2(c, d); b = rotr64_avx2(_mm256_xor_si256(b, c), 63);
+    }
+
+    __attribute__((target("avx2")))
+    inline void blamka_round_avx2(__m256i& a, __m256i& b, __m256i& c, __m256i& d) {
+      blamka_g_avx2(a, b, c, d);
+      // Diagonalise
+      b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+      c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+      d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+      blamka_g_avx2(a, b, c, d);
+      b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+      c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+      d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i load_pair(const uint64_t* lo, const uint64_t* hi) {
+      return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lo))),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)), 1);
+    }
+
+    __attribute__((target("avx2")))
+    inline void store_pair(uint64_t* lo, uint64_t* hi, __m256i x) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), _mm256_castsi256_si128(x));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(hi), _mm256_extracti128_si256(x, 1));
+    }
+
+    __attribute__((target("avx2")))
+    void fill_block_avx2(const block& prev, const block& ref, block& next, bool with_xor) {
+      block r;
+      __m256i tmp[block_words / 4];
+      for (size_t i = 0; i < block_words / 4; ++i) {
+        auto x = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(prev.v) + i),
+                                  _mm256_load_si256(reinterpret_cast<const __m256i*>(ref.v) + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(r.v) + i, x);
+        tmp[i] = with_xor ? _mm256_xor_si256(x, _mm256_load_si256(reinterpret_cast<const __m256i*>(next.v) + i)) : x;
+      }
+
+      auto* v = r.v;
+      for (size_t i = 0; i < 8; ++i) {
+        auto* row = reinterpret_cast<__m256i*>(v + 16 * i);
+        auto a = _mm256_load_si256(row), b = _mm256_load_si256(row + 1),
+             c = _mm256_load_si256(row + 2), d = _mm256_load_si256(row + 3);
+        blamka_round_avx2(a, b, c, d);
+        _mm256_store_si256(row, a); _mm256_store_si256(row + 1, b);
+        _mm256_store_si256(row + 2, c); _mm256_store_si256(row + 3, d);
+      }
+      for (size_t i = 0; i < 8; ++i) {
+        auto* col = v + 2 * i;
+        auto a = load_pair(col, col + 16), b = load_pair(col + 32, col + 48),
+             c = load_pair(col + 64, col + 80), d = load_pair(col + 96, col + 112);
+        blamka_round_avx2(a, b, c, d);
+        store_pair(col, col + 16, a); store_pair(col + 32, col + 48, b);
+        store_pair(col + 64, col + 80, c); store_pair(col + 96, col + 112, d);
+      }
+
+      for (size_t i = 0; i < block_words / 4; ++i)
+        _mm256_store_si256(reinterpret_cast<__m256i*>(next.v) + i,
+                           _mm256_xor_si256(tmp[i], _mm256_load_si256(reinterpret_cast<const __m256i*>(r.v) + i)));
+    }
+#endif
+
+    using fill_block_func = void(*)(const block&, const block&, block&, bool);
+
+    fill_block_func pick_fill_block() {
+      auto backend = choose_backend(algorithm_family::kdf, static_cast<uint16_t>(kdf_algorithm::Argon2id), {
+#ifdef C3_UPSILON_ARGON2_AVX2
+        { "avx2", { cpu_feature::avx2 } },
+#endif
+        { "portable", {} },
+      });
+#ifdef C3_UPSILON_ARGON2_AVX2
+      if (backend == std::string_view{"avx2"})
+        return fill_block_avx2;
+#endif
+      return fill_block_portable;
+    }
+
+    // Picked on first use rather than at load, so an override it can't honour throws from argon2id
+    fill_block_func get_fill_block() {
+      static const fill_block_func ret = pick_fill_block();
+      return ret;
+    }
+
+    // Maps the memory matrix, asking for huge pages since Argon2 walks all of it at random
+    class block_memory {
+    private:
+      void* _base = MAP_FAILED;
+      size_t _len;
+
+    public:
+      inline block* blocks() const { return static_cast<block*>(_base); }
+
+    public:
+      block_memory(size_t n_blocks) : _len{n_blocks * sizeof(block)} {
+#ifdef MAP_HUGETLB
+        // Only works if the admin has set some aside, so rounding up to 2MiB is fine
+        constexpr size_t huge_page = 2 * 1024 * 1024;
+        if (_len >= huge_page) {
+          auto huge_len = (_len + huge_page - 1) / huge_page * huge_page;
+          _base = mmap(nullptr, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+          if (_base != MAP_FAILED)
+            _len = huge_len;
+        }
+#endif
+        if (_base == MAP_FAILED) {
+          _base = mmap(nullptr, _len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if (_base == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+          // Transparent huge pages instead, if they're on
+          madvise(_base, _len, MADV_HUGEPAGE);
+#endif
+        }
+      }
+
+      ~block_memory() {
+        nuke(static_cast<uint8_t*>(_base), _len);
+        munmap(_base, _len);
+      }
+
+      block_memory(const block_memory&) = delete;
+      block_memory& operator=(const block_memory&) = delete;
+    };
+
+    // Lets the lane threads wait for each other at the end of each slice
+    class barrier {
+    private:
+      std::mutex _lock;
+      std::condition_variable _cv;
+      size_t _n;
+      size_t _waiting = 0;
+      size_t _generation = 0;
+      bool _aborted = false;
+
+    public:
+      /// Returns false once abort has been called, as the others will never arrive
+      bool wait() {
+        std::unique_lock lock{_lock};
+        auto gen = _generation;
+        if (++_waiting == _n) {
+          _waiting = 0;
+          ++_generation;
+          _cv.notify_all();
+        }
+        else
+          _cv.wait(lock, [&]() { return gen != _generation || _aborted; });
+        return !_aborted;
+      }
+
+      void abort() {
+        std::lock_guard lock{_lock};
+        _aborted = true;
+        _cv.notify_all();
+      }
+
+    public:
+      barrier(size_t n) : _n{n} {}
+    };
+
+    struct instance {
+      fill_block_func fill_block;
+      block* memory;
+      uint32_t passes;
+      uint32_t lanes;
+      uint32_t lane_length;
+      uint32_t segment_length;
+      uint32_t memory_blocks;
+    };
+
+    // Section 3.4.1.3 and 3.4.2: maps J1 onto a block in the reference set
+    uint32_t index_alpha(const instance& inst, uint32_t pass, uint32_t slice, uint32_t index,
+                         uint32_t pseudo_rand, bool same_lane) {
+      uint32_t ref_area;
+      if (pass == 0) {
+        if (slice == 0)
+          ref_area = index - 1;
+        else if (same_lane)
+          ref_area = slice * inst.segment_length + index - 1;
+        else
+          ref_area = slice * inst.segment_length + (index == 0 ? -1 : 0);
+      }
+      else {
+        if (same_lane)
+          ref_area = inst.lane_length - inst.segment_length + index - 1;
+        else
+          ref_area = inst.lane_length - inst.segment_length + (index == 0 ? -1 : 0);
+      }
+
+      uint64_t rel = pseudo_rand;
+      rel = (rel * rel) >> 32;
+      rel = ref_area - 1 - ((ref_area * rel) >> 32);
+
+      uint32_t start = 0;
+      if (pass != 0)
+        start = slice == sync_points - 1 ? 0 : (slice + 1) * inst.segment_length;
+
+      return static_cast<uint32_t>((start + rel) % inst.lane_length);
+    }
+
+    void fill_segment(const instance& inst, uint32_t pass, uint32_t lane, uint32_t slice) {
+      // Argon2id is data independent for the first half of the first pass
+      bool data_independent = pass == 0 && slice < sync_points / 2;
+
+      block address_block, input_block, zero_block;
+      if (data_independent) {
+        std::memset(&zero_block, 0, sizeof(block));
+        std::memset(&input_block, 0, sizeof(block));
+        input_block.v[0] = pass;
+        input_block.v[1] = lane;
+        input_block.v[2] = slice;
+        input_block.v[3] = inst.memory_blocks;
+        input_block.v[4] = inst.passes;
+        input_block.v[5] = argon2id_type;
+      }
+      auto next_addresses = [&]() {
+        ++input_block.v[6];
+        inst.fill_block(zero_block, input_block, address_block, false);
+        inst.fill_block(zero_block, address_block, address_block, false);
+      };
+
+      uint32_t start_index = 0;
+      if (pass == 0 && slice == 0) {
+        // The first two blocks of each lane come straight from H0
+        start_index = 2;
+        if (data_independent)
+          next_addresses();
+      }
+
+      uint32_t curr_offset = lane * inst.lane_length + slice * inst.segment_length + start_index;
+      uint32_t prev_offset = curr_offset % inst.lane_length == 0 ? curr_offset + inst.lane_length - 1 : curr_offset - 1;
+
+      for (uint32_t i = start_index; i < inst.segment_length; ++i, ++curr_offset, ++prev_offset) {
+        if (curr_offset % inst.lane_length == 1)
+          prev_offset = curr_offset - 1;
+
+        uint64_t pseudo_rand;
+        if (data_independent) {
+          if (i % block_words == 0)
+            next_addresses();
+          pseudo_rand = address_block.v[i % block_words];
+        }
+        else
+          pseudo_rand = inst.memory[prev_offset].v[0];
+
+        uint32_t ref_lane = static_cast<uint32_t>((pseudo_rand >> 32) % inst.lanes);
+        if (pass == 0 && slice == 0)
+          ref_lane = lane;
+
+        uint32_t ref_index = index_alpha(inst, pass, slice, i, static_cast<uint32_t>(pseudo_rand), ref_lane == lane);
+
+        inst.fill_block(inst.memory[prev_offset], inst.memory[inst.lane_length * ref_lane + ref_index],
+                        inst.memory[curr_offset], pass != 0);
+      }
+    }
+
+    // Returns false if cancelled returned true at the start of a slice, leaving memory part filled
+    bool fill_memory(const instance& inst, uint32_t n_threads, const std::function<bool()>& cancelled) {
+      if (n_threads <= 1) {
+        for (uint32_t pass = 0; pass < inst.passes; ++pass)
+          for (uint32_t slice = 0; slice < sync_points; ++slice) {
+            if (cancelled && cancelled())
+              return false;
+            for (uint32_t lane = 0; lane < inst.lanes; ++lane)
+              fill_segment(inst, pass, lane, slice);
+          }
+        return true;
+      }
+
+      // Each thread keeps the same lanes throughout, and they meet up after every slice.
+      // Only the first checks cancelled, and aborting the barrier lets the rest go
+      barrier sync{n_threads};
+      bool stopped = false;
+      auto work = [&](uint32_t first_lane) {
+        for (uint32_t pass = 0; pass < inst.passes; ++pass)
+          for (uint32_t slice = 0; slice < sync_points; ++slice) {
+            if (first_lane == 0 && cancelled && cancelled()) {
+              stopped = true;
+              sync.abort();
+              return;
+            }
+            for (uint32_t lane = first_lane; lane < inst.lanes; lane += n_threads)
+              fill_segment(inst, pass, lane, slice);
+            if (!sync.wait())
+              return;
+          }
+      };
+
+      std::vector<std::thread> threads;
+      try {
+        threads.reserve(n_threads - 1);
+        for (uint32_t i = 1; i < n_threads; ++i)
+          threads.emplace_back(work, i);
+      }
+      catch (...) {
+        // The threads already running would wait forever for the ones that never started
+        sync.abort();
+        for (auto& i : threads)
+          i.join();
+        throw;
+      }
+      try {
+        work(0);
+      }
+      catch (...) {
+        sync.abort();
+        for (auto& i : threads)
+          i.join();
+        throw;
+      }
+      for (auto& i : threads)
+        i.join();
+      return !stopped;
+    }
+  }
+
+  void argon2id(nu::data_const_ref password, nu::data_const_ref salt, nu::data_ref output,
+                const argon2_params& params,
+                nu::data_const_ref secret, nu::data_const_ref associated) {
+    argon2id(password, salt, output, params, secret, associated, {});
+  }
+
+  bool argon2id(nu::data_const_ref password, nu::data_const_ref salt, nu::data_ref output,
+                const argon2_params& params,
+                nu::data_const_ref secret, nu::data_const_ref associated,
+                const std::function<bool()>& cancelled) {
+    if (params.lanes < 1 || params.lanes > 0xFFFFFF)
+      throw std::invalid_argument("Argon2 needs between 1 and 2^24-1 lanes");
+    if (params.memory < 8 * params.lanes)
+      throw std::invalid_argument("Argon2 needs at least 8KiB of memory per lane");
+    if (params.iterations < 1)
+      throw std::invalid_argument("Argon2 needs at least one iteration");
+    if (salt.size() < 8)
+      throw std::invalid_argument("Argon2 needs a salt of at least 8 bytes");
+    if (output.size() < 4)
+      throw std::range_error("Argon2 cannot output fewer than 4 bytes");
+
+    instance inst;
+    inst.fill_block = get_fill_block();
+    inst.passes = params.iterations;
+    inst.lanes = params.lanes;
+    inst.memory_blocks = params.memory / (sync_points * params.lanes) * (sync_points * params.lanes);
+    inst.lane_length = inst.memory_blocks / params.lanes;
+    inst.segment_length = inst.lane_length / sync_points;
+
+    // Section 3.2: H0
+    uint8_t h0[64 + 8];
+    {
+      blake2::blake2b h;
+      blake2b_update_le32(h, params.lanes);
+      blake2b_update_le32(h, static_cast<uint32_t>(output.size()));
+      blake2b_update_le32(h, params.memory);
+      blake2b_update_le32(h, params.iterations);
+      blake2b_update_le32(h, argon2_version);
+      blake2b_update_le32(h, argon2id_type);
+      blake2b_update_prefixed(h, password);
+      blake2b_update_prefixed(h, salt);
+      blake2b_update_prefixed(h, secret);
+      blake2b_update_prefixed(h, associated);
+      h.final(h0);
+    }
+
+    block_memory mem{inst.memory_blocks};
+    inst.memory = mem.blocks();
+
+    uint8_t block_buf[block_bytes];
+    for (uint32_t lane = 0; lane < inst.lanes; ++lane) {
+      store_le32(h0 + 68, lane);
+      for (uint32_t i = 0; i < 2; ++i) {
+        store_le32(h0 + 64, i);
+        hash_long(h0, sizeof(h0), block_buf, block_bytes);
+        block_from_bytes(inst.memory[lane * inst.lane_length + i], block_buf);
+      }
+    }
+    nuke(h0, sizeof(h0));
+
+    auto n_threads = params.threads == 0 ? inst.lanes : std::min(params.threads, inst.lanes);
+    if (!fill_memory(inst, n_threads, cancelled))
+      return false;
+
+    // XOR the last column together
+    block final_block = inst.memory[inst.lane_length - 1];
+    for (uint32_t lane = 1; lane < inst.lanes; ++lane) {
+      auto& last = inst.memory[lane * inst.lane_length + inst.lane_length - 1];
+      for (size_t i = 0; i < block_words; ++i)
+        final_block.v[i] ^= last.v[i];
+    }
+
+    block_to_bytes(block_buf, final_block);
+    hash_long(block_buf, block_bytes, output.data(), output.size());
+
+    nuke(block_buf, sizeof(block_buf));
+    nuke(reinterpret_cast<uint8_t*>(final_block.v), sizeof(final_block.v));
+    return true;
+  }
+
+  argon2_params argon2_calibrate(std::chrono::milliseconds target, uint32_t max_memory, uint32_t lanes) {
+    using clock = std::chrono::steady_clock;
+
+    argon2_params ret;
+    ret.lanes = std::max<uint32_t>(lanes, 1);
+    ret.iterations = 1;
+    ret.memory = std::max(max_memory, 8 * ret.lanes);
+
+    const uint8_t password[16] = {}, salt[16] = {};
+    uint8_t output[32];
+    auto time_one = [&]() {
+      auto start = clock::now();
+      argon2id(password, salt, output, ret);
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+    };
+
+    // Halve the memory until a single pass fits
+    auto taken = time_one();
+    while (taken > target && ret.memory / 2 >= 8 * ret.lanes) {
+      ret.memory /= 2;
+      taken = time_one();
+    }
+
+    // Then spend whatever's left on extra passes, which each cost about the same as the first
+    if (taken.count() > 0 && taken < target)
+      ret.iterations = static_cast<uint32_t>(std::max<int64_t>(1, target / taken));
+
+    return ret;
+  }
+}
@@ -0,0 +1,54 @@
+#include "c3/upsilon/async.hpp"
+
+namespace c3::upsilon {
+  worker_pool::worker_pool(size_t n_workers) {
+    n_workers = std::max<size_t>(n_workers, 1);
+    _workers.reserve(n_workers);
+    for (size_t i = 0; i < n_workers; ++i)
+      _workers.emplace_back([this]() { _work(); });
+  }
+
+  worker_pool::~worker_pool() {
+    {
+      std::lock_guard lock{_lock};
+      _stopping = true;
+    }
+    _not_empty.notify_all();
+
+    for (auto& i : _workers)
+      i.join();
+  }
+
+  void worker_pool::submit(std::function<void()> job) {
+    {
+      std::lock_guard lock{_lock};
+      if (_stopping)
+        throw std::logic_error("Cannot submit to a worker pool that is shutting down");
+      _queue.emplace_back(std::move(job));
+    }
+    _not_empty.notify_one();
+  }
+
+  void worker_pool::_work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock{_lock};
+        _not_empty.wait(lock, [&]() { return _stopping || !_queue.empty(); });
+
+        // Only leave once everything queued has been done
+        if (_queue.empty())
+          return;
+
+        job = std::move(_queue.front());
+        _queue.pop_front();
+      }
+      job();
+    }
+  }
+
+  worker_pool& worker_pool::shared() {
+    static worker_pool* ret = new worker_pool;
+    return *ret;
+  }
+}
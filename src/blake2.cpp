@@ -0,0 +1,375 @@
+#include "blake2.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef C3_UPSILON_BLAKE2_AVX2
+#include <immintrin.h>
+#endif
+
+#include "c3/upsilon/nuker.hpp"
+
+namespace c3::upsilon::blake2 {
+  static constexpr std::array<uint64_t, 8> blake2b_iv = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+  static constexpr uint8_t sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+  };
+
+  static constexpr std::array<uint32_t, 8> blake2s_iv = {
+    0x6a09e667UL, 0xbb67ae85UL, 0x3c6ef372UL, 0xa54ff53aUL, 0x510e527fUL, 0x9b05688cUL, 0x1f83d9abUL, 0x5be0cd19UL
+  };
+
+  static inline uint64_t rotr64(uint64_t x, unsigned n) { return (x >> n) | (x << (64 - n)); }
+  static inline uint32_t rotr32(uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+
+  static inline uint32_t load_le32(const uint8_t* b) {
+    return static_cast<uint32_t>(b[0]) | static_cast<uint32_t>(b[1]) << 8 |
+           static_cast<uint32_t>(b[2]) << 16 | static_cast<uint32_t>(b[3]) << 24;
+  }
+
+  static inline void store_le32(uint8_t* b, uint32_t x) {
+    for (int i = 0; i < 4; ++i, x >>= 8)
+      b[i] = static_cast<uint8_t>(x);
+  }
+
+  static inline uint64_t load_le64(const uint8_t* b) {
+    uint64_t ret = 0;
+    for (int i = 7; i >= 0; --i)
+      ret = (ret << 8) | b[i];
+    return ret;
+  }
+
+  static inline void store_le64(uint8_t* b, uint64_t x) {
+    for (int i = 0; i < 8; ++i, x >>= 8)
+      b[i] = static_cast<uint8_t>(x);
+  }
+
+  void blake2b::_compress(const uint8_t* block, bool last) {
+    uint64_t m[16];
+    for (size_t i = 0; i < 16; ++i)
+      m[i] = load_le64(block + i * 8);
+
+    uint64_t v[16];
+    std::copy(_h.begin(), _h.end(), v);
+    std::copy(blake2b_iv.begin(), blake2b_iv.end(), v + 8);
+    v[12] ^= _t[0];
+    v[13] ^= _t[1];
+    if (last)
+      v[14] = ~v[14];
+
+    auto g = [&](int a, int b, int c, int d, uint64_t x, uint64_t y) {
+      v[a] = v[a] + v[b] + x; v[d] = rotr64(v[d] ^ v[a], 32);
+      v[c] = v[c] + v[d];     v[b] = rotr64(v[b] ^ v[c], 24);
+      v[a] = v[a] + v[b] + y; v[d] = rotr64(v[d] ^ v[a], 16);
+      v[c] = v[c] + v[d];     v[b] = rotr64(v[b] ^ v[c], 63);
+    };
+
+    for (auto& s : sigma) {
+      g(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+      g(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+      g(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+      g(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+      g(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+      g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+      g(2, 7,  8, 13, m[s[12]], m[s[13]]);
+      g(3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+      _h[i] ^= v[i] ^ v[i + 8];
+
+    nuke(reinterpret_cast<uint8_t*>(m), sizeof(m));
+    nuke(reinterpret_cast<uint8_t*>(v), sizeof(v));
+  }
+
+  template<typename Word>
+  static inline void add_counter(std::array<Word, 2>& t, size_t n) {
+    t[0] += static_cast<Word>(n);
+    if (t[0] < n)
+      ++t[1];
+  }
+
+  void blake2b::update(const uint8_t* input, size_t len) {
+    // The last block has to go through with the final flag, so a full buffer waits for more input
+    while (len > 0) {
+      if (_buf_len == block_size) {
+        add_counter(_t, block_size);
+        _compress(_buf.data(), false);
+        _buf_len = 0;
+      }
+
+      size_t n = std::min(len, block_size - _buf_len);
+      std::copy(input, input + n, _buf.begin() + _buf_len);
+      _buf_len += n;
+      input += n;
+      len -= n;
+    }
+  }
+
+  void blake2b::absorb_buffered() {
+    if (_buf_len != block_size)
+      return;
+
+    add_counter(_t, block_size);
+    _compress(_buf.data(), false);
+    _buf_len = 0;
+  }
+
+  void blake2b::final(uint8_t* output) {
+    add_counter(_t, _buf_len);
+    std::fill(_buf.begin() + _buf_len, _buf.end(), 0);
+    _compress(_buf.data(), true);
+
+    uint8_t out[max_output];
+    for (size_t i = 0; i < 8; ++i)
+      store_le64(out + i * 8, _h[i]);
+    std::copy(out, out + _out_len, output);
+    nuke(out, sizeof(out));
+  }
+
+  blake2b::blake2b(size_t out_len, const uint8_t* key, size_t key_len) : _t{0, 0}, _buf_len{0}, _out_len{out_len} {
+    if (out_len == 0 || out_len > max_output)
+      throw std::range_error("BLAKE2b output must be between 1 and 64 bytes");
+    if (key_len > max_key)
+      throw std::range_error("BLAKE2b key must be at most 64 bytes");
+
+    _h = blake2b_iv;
+    _h[0] ^= 0x01010000ULL ^ (static_cast<uint64_t>(key_len) << 8) ^ out_len;
+
+    _buf.fill(0);
+    if (key_len > 0) {
+      std::copy(key, key + key_len, _buf.begin());
+      _buf_len = block_size;
+    }
+  }
+
+  blake2b::~blake2b() {
+    nuke(reinterpret_cast<uint8_t*>(_h.data()), sizeof(_h));
+    nuke(_buf.data(), _buf.size());
+  }
+#ifdef C3_UPSILON_BLAKE2_AVX2
+  // Lane i of every vector belongs to message i, so the rounds are the scalar ones, a vector at a time
+
+  __attribute__((target("avx2")))
+  static inline __m256i rotr64_x4(__m256i x, int n) {
+    const auto rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const auto rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    switch (n) {
+      case 32: return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+      case 24: return _mm256_shuffle_epi8(x, rot24);
+      case 16: return _mm256_shuffle_epi8(x, rot16);
+      // 63
+      default: return _mm256_xor_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x));
+    }
+  }
+
+  // Lambdas don't pick up the target attribute, hence a function
+  __attribute__((target("avx2")))
+  static inline void g_x4(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = _mm256_add_epi64(_mm256_add_epi64(v[a], v[b]), x); v[d] = rotr64_x4(_mm256_xor_si256(v[d], v[a]), 32);
+    v[c] = _mm256_add_epi64(v[c], v[d]);                      v[b] = rotr64_x4(_mm256_xor_si256(v[b], v[c]), 24);
+    v[a] = _mm256_add_epi64(_mm256_add_epi64(v[a], v[b]), y); v[d] = rotr64_x4(_mm256_xor_si256(v[d], v[a]), 16);
+    v[c] = _mm256_add_epi64(v[c], v[d]);                      v[b] = rotr64_x4(_mm256_xor_si256(v[b], v[c]), 63);
+  }
+
+  __attribute__((target("avx2")))
+  static void update_x4_avx2(std::array<uint64_t, 8>* const h[4],
+                             std::array<uint64_t, 2>* const t[4], const uint8_t* const inputs[4], size_t n_blocks) {
+    __m256i hv[8];
+    for (size_t i = 0; i < 8; ++i)
+      hv[i] = _mm256_setr_epi64x((*h[0])[i], (*h[1])[i], (*h[2])[i], (*h[3])[i]);
+
+    for (size_t n = 0; n < n_blocks; ++n) {
+      // Transposes four words from each message at a time into four vectors of one word each
+      __m256i m[16];
+      for (size_t g = 0; g < 4; ++g) {
+        auto r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inputs[0] + n * blake2b::block_size) + g);
+        auto r1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inputs[1] + n * blake2b::block_size) + g);
+        auto r2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inputs[2] + n * blake2b::block_size) + g);
+        auto r3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inputs[3] + n * blake2b::block_size) + g);
+        auto t0 = _mm256_unpacklo_epi64(r0, r1), t1 = _mm256_unpackhi_epi64(r0, r1);
+        auto t2 = _mm256_unpacklo_epi64(r2, r3), t3 = _mm256_unpackhi_epi64(r2, r3);
+        m[g * 4 + 0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+        m[g * 4 + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+        m[g * 4 + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+        m[g * 4 + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+      }
+
+      for (size_t i = 0; i < 4; ++i)
+        add_counter(*t[i], blake2b::block_size);
+
+      __m256i v[16];
+      std::copy(hv, hv + 8, v);
+      for (size_t i = 0; i < 8; ++i)
+        v[i + 8] = _mm256_set1_epi64x(static_cast<int64_t>(blake2b_iv[i]));
+      v[12] = _mm256_xor_si256(v[12], _mm256_setr_epi64x((*t[0])[0], (*t[1])[0], (*t[2])[0], (*t[3])[0]));
+      v[13] = _mm256_xor_si256(v[13], _mm256_setr_epi64x((*t[0])[1], (*t[1])[1], (*t[2])[1], (*t[3])[1]));
+
+      for (auto& s : sigma) {
+        g_x4(v, 0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+        g_x4(v, 1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+        g_x4(v, 2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+        g_x4(v, 3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+        g_x4(v, 0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+        g_x4(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g_x4(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+        g_x4(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+      }
+
+      for (size_t i = 0; i < 8; ++i)
+        hv[i] = _mm256_xor_si256(hv[i], _mm256_xor_si256(v[i], v[i + 8]));
+
+      nuke(reinterpret_cast<uint8_t*>(m), sizeof(m));
+      nuke(reinterpret_cast<uint8_t*>(v), sizeof(v));
+    }
+
+    alignas(32) uint64_t out[4];
+    for (size_t i = 0; i < 8; ++i) {
+      _mm256_store_si256(reinterpret_cast<__m256i*>(out), hv[i]);
+      for (size_t lane = 0; lane < 4; ++lane)
+        (*h[lane])[i] = out[lane];
+    }
+    nuke(reinterpret_cast<uint8_t*>(out), sizeof(out));
+    nuke(reinterpret_cast<uint8_t*>(hv), sizeof(hv));
+  }
+#endif
+
+  void blake2b::update_x4(blake2b* const states[4], const uint8_t* const inputs[4], size_t n_blocks, bool avx2) {
+    for (size_t i = 0; i < 4; ++i)
+      if (states[i]->_buf_len != 0)
+        throw std::logic_error("BLAKE2b lanes must start on a block boundary");
+
+#ifdef C3_UPSILON_BLAKE2_AVX2
+    if (avx2) {
+      std::array<uint64_t, 8>* h[4] = { &states[0]->_h, &states[1]->_h, &states[2]->_h, &states[3]->_h };
+      std::array<uint64_t, 2>* t[4] = { &states[0]->_t, &states[1]->_t, &states[2]->_t, &states[3]->_t };
+      update_x4_avx2(h, t, inputs, n_blocks);
+      return;
+    }
+#else
+    (void)avx2;
+#endif
+
+    for (size_t i = 0; i < 4; ++i) {
+      for (size_t n = 0; n < n_blocks; ++n) {
+        add_counter(states[i]->_t, block_size);
+        states[i]->_compress(inputs[i] + n * block_size, false);
+      }
+    }
+  }
+
+  void blake2s::_compress(const uint8_t* block, bool last) {
+    uint32_t m[16];
+    for (size_t i = 0; i < 16; ++i)
+      m[i] = load_le32(block + i * 4);
+
+    uint32_t v[16];
+    std::copy(_h.begin(), _h.end(), v);
+    std::copy(blake2s_iv.begin(), blake2s_iv.end(), v + 8);
+    v[12] ^= _t[0];
+    v[13] ^= _t[1];
+    if (last)
+      v[14] = ~v[14];
+
+    auto g = [&](int a, int b, int c, int d, uint32_t x, uint32_t y) {
+      v[a] = v[a] + v[b] + x; v[d] = rotr32(v[d] ^ v[a], 16);
+      v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 12);
+      v[a] = v[a] + v[b] + y; v[d] = rotr32(v[d] ^ v[a], 8);
+      v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 7);
+    };
+
+    // BLAKE2s has ten rounds, where BLAKE2b repeats the first two
+    for (size_t r = 0; r < 10; ++r) {
+      auto& s = sigma[r];
+      g(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+      g(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+      g(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+      g(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+      g(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+      g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+      g(2, 7,  8, 13, m[s[12]], m[s[13]]);
+      g(3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+      _h[i] ^= v[i] ^ v[i + 8];
+
+    nuke(reinterpret_cast<uint8_t*>(m), sizeof(m));
+    nuke(reinterpret_cast<uint8_t*>(v), sizeof(v));
+  }
+
+  void blake2s::update(const uint8_t* input, size_t len) {
+    while (len > 0) {
+      if (_buf_len == block_size) {
+        add_counter(_t, block_size);
+        _compress(_buf.data(), false);
+        _buf_len = 0;
+      }
+
+      size_t n = std::min(len, block_size - _buf_len);
+      std::copy(input, input + n, _buf.begin() + _buf_len);
+      _buf_len += n;
+      input += n;
+      len -= n;
+    }
+  }
+
+  void blake2s::absorb_buffered() {
+    if (_buf_len != block_size)
+      return;
+
+    add_counter(_t, block_size);
+    _compress(_buf.data(), false);
+    _buf_len = 0;
+  }
+
+  void blake2s::final(uint8_t* output) {
+    add_counter(_t, _buf_len);
+    std::fill(_buf.begin() + _buf_len, _buf.end(), 0);
+    _compress(_buf.data(), true);
+
+    uint8_t out[max_output];
+    for (size_t i = 0; i < 8; ++i)
+      store_le32(out + i * 4, _h[i]);
+    std::copy(out, out + _out_len, output);
+    nuke(out, sizeof(out));
+  }
+
+  blake2s::blake2s(size_t out_len, const uint8_t* key, size_t key_len) : _t{0, 0}, _buf_len{0}, _out_len{out_len} {
+    if (out_len == 0 || out_len > max_output)
+      throw std::range_error("BLAKE2s output must be between 1 and 32 bytes");
+    if (key_len > max_key)
+      throw std::range_error("BLAKE2s key must be at most 32 bytes");
+
+    _h = blake2s_iv;
+    _h[0] ^= 0x01010000UL ^ (static_cast<uint32_t>(key_len) << 8) ^ static_cast<uint32_t>(out_len);
+
+    _buf.fill(0);
+    if (key_len > 0) {
+      std::copy(key, key + key_len, _buf.begin());
+      _buf_len = block_size;
+    }
+  }
+
+  blake2s::~blake2s() {
+    nuke(reinterpret_cast<uint8_t*>(_h.data()), sizeof(_h));
+    nuke(_buf.data(), _buf.size());
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Whether blake2b::update_x4 has an AVX2 version
+#if defined(__x86_64__) || defined(__i386__)
+#define C3_UPSILON_BLAKE2_AVX2
+#endif
+
+namespace c3::upsilon::blake2 {
+  /// BLAKE2b from RFC 7693, kept here because Botan has no keyed mode
+  ///
+  /// Plain copyable state, so a keyed midstate can be copied instead of recomputed
+  class blake2b {
+  public:
+    static constexpr size_t block_size = 128;
+    static constexpr size_t max_output = 64;
+    static constexpr size_t max_key = 64;
+
+  private:
+    std::array<uint64_t, 8> _h;
+    std::array<uint64_t, 2> _t;
+    std::array<uint8_t, block_size> _buf;
+    size_t _buf_len;
+    size_t _out_len;
+
+  private:
+    void _compress(const uint8_t* block, bool last);
+
+  public:
+    void update(const uint8_t* input, size_t len);
+    /// Writes output_length() bytes, and leaves the state unusable
+    void final(uint8_t* output);
+
+    /// Compresses a full buffered block (i.e. the key) early, so copies of this state skip it
+    ///
+    /// Only valid if more input will follow before final
+    void absorb_buffered();
+
+    inline size_t output_length() const noexcept { return _out_len; }
+    inline bool buffer_empty() const noexcept { return _buf_len == 0; }
+
+    /// Runs n_blocks whole blocks from each input through the matching state, four messages at once
+    ///
+    /// Each state's buffer must be empty, and each must get more input afterwards,
+    /// as none of these blocks can be the final one. With avx2, the four states share
+    /// vectors a lane each, which the caller must have checked the CPU can do
+    static void update_x4(blake2b* const states[4], const uint8_t* const inputs[4], size_t n_blocks, bool avx2);
+
+  public:
+    blake2b(size_t out_len = max_output, const uint8_t* key = nullptr, size_t key_len = 0);
+    ~blake2b();
+  };
+
+  /// BLAKE2s from RFC 7693, for 32-bit and small-message use
+  ///
+  /// Works just as blake2b does
+  class blake2s {
+  public:
+    static constexpr size_t block_size = 64;
+    static constexpr size_t max_output = 32;
+    static constexpr size_t max_key = 32;
+
+  private:
+    std::array<uint32_t, 8> _h;
+    std::array<uint32_t, 2> _t;
+    std::array<uint8_t, block_size> _buf;
+    size_t _buf_len;
+    size_t _out_len;
+
+  private:
+    void _compress(const uint8_t* block, bool last);
+
+  public:
+    void update(const uint8_t* input, size_t len);
+    /// Writes output_length() bytes, and leaves the state unusable
+    void final(uint8_t* output);
+
+    /// Compresses a full buffered block (i.e. the key) early, so copies of this state skip it
+    ///
+    /// Only valid if more input will follow before final
+    void absorb_buffered();
+
+    inline size_t output_length() const noexcept { return _out_len; }
+
+  public:
+    blake2s(size_t out_len = max_output, const uint8_t* key = nullptr, size_t key_len = 0);
+    ~blake2s();
+  };
+}
@@ -0,0 +1,392 @@
+#include "c3/upsilon/cpu.hpp"
+#include "c3/upsilon/agreement.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/identity.hpp"
+#include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/mac.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+#include "dispatch.hpp"
+
+#include <botan/cpuid.h>
+#include <botan/pk_algs.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace c3::upsilon {
+  namespace {
+    constexpr std::pair<cpu_feature, const char*> feature_names[] = {
+      { cpu_feature::sse2, "sse2" },
+      { cpu_feature::ssse3, "ssse3" },
+      { cpu_feature::sse4_1, "sse4_1" },
+      { cpu_feature::avx2, "avx2" },
+      { cpu_feature::avx512f, "avx512f" },
+      { cpu_feature::bmi2, "bmi2" },
+      { cpu_feature::aes_ni, "aes_ni" },
+      { cpu_feature::clmul, "clmul" },
+      { cpu_feature::sha_ni, "sha_ni" },
+      { cpu_feature::neon, "neon" },
+      { cpu_feature::arm_aes, "arm_aes" },
+      { cpu_feature::arm_pmull, "arm_pmull" },
+      { cpu_feature::arm_sha2, "arm_sha2" },
+    };
+
+    // What Botan::CPUID::bit_from_string calls the same thing
+    const char* botan_feature_name(cpu_feature f) {
+      switch (f) {
+        case cpu_feature::sse2: return "sse2";
+        case cpu_feature::ssse3: return "ssse3";
+        case cpu_feature::sse4_1: return "sse41";
+        case cpu_feature::avx2: return "avx2";
+        case cpu_feature::avx512f: return "avx512f";
+        case cpu_feature::bmi2: return "bmi2";
+        case cpu_feature::aes_ni: return "aesni";
+        case cpu_feature::clmul: return "clmul";
+        case cpu_feature::sha_ni: return "intel_sha";
+        case cpu_feature::neon: return "neon";
+        case cpu_feature::arm_aes: return "armv8aes";
+        case cpu_feature::arm_pmull: return "armv8pmull";
+        case cpu_feature::arm_sha2: return "armv8sha2";
+      }
+      return "";
+    }
+
+    constexpr std::pair<algorithm_family, const char*> family_names[] = {
+      { algorithm_family::hash, "hash" },
+      { algorithm_family::symmetric, "symmetric" },
+      { algorithm_family::kdf, "kdf" },
+      { algorithm_family::signature, "signature" },
+      { algorithm_family::agreement, "agreement" },
+      { algorithm_family::mac, "mac" },
+      { algorithm_family::utility, "utility" },
+    };
+
+    // Botan's name for each public key algorithm, to ask it which providers it has
+    struct botan_pk_name {
+      algorithm_family family;
+      uint16_t alg;
+      const char* name;
+    };
+    constexpr botan_pk_name botan_pk_names[] = {
+      { algorithm_family::signature, static_cast<uint16_t>(signature_algorithm::Curve25519), "Ed25519" },
+      { algorithm_family::agreement, static_cast<uint16_t>(agreement_algorithm::Curve25519), "Curve25519" },
+    };
+
+    std::vector<std::string> split(const char* s, char sep) {
+      std::vector<std::string> ret;
+      if (!s)
+        return ret;
+      std::stringstream ss{s};
+      std::string item;
+      while (std::getline(ss, item, sep))
+        if (!item.empty())
+          ret.push_back(item);
+      return ret;
+    }
+
+    cpu_features detect() {
+      cpu_features ret;
+#if defined(__x86_64__) || defined(__i386__)
+      unsigned a, b, c, d;
+      if (!__get_cpuid(1, &a, &b, &c, &d))
+        return ret;
+      ret.set(cpu_feature::sse2, d & bit_SSE2);
+      ret.set(cpu_feature::ssse3, c & bit_SSSE3);
+      ret.set(cpu_feature::sse4_1, c & bit_SSE4_1);
+      ret.set(cpu_feature::aes_ni, c & bit_AES);
+      ret.set(cpu_feature::clmul, c & bit_PCLMUL);
+
+      // The OS has to save the wider registers too, or the instructions are no use
+      uint64_t xcr0 = 0;
+      if (c & bit_OSXSAVE) {
+        uint32_t lo, hi;
+        __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        xcr0 = (uint64_t{hi} << 32) | lo;
+      }
+      bool ymm = (xcr0 & 0x06) == 0x06;
+      bool zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+
+      if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        ret.set(cpu_feature::avx2, ymm && (b & bit_AVX2));
+        ret.set(cpu_feature::avx512f, zmm && (b & bit_AVX512F));
+        ret.set(cpu_feature::bmi2, b & bit_BMI2);
+        ret.set(cpu_feature::sha_ni, b & bit_SHA);
+      }
+#elif defined(__aarch64__) && defined(__linux__)
+      auto hwcap = getauxval(AT_HWCAP);
+      ret.set(cpu_feature::neon, hwcap & HWCAP_ASIMD);
+      ret.set(cpu_feature::arm_aes, hwcap & HWCAP_AES);
+      ret.set(cpu_feature::arm_pmull, hwcap & HWCAP_PMULL);
+      ret.set(cpu_feature::arm_sha2, hwcap & HWCAP_SHA2);
+#endif
+      return ret;
+    }
+
+    std::string detect_model() {
+#if defined(__x86_64__) || defined(__i386__)
+      unsigned regs[12];
+      if (__get_cpuid(0x80000004, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        for (unsigned i = 0; i < 3; ++i)
+          __get_cpuid(0x80000002 + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+        char brand[sizeof(regs) + 1] = {};
+        std::memcpy(brand, regs, sizeof(regs));
+        std::string ret = brand;
+        ret.erase(0, ret.find_first_not_of(' '));
+        if (!ret.empty())
+          return ret;
+      }
+#endif
+      // Elsewhere, Linux is the only easy source
+      std::ifstream cpuinfo{"/proc/cpuinfo"};
+      std::string ret, line;
+      // Only the first core's block, which ends at a blank line
+      while (std::getline(cpuinfo, line) && !line.empty()) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos || colon == 0)
+          continue;
+        auto key = line.substr(0, line.find_last_not_of(" \t", colon - 1) + 1);
+        auto value = line.substr(std::min(colon + 2, line.size()));
+        if (key == "model name")
+          return value;
+        if (key == "CPU implementer" || key == "CPU variant" || key == "CPU part" || key == "CPU revision")
+          ret += (ret.empty() ? "" : " ") + value;
+      }
+      return ret.empty() ? "unknown" : ret;
+    }
+
+    cpu_features apply_disabled(cpu_features features) {
+      for (auto& name : split(std::getenv("C3_UPSILON_DISABLE_CPU"), ',')) {
+        for (auto& [f, f_name] : feature_names) {
+          if (name != f_name)
+            continue;
+          features.set(f, false);
+          // Botan looks at its own flags on each call, so this takes effect even if it has been used already
+          for (auto bit : Botan::CPUID::bit_from_string(botan_feature_name(f)))
+            Botan::CPUID::clear_cpuid_bit(bit);
+        }
+      }
+      return features;
+    }
+
+    uint32_t backend_key(algorithm_family family, uint16_t alg) {
+      return (static_cast<uint32_t>(family) + 1) << 16 | alg;
+    }
+
+    struct forced_table {
+      std::map<uint32_t, std::string> by_alg;
+      std::map<algorithm_family, std::string> by_family;
+      std::string none;
+    };
+
+    const forced_table& forced() {
+      static const forced_table ret = []() {
+        forced_table ret;
+        for (auto& item : split(std::getenv("C3_UPSILON_BACKEND"), ',')) {
+          auto eq = item.find('=');
+          if (eq == std::string::npos)
+            continue;
+          auto key = item.substr(0, eq);
+          auto value = item.substr(eq + 1);
+
+          auto slash = key.find('/');
+          auto family_name = key.substr(0, slash);
+          for (auto& [f, f_name] : family_names) {
+            if (family_name != f_name)
+              continue;
+            if (slash == std::string::npos) {
+              ret.by_family[f] = value;
+              continue;
+            }
+            // Anything that isn't a whole number that fits an algorithm is skipped, like an unknown family
+            auto alg_name = key.substr(slash + 1);
+            char* end = nullptr;
+            errno = 0;
+            auto alg = std::strtoul(alg_name.c_str(), &end, 0);
+            if (alg_name.empty() || *end || errno || alg > 0xFFFF)
+              continue;
+            ret.by_alg[backend_key(f, static_cast<uint16_t>(alg))] = value;
+          }
+        }
+        return ret;
+      }();
+      return ret;
+    }
+
+    struct recorded_table {
+      // Lets repeat recordings of the same algorithm skip the lock
+      std::array<std::atomic<uint32_t>, 256> seen = {};
+      std::mutex lock;
+      std::map<uint32_t, std::string> backends;
+    };
+
+    recorded_table& recorded() {
+      static recorded_table ret;
+      return ret;
+    }
+
+    // Makes sure C3_UPSILON_DISABLE_CPU reaches Botan before anything else runs
+    [[maybe_unused]] const bool cpu_features_applied = (enabled_cpu_features(), true);
+  }
+
+  std::string cpu_features::to_string() const {
+    std::string ret;
+    for (auto& [f, name] : feature_names) {
+      if (!has(f))
+        continue;
+      if (!ret.empty())
+        ret += ' ';
+      ret += name;
+    }
+    return ret;
+  }
+
+  const char* cpu_feature_name(cpu_feature f) noexcept {
+    for (auto& [i, name] : feature_names)
+      if (i == f)
+        return name;
+    return "unknown";
+  }
+
+  const char* algorithm_family_name(algorithm_family f) noexcept {
+    for (auto& [i, name] : family_names)
+      if (i == f)
+        return name;
+    return "unknown";
+  }
+
+  const std::string& cpu_model_name() {
+    static const std::string ret = detect_model();
+    return ret;
+  }
+
+  const cpu_features& detected_cpu_features() noexcept {
+    static const cpu_features ret = detect();
+    return ret;
+  }
+
+  const cpu_features& enabled_cpu_features() noexcept {
+    static const cpu_features ret = apply_disabled(detected_cpu_features());
+    return ret;
+  }
+
+  const std::string& forced_backend(algorithm_family family, uint16_t alg) {
+    auto& f = forced();
+    if (auto iter = f.by_alg.find(backend_key(family, alg)); iter != f.by_alg.end())
+      return iter->second;
+    if (auto iter = f.by_family.find(family); iter != f.by_family.end())
+      return iter->second;
+    return f.none;
+  }
+
+  bool forced_for_family(algorithm_family family, uint16_t alg) {
+    auto& f = forced();
+    return !f.by_alg.count(backend_key(family, alg)) && f.by_family.count(family);
+  }
+
+  void record_backend(algorithm_family family, uint16_t alg, const std::string& backend) {
+    auto& r = recorded();
+    auto key = backend_key(family, alg);
+    auto& seen = r.seen[(key * 2654435761u) >> 24];
+    if (seen.load(std::memory_order_acquire) == key)
+      return;
+
+    std::lock_guard lock{r.lock};
+    r.backends[key] = backend;
+    uint32_t expected = 0;
+    seen.compare_exchange_strong(expected, key, std::memory_order_release);
+  }
+
+  const char* choose_backend(algorithm_family family, uint16_t alg,
+                             std::initializer_list<backend_candidate> candidates) {
+    auto& forced = forced_backend(family, alg);
+    const char* ret = nullptr;
+    for (auto& i : candidates) {
+      if (!forced.empty() && forced == i.name) {
+        ret = i.name;
+        break;
+      }
+    }
+    if (!ret && (forced.empty() || forced_for_family(family, alg))) {
+      for (auto& i : candidates) {
+        if (enabled_cpu_features().has(i.needs)) {
+          ret = i.name;
+          break;
+        }
+      }
+    }
+    if (!ret)
+      throw std::invalid_argument("No usable " + std::string{algorithm_family_name(family)} + " backend" +
+                                  (forced.empty() ? "" : " called " + forced));
+
+    record_backend(family, alg, ret);
+    return ret;
+  }
+
+  const std::string& botan_pk_provider(algorithm_family family, uint16_t alg) {
+    static const std::string base;
+    auto& ret = forced_backend(family, alg);
+    if (!ret.empty()) {
+      const char* name = nullptr;
+      for (auto& i : botan_pk_names)
+        if (i.family == family && i.alg == alg)
+          name = i.name;
+      if (name && Botan::probe_provider_private_key(name, { ret }).empty()) {
+        if (!forced_for_family(family, alg))
+          throw std::invalid_argument("Botan has no " + ret + " provider for " + name);
+        record_backend(family, alg, "base");
+        return base;
+      }
+    }
+    record_backend(family, alg, ret.empty() ? "base" : ret);
+    return ret;
+  }
+
+  std::vector<backend_info> active_backends() {
+    // Build one of everything, so that each gets to pick
+    _hash_funcs.for_each([](hash_algorithm, const hash_function* f) { f->begin_hash(); });
+    _symmetric_functions.for_each([](symmetric_algorithm alg, auto make) {
+      auto props = get_symmetric_properties(alg);
+      make(nu::data(props.key_size), nu::data(props.iv_size));
+    });
+    _kdfs.for_each([](kdf_algorithm, const kdf* k) { k->begin_expand(); });
+    _verifiers.for_each([](signature_algorithm alg, auto) {
+      botan_pk_provider(algorithm_family::signature, static_cast<uint16_t>(alg));
+    });
+    _agreement_functions.for_each([](agreement_algorithm alg, auto) {
+      botan_pk_provider(algorithm_family::agreement, static_cast<uint16_t>(alg));
+    });
+    _mac_functions.for_each([](mac_algorithm, const mac_function* f) {
+      f->make_key(nu::data(std::clamp<size_t>(32, f->properties()->min_key, f->properties()->max_key)));
+    });
+
+    auto& r = recorded();
+    std::lock_guard lock{r.lock};
+    std::vector<backend_info> ret;
+    for (auto& [key, backend] : r.backends)
+      ret.push_back({ static_cast<algorithm_family>((key >> 16) - 1), static_cast<uint16_t>(key), backend });
+    return ret;
+  }
+
+  std::string active_backend(algorithm_family family, uint16_t alg) {
+    auto& r = recorded();
+    std::lock_guard lock{r.lock};
+    auto iter = r.backends.find(backend_key(family, alg));
+    return iter == r.backends.end() ? std::string{} : iter->second;
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "c3/upsilon/cpu.hpp"
+
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace c3::upsilon {
+  /// The backend C3_UPSILON_BACKEND forces on this algorithm, or an empty string
+  const std::string& forced_backend(algorithm_family family, uint16_t alg);
+  /// Whether forced_backend comes from an override for the whole family, which algorithms
+  /// without a backend of that name ignore. One naming the algorithm is an error if it has none
+  bool forced_for_family(algorithm_family family, uint16_t alg);
+
+  /// Notes what an algorithm ended up running on, for active_backends
+  ///
+  /// Cheap after the first call for each algorithm
+  void record_backend(algorithm_family family, uint16_t alg, const std::string& backend);
+
+  struct backend_candidate {
+    const char* name;
+    cpu_features needs;
+  };
+
+  /// Picks the first candidate whose features are all enabled, unless C3_UPSILON_BACKEND names one.
+  /// Throws std::invalid_argument if it names one there isn't, and not just for the whole family
+  const char* choose_backend(algorithm_family family, uint16_t alg,
+                             std::initializer_list<backend_candidate> candidates);
+
+  /// The provider to give Botan's public key operations, which is empty unless one is forced
+  ///
+  /// Their only choice is between providers, and "base" is the default one.
+  /// A forced provider Botan doesn't have is handled as in choose_backend
+  const std::string& botan_pk_provider(algorithm_family family, uint16_t alg);
+
+  /// Makes a Botan HashFunction, StreamCipher or MessageAuthenticationCode on the forced provider,
+  /// or on whichever Botan prefers. A forced provider Botan doesn't have is handled as in choose_backend
+  template<typename T>
+  std::unique_ptr<T> create_botan(algorithm_family family, uint16_t alg, const std::string& botan_name) {
+    auto& forced = forced_backend(family, alg);
+    auto ret = T::create(botan_name, forced);
+    if (!ret && !forced.empty() && forced_for_family(family, alg))
+      ret = T::create(botan_name);
+    if (!ret)
+      throw std::invalid_argument("Botan has no " + forced + " provider for " + botan_name);
+    record_backend(family, alg, ret->provider());
+    return ret;
+  }
+}
@@ -0,0 +1,478 @@
+#include "ed25519.hpp"
+
+#include "c3/upsilon/csprng.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "instrument.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace c3::upsilon::ed25519 {
+  using u128 = unsigned __int128;
+
+  static constexpr uint64_t mask51 = (uint64_t{1} << 51) - 1;
+
+  static inline uint64_t load_le64(const uint8_t* b) {
+    uint64_t ret = 0;
+    for (int i = 7; i >= 0; --i)
+      ret = (ret << 8) | b[i];
+    return ret;
+  }
+
+  static inline void store_le64(uint8_t* b, uint64_t x) {
+    for (int i = 0; i < 8; ++i, x >>= 8)
+      b[i] = static_cast<uint8_t>(x);
+  }
+
+  // GF(2^255 - 19) on 51-bit limbs, which are kept under 2^52 between operations
+  struct fe {
+    std::array<uint64_t, 5> v;
+  };
+
+  static constexpr fe fe_zero = {{ 0, 0, 0, 0, 0 }};
+  static constexpr fe fe_one = {{ 1, 0, 0, 0, 0 }};
+  static constexpr fe fe_d = {{ 0x34dca135978a3, 0x1a8283b156ebd, 0x5e7a26001c029, 0x739c663a03cbb, 0x52036cee2b6ff }};
+  static constexpr fe fe_d2 = {{ 0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff }};
+  static constexpr fe fe_sqrtm1 = {{ 0x61b274a0ea0b0, 0x0d5a5fc8f189d, 0x7ef5e9cbd0c60, 0x78595a6804c9e, 0x2b8324804fc1d }};
+
+  static inline fe fe_carry(fe a) {
+    uint64_t c;
+    c = a.v[0] >> 51; a.v[0] &= mask51; a.v[1] += c;
+    c = a.v[1] >> 51; a.v[1] &= mask51; a.v[2] += c;
+    c = a.v[2] >> 51; a.v[2] &= mask51; a.v[3] += c;
+    c = a.v[3] >> 51; a.v[3] &= mask51; a.v[4] += c;
+    c = a.v[4] >> 51; a.v[4] &= mask51; a.v[0] += c * 19;
+    return a;
+  }
+
+  static inline fe fe_add(const fe& a, const fe& b) {
+    fe ret;
+    for (int i = 0; i < 5; ++i)
+      ret.v[i] = a.v[i] + b.v[i];
+    return fe_carry(ret);
+  }
+
+  // a + 4p - b, so that nothing goes negative
+  static inline fe fe_sub(const fe& a, const fe& b) {
+    fe ret;
+    ret.v[0] = a.v[0] + 0x1fffffffffffb4 - b.v[0];
+    for (int i = 1; i < 5; ++i)
+      ret.v[i] = a.v[i] + 0x1ffffffffffffc - b.v[i];
+    return fe_carry(ret);
+  }
+
+  static inline fe fe_neg(const fe& a) {
+    return fe_sub(fe_zero, a);
+  }
+
+  static inline fe fe_reduce_wide(u128 r0, u128 r1, u128 r2, u128 r3, u128 r4) {
+    fe ret;
+    r1 += static_cast<uint64_t>(r0 >> 51); ret.v[0] = static_cast<uint64_t>(r0) & mask51;
+    r2 += static_cast<uint64_t>(r1 >> 51); ret.v[1] = static_cast<uint64_t>(r1) & mask51;
+    r3 += static_cast<uint64_t>(r2 >> 51); ret.v[2] = static_cast<uint64_t>(r2) & mask51;
+    r4 += static_cast<uint64_t>(r3 >> 51); ret.v[3] = static_cast<uint64_t>(r3) & mask51;
+    u128 c = (r4 >> 51) * 19 + ret.v[0];
+    ret.v[4] = static_cast<uint64_t>(r4) & mask51;
+    ret.v[0] = static_cast<uint64_t>(c) & mask51;
+    ret.v[1] += static_cast<uint64_t>(c >> 51);
+    return ret;
+  }
+
+  static inline fe fe_mul(const fe& a, const fe& b) {
+    const uint64_t a0 = a.v[0], a1 = a.v[1], a2 = a.v[2], a3 = a.v[3], a4 = a.v[4];
+    const uint64_t b0 = b.v[0], b1 = b.v[1], b2 = b.v[2], b3 = b.v[3], b4 = b.v[4];
+    const uint64_t b1_19 = b1 * 19, b2_19 = b2 * 19, b3_19 = b3 * 19, b4_19 = b4 * 19;
+
+    return fe_reduce_wide(
+      u128{a0} * b0 + u128{a1} * b4_19 + u128{a2} * b3_19 + u128{a3} * b2_19 + u128{a4} * b1_19,
+      u128{a0} * b1 + u128{a1} * b0 + u128{a2} * b4_19 + u128{a3} * b3_19 + u128{a4} * b2_19,
+      u128{a0} * b2 + u128{a1} * b1 + u128{a2} * b0 + u128{a3} * b4_19 + u128{a4} * b3_19,
+      u128{a0} * b3 + u128{a1} * b2 + u128{a2} * b1 + u128{a3} * b0 + u128{a4} * b4_19,
+      u128{a0} * b4 + u128{a1} * b3 + u128{a2} * b2 + u128{a3} * b1 + u128{a4} * b0);
+  }
+
+  static inline fe fe_sq(const fe& a) {
+    const uint64_t a0 = a.v[0], a1 = a.v[1], a2 = a.v[2], a3 = a.v[3], a4 = a.v[4];
+    const uint64_t d0 = a0 * 2, d1 = a1 * 2, d2 = a2 * 2;
+    const uint64_t a3_19 = a3 * 19, a4_19 = a4 * 19;
+
+    return fe_reduce_wide(
+      u128{a0} * a0 + u128{d1} * a4_19 + u128{d2} * a3_19,
+      u128{d0} * a1 + u128{d2} * a4_19 + u128{a3} * a3_19,
+      u128{d0} * a2 + u128{a1} * a1 + u128{a3 * 2} * a4_19,
+      u128{d0} * a3 + u128{d1} * a2 + u128{a4} * a4_19,
+      u128{d0} * a4 + u128{d1} * a3 + u128{a2} * a2);
+  }
+
+  static inline fe fe_sq_n(fe a, int n) {
+    for (int i = 0; i < n; ++i)
+      a = fe_sq(a);
+    return a;
+  }
+
+  // a^((p - 5) / 8), i.e. a^(2^252 - 3), by the addition chain from ref10
+  static inline fe fe_pow_p58(const fe& a) {
+    fe a2 = fe_sq(a);
+    fe a9 = fe_mul(fe_sq_n(a2, 2), a);
+    fe a11 = fe_mul(a9, a2);
+    fe t_5 = fe_mul(fe_sq(a11), a9);
+    fe t_10 = fe_mul(fe_sq_n(t_5, 5), t_5);
+    fe t_20 = fe_mul(fe_sq_n(t_10, 10), t_10);
+    fe t_40 = fe_mul(fe_sq_n(t_20, 20), t_20);
+    fe t_50 = fe_mul(fe_sq_n(t_40, 10), t_10);
+    fe t_100 = fe_mul(fe_sq_n(t_50, 50), t_50);
+    fe t_200 = fe_mul(fe_sq_n(t_100, 100), t_100);
+    fe t_250 = fe_mul(fe_sq_n(t_200, 50), t_50);
+    return fe_mul(fe_sq_n(t_250, 2), a);
+  }
+
+  static fe fe_from_bytes(const uint8_t* b) {
+    uint64_t w0 = load_le64(b), w1 = load_le64(b + 8), w2 = load_le64(b + 16), w3 = load_le64(b + 24);
+    return {{
+      w0 & mask51,
+      ((w0 >> 51) | (w1 << 13)) & mask51,
+      ((w1 >> 38) | (w2 << 26)) & mask51,
+      ((w2 >> 25) | (w3 << 39)) & mask51,
+      (w3 >> 12) & mask51,
+    }};
+  }
+
+  // Fully reduced, as in curve25519-donna
+  static void fe_to_bytes(const fe& a, uint8_t* b) {
+    fe t = fe_carry(fe_carry(a));
+
+    // Now in [0, 2^255 + 19); adding 19 carries out of the top exactly when t >= p
+    t.v[0] += 19;
+    t = fe_carry(t);
+    t.v[0] += (uint64_t{1} << 51) - 19;
+    for (int i = 1; i < 5; ++i)
+      t.v[i] += (uint64_t{1} << 51) - 1;
+    uint64_t c;
+    c = t.v[0] >> 51; t.v[0] &= mask51; t.v[1] += c;
+    c = t.v[1] >> 51; t.v[1] &= mask51; t.v[2] += c;
+    c = t.v[2] >> 51; t.v[2] &= mask51; t.v[3] += c;
+    c = t.v[3] >> 51; t.v[3] &= mask51; t.v[4] += c;
+    t.v[4] &= mask51;
+
+    store_le64(b, t.v[0] | (t.v[1] << 51));
+    store_le64(b + 8, (t.v[1] >> 13) | (t.v[2] << 38));
+    store_le64(b + 16, (t.v[2] >> 26) | (t.v[3] << 25));
+    store_le64(b + 24, (t.v[3] >> 39) | (t.v[4] << 12));
+  }
+
+  static inline bool fe_is_zero(const fe& a) {
+    std::array<uint8_t, 32> b;
+    fe_to_bytes(a, b.data());
+    return std::all_of(b.begin(), b.end(), [](uint8_t x) { return x == 0; });
+  }
+
+  static inline bool fe_eq(const fe& a, const fe& b) {
+    return fe_is_zero(fe_sub(a, b));
+  }
+
+  static inline bool fe_is_negative(const fe& a) {
+    std::array<uint8_t, 32> b;
+    fe_to_bytes(a, b.data());
+    return b[0] & 1;
+  }
+
+  // Extended twisted Edwards coordinates, x = X/Z, y = Y/Z, xy = T/Z, on -x^2 + y^2 = 1 + dx^2y^2
+  struct ge {
+    fe X, Y, Z, T;
+  };
+
+  static constexpr ge ge_identity = { fe_zero, fe_one, fe_one, fe_zero };
+  static constexpr ge ge_base = {
+    {{ 0x62d608f25d51a, 0x412a4b4f6592a, 0x75b7171a4b31d, 0x1ff60527118fe, 0x216936d3cd6e5 }},
+    {{ 0x6666666666658, 0x4cccccccccccc, 0x1999999999999, 0x3333333333333, 0x6666666666666 }},
+    fe_one,
+    {{ 0x68ab3a5b7dda3, 0x00eea2a5eadbb, 0x2af8df483c27e, 0x332b375274732, 0x67875f0fd78b7 }},
+  };
+
+  // add-2008-hwcd-3, which is complete on this curve, so doubling and the identity need no cases
+  static inline ge ge_add(const ge& p, const ge& q) {
+    fe a = fe_mul(fe_sub(p.Y, p.X), fe_sub(q.Y, q.X));
+    fe b = fe_mul(fe_add(p.Y, p.X), fe_add(q.Y, q.X));
+    fe c = fe_mul(fe_mul(p.T, fe_d2), q.T);
+    fe d = fe_mul(p.Z, fe_add(q.Z, q.Z));
+    fe e = fe_sub(b, a), f = fe_sub(d, c), g = fe_add(d, c), h = fe_add(b, a);
+    return { fe_mul(e, f), fe_mul(g, h), fe_mul(f, g), fe_mul(e, h) };
+  }
+
+  // dbl-2008-hwcd with a = -1
+  static inline ge ge_dbl(const ge& p) {
+    fe a = fe_sq(p.X);
+    fe b = fe_sq(p.Y);
+    fe c = fe_sq(p.Z);
+    c = fe_add(c, c);
+    fe d = fe_neg(a);
+    fe e = fe_sub(fe_sub(fe_sq(fe_add(p.X, p.Y)), a), b);
+    fe g = fe_add(d, b), f = fe_sub(g, c), h = fe_sub(d, b);
+    return { fe_mul(e, f), fe_mul(g, h), fe_mul(f, g), fe_mul(e, h) };
+  }
+
+  static inline ge ge_neg(const ge& p) {
+    return { fe_neg(p.X), p.Y, p.Z, fe_neg(p.T) };
+  }
+
+  static inline bool ge_is_identity(const ge& p) {
+    return fe_is_zero(p.X) && fe_eq(p.Y, p.Z);
+  }
+
+  // RFC 8032 5.1.3, but refusing encodings of y that aren't reduced, which Botan's own
+  // comparison of R never accepts either
+  static bool ge_decompress(const uint8_t* b, ge& out) {
+    fe y = fe_from_bytes(b);
+    std::array<uint8_t, 32> check;
+    fe_to_bytes(y, check.data());
+    check[31] |= b[31] & 0x80;
+    if (!std::equal(check.begin(), check.end(), b))
+      return false;
+
+    fe y2 = fe_sq(y);
+    fe u = fe_sub(y2, fe_one);
+    fe v = fe_add(fe_mul(y2, fe_d), fe_one);
+    fe v3 = fe_mul(fe_sq(v), v);
+    fe x = fe_mul(fe_mul(u, v3), fe_pow_p58(fe_mul(u, fe_mul(fe_sq(v3), v))));
+
+    fe vx2 = fe_mul(v, fe_sq(x));
+    if (!fe_eq(vx2, u)) {
+      if (!fe_eq(vx2, fe_neg(u)))
+        return false;
+      x = fe_mul(x, fe_sqrtm1);
+    }
+
+    bool sign = b[31] >> 7;
+    if (sign && fe_is_zero(x))
+      return false;
+    if (fe_is_negative(x) != sign)
+      x = fe_neg(x);
+
+    out = { x, y, fe_one, fe_mul(x, y) };
+    return true;
+  }
+
+  // Scalars as little-endian 64-bit limbs. Sums of products are only reduced mod L once,
+  // when a batch is checked, so they get room for 2^64 entries
+  using scalar = std::array<uint64_t, 4>;
+  using wide_scalar = std::array<uint64_t, 12>;
+
+  static constexpr scalar order = { 0x5812631a5cf5d3ed, 0x14def9dea2f79cd6, 0, 0x1000000000000000 };
+
+  static inline bool scalar_less(const scalar& a, const scalar& b) {
+    for (int i = 3; i >= 0; --i)
+      if (a[i] != b[i])
+        return a[i] < b[i];
+    return false;
+  }
+
+  // acc += a * b
+  template<size_t N>
+  static inline void scalar_mac(wide_scalar& acc, const std::array<uint64_t, 2>& a, const std::array<uint64_t, N>& b) {
+    for (size_t i = 0; i < 2; ++i) {
+      uint64_t carry = 0;
+      for (size_t j = 0; j < N; ++j) {
+        u128 t = u128{a[i]} * b[j] + acc[i + j] + carry;
+        acc[i + j] = static_cast<uint64_t>(t);
+        carry = static_cast<uint64_t>(t >> 64);
+      }
+      for (size_t k = i + N; carry && k < acc.size(); ++k) {
+        acc[k] += carry;
+        carry = acc[k] < carry;
+      }
+    }
+  }
+
+  // Bit by bit, since it only runs twice per check
+  static scalar scalar_reduce(const wide_scalar& a) {
+    scalar r = {};
+    for (size_t bit = a.size() * 64; bit-- > 0;) {
+      for (int i = 3; i > 0; --i)
+        r[i] = (r[i] << 1) | (r[i - 1] >> 63);
+      r[0] = (r[0] << 1) | ((a[bit / 64] >> (bit % 64)) & 1);
+
+      if (!scalar_less(r, order)) {
+        uint64_t borrow = 0;
+        for (int i = 0; i < 4; ++i) {
+          u128 t = u128{r[i]} - order[i] - borrow;
+          r[i] = static_cast<uint64_t>(t);
+          borrow = static_cast<uint64_t>(t >> 64) & 1;
+        }
+      }
+    }
+    return r;
+  }
+
+  // [a]P + [b]Q, four bits at a time
+  static ge ge_double_scalarmult(const scalar& a, const ge& p, const scalar& b, const ge& q) {
+    std::array<ge, 16> p_tbl, q_tbl;
+    p_tbl[0] = q_tbl[0] = ge_identity;
+    for (size_t i = 1; i < 16; ++i) {
+      p_tbl[i] = ge_add(p_tbl[i - 1], p);
+      q_tbl[i] = ge_add(q_tbl[i - 1], q);
+    }
+
+    ge ret = ge_identity;
+    for (int w = 63; w >= 0; --w) {
+      for (int i = 0; i < 4; ++i)
+        ret = ge_dbl(ret);
+      if (auto d = (a[w / 16] >> (w % 16 * 4)) & 0xf)
+        ret = ge_add(ret, p_tbl[d]);
+      if (auto d = (b[w / 16] >> (w % 16 * 4)) & 0xf)
+        ret = ge_add(ret, q_tbl[d]);
+    }
+    return ret;
+  }
+
+  struct prepared {
+    size_t index;
+    ge neg_r;
+    std::array<uint64_t, 2> z;
+    scalar s;
+    std::array<uint64_t, 8> k;
+  };
+
+  static unsigned window_bits(size_t n) {
+    return n < 8 ? 3 : n < 32 ? 4 : n < 128 ? 5 : n < 512 ? 6 : n < 2048 ? 7 : 8;
+  }
+
+  // sum [z_i](-R_i) by Pippenger's bucket method, over the 128 bits of z
+  static ge msm_neg_r(gsl::span<const prepared> es) {
+    const unsigned c = window_bits(static_cast<size_t>(es.size()));
+    std::vector<ge> buckets(size_t{1} << c);
+    std::vector<bool> used(buckets.size());
+
+    ge ret = ge_identity;
+    for (int w = (128 + c - 1) / c - 1; w >= 0; --w) {
+      for (unsigned i = 0; i < c; ++i)
+        ret = ge_dbl(ret);
+
+      std::fill(used.begin(), used.end(), false);
+      for (auto& e : es) {
+        u128 z = (u128{e.z[1]} << 64) | e.z[0];
+        size_t d = static_cast<size_t>(z >> (w * c)) & (buckets.size() - 1);
+        if (!d)
+          continue;
+        buckets[d] = used[d] ? ge_add(buckets[d], e.neg_r) : e.neg_r;
+        used[d] = true;
+      }
+
+      // sum d * bucket[d], as a running sum of the buckets from the top down
+      ge running = ge_identity, sum = ge_identity;
+      bool any = false;
+      for (size_t d = buckets.size() - 1; d > 0; --d) {
+        if (used[d]) {
+          running = any ? ge_add(running, buckets[d]) : buckets[d];
+          any = true;
+        }
+        if (any)
+          sum = ge_add(sum, running);
+      }
+      ret = ge_add(ret, sum);
+    }
+    return ret;
+  }
+
+  static bool batch_holds(gsl::span<const prepared> es, const ge& neg_a) {
+    wide_scalar sum_s = {}, sum_k = {};
+    for (auto& e : es) {
+      scalar_mac(sum_s, e.z, e.s);
+      scalar_mac(sum_k, e.z, e.k);
+    }
+
+    ge p = ge_add(msm_neg_r(es), ge_double_scalarmult(scalar_reduce(sum_s), ge_base,
+                                                       scalar_reduce(sum_k), neg_a));
+    for (int i = 0; i < 3; ++i)
+      p = ge_dbl(p);
+    return ge_is_identity(p);
+  }
+
+  static bool bisect(gsl::span<const prepared> es, const ge& neg_a, gsl::span<const verify_batch_entry> entries,
+                     gsl::span<bool> results, const std::function<bool(size_t)>& verify_one) {
+    auto n = static_cast<size_t>(es.size());
+    if (n < min_batch) {
+      bool ret = true;
+      for (auto& e : es)
+        ret &= (results[e.index] = verify_one(e.index));
+      return ret;
+    }
+
+    {
+      size_t bytes = 0;
+      for (auto& e : es)
+        bytes += static_cast<size_t>(entries[e.index].input_hashed.size());
+      C3_UPSILON_MEASURE_N(verify, signature_algorithm::Curve25519, bytes, n);
+
+      if (batch_holds(es, neg_a)) {
+        for (auto& e : es)
+          results[e.index] = true;
+        return true;
+      }
+      // Each entry is counted by whichever check settles it
+      C3_UPSILON_MEASURE_DISCARD();
+    }
+
+    auto half = n / 2;
+    bool ret = bisect(es.first(half), neg_a, entries, results, verify_one);
+    ret &= bisect(es.subspan(half), neg_a, entries, results, verify_one);
+    return ret;
+  }
+
+  bool verify_batch(nu::data_const_ref public_key, gsl::span<const verify_batch_entry> entries,
+                    gsl::span<bool> results, const std::function<bool(size_t)>& verify_one) {
+    ge neg_a;
+    if (static_cast<size_t>(entries.size()) < min_batch || public_key.size() != 32 ||
+        !ge_decompress(public_key.data(), neg_a)) {
+      bool ret = true;
+      for (decltype(entries.size()) i = 0; i < entries.size(); ++i)
+        ret &= (results[i] = verify_one(static_cast<size_t>(i)));
+      return ret;
+    }
+    neg_a = ge_neg(neg_a);
+
+    auto sha512 = get_hash_function<hash_algorithm::SHA2_512>()->begin_hash();
+    std::array<uint8_t, 64> k;
+    std::array<uint8_t, 16> z;
+
+    bool ret = true;
+    std::vector<prepared> es;
+    es.reserve(static_cast<size_t>(entries.size()));
+    for (decltype(entries.size()) i = 0; i < entries.size(); ++i) {
+      auto& entry = entries[i];
+      auto index = static_cast<size_t>(i);
+
+      // Anything off about the encoding is left for verify_one to turn down
+      prepared e;
+      e.index = index;
+      if (entry.sig.size() != 64 || !ge_decompress(entry.sig.data(), e.neg_r)) {
+        ret &= (results[i] = verify_one(index));
+        continue;
+      }
+      for (int j = 0; j < 4; ++j)
+        e.s[j] = load_le64(entry.sig.data() + 32 + 8 * j);
+      if (!scalar_less(e.s, order)) {
+        ret &= (results[i] = verify_one(index));
+        continue;
+      }
+      e.neg_r = ge_neg(e.neg_r);
+
+      // k = SHA-512(R || A || M), left unreduced
+      sha512->process(entry.sig.first(32));
+      sha512->process(public_key);
+      sha512->process(entry.input_hashed);
+      sha512->finish(nu::data_ref{k.data(), 64});
+      sha512->reset();
+      for (int j = 0; j < 8; ++j)
+        e.k[j] = load_le64(k.data() + 8 * j);
+
+      std::generate(z.begin(), z.end(), std::ref(csprng::standard));
+      e.z = { load_le64(z.data()), load_le64(z.data() + 8) };
+
+      es.push_back(e);
+    }
+
+    ret &= bisect(es, neg_a, entries, results, verify_one);
+    return ret;
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "c3/upsilon/identity.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+namespace c3::upsilon::ed25519 {
+  /// Below this many signatures, checking them one at a time is cheaper
+  constexpr size_t min_batch = 4;
+
+  /// Batch verification of pure Ed25519 signatures by one key, kept here because Botan has no
+  /// access to the curve's group operations
+  ///
+  /// Each signature i is given a random 128-bit z_i, and all of them are checked at once with
+  /// [8]([sum z_i S_i]B - [sum z_i k_i]A - sum [z_i]R_i) == 0. If that fails, the batch is split in
+  /// half and each half checked again, down to single signatures, which go to verify_one.
+  /// Signatures this can't parse go straight to verify_one, so every rejection comes from it.
+  ///
+  /// The check is cofactored, so a signature whose R was given a small-order component can pass
+  /// here and fail verify_one. Signers never produce those, and only the signature bytes change.
+  ///
+  /// Writes the validity of each entry into results, and returns true iff all are valid
+  bool verify_batch(nu::data_const_ref public_key, gsl::span<const verify_batch_entry> entries,
+                    gsl::span<bool> results, const std::function<bool(size_t)>& verify_one);
+}
@@ -0,0 +1,427 @@
+#include "c3/upsilon/filter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "c3/upsilon/cpu.hpp"
+
+#include "dispatch.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define C3_UPSILON_FILTER_AVX2
+#endif
+
+namespace c3::upsilon {
+  // Serialised filters start with 8 bytes of magic, then little-endian 64 bit fields, padded
+  // to 32 bytes so that the body keeps the alignment of whatever it was mapped from
+  constexpr size_t filter_header_size = 32;
+  static constexpr uint8_t bloom_magic[8] = { 'c', '3', 'b', 'l', 'o', 'o', 'm', '1' };
+  static constexpr uint8_t cuckoo_magic[8] = { 'c', '3', 'c', 'u', 'c', 'k', 'o', '1' };
+
+  static inline void store_le64(uint8_t* b, uint64_t x) {
+    for (int i = 0; i < 8; ++i, x >>= 8)
+      b[i] = static_cast<uint8_t>(x);
+  }
+
+  static inline uint64_t load_le64(const uint8_t* b) {
+    uint64_t ret = 0;
+    for (int i = 7; i >= 0; --i)
+      ret = (ret << 8) | b[i];
+    return ret;
+  }
+
+  // Checks the magic, returning the header's fields and the body
+  static nu::data_const_ref parse_header(nu::data_const_ref b, const uint8_t (&magic)[8], uint64_t (&fields)[3]) {
+    if (static_cast<size_t>(b.size()) < filter_header_size)
+      throw nu::serialisation_failure("Filter too short for its header");
+    if (!std::equal(magic, magic + 8, b.begin()))
+      throw nu::serialisation_failure("Not a serialised filter of this kind");
+    for (size_t i = 0; i < 3; ++i)
+      fields[i] = load_le64(b.data() + 8 + 8 * i);
+    return b.subspan(filter_header_size);
+  }
+
+  static bool bloom_avx2() {
+    static const bool ret = std::string_view{choose_backend(algorithm_family::utility,
+                                                            static_cast<uint16_t>(utility_algorithm::bloom_filter), {
+#ifdef C3_UPSILON_FILTER_AVX2
+      { "avx2", { cpu_feature::avx2 } },
+#endif
+      { "portable", {} },
+    })} == "avx2";
+    return ret;
+  }
+
+  // bloom_filter
+
+  // Scaling the top 32 bits rather than taking a remainder, which is as uniform and cheaper
+  static inline size_t bloom_block(uint64_t hi, size_t n_blocks) {
+    return static_cast<size_t>(((hi >> 32) * n_blocks) >> 32);
+  }
+
+  // The bit set in word i of the block, from 5 bits of lo each
+  static inline unsigned bloom_bit(uint64_t lo, size_t i) {
+    return static_cast<unsigned>((lo >> (5 * i)) & 31);
+  }
+
+  // Words are little-endian, so bit n of word i is bit n % 8 of byte 4i + n / 8 on any host
+  static bool bloom_probe_portable(const uint8_t* block, uint64_t lo) {
+    for (size_t i = 0; i < 8; ++i) {
+      auto bit = bloom_bit(lo, i);
+      if (!(__atomic_load_n(block + 4 * i + bit / 8, __ATOMIC_RELAXED) & (1u << (bit % 8))))
+        return false;
+    }
+    return true;
+  }
+
+#ifdef C3_UPSILON_FILTER_AVX2
+  __attribute__((target("avx2")))
+  static bool bloom_probe_avx2(const uint8_t* block, uint64_t lo) {
+    alignas(32) uint32_t shifts[8];
+    for (size_t i = 0; i < 8; ++i)
+      shifts[i] = bloom_bit(lo, i);
+    auto mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_load_si256(reinterpret_cast<const __m256i*>(shifts)));
+    return _mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)), mask);
+  }
+#endif
+
+  static inline bool bloom_probe(const uint8_t* block, uint64_t lo) {
+#ifdef C3_UPSILON_FILTER_AVX2
+    // Already picked by the time a view exists
+    if (bloom_avx2())
+      return bloom_probe_avx2(block, lo);
+#endif
+    return bloom_probe_portable(block, lo);
+  }
+
+  void bloom_filter_view::_choose_backend() {
+    bloom_avx2();
+  }
+
+  bool bloom_filter_view::contains(filter_key k) const noexcept {
+    return bloom_probe(_blocks + bloom_filter::block_size * bloom_block(k.hi, _n_blocks), k.lo);
+  }
+
+  // Far enough ahead that the line has arrived by the time it is probed
+  constexpr size_t bloom_prefetch_distance = 8;
+
+  size_t bloom_filter_view::contains(gsl::span<const filter_key> keys, gsl::span<bool> results) const {
+    if (results.size() < keys.size())
+      throw std::invalid_argument("Results too small for the number of keys");
+
+    size_t n_keys = keys.size(), n_present = 0;
+    for (size_t i = 0; i < n_keys; ++i) {
+      if (i + bloom_prefetch_distance < n_keys)
+        __builtin_prefetch(_blocks + bloom_filter::block_size *
+                                     bloom_block(keys[i + bloom_prefetch_distance].hi, _n_blocks));
+      results[i] = contains(keys[i]);
+      n_present += results[i];
+    }
+    return n_present;
+  }
+
+  bloom_filter_view bloom_filter_view::parse(nu::data_const_ref b) {
+    uint64_t fields[3];
+    auto body = parse_header(b, bloom_magic, fields);
+    auto n_blocks = fields[0];
+    if (n_blocks == 0 || n_blocks > 0xffffffff || n_blocks != static_cast<size_t>(body.size()) / bloom_filter::block_size ||
+        static_cast<size_t>(body.size()) % bloom_filter::block_size != 0)
+      throw nu::serialisation_failure("Bloom filter has the wrong length");
+    return { body.data(), static_cast<size_t>(n_blocks) };
+  }
+
+  bool bloom_filter::insert(filter_key k) noexcept {
+    auto* block = reinterpret_cast<uint8_t*>(_lines.data()) + block_size * bloom_block(k.hi, _n_blocks);
+    bool added = false;
+    for (size_t i = 0; i < 8; ++i) {
+      auto bit = bloom_bit(k.lo, i);
+      auto* byte = block + 4 * i + bit / 8;
+      uint8_t mask = static_cast<uint8_t>(1u << (bit % 8));
+      // Checking first keeps the line shared between cores when the bit is already set
+      if (!(__atomic_load_n(byte, __ATOMIC_RELAXED) & mask) && !(__atomic_fetch_or(byte, mask, __ATOMIC_RELAXED) & mask))
+        added = true;
+    }
+    return added;
+  }
+
+  size_t bloom_filter::serialised_size() const noexcept {
+    return filter_header_size + _n_blocks * block_size;
+  }
+
+  size_t bloom_filter::serialise_into(nu::data_ref b) const {
+    auto len = serialised_size();
+    if (static_cast<size_t>(b.size()) < len)
+      throw std::invalid_argument("Buffer too small to serialise into");
+
+    std::fill(b.begin(), b.begin() + filter_header_size, 0);
+    std::copy(bloom_magic, bloom_magic + 8, b.begin());
+    store_le64(b.data() + 8, _n_blocks);
+    std::memcpy(b.data() + filter_header_size, _lines.data(), _n_blocks * block_size);
+    return len;
+  }
+
+  bloom_filter bloom_filter::deserialise(nu::data_const_ref b) {
+    auto v = bloom_filter_view::parse(b);
+    bloom_filter ret{0};
+    ret._n_blocks = v.n_blocks();
+    ret._lines.assign((ret._n_blocks * block_size + sizeof(_line) - 1) / sizeof(_line), _line{});
+    std::memcpy(ret._lines.data(), b.data() + filter_header_size, ret._n_blocks * block_size);
+    return ret;
+  }
+
+  bloom_filter::bloom_filter(size_t expected_items, double false_positive_rate) {
+    if (!(false_positive_rate > 0 && false_positive_rate < 1))
+      throw std::invalid_argument("False positive rate must be between 0 and 1");
+
+    // The classic optimum, plus a quarter for keys crowding into the same blocks
+    double bits_per_item = -std::log(false_positive_rate) / (std::log(2.0) * std::log(2.0)) * 1.25;
+    double n_blocks = std::ceil(static_cast<double>(expected_items) * bits_per_item / (8 * block_size));
+    if (n_blocks > 0xffffffff)
+      throw std::invalid_argument("Bloom filter would be too large");
+
+    _n_blocks = std::max<size_t>(1, static_cast<size_t>(n_blocks));
+    _lines.assign((_n_blocks * block_size + sizeof(_line) - 1) / sizeof(_line), _line{});
+    // view is noexcept, so the probe has to be settled before it is called
+    bloom_filter_view::_choose_backend();
+  }
+
+  // cuckoo_filter
+
+  constexpr size_t cuckoo_max_kicks = 500;
+
+  // Bytes 8 and 9 of the digest, with 0 kept for empty slots
+  static inline uint16_t cuckoo_fingerprint(filter_key k) {
+    auto ret = static_cast<uint16_t>(k.lo >> 48);
+    return ret ? ret : 1;
+  }
+
+  static inline size_t cuckoo_alt(size_t bucket, uint16_t fp, size_t n_buckets) {
+    return (bucket ^ (static_cast<size_t>(fp) * 0x5bd1e995)) & (n_buckets - 1);
+  }
+
+  // Slots are stored little-endian
+  static inline uint16_t slot_to_host(uint16_t x) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap16(x);
+#else
+    return x;
+#endif
+  }
+
+  static inline uint16_t load_slot(const uint16_t* slot) {
+    return slot_to_host(__atomic_load_n(slot, __ATOMIC_RELAXED));
+  }
+
+  static inline void store_slot(uint16_t* slot, uint16_t fp) {
+    __atomic_store_n(slot, slot_to_host(fp), __ATOMIC_RELAXED);
+  }
+
+  static inline bool cuckoo_probe(const uint8_t* buckets, size_t b1, size_t b2, uint16_t fp) {
+#if defined(__SSE2__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Both buckets in one register, so a single compare covers all eight slots
+    auto both = _mm_unpacklo_epi64(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(buckets + b1 * cuckoo_filter::bucket_size)),
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(buckets + b2 * cuckoo_filter::bucket_size)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(both, _mm_set1_epi16(static_cast<short>(fp))));
+#else
+    auto* slots = reinterpret_cast<const uint16_t*>(buckets);
+    for (size_t i = 0; i < cuckoo_filter::slots_per_bucket; ++i)
+      if (load_slot(slots + b1 * cuckoo_filter::slots_per_bucket + i) == fp ||
+          load_slot(slots + b2 * cuckoo_filter::slots_per_bucket + i) == fp)
+        return true;
+    return false;
+#endif
+  }
+
+  bool cuckoo_filter_view::contains(filter_key k) const noexcept {
+    auto fp = cuckoo_fingerprint(k);
+    auto b1 = static_cast<size_t>(k.hi) & (_n_buckets - 1);
+    auto b2 = cuckoo_alt(b1, fp, _n_buckets);
+
+    while (true) {
+      uint64_t version = _version ? _version->load(std::memory_order_acquire) : 0;
+      if (cuckoo_probe(_buckets, b1, b2, fp))
+        return true;
+      if (!_version)
+        return false;
+      // A miss only counts if nothing moved while we looked
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(version & 1) && _version->load(std::memory_order_relaxed) == version)
+        return false;
+    }
+  }
+
+  cuckoo_filter_view cuckoo_filter_view::parse(nu::data_const_ref b) {
+    uint64_t fields[3];
+    auto body = parse_header(b, cuckoo_magic, fields);
+    auto n_buckets = fields[0];
+    if (n_buckets == 0 || (n_buckets & (n_buckets - 1)) ||
+        n_buckets != static_cast<size_t>(body.size()) / cuckoo_filter::bucket_size ||
+        static_cast<size_t>(body.size()) % cuckoo_filter::bucket_size != 0)
+      throw nu::serialisation_failure("Cuckoo filter has the wrong length");
+    if (fields[1] > n_buckets * cuckoo_filter::slots_per_bucket)
+      throw nu::serialisation_failure("Cuckoo filter holds more than it has room for");
+    return { body.data(), static_cast<size_t>(n_buckets) };
+  }
+
+  bool cuckoo_filter::insert(filter_key k) {
+    auto fp = cuckoo_fingerprint(k);
+    auto mask = _n_buckets - 1;
+    size_t b1 = static_cast<size_t>(k.hi) & mask;
+    size_t b2 = cuckoo_alt(b1, fp, _n_buckets);
+
+    std::lock_guard lock{_write_lock};
+    auto* slots = _slots();
+
+    auto find_empty = [&](size_t bucket) -> uint16_t* {
+      for (size_t i = 0; i < slots_per_bucket; ++i)
+        if (!load_slot(slots + bucket * slots_per_bucket + i))
+          return slots + bucket * slots_per_bucket + i;
+      return nullptr;
+    };
+
+    auto* empty = find_empty(b1);
+    if (!empty)
+      empty = find_empty(b2);
+    if (empty) {
+      store_slot(empty, fp);
+      ++_size;
+      return true;
+    }
+
+    // Walk victims until one has room in its other bucket, without moving anything yet, so a
+    // full filter is left as it was. The walk must not revisit a slot, or the moves would clash
+    std::minstd_rand rng{static_cast<std::minstd_rand::result_type>(k.hi >> 32) | 1};
+    std::vector<uint16_t*> path;
+    size_t n_kicks = 0;
+    while (n_kicks < cuckoo_max_kicks) {
+      path.clear();
+      size_t bucket = rng() & 1 ? b1 : b2;
+      while (n_kicks++ < cuckoo_max_kicks) {
+        auto* slot = slots + bucket * slots_per_bucket + rng() % slots_per_bucket;
+        if (std::find(path.begin(), path.end(), slot) != path.end())
+          break;
+        path.push_back(slot);
+
+        bucket = cuckoo_alt(bucket, load_slot(slot), _n_buckets);
+        if (auto* dest = find_empty(bucket)) {
+          // Moves run from the end of the path back, each item landing before it leaves
+          _version.fetch_add(1, std::memory_order_acq_rel);
+          for (size_t i = path.size(); i-- > 0;) {
+            store_slot(dest, load_slot(path[i]));
+            dest = path[i];
+          }
+          store_slot(dest, fp);
+          _version.fetch_add(1, std::memory_order_release);
+          ++_size;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool cuckoo_filter::erase(filter_key k) {
+    auto fp = cuckoo_fingerprint(k);
+    size_t b1 = static_cast<size_t>(k.hi) & (_n_buckets - 1);
+    size_t b2 = cuckoo_alt(b1, fp, _n_buckets);
+
+    std::lock_guard lock{_write_lock};
+    auto* slots = _slots();
+    for (auto bucket : { b1, b2 }) {
+      for (size_t i = 0; i < slots_per_bucket; ++i) {
+        auto* slot = slots + bucket * slots_per_bucket + i;
+        if (load_slot(slot) == fp) {
+          store_slot(slot, 0);
+          --_size;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  size_t cuckoo_filter::serialised_size() const noexcept {
+    return filter_header_size + _n_buckets * bucket_size;
+  }
+
+  size_t cuckoo_filter::serialise_into(nu::data_ref b) const {
+    auto len = serialised_size();
+    if (static_cast<size_t>(b.size()) < len)
+      throw std::invalid_argument("Buffer too small to serialise into");
+
+    std::fill(b.begin(), b.begin() + filter_header_size, 0);
+    std::copy(cuckoo_magic, cuckoo_magic + 8, b.begin());
+    store_le64(b.data() + 8, _n_buckets);
+    store_le64(b.data() + 16, _size);
+    std::memcpy(b.data() + filter_header_size, _lines.data(), _n_buckets * bucket_size);
+    return len;
+  }
+
+  cuckoo_filter cuckoo_filter::deserialise(nu::data_const_ref b) {
+    auto v = cuckoo_filter_view::parse(b);
+    cuckoo_filter ret{0};
+    ret._n_buckets = v.n_buckets();
+    ret._lines.assign((ret._n_buckets * bucket_size + sizeof(_line) - 1) / sizeof(_line), _line{});
+    std::memcpy(ret._lines.data(), b.data() + filter_header_size, ret._n_buckets * bucket_size);
+    ret._size = static_cast<size_t>(load_le64(b.data() + 16));
+    return ret;
+  }
+
+  cuckoo_filter::cuckoo_filter(size_t expected_items) {
+    // Four slot buckets fill to about 95% before inserts start failing
+    auto min_buckets = static_cast<size_t>(std::ceil(static_cast<double>(expected_items) / (slots_per_bucket * 0.95)));
+    _n_buckets = 2;
+    while (_n_buckets < min_buckets)
+      _n_buckets <<= 1;
+    _lines.assign((_n_buckets * bucket_size + sizeof(_line) - 1) / sizeof(_line), _line{});
+  }
+
+  cuckoo_filter::cuckoo_filter(cuckoo_filter&& other) noexcept :
+    _lines{std::move(other._lines)}, _n_buckets{other._n_buckets},
+    _version{other._version.load()}, _size{other._size.load()} {}
+
+  // mapped_file
+
+  mapped_file::mapped_file(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::system_category(), "Failed to open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::system_category(), "Failed to stat " + path);
+    }
+
+    _len = static_cast<size_t>(st.st_size);
+    // Mapping nothing fails, and there is nothing to map
+    if (_len) {
+      _base = mmap(nullptr, _len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (_base == MAP_FAILED) {
+        int err = errno;
+        _base = nullptr;
+        close(fd);
+        throw std::system_error(err, std::system_category(), "Failed to map " + path);
+      }
+    }
+    close(fd);
+  }
+
+  mapped_file::~mapped_file() {
+    if (_base)
+      munmap(_base, _len);
+  }
+}
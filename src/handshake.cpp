@@ -0,0 +1,447 @@
+#include "c3/upsilon/handshake.hpp"
+#include "c3/upsilon/mac.hpp"
+#include "c3/upsilon/nuker.hpp"
+
+#include "poly1305.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace c3::upsilon {
+  namespace {
+    enum class token : uint8_t { e, s, ee, es, se, ss };
+
+    struct message_pattern {
+      size_t n_tokens;
+      std::array<token, 4> tokens;
+    };
+
+    struct pattern_def {
+      const char* name;
+      // The only pre-message either pattern has is the responder's static key
+      bool responder_static_known;
+      size_t n_messages;
+      std::array<message_pattern, 3> messages;
+    };
+
+    constexpr pattern_def xx = {
+      "XX", false, 3, {{
+        { 1, { token::e } },
+        { 4, { token::e, token::ee, token::s, token::es } },
+        { 2, { token::s, token::se } },
+      }}
+    };
+    constexpr pattern_def ik = {
+      "IK", true, 2, {{
+        { 4, { token::e, token::es, token::s, token::ss } },
+        { 3, { token::e, token::ee, token::se } },
+      }}
+    };
+
+    const pattern_def& get_pattern(handshake_pattern pattern) {
+      switch (pattern) {
+        case handshake_pattern::XX: return xx;
+        case handshake_pattern::IK: return ik;
+        default: throw std::invalid_argument("Unknown handshake pattern");
+      }
+    }
+
+    const char* cipher_name(symmetric_algorithm alg) {
+      switch (alg) {
+        case symmetric_algorithm::ChaCha20_20: return "ChaChaPoly";
+        // Not in the spec, but named the same way
+        case symmetric_algorithm::ChaCha20_12: return "ChaCha12Poly";
+        case symmetric_algorithm::ChaCha20_8: return "ChaCha8Poly";
+        default: throw algorithm_not_implemented<symmetric_algorithm>{alg};
+      }
+    }
+
+    std::pair<hash_algorithm, const char*> kdf_hash(kdf_algorithm alg) {
+      switch (alg) {
+        case kdf_algorithm::HKDF_SHA2_256: return { hash_algorithm::SHA2_256, "SHA256" };
+        case kdf_algorithm::HKDF_SHA2_512: return { hash_algorithm::SHA2_512, "SHA512" };
+        default: throw algorithm_not_implemented<kdf_algorithm>{alg};
+      }
+    }
+
+    const char* dh_name(agreement_algorithm alg) {
+      switch (alg) {
+        case agreement_algorithm::Curve25519: return "25519";
+        default: throw algorithm_not_implemented<agreement_algorithm>{alg};
+      }
+    }
+
+    inline void store_le64(uint8_t* b, uint64_t x) {
+      for (int i = 0; i < 8; ++i, x >>= 8)
+        b[i] = static_cast<uint8_t>(x);
+    }
+  }
+
+  //////////////////////////////////////////////////////////////// noise_cipher_state
+
+  // The IV is the nonce as 8 little-endian bytes, which with ChaCha's 64-bit counter gives the same
+  // state as RFC 8439's 12-byte nonce of 4 zero bytes then the same 8
+  void noise_cipher_state::_start(uint64_t n, uint8_t* poly_key) {
+    std::array<uint8_t, 8> iv;
+    store_le64(iv.data(), n);
+    _cipher->set_iv(iv);
+
+    // The first block gives the Poly1305 key, and the message starts on the second
+    std::memset(poly_key, 0, 64);
+    _cipher->encrypt(nu::data_ref{poly_key, 64});
+  }
+
+  static void aead_tag(const uint8_t* poly_key, nu::data_const_ref ad,
+                       nu::data_const_ref ct, uint8_t* tag) {
+    poly1305::poly1305 mac{poly_key};
+    poly1305::poly1305::accumulator acc;
+    mac.update_padded(acc, ad.data(), static_cast<size_t>(ad.size()));
+    mac.update_padded(acc, ct.data(), static_cast<size_t>(ct.size()));
+    std::array<uint8_t, 16> lengths;
+    store_le64(lengths.data(), static_cast<uint64_t>(ad.size()));
+    store_le64(lengths.data() + 8, static_cast<uint64_t>(ct.size()));
+    mac.update_padded(acc, lengths.data(), lengths.size());
+    mac.finish(acc, tag);
+  }
+
+  void noise_cipher_state::initialise_key(symmetric_algorithm alg, nu::data_const_ref key) {
+    // Throws for anything without the AEAD
+    cipher_name(alg);
+    if (key.size() != key_size)
+      throw std::invalid_argument("Noise keys are 32 bytes");
+
+    std::array<uint8_t, 8> iv = {};
+    if (_cipher && _cipher->alg() == alg)
+      _cipher->rekey(key, iv);
+    else
+      _cipher = get_symmetric_function(alg, key, iv);
+    _has_key = true;
+    _n = 0;
+  }
+
+  size_t noise_cipher_state::encrypt_with_ad(nu::data_const_ref ad, nu::data_const_ref input, nu::data_ref output) {
+    auto len = static_cast<size_t>(input.size());
+    if (!_has_key) {
+      if (static_cast<size_t>(output.size()) < len)
+        throw std::invalid_argument("Output is too small");
+      if (output.data() != input.data())
+        std::copy(input.begin(), input.end(), output.begin());
+      return len;
+    }
+
+    if (static_cast<size_t>(output.size()) < len + tag_size)
+      throw std::invalid_argument("Output is too small");
+    if (_n == max_nonce)
+      throw noise_error("Ran out of nonces");
+
+    std::array<uint8_t, 64> poly_key;
+    _start(_n, poly_key.data());
+    _cipher->encrypt(input, output.first(len));
+    aead_tag(poly_key.data(), ad, output.first(len), output.data() + len);
+    nuke(poly_key.data(), poly_key.size());
+
+    ++_n;
+    return len + tag_size;
+  }
+
+  size_t noise_cipher_state::decrypt_with_ad(nu::data_const_ref ad, nu::data_const_ref input, nu::data_ref output) {
+    auto len = static_cast<size_t>(input.size());
+    if (!_has_key) {
+      if (static_cast<size_t>(output.size()) < len)
+        throw std::invalid_argument("Output is too small");
+      if (output.data() != input.data())
+        std::copy(input.begin(), input.end(), output.begin());
+      return len;
+    }
+
+    if (len < tag_size)
+      throw noise_error("Message is too short to hold a tag");
+    len -= tag_size;
+    if (static_cast<size_t>(output.size()) < len)
+      throw std::invalid_argument("Output is too small");
+    if (_n == max_nonce)
+      throw noise_error("Ran out of nonces");
+
+    // The tag is checked before anything is decrypted, so output may alias input
+    std::array<uint8_t, 64> poly_key;
+    std::array<uint8_t, tag_size> tag;
+    _start(_n, poly_key.data());
+    aead_tag(poly_key.data(), ad, input.first(len), tag.data());
+    nuke(poly_key.data(), poly_key.size());
+    if (!constant_time_equal(tag, input.subspan(len)))
+      throw noise_error("Message failed authentication");
+
+    _cipher->decrypt(input.first(len), output.first(len));
+    ++_n;
+    return len;
+  }
+
+  // The first 32 bytes of encrypting zeroes under the reserved nonce, without the tag
+  void noise_cipher_state::rekey() {
+    if (!_has_key)
+      throw std::logic_error("Cannot rekey without a key");
+
+    std::array<uint8_t, 64> poly_key;
+    _start(max_nonce, poly_key.data());
+    nuke(poly_key.data(), poly_key.size());
+
+    std::array<uint8_t, key_size> key = {};
+    _cipher->encrypt(nu::data_ref{key});
+    std::array<uint8_t, 8> iv = {};
+    _cipher->rekey(key, iv);
+    nuke(key.data(), key.size());
+  }
+
+  //////////////////////////////////////////////////////////////// noise_session
+
+  noise_session::noise_session(noise_cipher_state&& send, noise_cipher_state&& receive, uint64_t rekey_interval,
+                               nu::data_const_ref handshake_hash) :
+    _send{std::move(send)}, _receive{std::move(receive)}, _rekey_interval{rekey_interval},
+    _hash_len{static_cast<size_t>(handshake_hash.size())} {
+    std::copy(handshake_hash.begin(), handshake_hash.end(), _handshake_hash.begin());
+  }
+
+  noise_session::~noise_session() {
+    nuke(_handshake_hash.data(), _handshake_hash.size());
+  }
+
+  // Both sides count the same records, so rekey at the same place without saying so. Only after
+  // a record has gone through, so that a forged one can't move the receiver on
+  void noise_session::_maybe_rekey(noise_cipher_state& cs) {
+    if (_rekey_interval && cs.nonce() % _rekey_interval == 0)
+      cs.rekey();
+  }
+
+  size_t noise_session::encrypt(nu::data_const_ref plaintext, nu::data_ref record, nu::data_const_ref ad) {
+    if (static_cast<size_t>(plaintext.size()) + record_overhead > max_record_size)
+      throw std::invalid_argument("Plaintext is too large for one record");
+    auto ret = _send.encrypt_with_ad(ad, plaintext, record);
+    _maybe_rekey(_send);
+    return ret;
+  }
+
+  size_t noise_session::decrypt(nu::data_const_ref record, nu::data_ref plaintext, nu::data_const_ref ad) {
+    if (static_cast<size_t>(record.size()) > max_record_size)
+      throw noise_error("Record is too large");
+    auto ret = _receive.decrypt_with_ad(ad, record, plaintext);
+    _maybe_rekey(_receive);
+    return ret;
+  }
+
+  //////////////////////////////////////////////////////////////// noise_handshake
+
+  noise_handshake::noise_handshake(handshake_pattern pattern, bool initiator, const agreement_function& s,
+                                   nu::data_const_ref remote_static, nu::data_const_ref prologue,
+                                   noise_suite suite) :
+    _pattern{pattern}, _cipher_alg{suite.cipher}, _initiator{initiator}, _dh_alg{suite.dh},
+    _s{&s}, _s_public{s.serialise_public()} {
+    auto& def = get_pattern(pattern);
+    auto [hash_alg, hash_name] = kdf_hash(suite.kdf);
+    _hash = get_hash_function(hash_alg);
+    _kdf = get_kdf(suite.kdf);
+    _hash_len = _hash->properties()->max_output;
+
+    std::string name = "Noise_";
+    name += def.name;
+    name += '_';
+    name += dh_name(suite.dh);
+    name += '_';
+    name += cipher_name(suite.cipher);
+    name += '_';
+    name += hash_name;
+
+    _h.fill(0);
+    if (name.size() <= _hash_len)
+      std::copy(name.begin(), name.end(), _h.begin());
+    else
+      _hash->compute_hash(nu::data_const_ref{reinterpret_cast<const uint8_t*>(name.data()),
+                                             static_cast<std::ptrdiff_t>(name.size())},
+                          nu::data_ref{_h}.first(_hash_len));
+    _ck = _h;
+
+    _mix_hash(prologue);
+
+    if (def.responder_static_known) {
+      if (initiator) {
+        if (remote_static.empty())
+          throw std::invalid_argument("This pattern needs the responder's static key");
+        _rs.assign(remote_static.begin(), remote_static.end());
+        _mix_hash(_rs);
+      }
+      else {
+        _mix_hash(_s_public);
+      }
+    }
+  }
+
+  noise_handshake::~noise_handshake() {
+    nuke(_h.data(), _h.size());
+    nuke(_ck.data(), _ck.size());
+  }
+
+  noise_handshake noise_handshake::initiator(handshake_pattern pattern, const agreement_function& s,
+                                             nu::data_const_ref remote_static, nu::data_const_ref prologue,
+                                             noise_suite suite) {
+    return { pattern, true, s, remote_static, prologue, suite };
+  }
+
+  noise_handshake noise_handshake::responder(handshake_pattern pattern, const agreement_function& s,
+                                             nu::data_const_ref prologue, noise_suite suite) {
+    return { pattern, false, s, {}, prologue, suite };
+  }
+
+  size_t noise_handshake::_n_messages() const noexcept {
+    return _pattern == handshake_pattern::IK ? ik.n_messages : xx.n_messages;
+  }
+
+  void noise_handshake::_mix_hash(nu::data_const_ref data) {
+    std::array<uint8_t, 64> tmp;
+    _hash->compute_hash(data, nu::data_const_ref{_h}.first(_hash_len), nu::data_ref{tmp}.first(_hash_len));
+    std::copy(tmp.begin(), tmp.begin() + _hash_len, _h.begin());
+  }
+
+  // HKDF with ck as the salt and no info, where the first output becomes the new ck
+  void noise_handshake::_hkdf(nu::data_const_ref ikm, nu::data_ref out_1, nu::data_ref out_2) {
+    std::array<uint8_t, 128> tmp;
+    auto okm = nu::data_ref{tmp}.first(2 * _hash_len);
+    _kdf->extract(ikm, nu::data_const_ref{_ck}.first(_hash_len))->expand({}, okm);
+    std::copy(okm.begin(), okm.begin() + _hash_len, out_1.begin());
+    std::copy(okm.begin() + _hash_len, okm.end(), out_2.begin());
+    nuke(tmp.data(), tmp.size());
+  }
+
+  void noise_handshake::_mix_key(nu::data_const_ref ikm) {
+    std::array<uint8_t, 64> temp_k;
+    _hkdf(ikm, nu::data_ref{_ck}.first(_hash_len), nu::data_ref{temp_k}.first(_hash_len));
+    _cs.initialise_key(_cipher_alg, nu::data_const_ref{temp_k}.first(noise_cipher_state::key_size));
+    nuke(temp_k.data(), temp_k.size());
+  }
+
+  size_t noise_handshake::_encrypt_and_hash(nu::data_const_ref input, nu::data_ref output) {
+    auto len = _cs.encrypt_with_ad(handshake_hash(), input, output);
+    _mix_hash(output.first(len));
+    return len;
+  }
+
+  size_t noise_handshake::_decrypt_and_hash(nu::data_const_ref input, nu::data_ref output) {
+    auto len = _cs.decrypt_with_ad(handshake_hash(), input, output);
+    _mix_hash(input);
+    return len;
+  }
+
+  void noise_handshake::_dh(const agreement_function& local, nu::data_const_ref remote) {
+    auto secret = local.agree(remote);
+    _mix_key(secret);
+  }
+
+  size_t noise_handshake::message_overhead() const {
+    if (finished())
+      throw std::logic_error("Handshake has already finished");
+
+    auto& msg = get_pattern(_pattern).messages[_message];
+    auto dh_len = _s_public.size();
+    bool has_key = _cs.has_key();
+    size_t ret = 0;
+    for (size_t i = 0; i < msg.n_tokens; ++i) {
+      switch (msg.tokens[i]) {
+        case token::e: ret += dh_len; break;
+        case token::s: ret += dh_len + (has_key ? noise_cipher_state::tag_size : 0); break;
+        default: has_key = true; break;
+      }
+    }
+    return ret + (has_key ? noise_cipher_state::tag_size : 0);
+  }
+
+  size_t noise_handshake::write_message(nu::data_const_ref payload, nu::data_ref out) {
+    if (!is_my_turn())
+      throw std::logic_error("Not this side's turn to write");
+    auto total = message_overhead() + static_cast<size_t>(payload.size());
+    if (total > max_message_size)
+      throw std::invalid_argument("Payload is too large for a handshake message");
+    if (static_cast<size_t>(out.size()) < total)
+      throw std::invalid_argument("Output is too small");
+
+    auto& msg = get_pattern(_pattern).messages[_message];
+    size_t pos = 0;
+    for (size_t i = 0; i < msg.n_tokens; ++i) {
+      switch (msg.tokens[i]) {
+        case token::e:
+          _e = gen_agreement_function(_dh_alg);
+          _e_public = _e->serialise_public();
+          std::copy(_e_public.begin(), _e_public.end(), out.begin() + pos);
+          pos += _e_public.size();
+          _mix_hash(_e_public);
+          break;
+        case token::s:
+          pos += _encrypt_and_hash(_s_public, out.subspan(pos));
+          break;
+        case token::ee: _dh(*_e, _re); break;
+        case token::es: _initiator ? _dh(*_e, _rs) : _dh(*_s, _re); break;
+        case token::se: _initiator ? _dh(*_s, _re) : _dh(*_e, _rs); break;
+        case token::ss: _dh(*_s, _rs); break;
+      }
+    }
+    pos += _encrypt_and_hash(payload, out.subspan(pos));
+    ++_message;
+    return pos;
+  }
+
+  size_t noise_handshake::read_message(nu::data_const_ref msg, nu::data_ref payload_out) {
+    if (finished() || is_my_turn())
+      throw std::logic_error("Not this side's turn to read");
+    if (static_cast<size_t>(msg.size()) > max_message_size)
+      throw noise_error("Handshake message is too large");
+    auto overhead = message_overhead();
+    if (static_cast<size_t>(msg.size()) < overhead)
+      throw noise_error("Handshake message is too short");
+    if (static_cast<size_t>(payload_out.size()) < static_cast<size_t>(msg.size()) - overhead)
+      throw std::invalid_argument("Payload output is too small");
+
+    auto& def = get_pattern(_pattern).messages[_message];
+    auto dh_len = _s_public.size();
+    size_t pos = 0;
+    for (size_t i = 0; i < def.n_tokens; ++i) {
+      switch (def.tokens[i]) {
+        case token::e:
+          _re.assign(msg.begin() + pos, msg.begin() + pos + dh_len);
+          pos += dh_len;
+          _mix_hash(_re);
+          break;
+        case token::s: {
+          auto len = dh_len + (_cs.has_key() ? noise_cipher_state::tag_size : 0);
+          _rs.resize(dh_len);
+          _decrypt_and_hash(msg.subspan(pos, len), _rs);
+          pos += len;
+          break;
+        }
+        case token::ee: _dh(*_e, _re); break;
+        case token::es: _initiator ? _dh(*_e, _rs) : _dh(*_s, _re); break;
+        case token::se: _initiator ? _dh(*_s, _re) : _dh(*_e, _rs); break;
+        case token::ss: _dh(*_s, _rs); break;
+      }
+    }
+    auto ret = _decrypt_and_hash(msg.subspan(pos), payload_out);
+    ++_message;
+    return ret;
+  }
+
+  noise_session noise_handshake::split(uint64_t rekey_interval) {
+    if (!finished())
+      throw std::logic_error("Handshake has not finished");
+
+    std::array<uint8_t, 64> k_1, k_2;
+    _hkdf({}, nu::data_ref{k_1}.first(_hash_len), nu::data_ref{k_2}.first(_hash_len));
+    noise_cipher_state c_1, c_2;
+    c_1.initialise_key(_cipher_alg, nu::data_const_ref{k_1}.first(noise_cipher_state::key_size));
+    c_2.initialise_key(_cipher_alg, nu::data_const_ref{k_2}.first(noise_cipher_state::key_size));
+    nuke(k_1.data(), k_1.size());
+    nuke(k_2.data(), k_2.size());
+
+    if (_initiator)
+      return { std::move(c_1), std::move(c_2), rekey_interval, handshake_hash() };
+    else
+      return { std::move(c_2), std::move(c_1), rekey_interval, handshake_hash() };
+  }
+}
@@ -1,19 +1,45 @@
 #include "c3/upsilon/hash.hpp"
 #include "c3/upsilon/except.hpp"
 
+#include "dispatch.hpp"
+#include "instrument.hpp"
+#include "iovec.hpp"
+
 #include <botan/hash.h>
 
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #define C3_UPSILON_DEF_HASH_BOTAN(CLASS_NAME, ALG, BOTAN_HASH_NAME) \
-  thread_local static auto CLASS_NAME##_impl = Botan::HashFunction::create(BOTAN_HASH_NAME); \
+  static Botan::HashFunction& CLASS_NAME##_impl() { \
+    thread_local const auto ret = \
+      create_botan<Botan::HashFunction>(algorithm_family::hash, static_cast<uint16_t>(ALG), BOTAN_HASH_NAME); \
+    return *ret; \
+  } \
   class CLASS_NAME##_partial : public partial_hash_function { \
   public: \
     static constexpr auto props = get_hash_properties<ALG>(); \
     static constexpr auto static_props = props; \
   private: \
-    std::unique_ptr<Botan::HashFunction> hf = Botan::HashFunction::create(BOTAN_HASH_NAME); \
+    std::unique_ptr<Botan::HashFunction> hf = \
+      create_botan<Botan::HashFunction>(algorithm_family::hash, static_cast<uint16_t>(ALG), BOTAN_HASH_NAME); \
     nu::data salt; \
   public: \
-    void process(nu::data_const_ref input) override { hf->update(input.data(), input.size()); } \
+    void process(nu::data_const_ref input) override { \
+      C3_UPSILON_MEASURE(hash_process, ALG, input.size()); \
+      hf->update(input.data(), input.size()); \
+    } \
+    void processv(gsl::span<const nu::data_const_ref> inputs) override { \
+      size_t total = 0; \
+      for (auto& i : inputs) \
+        total += static_cast<size_t>(i.size()); \
+      C3_UPSILON_MEASURE(hash_process, ALG, total); \
+      for (auto& i : inputs) \
+        hf->update(i.data(), i.size()); \
+    } \
     void finish(nu::data_ref output) override { \
       hf->update(salt.data(), salt.size()); \
       if (output.size() == props.max_output) \
@@ -37,27 +63,31 @@
     static constexpr auto static_props = props; \
   public: \
     void compute_hash(nu::data_const_ref input, nu::data_ref output) const override { \
-      CLASS_NAME##_impl->update(input.data(), input.size()); \
+      C3_UPSILON_MEASURE(hash, ALG, input.size()); \
+      auto& impl = CLASS_NAME##_impl(); \
+      impl.update(input.data(), input.size()); \
       if (output.size() == props.max_output) \
-        CLASS_NAME##_impl->final(output.data()); \
+        impl.final(output.data()); \
       else if (static_cast<size_t>(output.size()) > props.max_output) \
         throw std::range_error("Too many bytes requested from hash"); \
       else { \
         std::array<uint8_t, props.max_output> tmp_output; \
-        CLASS_NAME##_impl->final(tmp_output.data()); \
+        impl.final(tmp_output.data()); \
         std::copy(tmp_output.begin(), tmp_output.begin() + output.size(), output.begin()); \
       } \
     } \
     void compute_hash(nu::data_const_ref input, nu::data_const_ref salt, nu::data_ref output) const override { \
-      CLASS_NAME##_impl->update(salt.data(), salt.size()); \
-      CLASS_NAME##_impl->update(input.data(), input.size()); \
+      C3_UPSILON_MEASURE(hash, ALG, input.size() + salt.size()); \
+      auto& impl = CLASS_NAME##_impl(); \
+      impl.update(salt.data(), salt.size()); \
+      impl.update(input.data(), input.size()); \
       if (output.size() == props.max_output) \
-        CLASS_NAME##_impl->final(output.data()); \
+        impl.final(output.data()); \
       else if (static_cast<size_t>(output.size()) > props.max_output) \
         throw std::range_error("Too many bytes requested from hash"); \
       else { \
         std::array<uint8_t, props.max_output> tmp_output; \
-        CLASS_NAME##_impl->final(tmp_output.data()); \
+        impl.final(tmp_output.data()); \
         std::copy(tmp_output.begin(), tmp_output.begin() + output.size(), output.begin()); \
       } \
     } \
@@ -70,13 +100,10 @@
     const hash_properties* properties() const noexcept override { return &static_props; } \
   }; \
   static const CLASS_NAME CLASS_NAME##_static; \
-  static auto __##CLASS_NAME##_registered = _hash_funcs.emplace(ALG, &CLASS_NAME##_static); \
   template<> \
   const hash_function* get_hash_function<ALG>() { return &CLASS_NAME##_static; }
 
 namespace c3::upsilon {
-  std::map<hash_algorithm, const hash_function*> _hash_funcs;
-
   C3_UPSILON_DEF_HASH_BOTAN(sha2_224, hash_algorithm::SHA2_224, "SHA-224");
   C3_UPSILON_DEF_HASH_BOTAN(sha2_256, hash_algorithm::SHA2_256, "SHA-256");
   C3_UPSILON_DEF_HASH_BOTAN(sha2_384, hash_algorithm::SHA2_384, "SHA-384");
@@ -90,4 +117,79 @@ namespace c3::upsilon {
   C3_UPSILON_DEF_HASH_BOTAN(blake2b_128, hash_algorithm::BLAKE2b_128, "Blake2b(128)");
   C3_UPSILON_DEF_HASH_BOTAN(blake2b_256, hash_algorithm::BLAKE2b_256, "Blake2b(256)");
   C3_UPSILON_DEF_HASH_BOTAN(blake2b_512, hash_algorithm::BLAKE2b_512, "Blake2b(512)");
+
+  constexpr registry<hash_algorithm, const hash_function*> _hash_funcs = {
+    { hash_algorithm::SHA2_224, &sha2_224_static },
+    { hash_algorithm::SHA2_256, &sha2_256_static },
+    { hash_algorithm::SHA2_384, &sha2_384_static },
+    { hash_algorithm::SHA2_512, &sha2_512_static },
+
+    { hash_algorithm::SHA3_224, &sha3_224_static },
+    { hash_algorithm::SHA3_256, &sha3_256_static },
+    { hash_algorithm::SHA3_384, &sha3_384_static },
+    { hash_algorithm::SHA3_512, &sha3_512_static },
+
+    { hash_algorithm::BLAKE2b_128, &blake2b_128_static },
+    { hash_algorithm::BLAKE2b_256, &blake2b_256_static },
+    { hash_algorithm::BLAKE2b_512, &blake2b_512_static },
+  };
+
+  // Big enough that the syscalls vanish, small enough not to hog address space
+  constexpr size_t fd_map_window = 64 << 20;
+  constexpr size_t fd_read_buffer = 64 << 10;
+
+  void partial_hasher::processv(const iovec* iov, size_t n) {
+    for_each_iovec_chunk<nu::data_const_ref>(iov, n, [this](gsl::span<const nu::data_const_ref> chunk) {
+      _impl->processv(chunk);
+    });
+  }
+
+  uint64_t partial_hasher::process_fd(int fd) {
+    uint64_t total = 0;
+
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      const off_t page_size = sysconf(_SC_PAGESIZE);
+
+      while (pos < st.st_size) {
+        // mmap offsets have to be page aligned
+        off_t map_start = pos - (pos % page_size);
+        size_t skip = static_cast<size_t>(pos - map_start);
+        size_t len = std::min<size_t>(fd_map_window, static_cast<size_t>(st.st_size - pos));
+
+        void* map = mmap(nullptr, skip + len, PROT_READ, MAP_PRIVATE, fd, map_start);
+        // Let read() have a go instead
+        if (map == MAP_FAILED)
+          break;
+        madvise(map, skip + len, MADV_SEQUENTIAL);
+
+        process({ static_cast<const uint8_t*>(map) + skip, static_cast<std::ptrdiff_t>(len) });
+        munmap(map, skip + len);
+
+        pos += len;
+        total += len;
+      }
+
+      // Leave the file where read() would have
+      if (lseek(fd, pos, SEEK_SET) < 0)
+        throw std::system_error(errno, std::system_category(), "Failed to seek file");
+    }
+
+    std::array<uint8_t, fd_read_buffer> buf;
+    while (true) {
+      auto n_read = read(fd, buf.data(), buf.size());
+      if (n_read == 0)
+        break;
+      if (n_read < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::system_error(errno, std::system_category(), "Failed to read file");
+      }
+      process({ buf.data(), n_read });
+      total += static_cast<uint64_t>(n_read);
+    }
+
+    return total;
+  }
 }
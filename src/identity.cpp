@@ -2,6 +2,10 @@
 
 #include "c3/upsilon/csprng.hpp"
 #include "botan_common.hpp"
+#include "shared_global.hpp"
+#include "dispatch.hpp"
+#include "instrument.hpp"
+#include "ed25519.hpp"
 
 #include <botan/ed25519.h>
 #include <botan/pubkey.h>
@@ -11,39 +15,73 @@
 
 #include <iostream>
 
+// Botan's operation objects buffer the message, so they can't be shared between threads.
+// They are cheap to make, so each call gets its own, and the keys stay shared and read-only.
 #define C3_UPSILON_DEF_SIG_BOTAN(CLASS_NAME, ALG, PUB_KEY_TYPE, PRIV_KEY_TYPE) \
+  static const std::string& CLASS_NAME##_provider() { \
+    static const std::string& ret = botan_pk_provider(algorithm_family::signature, static_cast<uint16_t>(ALG)); \
+    return ret; \
+  } \
   class CLASS_NAME##_verifier : public verifier { \
   public: \
-    PUB_KEY_TYPE pub_key; \
-    mutable Botan::PK_Verifier pub; \
+    const PUB_KEY_TYPE pub_key; \
   public: \
     bool verify(nu::data_const_ref input_hash, nu::data_const_ref sig) const override { \
-      return pub.verify_message(input_hash.data(), input_hash.size(), sig.data(), sig.size()); \
+      C3_UPSILON_MEASURE(verify, ALG, input_hash.size()); \
+      Botan::PK_Verifier pub{pub_key, "", Botan::IEEE_1363, CLASS_NAME##_provider()}; \
+      bool ret = pub.verify_message(input_hash.data(), input_hash.size(), sig.data(), sig.size()); \
+      if (!ret) \
+        C3_UPSILON_MEASURE_FAILED(); \
+      return ret; \
+    } \
+    bool verify_batch(gsl::span<const verify_batch_entry> entries, gsl::span<bool> results) const override { \
+      Botan::PK_Verifier pub{pub_key, "", Botan::IEEE_1363, CLASS_NAME##_provider()}; \
+      return verify_batch_by_key<ALG>(pub_key.public_key_bits(), entries, results, [&](size_t i) { \
+        auto& e = entries[i]; \
+        C3_UPSILON_MEASURE(verify, ALG, e.input_hashed.size()); \
+        bool ret = pub.verify_message(e.input_hashed.data(), e.input_hashed.size(), e.sig.data(), e.sig.size()); \
+        if (!ret) \
+          C3_UPSILON_MEASURE_FAILED(); \
+        return ret; \
+      }); \
     } \
     nu::data serialise_pub() const override { \
       return pub_key.public_key_bits(); \
     } \
   public: \
     CLASS_NAME##_verifier(nu::data_const_ref b) : \
-      pub_key{std::vector<uint8_t>{b.begin(), b.end()}}, \
-      pub{pub_key, ""} {} \
+      pub_key{std::vector<uint8_t>{b.begin(), b.end()}} {} \
   }; \
   class CLASS_NAME##_signer : public signer { \
   public: \
-    PRIV_KEY_TYPE priv_key; \
-    mutable Botan::PK_Verifier pub; \
-    mutable Botan::PK_Signer priv; \
+    const PRIV_KEY_TYPE priv_key; \
   public: \
     nu::data sign(nu::data_const_ref input_hash) const override { \
+      C3_UPSILON_MEASURE(sign, ALG, input_hash.size()); \
+      Botan::PK_Signer priv{priv_key, csprng_wrapper::standard, "", Botan::IEEE_1363, CLASS_NAME##_provider()}; \
       return priv.sign_message(input_hash.data(), input_hash.size(), csprng_wrapper::standard); \
     } \
     bool verify(nu::data_const_ref input_hash, nu::data_const_ref sig) const override { \
-      return pub.verify_message(input_hash.data(), input_hash.size(), sig.data(), sig.size()); \
+      C3_UPSILON_MEASURE(verify, ALG, input_hash.size()); \
+      Botan::PK_Verifier pub{priv_key, "", Botan::IEEE_1363, CLASS_NAME##_provider()}; \
+      bool ret = pub.verify_message(input_hash.data(), input_hash.size(), sig.data(), sig.size()); \
+      if (!ret) \
+        C3_UPSILON_MEASURE_FAILED(); \
+      return ret; \
     } \
-    nu::data serialise_priv() const override { \
+    nuking_data serialise_priv() const override { \
       auto ret = priv_key.get_private_key(); \
       return { ret.begin(), ret.end() }; \
     } \
+    size_t serialised_priv_size() const override { \
+      return priv_key.get_private_key().size(); \
+    } \
+    void serialise_priv_into(nu::data_ref b) const override { \
+      auto& key = priv_key.get_private_key(); \
+      if (key.size() != static_cast<size_t>(b.size())) \
+        throw std::invalid_argument("Private key is not the size of the buffer"); \
+      std::copy(key.begin(), key.end(), b.begin()); \
+    } \
     nu::data serialise_pub() const override { \
       return priv_key.public_key_bits(); \
     } \
@@ -51,9 +89,7 @@
     static inline PRIV_KEY_TYPE gen(); \
   public: \
     inline CLASS_NAME##_signer(PRIV_KEY_TYPE&& _priv_key) : \
-      priv_key{std::forward<PRIV_KEY_TYPE&&>(_priv_key)}, \
-      pub{priv_key, ""}, \
-      priv{priv_key, csprng_wrapper::standard, ""} {} \
+      priv_key{std::forward<PRIV_KEY_TYPE&&>(_priv_key)} {} \
     inline CLASS_NAME##_signer() : \
       CLASS_NAME##_signer{gen()} {} \
     inline CLASS_NAME##_signer(nu::data_const_ref b) : \
@@ -65,27 +101,354 @@
   std::unique_ptr<signer> get_signer<ALG>(nu::data_const_ref b) { \
     return std::make_unique<CLASS_NAME##_signer>(b); \
   } \
-  auto __##CLASS_NAME##_signer_get_registered = \
-    _signers.emplace(ALG, [](auto a) { return std::make_unique<CLASS_NAME##_signer>(a); }); \
-  auto __##CLASS_NAME##_verifier_get_registered = \
-    _verifiers.emplace(ALG, [](auto a) { return std::make_unique<CLASS_NAME##_verifier>(a); }); \
-  auto __##CLASS_NAME##_signer_gen_registered = \
-    _sig_gens.emplace(ALG, std::make_unique<CLASS_NAME##_signer>);
+  static std::unique_ptr<verifier> CLASS_NAME##_get_verifier(nu::data_const_ref b) { \
+    return std::make_unique<CLASS_NAME##_verifier>(b); \
+  }
 
 #define C3_UPSILON_DEF_SIG_BOTAN_GEN(CLASS_NAME) \
-  inline decltype(CLASS_NAME##_signer::priv_key) CLASS_NAME##_signer::gen()
+  inline std::remove_const_t<decltype(CLASS_NAME##_signer::priv_key)> CLASS_NAME##_signer::gen()
 
 
 namespace c3::upsilon {
-  std::map<signature_algorithm,
-           std::function<std::unique_ptr<verifier>(nu::data_const_ref)>> _verifiers;
-  std::map<signature_algorithm,
-           std::function<std::unique_ptr<signer>(nu::data_const_ref)>> _signers;
-  std::map<signature_algorithm, std::function<std::unique_ptr<signer>()>> _sig_gens;
+  /// Checks signatures that are all by one key, with verify_one checking a single entry
+  ///
+  /// Algorithms with a batch check of their own specialise this
+  template<signature_algorithm Alg>
+  bool verify_batch_by_key(nu::data_const_ref, gsl::span<const verify_batch_entry> entries,
+                           gsl::span<bool> results, const std::function<bool(size_t)>& verify_one) {
+    bool ret = true;
+    for (decltype(entries.size()) i = 0; i < entries.size(); ++i)
+      ret &= (results[i] = verify_one(static_cast<size_t>(i)));
+    return ret;
+  }
+  template<>
+  bool verify_batch_by_key<signature_algorithm::Curve25519>(nu::data_const_ref pub, gsl::span<const verify_batch_entry> entries,
+                                                            gsl::span<bool> results, const std::function<bool(size_t)>& verify_one) {
+    return ed25519::verify_batch(pub, entries, results, verify_one);
+  }
 
   C3_UPSILON_DEF_SIG_BOTAN(curve25519, signature_algorithm::Curve25519,
                            Botan::Ed25519_PublicKey, Botan::Ed25519_PrivateKey);
   C3_UPSILON_DEF_SIG_BOTAN_GEN(curve25519) {
     return Botan::Ed25519_PrivateKey(csprng_wrapper::standard);
   }
+
+  constexpr registry<signature_algorithm, std::unique_ptr<verifier>(*)(nu::data_const_ref)> _verifiers = {
+    { signature_algorithm::Curve25519, curve25519_get_verifier },
+  };
+  constexpr registry<signature_algorithm, std::unique_ptr<signer>(*)(nu::data_const_ref)> _signers = {
+    { signature_algorithm::Curve25519, get_signer<signature_algorithm::Curve25519> },
+  };
+  constexpr registry<signature_algorithm, std::unique_ptr<signer>(*)()> _sig_gens = {
+    { signature_algorithm::Curve25519, gen_signer<signature_algorithm::Curve25519> },
+  };
+
+  verifier_cache::verifier_cache(size_t max_bytes, size_t n_shards) :
+    _n_shards{std::max<size_t>(n_shards, 1)},
+    _shard_max_bytes{max_bytes / _n_shards},
+    _shards{std::make_unique<shard[]>(_n_shards)} {}
+
+  verifier_cache::shard& verifier_cache::_get_shard(std::string_view key) {
+    return _shards[std::hash<std::string_view>{}(key) % _n_shards];
+  }
+
+  void verifier_cache::_evict(shard& s, std::list<entry>::iterator iter) {
+    s.index.erase(iter->key);
+    s.bytes -= iter->cost;
+    _bytes -= iter->cost;
+    s.lru.erase(iter);
+    ++_evictions;
+  }
+
+  std::shared_ptr<verifier> verifier_cache::get(signature_algorithm alg, nu::data_const_ref b) {
+    // Reuse a buffer so that hits don't allocate
+    thread_local std::string key;
+    auto alg_val = static_cast<std::underlying_type_t<signature_algorithm>>(alg);
+    key.assign(reinterpret_cast<const char*>(&alg_val), sizeof(alg_val));
+    key.append(reinterpret_cast<const char*>(b.data()), static_cast<size_t>(b.size()));
+
+    auto& s = _get_shard(key);
+    {
+      std::lock_guard lock{s.lock};
+      auto iter = s.index.find(key);
+      if (iter != s.index.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, iter->second);
+        ++_hits;
+        return iter->second->value;
+      }
+    }
+    ++_misses;
+
+    // Don't hold the lock over the expensive bit
+    std::shared_ptr<verifier> value = get_verifier(alg, b);
+
+    std::lock_guard lock{s.lock};
+    // Someone else may have beaten us to it
+    auto iter = s.index.find(key);
+    if (iter != s.index.end()) {
+      s.lru.splice(s.lru.begin(), s.lru, iter->second);
+      return iter->second->value;
+    }
+
+    size_t cost = sizeof(entry) + key.size() + verifier_cost
+      // Rough size of the index node
+      + 4 * sizeof(void*) + sizeof(std::string_view);
+
+    s.lru.push_front({ key, value, cost });
+    s.index.emplace(s.lru.front().key, s.lru.begin());
+    s.bytes += cost;
+    _bytes += cost;
+
+    // Always keep the new entry, even if it alone is over budget
+    while (s.bytes > _shard_max_bytes && s.lru.size() > 1)
+      _evict(s, std::prev(s.lru.end()));
+
+    return value;
+  }
+
+  void verifier_cache::clear() {
+    for (size_t i = 0; i < _n_shards; ++i) {
+      auto& s = _shards[i];
+      std::lock_guard lock{s.lock};
+      _bytes -= s.bytes;
+      s.bytes = 0;
+      s.index.clear();
+      s.lru.clear();
+    }
+  }
+
+  verifier_cache::stats verifier_cache::get_stats() const noexcept {
+    return { _hits.load(), _misses.load(), _evictions.load(), _bytes.load() };
+  }
+
+  static shared_global<verifier_cache> _verifier_cache;
+
+  void set_verifier_cache(std::shared_ptr<verifier_cache> cache) {
+    _verifier_cache.set(std::move(cache));
+  }
+  std::shared_ptr<verifier_cache> get_verifier_cache() {
+    return _verifier_cache.get_shared();
+  }
+
+  std::shared_ptr<verifier> get_verifier_cached(signature_algorithm alg, nu::data_const_ref b) {
+    if (auto* cache = _verifier_cache.get())
+      return cache->get(alg, b);
+    else
+      return get_verifier(alg, b);
+  }
+
+  signature_cache::signature_cache(size_t capacity, size_t n_stripes) :
+    _n_sets{std::max<size_t>((capacity + ways - 1) / ways, 1)},
+    _n_stripes{std::min(std::max<size_t>(n_stripes, 1), _n_sets)},
+    _slots{std::make_unique<key[]>(_n_sets * ways)},
+    _next_victim{std::make_unique<uint8_t[]>(_n_sets)},
+    _stripes{std::make_unique<stripe[]>(_n_stripes)} {
+    std::generate(_salt.begin(), _salt.end(), csprng::standard);
+  }
+
+  size_t signature_cache::_get_set(const key& k) const {
+    // The key is already a salted digest, so any bits will do
+    uint64_t x = 0;
+    for (size_t i = 0; i < sizeof(x); ++i)
+      x = (x << 8) | k.value[i];
+    return x % _n_sets;
+  }
+
+  signature_cache::key signature_cache::make_key(signature_algorithm sig_alg, hash_algorithm hash_alg,
+                                                 nu::data_const_ref pub, nu::data_const_ref input_hashed,
+                                                 nu::data_const_ref sig) const {
+    // Reuse a buffer so that lookups don't allocate
+    thread_local nu::data buf;
+    buf.clear();
+
+    auto append_u16 = [](uint16_t x) {
+      buf.push_back(static_cast<uint8_t>(x >> 8));
+      buf.push_back(static_cast<uint8_t>(x));
+    };
+    // Length prefixes keep the fields from running into each other
+    auto append_field = [](nu::data_const_ref b) {
+      auto len = static_cast<uint32_t>(b.size());
+      for (int shift = 24; shift >= 0; shift -= 8)
+        buf.push_back(static_cast<uint8_t>(len >> shift));
+      buf.insert(buf.end(), b.begin(), b.end());
+    };
+
+    append_u16(static_cast<uint16_t>(sig_alg));
+    append_u16(static_cast<uint16_t>(hash_alg));
+    append_field(pub);
+    append_field(input_hashed);
+    append_field(sig);
+
+    key ret;
+    get_hash_function<hash_algorithm::BLAKE2b_256>()->compute_hash(buf, _salt, ret.value);
+    return ret;
+  }
+
+  bool signature_cache::contains(const key& k) {
+    auto set = _get_set(k);
+    auto& s = _stripes[set % _n_stripes];
+    std::lock_guard lock{s.lock};
+
+    auto* slots = &_slots[set * ways];
+    for (size_t i = 0; i < ways; ++i) {
+      if (slots[i] == k) {
+        ++s.hits;
+        return true;
+      }
+    }
+    ++s.misses;
+    return false;
+  }
+
+  void signature_cache::insert(const key& k) {
+    static const key empty;
+
+    auto set = _get_set(k);
+    auto& s = _stripes[set % _n_stripes];
+    std::lock_guard lock{s.lock};
+
+    auto* slots = &_slots[set * ways];
+    for (size_t i = 0; i < ways; ++i)
+      if (slots[i] == k)
+        return;
+
+    ++s.insertions;
+    for (size_t i = 0; i < ways; ++i) {
+      if (slots[i] == empty) {
+        slots[i] = k;
+        return;
+      }
+    }
+
+    // Full, so replace the oldest
+    auto& victim = _next_victim[set];
+    slots[victim] = k;
+    victim = (victim + 1) % ways;
+    ++s.evictions;
+  }
+
+  void signature_cache::clear() {
+    for (size_t i = 0; i < _n_stripes; ++i)
+      _stripes[i].lock.lock();
+
+    std::fill(_slots.get(), _slots.get() + _n_sets * ways, key{});
+    std::fill(_next_victim.get(), _next_victim.get() + _n_sets, 0);
+
+    for (size_t i = 0; i < _n_stripes; ++i)
+      _stripes[i].lock.unlock();
+  }
+
+  signature_cache::stats signature_cache::get_stats() const {
+    stats ret = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < _n_stripes; ++i) {
+      auto& s = _stripes[i];
+      std::lock_guard lock{s.lock};
+      ret.hits += s.hits;
+      ret.misses += s.misses;
+      ret.insertions += s.insertions;
+      ret.evictions += s.evictions;
+    }
+    return ret;
+  }
+
+  static shared_global<signature_cache> _signature_cache;
+
+  void set_signature_cache(std::shared_ptr<signature_cache> cache) {
+    _signature_cache.set(std::move(cache));
+  }
+  std::shared_ptr<signature_cache> get_signature_cache() {
+    return _signature_cache.get_shared();
+  }
+
+  bool identity::verify_hashed(nu::data_const_ref input_hashed, nu::data_const_ref sig) const {
+    auto* cache = _signature_cache.get();
+    if (!cache)
+      return _impl->verify(input_hashed, sig);
+
+    auto k = cache->make_key(_sig_alg, _msg_hasher.properties()->alg, _get_serialised(),
+                             input_hashed, sig);
+    if (cache->contains(k))
+      return true;
+
+    if (!_impl->verify(input_hashed, sig))
+      return false;
+
+    cache->insert(k);
+    return true;
+  }
+
+  bool verify_batch_hashed(gsl::span<const identity_batch_entry> entries, gsl::span<bool> results) {
+    if (results.size() < entries.size())
+      throw std::invalid_argument("Not enough space for batch results");
+
+    auto n_entries = static_cast<size_t>(entries.size());
+    auto* cache = _signature_cache.get();
+
+    bool ret = true;
+
+    // Only the entries the cache can't already vouch for go to the verifiers
+    std::vector<signature_cache::key> keys;
+    std::vector<size_t> pending;
+    std::vector<verify_batch_entry> hashed;
+    pending.reserve(n_entries);
+    hashed.reserve(n_entries);
+    if (cache)
+      keys.reserve(n_entries);
+
+    for (size_t i = 0; i < n_entries; ++i) {
+      auto& e = entries[i];
+      if (cache) {
+        keys.emplace_back(cache->make_key(e.id->_sig_alg, e.id->_msg_hasher.properties()->alg,
+                                          e.id->_get_serialised(), e.msg, e.sig));
+        if (cache->contains(keys.back())) {
+          results[i] = true;
+          continue;
+        }
+      }
+      pending.push_back(i);
+      hashed.push_back({ e.msg, e.sig });
+    }
+
+    auto n_pending = pending.size();
+    std::unique_ptr<bool[]> pending_results{new bool[n_pending]};
+
+    // Hand each run of entries that share a verifier over in one go
+    size_t run_begin = 0;
+    while (run_begin < n_pending) {
+      auto* impl = entries[pending[run_begin]].id->_impl.get();
+      size_t run_end = run_begin + 1;
+      while (run_end < n_pending && entries[pending[run_end]].id->_impl.get() == impl)
+        ++run_end;
+
+      auto run_len = static_cast<std::ptrdiff_t>(run_end - run_begin);
+      ret &= impl->verify_batch(gsl::span<const verify_batch_entry>{hashed}.subspan(run_begin, run_len),
+                                { pending_results.get() + run_begin, run_len });
+
+      run_begin = run_end;
+    }
+
+    for (size_t i = 0; i < n_pending; ++i) {
+      results[pending[i]] = pending_results[i];
+      if (cache && pending_results[i])
+        cache->insert(keys[pending[i]]);
+    }
+
+    return ret;
+  }
+
+  bool verify_batch(gsl::span<const identity_batch_entry> entries, gsl::span<bool> results) {
+    auto n_entries = static_cast<size_t>(entries.size());
+
+    std::vector<hash<>> hashes;
+    hashes.reserve(n_entries);
+    std::vector<identity_batch_entry> hashed;
+    hashed.reserve(n_entries);
+
+    for (auto& e : entries) {
+      hashes.emplace_back(e.id->hash_message(e.msg));
+      hashed.push_back({ e.id, hashes.back().value, e.sig });
+    }
+
+    return verify_batch_hashed(hashed, results);
+  }
 }
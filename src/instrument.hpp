@@ -0,0 +1,90 @@
+#pragma once
+
+#include "c3/upsilon/metrics.hpp"
+
+// Without C3_UPSILON_METRICS these all expand to nothing, so the hot paths are untouched
+
+#ifdef C3_UPSILON_METRICS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+
+namespace c3::upsilon::metrics {
+  /// One thread's counters for one (operation, algorithm) pair
+  ///
+  /// Only the owning thread writes, so plain loads and stores do rather than locked adds;
+  /// the atomics are there so that snapshot can read them from elsewhere
+  struct slot {
+    // (op + 1) << 16 | alg, or 0 if unused
+    std::atomic<uint32_t> key = 0;
+    std::atomic<uint64_t> ops = 0;
+    std::atomic<uint64_t> bytes = 0;
+    std::atomic<uint64_t> errors = 0;
+    std::array<std::atomic<uint64_t>, n_latency_buckets> latency = {};
+  };
+
+  /// Finds or claims this thread's slot
+  slot& local_slot(operation op, uint16_t alg);
+
+  inline void bump(std::atomic<uint64_t>& x, uint64_t n) {
+    x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  class timer {
+  private:
+    slot& _slot;
+    uint64_t _bytes;
+    uint64_t _n_ops;
+    int _n_uncaught;
+    bool _failed = false;
+    bool _discarded = false;
+    std::chrono::steady_clock::time_point _start;
+
+  public:
+    inline void fail() { _failed = true; }
+    /// Counts nothing, for work that is thrown away and redone
+    inline void discard() { _discarded = true; }
+
+  public:
+    inline timer(operation op, uint16_t alg, uint64_t bytes, uint64_t n_ops = 1) :
+      _slot{local_slot(op, alg)}, _bytes{bytes}, _n_ops{n_ops},
+      _n_uncaught{std::uncaught_exceptions()}, _start{std::chrono::steady_clock::now()} {}
+
+    inline ~timer() {
+      if (_discarded)
+        return;
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+
+      size_t bucket = ns > 0 ? 63 - __builtin_clzll(static_cast<uint64_t>(ns)) : 0;
+      bump(_slot.latency[std::min(bucket, n_latency_buckets - 1)], 1);
+      bump(_slot.ops, _n_ops);
+      bump(_slot.bytes, _bytes);
+      if (_failed || std::uncaught_exceptions() > _n_uncaught)
+        bump(_slot.errors, 1);
+    }
+
+    timer(const timer&) = delete;
+    timer& operator=(const timer&) = delete;
+  };
+}
+
+#define C3_UPSILON_MEASURE_N(OP, ALG, BYTES, N) \
+  ::c3::upsilon::metrics::timer _c3_upsilon_timer{::c3::upsilon::metrics::operation::OP, \
+                                                  static_cast<uint16_t>(ALG), \
+                                                  static_cast<uint64_t>(BYTES), static_cast<uint64_t>(N)}
+#define C3_UPSILON_MEASURE_FAILED() _c3_upsilon_timer.fail()
+#define C3_UPSILON_MEASURE_DISCARD() _c3_upsilon_timer.discard()
+
+#else
+
+#define C3_UPSILON_MEASURE_N(OP, ALG, BYTES, N) ((void)0)
+#define C3_UPSILON_MEASURE_FAILED() ((void)0)
+#define C3_UPSILON_MEASURE_DISCARD() ((void)0)
+
+#endif
+
+/// Times the rest of the enclosing scope as one call of OP with ALG over BYTES
+#define C3_UPSILON_MEASURE(OP, ALG, BYTES) C3_UPSILON_MEASURE_N(OP, ALG, BYTES, 1)
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <c3/nu/data.hpp>
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include <sys/uio.h>
+
+namespace c3::upsilon {
+  /// Hands iov to f as a span of Spans, a stack-sized chunk at a time, so nothing is allocated
+  template<typename Span, typename Func>
+  inline void for_each_iovec_chunk(const iovec* iov, size_t n, Func&& f) {
+    using pointer = decltype(std::declval<Span>().data());
+    std::array<Span, 64> chunk;
+    while (n) {
+      size_t n_chunk = std::min(n, chunk.size());
+      for (size_t i = 0; i < n_chunk; ++i)
+        chunk[i] = Span{static_cast<pointer>(iov[i].iov_base),
+                        static_cast<std::ptrdiff_t>(iov[i].iov_len)};
+      f(gsl::span<const Span>{chunk.data(), static_cast<std::ptrdiff_t>(n_chunk)});
+      iov += n_chunk;
+      n -= n_chunk;
+    }
+  }
+
+  /// Walks two buffer lists as if each were one buffer, calling f on each run that is
+  /// contiguous in both, until the shorter runs out. Returns the number of bytes walked
+  template<typename Func>
+  inline uint64_t for_each_common_run(gsl::span<const nu::data_const_ref> input,
+                                      gsl::span<const nu::data_ref> output, Func&& f) {
+    uint64_t ret = 0;
+    std::ptrdiff_t i = 0, o = 0;
+    size_t i_pos = 0, o_pos = 0;
+    while (i < input.size() && o < output.size()) {
+      auto i_left = static_cast<size_t>(input[i].size()) - i_pos;
+      auto o_left = static_cast<size_t>(output[o].size()) - o_pos;
+      auto n = std::min(i_left, o_left);
+      if (n)
+        f(input[i].data() + i_pos, output[o].data() + o_pos, n);
+      ret += n;
+
+      if ((i_pos += n) == static_cast<size_t>(input[i].size())) {
+        ++i;
+        i_pos = 0;
+      }
+      if ((o_pos += n) == static_cast<size_t>(output[o].size())) {
+        ++o;
+        o_pos = 0;
+      }
+    }
+    return ret;
+  }
+}
@@ -1,35 +1,556 @@
 #include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/argon2.hpp"
+#include "c3/upsilon/nuker.hpp"
 
-#include <botan/hkdf.h>
+#include "blake2.hpp"
+#include "dispatch.hpp"
+#include "instrument.hpp"
+
+#include <botan/mac.h>
 #include <botan/shake.h>
+#include <botan/sha3.h>
+
+#include <optional>
+#include <string_view>
 
-#define C3_UPSILON_DEF_KDF_BOTAN(CLASS_NAME, ALG, INPUT, OUTPUT) \
+#define C3_UPSILON_DEF_KDF_BOTAN(CLASS_NAME, ALG, INPUT, OUTPUT, XOF_TYPE, PRK_TYPE, BACKEND) \
   class CLASS_NAME : public kdf { \
   public: \
     kdf_algorithm alg() const noexcept override { return ALG; } \
-    void expand(nu::data_const_ref input, nu::data_ref output) const override; \
+    void expand(nu::data_const_ref input, nu::data_ref output) const override { \
+      C3_UPSILON_MEASURE(kdf_expand, ALG, output.size()); \
+      _record_backend(); \
+      _expand(input, output); \
+    } \
+    std::unique_ptr<xof_reader> begin_expand() const override { \
+      _record_backend(); \
+      return std::make_unique<XOF_TYPE>(); \
+    } \
+    std::unique_ptr<kdf_prk> extract(nu::data_const_ref input, nu::data_const_ref salt) const override { \
+      _record_backend(); \
+      return std::make_unique<PRK_TYPE>(input, salt); \
+    } \
+  private: \
+    void _expand(nu::data_const_ref input, nu::data_ref output) const; \
+    static void _record_backend() { \
+      [[maybe_unused]] static const bool recorded = \
+        (record_backend(algorithm_family::kdf, static_cast<uint16_t>(ALG), BACKEND), true); \
+    } \
   }; \
   static const CLASS_NAME CLASS_NAME##_static; \
-  static auto __##CLASS_NAME##_registered = _kdfs.emplace(ALG, &CLASS_NAME##_static); \
   template<> \
   const kdf* get_kdf<ALG>() { return &CLASS_NAME##_static; } \
-  void CLASS_NAME::expand(nu::data_const_ref INPUT, nu::data_ref OUTPUT) const
+  void CLASS_NAME::_expand(nu::data_const_ref INPUT, nu::data_ref OUTPUT) const
 
 namespace c3::upsilon {
-  std::map<kdf_algorithm, const kdf*> _kdfs;
+  // Botan's SHAKE wants the output length up front, so drive the sponge directly
+  template<size_t Bitrate>
+  class shake_xof : public xof_reader {
+  private:
+    static constexpr size_t byterate = Bitrate / 8;
+
+  private:
+    Botan::secure_vector<uint64_t> _state = Botan::secure_vector<uint64_t>(25);
+    size_t _state_pos = 0;
+    bool _squeezing = false;
+    // The state has to be permuted before each block but the first
+    bool _permute_next = false;
+    std::array<uint8_t, byterate> _block;
+    size_t _block_pos = byterate;
+    // 0x1F for SHAKE, 0x04 for cSHAKE
+    uint8_t _pad = 0x1F;
+
+  private:
+    void _next_block(uint8_t* output) {
+      if (_permute_next)
+        Botan::SHA_3::permute(_state.data());
+      Botan::SHA_3::expand(Bitrate, _state, output, byterate);
+      _permute_next = true;
+    }
+
+  public:
+    void absorb(nu::data_const_ref input) override {
+      if (_squeezing)
+        throw std::logic_error("Cannot absorb once squeezing has started");
+      _state_pos = Botan::SHA_3::absorb(Bitrate, _state, _state_pos, input.data(), input.size());
+    }
+
+    void squeeze(nu::data_ref output) override {
+      if (!_squeezing) {
+        Botan::SHA_3::finish(Bitrate, _state, _state_pos, _pad, 0x80);
+        _squeezing = true;
+      }
+
+      auto* out = output.data();
+      auto remaining = static_cast<size_t>(output.size());
+
+      // Drain what's left of the last block
+      auto n_buffered = std::min(remaining, byterate - _block_pos);
+      std::copy(_block.begin() + _block_pos, _block.begin() + _block_pos + n_buffered, out);
+      _block_pos += n_buffered;
+      out += n_buffered;
+      remaining -= n_buffered;
+
+      // Whole blocks can skip the buffer
+      for (; remaining >= byterate; out += byterate, remaining -= byterate)
+        _next_block(out);
+
+      if (remaining > 0) {
+        _next_block(_block.data());
+        std::copy(_block.begin(), _block.begin() + remaining, out);
+        _block_pos = remaining;
+      }
+    }
+
+    void reset() override {
+      std::fill(_state.begin(), _state.end(), 0);
+      _state_pos = 0;
+      _squeezing = false;
+      _permute_next = false;
+      nuke(_block.data(), _block.size());
+      _block_pos = byterate;
+    }
+
+  public:
+    shake_xof() = default;
+    explicit shake_xof(uint8_t pad) : _pad{pad} {}
+    ~shake_xof() override { nuke(_block.data(), _block.size()); }
+  };
+
+  // NIST SP 800-185 left_encode
+  inline void append_left_encoded(nu::data& b, uint64_t x) {
+    size_t n = 1;
+    while (n < 8 && (x >> (8 * n)))
+      ++n;
+    b.push_back(static_cast<uint8_t>(n));
+    for (size_t i = n; i > 0; --i)
+      b.push_back(static_cast<uint8_t>(x >> (8 * (i - 1))));
+  }
+
+  // encode_string, which is what tells each field's end apart from the start of the next
+  inline void absorb_encoded(xof_reader& xof, nu::data_const_ref s) {
+    nu::data len;
+    append_left_encoded(len, static_cast<uint64_t>(s.size()) * 8);
+    xof.absorb(len);
+    xof.absorb(s);
+  }
+
+  // bytepad(encode_string(N) || encode_string(S), rate) with an empty N, which starts every cSHAKE input
+  inline nu::data cshake_prefix(size_t byterate, std::string_view customisation) {
+    nu::data ret;
+    append_left_encoded(ret, byterate);
+    append_left_encoded(ret, 0);
+    append_left_encoded(ret, customisation.size() * 8);
+    ret.insert(ret.end(), customisation.begin(), customisation.end());
+    ret.resize((ret.size() + byterate - 1) / byterate * byterate);
+    return ret;
+  }
+
+  // A sponge has no separate extract step, but the absorbed secret can still be kept as a midstate
+  //
+  // Salt, input and info are each length prefixed under cSHAKE, so no two ways of splitting the
+  // same bytes between them collide. With neither salt nor info this is SHAKE of the input, the same
+  // as expand, which SHAKE's padding keeps apart from anything cSHAKE gives
+  template<size_t Bitrate>
+  class shake_prk : public kdf_prk {
+  private:
+    shake_xof<Bitrate> _absorbed{0x04};
+    // Only kept without a salt
+    std::optional<shake_xof<Bitrate>> _plain;
+    shake_xof<Bitrate> _working;
+
+  public:
+    void expand(nu::data_const_ref info, nu::data_ref output) override {
+      // Same size, so these copy into the existing buffers
+      if (_plain && info.empty())
+        _working = *_plain;
+      else {
+        _working = _absorbed;
+        absorb_encoded(_working, info);
+      }
+      _working.squeeze(output);
+    }
+
+  public:
+    shake_prk(nu::data_const_ref input, nu::data_const_ref salt) {
+      static const nu::data prefix = cshake_prefix(Bitrate / 8, "c3-upsilon kdf");
+      _absorbed.absorb(prefix);
+      absorb_encoded(_absorbed, salt);
+      absorb_encoded(_absorbed, input);
+      if (salt.empty()) {
+        _plain.emplace();
+        _plain->absorb(input);
+      }
+    }
+  };
+
+  std::unique_ptr<xof_reader> begin_cshake(kdf_algorithm alg, std::string_view customisation) {
+    switch (alg) {
+    case kdf_algorithm::Shake128: {
+      auto ret = std::make_unique<shake_xof<1344>>(0x04);
+      ret->absorb(cshake_prefix(1344 / 8, customisation));
+      return ret;
+    }
+    case kdf_algorithm::Shake256: {
+      auto ret = std::make_unique<shake_xof<1088>>(0x04);
+      ret->absorb(cshake_prefix(1088 / 8, customisation));
+      return ret;
+    }
+    default:
+      throw std::invalid_argument("cSHAKE needs Shake128 or Shake256");
+    }
+  }
+
+  // Botan runs Keccak-f itself, so its choice of permutation is the one SHAKE gets
+  static const std::string& keccak_backend() {
+    static const std::string ret = Botan::SHA_3{256}.provider();
+    return ret;
+  }
+
+  // For kdfs with the one implementation, which an override can only confirm
+  static const char* only_backend(kdf_algorithm alg, const char* name) {
+    return choose_backend(algorithm_family::kdf, static_cast<uint16_t>(alg), { { name, {} } });
+  }
+
+  struct hmac_sha2_256 {
+    static constexpr const char* name = "HMAC(SHA-256)";
+    static constexpr auto alg = kdf_algorithm::HKDF_SHA2_256;
+  };
+  struct hmac_sha2_512 {
+    static constexpr const char* name = "HMAC(SHA-512)";
+    static constexpr auto alg = kdf_algorithm::HKDF_SHA2_512;
+  };
+
+  // Botan's HMAC keeps the padded key hashes after set_key, and final leaves it ready for the next message
+  template<typename Name>
+  class hmac_prf {
+  public:
+    static constexpr size_t max_output = 64;
+
+  private:
+    std::unique_ptr<Botan::MessageAuthenticationCode> _mac =
+      create_botan<Botan::MessageAuthenticationCode>(algorithm_family::kdf, static_cast<uint16_t>(Name::alg), Name::name);
+
+  public:
+    static const std::string& backend() {
+      static const std::string ret = hmac_prf{}._mac->provider();
+      return ret;
+    }
+
+    inline size_t output_length() const { return _mac->output_length(); }
+    inline void set_key(const uint8_t* key, size_t len) { _mac->set_key(key, len); }
+    inline void update(const uint8_t* input, size_t len) { _mac->update(input, len); }
+    inline void final(uint8_t* output) { _mac->final(output); }
+  };
+
+  // Keyed BLAKE2b, with the key block compressed once and the resulting state copied for each message
+  class blake2b_prf {
+  public:
+    static constexpr size_t max_output = blake2::blake2b::max_output;
+
+  private:
+    std::array<uint8_t, blake2::blake2b::max_key> _key;
+    size_t _key_len = 0;
+    blake2::blake2b _keyed;
+    blake2::blake2b _working;
+    bool _empty = true;
+
+  public:
+    inline size_t output_length() const { return max_output; }
+
+    void set_key(const uint8_t* key, size_t len) {
+      // Same trick as HMAC for long keys
+      if (len > _key.size()) {
+        blake2::blake2b shortener;
+        shortener.update(key, len);
+        shortener.final(_key.data());
+        _key_len = _key.size();
+      }
+      else {
+        std::copy(key, key + len, _key.begin());
+        _key_len = len;
+      }
+
+      _keyed = blake2::blake2b{max_output, _key.data(), _key_len};
+      _keyed.absorb_buffered();
+      _working = _keyed;
+      _empty = true;
+    }
+
+    inline void update(const uint8_t* input, size_t len) {
+      if (len == 0)
+        return;
+      _working.update(input, len);
+      _empty = false;
+    }
+
+    void final(uint8_t* output) {
+      // The midstate assumed more input was coming, so an empty message has to start over
+      if (_empty)
+        blake2::blake2b{max_output, _key.data(), _key_len}.final(output);
+      else
+        _working.final(output);
+
+      _working = _keyed;
+      _empty = true;
+    }
+
+  public:
+    ~blake2b_prf() { nuke(_key.data(), _key.size()); }
+  };
+
+  // RFC 5869, with no salt meaning a block of zeroes
+  template<typename Prf>
+  void hkdf_begin_extract(Prf& prf, nu::data_const_ref salt) {
+    if (salt.empty()) {
+      std::array<uint8_t, Prf::max_output> zeroes{};
+      prf.set_key(zeroes.data(), prf.output_length());
+    }
+    else
+      prf.set_key(salt.data(), salt.size());
+  }
+
+  // Produces T(1) | T(2) | ... from RFC 5869, a piece at a time
+  template<typename Prf>
+  class hkdf_expander {
+  private:
+    Prf _prf;
+    std::array<uint8_t, Prf::max_output> _block;
+    size_t _block_pos;
+    uint8_t _counter;
+
+  public:
+    inline size_t max_output() const { return 255 * _prf.output_length(); }
+
+    void rekey(const uint8_t* prk, size_t len) {
+      _prf.set_key(prk, len);
+      restart();
+    }
+
+    inline void restart() {
+      _block_pos = _prf.output_length();
+      _counter = 0;
+    }
+
+    void read(nu::data_const_ref info, uint8_t* output, size_t len) {
+      const size_t block_len = _prf.output_length();
+
+      while (len > 0) {
+        if (_block_pos == block_len) {
+          if (_counter == 255)
+            throw std::range_error("HKDF cannot output more than 255 blocks");
+
+          if (_counter > 0)
+            _prf.update(_block.data(), block_len);
+          _prf.update(info.data(), info.size());
+          ++_counter;
+          _prf.update(&_counter, 1);
+          _prf.final(_block.data());
+          _block_pos = 0;
+        }
+
+        auto n = std::min(len, block_len - _block_pos);
+        std::copy(_block.begin() + _block_pos, _block.begin() + _block_pos + n, output);
+        _block_pos += n;
+        output += n;
+        len -= n;
+      }
+    }
+
+  public:
+    hkdf_expander() { restart(); }
+    ~hkdf_expander() { nuke(_block.data(), _block.size()); }
+  };
+
+  template<typename Prf>
+  class hkdf_expanding_prk : public kdf_prk {
+  protected:
+    hkdf_expander<Prf> _expander;
+
+  public:
+    void expand(nu::data_const_ref info, nu::data_ref output) override {
+      // Check first, rather than throwing with half the output written
+      if (static_cast<size_t>(output.size()) > _expander.max_output())
+        throw std::range_error("Too many bytes requested from HKDF");
+
+      _expander.restart();
+      _expander.read(info, output.data(), output.size());
+    }
+  };
+
+  template<typename Prf>
+  class hkdf_prk : public hkdf_expanding_prk<Prf> {
+  public:
+    hkdf_prk(nu::data_const_ref input, nu::data_const_ref salt) {
+      Prf extractor;
+      hkdf_begin_extract(extractor, salt);
+      extractor.update(input.data(), input.size());
+
+      std::array<uint8_t, Prf::max_output> prk;
+      extractor.final(prk.data());
+      this->_expander.rekey(prk.data(), extractor.output_length());
+      nuke(prk.data(), prk.size());
+    }
+  };
+
+  template<typename Prf>
+  class hkdf_xof : public xof_reader {
+  private:
+    Prf _extractor;
+    hkdf_expander<Prf> _expander;
+    bool _squeezing = false;
+
+  public:
+    void absorb(nu::data_const_ref input) override {
+      if (_squeezing)
+        throw std::logic_error("Cannot absorb once squeezing has started");
+      _extractor.update(input.data(), input.size());
+    }
+
+    void squeeze(nu::data_ref output) override {
+      if (!_squeezing) {
+        std::array<uint8_t, Prf::max_output> prk;
+        _extractor.final(prk.data());
+        _expander.rekey(prk.data(), _extractor.output_length());
+        nuke(prk.data(), prk.size());
+        _squeezing = true;
+      }
+
+      _expander.read({}, output.data(), output.size());
+    }
+
+    void reset() override {
+      hkdf_begin_extract(_extractor, {});
+      _squeezing = false;
+    }
+
+  public:
+    hkdf_xof() { hkdf_begin_extract(_extractor, {}); }
+  };
 
-  C3_UPSILON_DEF_KDF_BOTAN(shake128, kdf_algorithm::Shake128, input, output) {
+  C3_UPSILON_DEF_KDF_BOTAN(shake128, kdf_algorithm::Shake128, input, output, shake_xof<1344>, shake_prk<1344>,
+                           only_backend(kdf_algorithm::Shake128, keccak_backend().c_str())) {
     // Dumb idiots whomst write crypto
     // Size is in bits
     Botan::SHAKE_128 impl(output.size() * 8);
     impl.process(input.data(), input.size());
     impl.final(output.data());
   }
-  C3_UPSILON_DEF_KDF_BOTAN(shake256, kdf_algorithm::Shake256, input, output) {
+  C3_UPSILON_DEF_KDF_BOTAN(shake256, kdf_algorithm::Shake256, input, output, shake_xof<1088>, shake_prk<1088>,
+                           only_backend(kdf_algorithm::Shake256, keccak_backend().c_str())) {
     // Dumb idiots whomst write crypto
     // Size is in bits
     Botan::SHAKE_256 impl(output.size() * 8);
     impl.process(input.data(), input.size());
     impl.final(output.data());
   }
+
+  C3_UPSILON_DEF_KDF_BOTAN(hkdf_sha2_256, kdf_algorithm::HKDF_SHA2_256, input, output,
+                           hkdf_xof<hmac_prf<hmac_sha2_256>>, hkdf_prk<hmac_prf<hmac_sha2_256>>,
+                           hmac_prf<hmac_sha2_256>::backend()) {
+    hkdf_prk<hmac_prf<hmac_sha2_256>>{input, {}}.expand({}, output);
+  }
+  C3_UPSILON_DEF_KDF_BOTAN(hkdf_sha2_512, kdf_algorithm::HKDF_SHA2_512, input, output,
+                           hkdf_xof<hmac_prf<hmac_sha2_512>>, hkdf_prk<hmac_prf<hmac_sha2_512>>,
+                           hmac_prf<hmac_sha2_512>::backend()) {
+    hkdf_prk<hmac_prf<hmac_sha2_512>>{input, {}}.expand({}, output);
+  }
+  // HKDF's construction, with keyed BLAKE2b-512 standing in for HMAC
+  C3_UPSILON_DEF_KDF_BOTAN(blake2b_kdf, kdf_algorithm::BLAKE2b, input, output,
+                           hkdf_xof<blake2b_prf>, hkdf_prk<blake2b_prf>,
+                           only_backend(kdf_algorithm::BLAKE2b, "portable")) {
+    hkdf_prk<blake2b_prf>{input, {}}.expand({}, output);
+  }
+
+  // Argon2id's tag is the prk, and subkeys come from HKDF over keyed BLAKE2b as above
+  static void argon2id_rekey(hkdf_expander<blake2b_prf>& expander, nu::data_const_ref input,
+                             nu::data_const_ref salt, const argon2_params& params) {
+    std::array<uint8_t, blake2b_prf::max_output> tag;
+    argon2id(input, salt, tag, params);
+    expander.rekey(tag.data(), tag.size());
+    nuke(tag.data(), tag.size());
+  }
+
+  class argon2id_prk : public hkdf_expanding_prk<blake2b_prf> {
+  public:
+    argon2id_prk(nu::data_const_ref input, nu::data_const_ref salt, const argon2_params& params) {
+      argon2id_rekey(_expander, input, salt, params);
+    }
+  };
+
+  // Argon2id can't start until it has the whole password, so this just holds onto it
+  class argon2id_xof : public xof_reader {
+  private:
+    argon2_params _params;
+    nu::data _salt;
+    nuking_data _input;
+    hkdf_expander<blake2b_prf> _expander;
+    bool _squeezing = false;
+
+  public:
+    void absorb(nu::data_const_ref input) override {
+      if (_squeezing)
+        throw std::logic_error("Cannot absorb once squeezing has started");
+      _input.insert(_input.end(), input.begin(), input.end());
+    }
+
+    void squeeze(nu::data_ref output) override {
+      if (!_squeezing) {
+        argon2id_rekey(_expander, _input, _salt, _params);
+        _squeezing = true;
+      }
+
+      _expander.read({}, output.data(), output.size());
+    }
+
+    void reset() override {
+      // The arena scrubs on deallocation, but clear doesn't deallocate
+      nuke(_input.data(), _input.size());
+      _input.clear();
+      _squeezing = false;
+    }
+
+  public:
+    argon2id_xof(const argon2_params& params, nu::data_const_ref salt) :
+      _params{params}, _salt{salt.begin(), salt.end()} {}
+  };
+
+  class argon2id_kdf : public kdf {
+  private:
+    argon2_params _params;
+    nu::data _salt;
+
+  public:
+    kdf_algorithm alg() const noexcept override { return kdf_algorithm::Argon2id; }
+    void expand(nu::data_const_ref input, nu::data_ref output) const override {
+      C3_UPSILON_MEASURE(kdf_expand, kdf_algorithm::Argon2id, output.size());
+      argon2id_prk{input, _salt, _params}.expand({}, output);
+    }
+    std::unique_ptr<xof_reader> begin_expand() const override {
+      return std::make_unique<argon2id_xof>(_params, _salt);
+    }
+    std::unique_ptr<kdf_prk> extract(nu::data_const_ref input, nu::data_const_ref salt) const override {
+      return std::make_unique<argon2id_prk>(input, salt.empty() ? nu::data_const_ref{_salt} : salt, _params);
+    }
+
+  public:
+    argon2id_kdf(nu::data_const_ref salt, const argon2_params& params) :
+      _params{params}, _salt{salt.begin(), salt.end()} {}
+  };
+
+  std::unique_ptr<kdf> make_argon2id_kdf(nu::data_const_ref salt, const argon2_params& params) {
+    if (salt.size() < 8)
+      throw std::invalid_argument("Argon2 needs a salt of at least 8 bytes");
+    return std::make_unique<argon2id_kdf>(salt, params);
+  }
+
+  constexpr registry<kdf_algorithm, const kdf*> _kdfs = {
+    { kdf_algorithm::Shake128, &shake128_static },
+    { kdf_algorithm::Shake256, &shake256_static },
+
+    { kdf_algorithm::HKDF_SHA2_256, &hkdf_sha2_256_static },
+    { kdf_algorithm::HKDF_SHA2_512, &hkdf_sha2_512_static },
+
+    { kdf_algorithm::BLAKE2b, &blake2b_kdf_static },
+  };
 }
@@ -0,0 +1,325 @@
+#include "c3/upsilon/mac.hpp"
+#include "c3/upsilon/nuker.hpp"
+
+#include "blake2.hpp"
+#include "dispatch.hpp"
+#include "instrument.hpp"
+#include "poly1305.hpp"
+
+#include <botan/hash.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace c3::upsilon {
+  bool constant_time_equal(nu::data_const_ref a, nu::data_const_ref b) noexcept {
+    if (a.size() != b.size())
+      return false;
+
+    // volatile, so the compiler can't stop at the first difference
+    volatile uint8_t diff = 0;
+    for (decltype(a.size()) i = 0; i < a.size(); ++i)
+      diff = diff | (a[i] ^ b[i]);
+    return diff == 0;
+  }
+
+  bool mac_key::verify(nu::data_const_ref msg, nu::data_const_ref expected) const {
+    auto tag_size = properties()->tag_size;
+    if (static_cast<size_t>(expected.size()) != tag_size)
+      return false;
+
+    std::array<uint8_t, 64> actual;
+    tag(msg, nu::data_ref{actual}.first(tag_size));
+    bool ret = constant_time_equal(nu::data_const_ref{actual}.first(tag_size), expected);
+    nuke(actual.data(), actual.size());
+    return ret;
+  }
+
+  static void check_batch(const mac_properties* props, size_t n_msgs, size_t output_size) {
+    if (output_size != n_msgs * props->tag_size)
+      throw std::invalid_argument("Batch output must hold one tag per message");
+    if (props->one_time && n_msgs > 1)
+      throw std::logic_error("A one-time key cannot authenticate more than one message");
+  }
+
+  void mac_key::tag_batch(gsl::span<const nu::data_const_ref> msgs, nu::data_ref output) const {
+    auto props = properties();
+    check_batch(props, msgs.size(), output.size());
+    for (decltype(msgs.size()) i = 0; i < msgs.size(); ++i)
+      tag(msgs[i], output.subspan(i * props->tag_size, props->tag_size));
+  }
+
+  bool mac_key::verify_batch(gsl::span<const mac_batch_entry> entries, gsl::span<bool> results) const {
+    auto tag_size = properties()->tag_size;
+
+    std::vector<nu::data_const_ref> msgs;
+    msgs.reserve(entries.size());
+    for (auto& i : entries)
+      msgs.push_back(i.msg);
+
+    nuking_data actual(entries.size() * tag_size);
+    tag_batch(msgs, actual);
+
+    bool ret = true;
+    for (decltype(entries.size()) i = 0; i < entries.size(); ++i)
+      ret &= (results[i] = constant_time_equal(nu::data_const_ref{actual}.subspan(i * tag_size, tag_size),
+                                               entries[i].tag));
+    return ret;
+  }
+
+  template<typename Key>
+  class mac_function_impl : public mac_function {
+  public:
+    std::unique_ptr<mac_key> make_key(nu::data_const_ref key) const override {
+      if (static_cast<size_t>(key.size()) < Key::props.min_key || static_cast<size_t>(key.size()) > Key::props.max_key)
+        throw std::range_error("Invalid MAC key length");
+      return std::make_unique<Key>(key);
+    }
+    const mac_properties* properties() const noexcept override { return &Key::props; }
+  };
+
+  // The key block is compressed once, and each message starts from a copy of the resulting state
+  template<mac_algorithm Alg, size_t TagSize>
+  class blake2b_key : public mac_key {
+  public:
+    static constexpr mac_properties props{Alg, TagSize, 1, blake2::blake2b::max_key};
+
+  private:
+    blake2::blake2b _keyed;
+    // The midstate assumes more input is coming, so the empty message's tag is worked out up front
+    std::array<uint8_t, TagSize> _empty_tag;
+
+  private:
+    void _tag(nu::data_const_ref msg, uint8_t* output) const {
+      if (msg.empty()) {
+        std::copy(_empty_tag.begin(), _empty_tag.end(), output);
+        return;
+      }
+      auto state = _keyed;
+      state.update(msg.data(), msg.size());
+      state.final(output);
+    }
+
+    static bool _use_avx2() {
+      static const bool ret = std::string_view{choose_backend(algorithm_family::mac, static_cast<uint16_t>(Alg), {
+#ifdef C3_UPSILON_BLAKE2_AVX2
+        { "avx2", { cpu_feature::avx2 } },
+#endif
+        { "portable", {} },
+      })} == "avx2";
+      return ret;
+    }
+
+  public:
+    void tag(nu::data_const_ref msg, nu::data_ref output) const override {
+      C3_UPSILON_MEASURE(mac, Alg, msg.size());
+      if (static_cast<size_t>(output.size()) != TagSize)
+        throw std::invalid_argument("MAC output must be exactly one tag long");
+      _tag(msg, output.data());
+    }
+
+    /// Four messages at a time, one to a vector lane, for as many blocks as the shortest of them has
+    void tag_batch(gsl::span<const nu::data_const_ref> msgs, nu::data_ref output) const override {
+      check_batch(&props, msgs.size(), output.size());
+
+      uint64_t total = 0;
+      for (auto& i : msgs)
+        total += i.size();
+      C3_UPSILON_MEASURE_N(mac, Alg, total, msgs.size());
+
+      // Grouping similar lengths keeps the lanes busy for longer
+      std::vector<size_t> order(msgs.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(),
+                       [&](size_t a, size_t b) { return msgs[a].size() < msgs[b].size(); });
+
+      size_t i = 0;
+      for (; i + 4 <= order.size(); i += 4) {
+        blake2::blake2b states[4] = { _keyed, _keyed, _keyed, _keyed };
+        blake2::blake2b* lanes[4];
+        const uint8_t* inputs[4];
+
+        // The last block has to go through final, so each lane leaves at least one byte
+        size_t n_blocks = std::numeric_limits<size_t>::max();
+        for (size_t lane = 0; lane < 4; ++lane) {
+          auto size = static_cast<size_t>(msgs[order[i + lane]].size());
+          n_blocks = std::min(n_blocks, size ? (size - 1) / blake2::blake2b::block_size : 0);
+          lanes[lane] = &states[lane];
+          inputs[lane] = msgs[order[i + lane]].data();
+        }
+        if (n_blocks > 0)
+          blake2::blake2b::update_x4(lanes, inputs, n_blocks, _use_avx2());
+
+        for (size_t lane = 0; lane < 4; ++lane) {
+          auto& msg = msgs[order[i + lane]];
+          auto* out = output.data() + order[i + lane] * TagSize;
+          if (msg.empty()) {
+            std::copy(_empty_tag.begin(), _empty_tag.end(), out);
+            continue;
+          }
+          auto done = n_blocks * blake2::blake2b::block_size;
+          states[lane].update(msg.data() + done, msg.size() - done);
+          states[lane].final(out);
+        }
+      }
+
+      for (; i < order.size(); ++i)
+        _tag(msgs[order[i]], output.data() + order[i] * TagSize);
+    }
+
+    const mac_properties* properties() const noexcept override { return &props; }
+
+  public:
+    blake2b_key(nu::data_const_ref key) : _keyed{TagSize, key.data(), static_cast<size_t>(key.size())} {
+      blake2::blake2b{TagSize, key.data(), static_cast<size_t>(key.size())}.final(_empty_tag.data());
+      _keyed.absorb_buffered();
+      // So that active_backends sees the choice before any batch has run
+      _use_avx2();
+    }
+    ~blake2b_key() { nuke(_empty_tag.data(), _empty_tag.size()); }
+  };
+
+  template<mac_algorithm Alg, size_t TagSize>
+  class blake2s_key : public mac_key {
+  public:
+    static constexpr mac_properties props{Alg, TagSize, 1, blake2::blake2s::max_key};
+
+  private:
+    blake2::blake2s _keyed;
+    std::array<uint8_t, TagSize> _empty_tag;
+
+  public:
+    void tag(nu::data_const_ref msg, nu::data_ref output) const override {
+      C3_UPSILON_MEASURE(mac, Alg, msg.size());
+      if (static_cast<size_t>(output.size()) != TagSize)
+        throw std::invalid_argument("MAC output must be exactly one tag long");
+      if (msg.empty()) {
+        std::copy(_empty_tag.begin(), _empty_tag.end(), output.begin());
+        return;
+      }
+      auto state = _keyed;
+      state.update(msg.data(), msg.size());
+      state.final(output.data());
+    }
+
+    const mac_properties* properties() const noexcept override { return &props; }
+
+  public:
+    blake2s_key(nu::data_const_ref key) : _keyed{TagSize, key.data(), static_cast<size_t>(key.size())} {
+      blake2::blake2s{TagSize, key.data(), static_cast<size_t>(key.size())}.final(_empty_tag.data());
+      _keyed.absorb_buffered();
+      record_backend(algorithm_family::mac, static_cast<uint16_t>(Alg), "portable");
+    }
+    ~blake2s_key() { nuke(_empty_tag.data(), _empty_tag.size()); }
+  };
+
+  // RFC 2104, with the padded key blocks hashed once and each message starting from copies of the two states
+  class hmac_sha2_256_key : public mac_key {
+  public:
+    static constexpr mac_properties props{mac_algorithm::HMAC_SHA2_256, 32, 1, std::numeric_limits<size_t>::max()};
+    static constexpr size_t block_size = 64;
+
+  private:
+    std::unique_ptr<Botan::HashFunction> _inner;
+    std::unique_ptr<Botan::HashFunction> _outer;
+
+  public:
+    void tag(nu::data_const_ref msg, nu::data_ref output) const override {
+      C3_UPSILON_MEASURE(mac, mac_algorithm::HMAC_SHA2_256, msg.size());
+      if (static_cast<size_t>(output.size()) != props.tag_size)
+        throw std::invalid_argument("MAC output must be exactly one tag long");
+
+      std::array<uint8_t, 32> inner_hash;
+      auto inner = _inner->copy_state();
+      inner->update(msg.data(), msg.size());
+      inner->final(inner_hash.data());
+
+      auto outer = _outer->copy_state();
+      outer->update(inner_hash.data(), inner_hash.size());
+      outer->final(output.data());
+      nuke(inner_hash.data(), inner_hash.size());
+    }
+
+    const mac_properties* properties() const noexcept override { return &props; }
+
+  public:
+    hmac_sha2_256_key(nu::data_const_ref key) {
+      auto hash = create_botan<Botan::HashFunction>(algorithm_family::mac,
+                                                    static_cast<uint16_t>(mac_algorithm::HMAC_SHA2_256), "SHA-256");
+
+      std::array<uint8_t, block_size> padded = {};
+      if (static_cast<size_t>(key.size()) > block_size) {
+        hash->update(key.data(), key.size());
+        hash->final(padded.data());
+      }
+      else {
+        std::copy(key.begin(), key.end(), padded.begin());
+      }
+
+      _inner = hash->copy_state();
+      _outer = hash->copy_state();
+      for (auto& i : padded)
+        i ^= 0x36;
+      _inner->update(padded.data(), padded.size());
+      for (auto& i : padded)
+        i ^= 0x36 ^ 0x5c;
+      _outer->update(padded.data(), padded.size());
+      nuke(padded.data(), padded.size());
+    }
+  };
+
+  class poly1305_key : public mac_key {
+  public:
+    static constexpr mac_properties props{mac_algorithm::Poly1305, poly1305::poly1305::tag_size,
+                                          poly1305::poly1305::key_size, poly1305::poly1305::key_size, true};
+
+  private:
+    poly1305::poly1305 _impl;
+    // Set by the first tag or verify, whichever thread it is on, so the key never covers two messages
+    mutable std::atomic<bool> _used = false;
+
+  public:
+    void tag(nu::data_const_ref msg, nu::data_ref output) const override {
+      C3_UPSILON_MEASURE(mac, mac_algorithm::Poly1305, msg.size());
+      if (static_cast<size_t>(output.size()) != props.tag_size)
+        throw std::invalid_argument("MAC output must be exactly one tag long");
+      if (_used.exchange(true))
+        throw std::logic_error("A one-time key cannot authenticate more than one message");
+      _impl.tag(msg.data(), msg.size(), output.data());
+    }
+
+    const mac_properties* properties() const noexcept override { return &props; }
+
+  public:
+    poly1305_key(nu::data_const_ref key) : _impl{key.data()} {
+      record_backend(algorithm_family::mac, static_cast<uint16_t>(mac_algorithm::Poly1305), "portable");
+    }
+  };
+
+  static const mac_function_impl<hmac_sha2_256_key> hmac_sha2_256_static;
+  static const mac_function_impl<blake2b_key<mac_algorithm::BLAKE2b_128, 16>> blake2b_128_static;
+  static const mac_function_impl<blake2b_key<mac_algorithm::BLAKE2b_256, 32>> blake2b_256_static;
+  static const mac_function_impl<blake2b_key<mac_algorithm::BLAKE2b_512, 64>> blake2b_512_static;
+  static const mac_function_impl<blake2s_key<mac_algorithm::BLAKE2s_128, 16>> blake2s_128_static;
+  static const mac_function_impl<blake2s_key<mac_algorithm::BLAKE2s_256, 32>> blake2s_256_static;
+  static const mac_function_impl<poly1305_key> poly1305_static;
+
+  constexpr registry<mac_algorithm, const mac_function*> _mac_functions = {
+    { mac_algorithm::HMAC_SHA2_256, &hmac_sha2_256_static },
+
+    { mac_algorithm::BLAKE2b_128, &blake2b_128_static },
+    { mac_algorithm::BLAKE2b_256, &blake2b_256_static },
+    { mac_algorithm::BLAKE2b_512, &blake2b_512_static },
+
+    { mac_algorithm::BLAKE2s_128, &blake2s_128_static },
+    { mac_algorithm::BLAKE2s_256, &blake2s_256_static },
+
+    { mac_algorithm::Poly1305, &poly1305_static },
+  };
+}
@@ -0,0 +1,136 @@
+#include "c3/upsilon/metrics.hpp"
+
+#include "instrument.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace c3::upsilon::metrics {
+#ifdef C3_UPSILON_METRICS
+  namespace {
+    // Far more than the number of algorithms that could be in use at once
+    constexpr size_t n_slots = 256;
+
+    struct thread_table {
+      std::array<slot, n_slots> slots;
+      // Anything that doesn't fit lands here uncounted, rather than failing the call
+      slot overflow;
+    };
+
+    struct global_state {
+      std::mutex lock;
+      std::vector<thread_table*> live;
+      // What exited threads left behind
+      std::map<uint32_t, counters> retired;
+    };
+
+    global_state& global() {
+      // Never destroyed, as thread exits can still come in while statics are being torn down
+      static global_state* ret = new global_state;
+      return *ret;
+    }
+
+    void add(counters& c, const slot& s) {
+      c.ops += s.ops.load(std::memory_order_relaxed);
+      c.bytes += s.bytes.load(std::memory_order_relaxed);
+      c.errors += s.errors.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < n_latency_buckets; ++i)
+        c.latency[i] += s.latency[i].load(std::memory_order_relaxed);
+    }
+
+    // Registers this thread's table on first use, and hands it over on exit
+    struct thread_owner {
+      std::unique_ptr<thread_table> table = std::make_unique<thread_table>();
+
+      thread_owner() {
+        auto& g = global();
+        std::lock_guard lock{g.lock};
+        g.live.push_back(table.get());
+      }
+      ~thread_owner() {
+        auto& g = global();
+        std::lock_guard lock{g.lock};
+        g.live.erase(std::find(g.live.begin(), g.live.end(), table.get()));
+        for (auto& s : table->slots)
+          if (auto key = s.key.load(std::memory_order_relaxed))
+            add(g.retired[key], s);
+      }
+    };
+  }
+
+  slot& local_slot(operation op, uint16_t alg) {
+    thread_local thread_owner owner;
+
+    uint32_t key = (static_cast<uint32_t>(op) + 1) << 16 | alg;
+    auto& slots = owner.table->slots;
+    for (size_t i = (key * 2654435761u) >> 24, n = 0; n < n_slots; ++i, ++n) {
+      auto& s = slots[i % n_slots];
+      auto k = s.key.load(std::memory_order_relaxed);
+      if (k == key)
+        return s;
+      if (k == 0) {
+        s.key.store(key, std::memory_order_release);
+        return s;
+      }
+    }
+    return owner.table->overflow;
+  }
+
+  bool enabled() noexcept { return true; }
+
+  std::vector<entry> snapshot() {
+    auto& g = global();
+    std::lock_guard lock{g.lock};
+
+    auto totals = g.retired;
+    for (auto* t : g.live)
+      for (auto& s : t->slots)
+        if (auto key = s.key.load(std::memory_order_acquire))
+          add(totals[key], s);
+
+    std::vector<entry> ret;
+    for (auto& [key, value] : totals)
+      ret.push_back({ static_cast<operation>((key >> 16) - 1), static_cast<uint16_t>(key), value });
+    return ret;
+  }
+#else
+  bool enabled() noexcept { return false; }
+
+  std::vector<entry> snapshot() { return {}; }
+#endif
+
+  uint64_t latency_quantile(const counters& c, double q) noexcept {
+    uint64_t total = 0;
+    for (auto i : c.latency)
+      total += i;
+    if (total == 0)
+      return 0;
+
+    auto target = static_cast<uint64_t>(q * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < n_latency_buckets; ++i) {
+      seen += c.latency[i];
+      if (seen > target)
+        return uint64_t{2} << i;
+    }
+    return uint64_t{2} << (n_latency_buckets - 1);
+  }
+
+  const char* name(operation op) noexcept {
+    switch (op) {
+      case operation::hash: return "hash";
+      case operation::hash_process: return "hash_process";
+      case operation::encrypt: return "encrypt";
+      case operation::decrypt: return "decrypt";
+      case operation::sign: return "sign";
+      case operation::verify: return "verify";
+      case operation::agree: return "agree";
+      case operation::kdf_expand: return "kdf_expand";
+      case operation::mac: return "mac";
+    }
+    return "unknown";
+  }
+}
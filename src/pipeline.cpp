@@ -0,0 +1,213 @@
+#include "c3/upsilon/pipeline.hpp"
+
+namespace c3::upsilon {
+  static uint64_t ns_since(pipeline::clock::time_point start, pipeline::clock::time_point end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+  }
+
+  pipeline::pipeline(config conf) : _conf{conf} {
+    _conf.n_workers = std::max<size_t>(_conf.n_workers, 1);
+    _conf.queue_capacity = std::max<size_t>(_conf.queue_capacity, 1);
+    _conf.max_batch = std::max<size_t>(_conf.max_batch, 1);
+
+    _workers.reserve(_conf.n_workers);
+    for (size_t i = 0; i < _conf.n_workers; ++i)
+      _workers.emplace_back([this]() { _work(); });
+  }
+
+  pipeline::~pipeline() {
+    {
+      std::lock_guard lock{_lock};
+      _stopping = true;
+    }
+    _not_empty.notify_all();
+    _not_full.notify_all();
+
+    for (auto& i : _workers)
+      i.join();
+  }
+
+  bool pipeline::_submit(job&& j, bool block) {
+    std::unique_lock lock{_lock};
+
+    if (block)
+      _not_full.wait(lock, [&]() { return _stopping || _queue.size() < _conf.queue_capacity; });
+    else if (_queue.size() >= _conf.queue_capacity)
+      return false;
+
+    if (_stopping)
+      throw std::logic_error("Cannot submit to a pipeline that is shutting down");
+
+    j.enqueued = clock::now();
+    _queue.emplace_back(std::move(j));
+    lock.unlock();
+
+    _not_empty.notify_one();
+    return true;
+  }
+
+  void pipeline::_work() {
+    std::vector<job> batch;
+    batch.reserve(_conf.max_batch);
+
+    while (true) {
+      {
+        std::unique_lock lock{_lock};
+        _not_empty.wait(lock, [&]() { return _stopping || !_queue.empty(); });
+
+        // Only leave once everything queued has been done
+        if (_queue.empty())
+          return;
+
+        // Take whatever has built up, rather than waiting for a full batch
+        while (!_queue.empty() && batch.size() < _conf.max_batch) {
+          batch.emplace_back(std::move(_queue.front()));
+          _queue.pop_front();
+        }
+      }
+      _not_full.notify_all();
+
+      _process(batch);
+      batch.clear();
+    }
+  }
+
+  void pipeline::_process(std::vector<job>& batch) {
+    auto start = clock::now();
+
+    uint64_t queue_wait = 0;
+    for (auto& j : batch)
+      queue_wait += ns_since(j.enqueued, start);
+
+    std::vector<hash<>> hashes(batch.size());
+    std::vector<std::exception_ptr> errors(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      try {
+        auto& j = batch[i];
+        hashes[i] = j.is_sign ? j.sign_id.hash_message(j.msg) : j.verify_id.hash_message(j.msg);
+      }
+      catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+
+    auto hashed = clock::now();
+
+    // Verifications go through as one batch, so the verifiers see runs from the same identity
+    std::vector<identity_batch_entry> to_verify;
+    std::vector<size_t> to_verify_idx;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (!batch[i].is_sign && !errors[i]) {
+        to_verify.push_back({ &batch[i].verify_id, hashes[i].value, batch[i].sig });
+        to_verify_idx.push_back(i);
+      }
+    }
+    std::unique_ptr<bool[]> verified{new bool[to_verify.size()]};
+    try {
+      verify_batch_hashed(to_verify, { verified.get(), static_cast<std::ptrdiff_t>(to_verify.size()) });
+    }
+    catch (...) {
+      for (auto i : to_verify_idx)
+        errors[i] = std::current_exception();
+    }
+
+    std::vector<nu::data> sigs(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i].is_sign && !errors[i]) {
+        try {
+          sigs[i] = batch[i].sign_id.sign_hashed(hashes[i].value);
+        }
+        catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    }
+
+    auto done = clock::now();
+
+    _queue_wait_ns += queue_wait;
+    _hash_ns += ns_since(start, hashed);
+    _crypto_ns += ns_since(hashed, done);
+    _jobs_completed += batch.size();
+    ++_batches;
+
+    size_t verified_pos = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      auto& j = batch[i];
+      bool result = false;
+      if (!j.is_sign && verified_pos < to_verify_idx.size() && to_verify_idx[verified_pos] == i)
+        result = verified[verified_pos++];
+
+      if (errors[i]) {
+        if (j.on_error)
+          j.on_error(errors[i]);
+        // A verification that blew up is as good as a bad signature
+        else if (!j.is_sign)
+          j.on_verified(false);
+      }
+      else if (j.is_sign)
+        j.on_signed(std::move(sigs[i]));
+      else
+        j.on_verified(result);
+    }
+  }
+
+  std::future<bool> pipeline::verify(identity id, nu::data msg, nu::data sig) {
+    auto p = std::make_shared<std::promise<bool>>();
+    auto ret = p->get_future();
+    verify(std::move(id), std::move(msg), std::move(sig),
+           [p](bool b) { p->set_value(b); },
+           [p](std::exception_ptr e) { p->set_exception(e); });
+    return ret;
+  }
+
+  void pipeline::verify(identity id, nu::data msg, nu::data sig,
+                        verify_callback on_verified, error_callback on_error) {
+    _submit({ false, std::move(id), {}, std::move(msg), std::move(sig),
+              std::move(on_verified), {}, std::move(on_error), {} }, true);
+  }
+
+  bool pipeline::try_verify(identity id, nu::data msg, nu::data sig,
+                            verify_callback on_verified, error_callback on_error) {
+    return _submit({ false, std::move(id), {}, std::move(msg), std::move(sig),
+                     std::move(on_verified), {}, std::move(on_error), {} }, false);
+  }
+
+  std::future<nu::data> pipeline::sign(owned_identity id, nu::data msg) {
+    auto p = std::make_shared<std::promise<nu::data>>();
+    auto ret = p->get_future();
+    sign(std::move(id), std::move(msg),
+         [p](nu::data sig) { p->set_value(std::move(sig)); },
+         [p](std::exception_ptr e) { p->set_exception(e); });
+    return ret;
+  }
+
+  void pipeline::sign(owned_identity id, nu::data msg,
+                      sign_callback on_signed, error_callback on_error) {
+    _submit({ true, {}, std::move(id), std::move(msg), {},
+              {}, std::move(on_signed), std::move(on_error), {} }, true);
+  }
+
+  bool pipeline::try_sign(owned_identity id, nu::data msg,
+                          sign_callback on_signed, error_callback on_error) {
+    return _submit({ true, {}, std::move(id), std::move(msg), {},
+                     {}, std::move(on_signed), std::move(on_error), {} }, false);
+  }
+
+  pipeline::stats pipeline::get_stats() {
+    size_t depth;
+    {
+      std::lock_guard lock{_lock};
+      depth = _queue.size();
+    }
+
+    return {
+      depth,
+      _jobs_completed.load(),
+      _batches.load(),
+      std::chrono::nanoseconds{_queue_wait_ns.load()},
+      std::chrono::nanoseconds{_hash_ns.load()},
+      std::chrono::nanoseconds{_crypto_ns.load()}
+    };
+  }
+}
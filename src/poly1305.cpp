@@ -0,0 +1,130 @@
+#include "poly1305.hpp"
+
+#include "c3/upsilon/nuker.hpp"
+
+#include <algorithm>
+
+namespace c3::upsilon::poly1305 {
+  static constexpr uint64_t mask44 = 0xfffffffffff;
+  static constexpr uint64_t mask42 = 0x3ffffffffff;
+
+  using u128 = unsigned __int128;
+
+  static inline uint64_t load_le64(const uint8_t* b) {
+    uint64_t ret = 0;
+    for (int i = 7; i >= 0; --i)
+      ret = (ret << 8) | b[i];
+    return ret;
+  }
+
+  static inline void store_le64(uint8_t* b, uint64_t x) {
+    for (int i = 0; i < 8; ++i, x >>= 8)
+      b[i] = static_cast<uint8_t>(x);
+  }
+
+  inline void poly1305::_block(std::array<uint64_t, 3>& h, const uint8_t* b, uint64_t hibit) const {
+    const uint64_t r0 = _r[0], r1 = _r[1], r2 = _r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = h[0], h1 = h[1], h2 = h[2];
+
+    uint64_t t0 = load_le64(b), t1 = load_le64(b + 8);
+    h0 += t0 & mask44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+    h2 += ((t1 >> 24) & mask42) | hibit;
+
+    u128 d0 = u128{h0} * r0 + u128{h1} * s2 + u128{h2} * s1;
+    u128 d1 = u128{h0} * r1 + u128{h1} * r0 + u128{h2} * s2;
+    u128 d2 = u128{h0} * r2 + u128{h1} * r1 + u128{h2} * r0;
+
+    uint64_t c = static_cast<uint64_t>(d0 >> 44); h0 = static_cast<uint64_t>(d0) & mask44;
+    d1 += c; c = static_cast<uint64_t>(d1 >> 44); h1 = static_cast<uint64_t>(d1) & mask44;
+    d2 += c; c = static_cast<uint64_t>(d2 >> 42); h2 = static_cast<uint64_t>(d2) & mask42;
+    h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+    h1 += c;
+
+    h = { h0, h1, h2 };
+  }
+
+  void poly1305::_finish(std::array<uint64_t, 3>& h, uint8_t* output) const {
+    uint64_t h0 = h[0], h1 = h[1], h2 = h[2];
+
+    // Fully carry h
+    uint64_t c = h1 >> 44; h1 &= mask44;
+    h2 += c; c = h2 >> 42; h2 &= mask42;
+    h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+    h1 += c; c = h1 >> 44; h1 &= mask44;
+    h2 += c; c = h2 >> 42; h2 &= mask42;
+    h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+    h1 += c;
+
+    // h - p, picked over h without branching if it didn't go negative
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= mask44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= mask44;
+    uint64_t g2 = h2 + c - (uint64_t{1} << 42);
+
+    c = (g2 >> 63) - 1;
+    g0 &= c; g1 &= c; g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // h + s
+    uint64_t t0 = _pad[0], t1 = _pad[1];
+    h0 += t0 & mask44; c = h0 >> 44; h0 &= mask44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & mask44) + c; c = h1 >> 44; h1 &= mask44;
+    h2 += (t1 >> 24) + c; h2 &= mask42;
+
+    store_le64(output, h0 | (h1 << 44));
+    store_le64(output + 8, (h1 >> 20) | (h2 << 24));
+    nuke(reinterpret_cast<uint8_t*>(h.data()), sizeof(h));
+  }
+
+  void poly1305::tag(const uint8_t* input, size_t len, uint8_t* output) const {
+    std::array<uint64_t, 3> h = {};
+    for (; len >= tag_size; input += tag_size, len -= tag_size)
+      _block(h, input, uint64_t{1} << 40);
+
+    // The last partial block gets its 1 bit as a byte, rather than above the top
+    if (len > 0) {
+      uint8_t last[tag_size] = {};
+      std::copy(input, input + len, last);
+      last[len] = 1;
+      _block(h, last, 0);
+      nuke(last, sizeof(last));
+    }
+
+    _finish(h, output);
+  }
+
+  void poly1305::update_padded(accumulator& acc, const uint8_t* input, size_t len) const {
+    for (; len >= tag_size; input += tag_size, len -= tag_size)
+      _block(acc.h, input, uint64_t{1} << 40);
+
+    // Padded with zeroes, the last block is a whole one
+    if (len > 0) {
+      uint8_t last[tag_size] = {};
+      std::copy(input, input + len, last);
+      _block(acc.h, last, uint64_t{1} << 40);
+      nuke(last, sizeof(last));
+    }
+  }
+
+  void poly1305::finish(accumulator& acc, uint8_t* output) const {
+    _finish(acc.h, output);
+  }
+
+  poly1305::poly1305(const uint8_t* key) {
+    uint64_t t0 = load_le64(key), t1 = load_le64(key + 8);
+    _r[0] = t0 & 0xffc0fffffff;
+    _r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    _r[2] = (t1 >> 24) & 0x00ffffffc0f;
+    _pad[0] = load_le64(key + 16);
+    _pad[1] = load_le64(key + 24);
+  }
+
+  poly1305::~poly1305() {
+    nuke(reinterpret_cast<uint8_t*>(_r.data()), sizeof(_r));
+    nuke(reinterpret_cast<uint8_t*>(_pad.data()), sizeof(_pad));
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace c3::upsilon::poly1305 {
+  /// Poly1305 from RFC 8439, on 44-bit limbs
+  ///
+  /// Botan's version wipes its key after each tag, so cannot keep a key's state around
+  class poly1305 {
+  public:
+    static constexpr size_t key_size = 32;
+    static constexpr size_t tag_size = 16;
+
+    /// A message part way through, so that it can be fed in pieces
+    struct accumulator {
+      std::array<uint64_t, 3> h = {};
+    };
+
+  private:
+    // Clamped r, and s
+    std::array<uint64_t, 3> _r;
+    std::array<uint64_t, 2> _pad;
+
+  private:
+    inline void _block(std::array<uint64_t, 3>& h, const uint8_t* b, uint64_t hibit) const;
+    void _finish(std::array<uint64_t, 3>& h, uint8_t* output) const;
+
+  public:
+    void tag(const uint8_t* input, size_t len, uint8_t* output) const;
+
+    /// Adds input with zeroes up to a whole block, which is how RFC 8439's AEAD lays out
+    /// each part of its MAC input
+    void update_padded(accumulator& acc, const uint8_t* input, size_t len) const;
+    /// Writes the tag, and nukes acc
+    void finish(accumulator& acc, uint8_t* output) const;
+
+  public:
+    poly1305(const uint8_t* key);
+    ~poly1305();
+  };
+}
@@ -0,0 +1,195 @@
+#include "c3/upsilon/secure_arena.hpp"
+#include "c3/upsilon/nuker.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace c3::upsilon {
+  static size_t size_class_of(size_t len) {
+    size_t ret = 0;
+    for (size_t block = secure_arena::min_block; block < len; block <<= 1)
+      ++ret;
+    return ret;
+  }
+
+  static constexpr size_t block_size(size_t size_class) {
+    return secure_arena::min_block << size_class;
+  }
+
+  secure_arena::secure_arena(size_t n_slabs) :
+    _page{static_cast<size_t>(sysconf(_SC_PAGESIZE))},
+    _n_slabs{n_slabs},
+    _slabs{std::make_unique<slab[]>(n_slabs)} {
+    // Leading guard, then each slab followed by its own
+    auto len = _page + _n_slabs * 2 * _page;
+    auto base = mmap(nullptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+      throw std::bad_alloc();
+    _base = static_cast<uint8_t*>(base);
+    madvise(_base, len, MADV_DONTDUMP);
+  }
+
+  secure_arena::~secure_arena() {
+    for (size_t i = 0; i < _n_touched; ++i)
+      nuke(_slab_data(i), _page);
+    // Unmapping drops the locks too
+    munmap(_base, _page + _n_slabs * 2 * _page);
+  }
+
+  bool secure_arena::_owns(const void* p) const {
+    auto* b = static_cast<const uint8_t*>(p);
+    return b >= _base && b < _base + _page + _n_slabs * 2 * _page;
+  }
+
+  bool secure_arena::_new_slab(size_t size_class, size_t& out) {
+    if (!_free_slabs.empty()) {
+      out = _free_slabs.back();
+      _free_slabs.pop_back();
+    }
+    else if (_n_touched < _n_slabs) {
+      out = _n_touched;
+      auto* data = _slab_data(out);
+      if (mprotect(data, _page, PROT_READ | PROT_WRITE) != 0)
+        return false;
+      if (mlock(data, _page) != 0)
+        _locked = false;
+      ++_n_touched;
+    }
+    else
+      return false;
+
+    auto& s = _slabs[out];
+    s.size_class = static_cast<int8_t>(size_class);
+    s.available = true;
+    _available[size_class].push_back(out);
+    return true;
+  }
+
+  void* secure_arena::allocate(size_t len) {
+    if (len > max_block)
+      return _allocate_large(len);
+
+    auto size_class = size_class_of(len);
+    auto block = block_size(size_class);
+    auto per_slab = _page / block;
+
+    std::unique_lock lock{_lock};
+
+    auto& available = _available[size_class];
+    size_t i;
+    if (available.empty()) {
+      if (!_new_slab(size_class, i)) {
+        lock.unlock();
+        return _allocate_large(len);
+      }
+    }
+    else
+      i = available.back();
+
+    auto& s = _slabs[i];
+    void* ret;
+    if (s.free_list) {
+      ret = s.free_list;
+      s.free_list = *static_cast<void**>(ret);
+      *static_cast<void**>(ret) = nullptr;
+    }
+    else
+      ret = _slab_data(i) + block * s.n_carved++;
+
+    if (++s.n_live == per_slab) {
+      s.available = false;
+      available.pop_back();
+    }
+    ++_live_blocks;
+    return ret;
+  }
+
+  void secure_arena::deallocate(void* p, size_t len) {
+    if (!p)
+      return;
+    if (!_owns(p)) {
+      _deallocate_large(p, len);
+      return;
+    }
+
+    auto i = (static_cast<uint8_t*>(p) - _base - _page) / (2 * _page);
+    auto& s = _slabs[i];
+    auto block = block_size(s.size_class);
+
+    nuke(static_cast<uint8_t*>(p), block);
+
+    std::lock_guard lock{_lock};
+    --_live_blocks;
+
+    if (--s.n_live == 0) {
+      // Scrubbed once more as a whole, as the free list left pointers lying about
+      nuke(_slab_data(i), _page);
+      if (s.available) {
+        auto& available = _available[s.size_class];
+        available.erase(std::find(available.begin(), available.end(), i));
+      }
+      s = {};
+      _free_slabs.push_back(i);
+      return;
+    }
+
+    *static_cast<void**>(p) = s.free_list;
+    s.free_list = p;
+    if (!s.available) {
+      s.available = true;
+      _available[s.size_class].push_back(i);
+    }
+  }
+
+  void* secure_arena::_allocate_large(size_t len) {
+    auto data_len = (len + _page - 1) / _page * _page;
+    auto map_len = data_len + 2 * _page;
+
+    auto base = mmap(nullptr, map_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      throw std::bad_alloc();
+    auto* data = static_cast<uint8_t*>(base) + _page;
+    if (mprotect(data, data_len, PROT_READ | PROT_WRITE) != 0) {
+      munmap(base, map_len);
+      throw std::bad_alloc();
+    }
+    madvise(base, map_len, MADV_DONTDUMP);
+    bool locked = mlock(data, data_len) == 0;
+
+    std::lock_guard lock{_lock};
+    _locked &= locked;
+    ++_live_large;
+    return data;
+  }
+
+  void secure_arena::_deallocate_large(void* p, size_t len) {
+    auto data_len = (len + _page - 1) / _page * _page;
+    auto* data = static_cast<uint8_t*>(p);
+
+    nuke(data, data_len);
+    munmap(data - _page, data_len + 2 * _page);
+
+    std::lock_guard lock{_lock};
+    --_live_large;
+  }
+
+  secure_arena::stats secure_arena::get_stats() const {
+    std::lock_guard lock{_lock};
+    return {
+      _page + _n_slabs * 2 * _page,
+      _n_touched - _free_slabs.size(),
+      _live_blocks,
+      _live_large,
+      _locked
+    };
+  }
+
+  secure_arena& secure_arena::standard() {
+    // Never destroyed, as static secrets may well outlive it otherwise
+    static secure_arena* ret = new secure_arena;
+    return *ret;
+  }
+}
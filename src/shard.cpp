@@ -0,0 +1,191 @@
+#include "c3/upsilon/shard.hpp"
+
+#include <cmath>
+#include <string_view>
+
+#include "c3/upsilon/cpu.hpp"
+
+#include "dispatch.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define C3_UPSILON_SHARD_AVX2
+#endif
+
+namespace c3::upsilon {
+  static constexpr uint64_t jump_mult = 2862933555777941757ULL;
+  static constexpr double jump_scale = static_cast<double>(uint64_t{1} << 31);
+
+  uint32_t jump_shard(uint64_t key, uint32_t n_shards) {
+    if (n_shards == 0)
+      throw std::invalid_argument("Cannot shard over no shards");
+
+    int64_t b = -1, j = 0;
+    while (j < n_shards) {
+      b = j;
+      key = key * jump_mult + 1;
+      j = static_cast<int64_t>(static_cast<double>(b + 1) * (jump_scale / static_cast<double>((key >> 33) + 1)));
+    }
+    return static_cast<uint32_t>(b);
+  }
+
+#ifdef C3_UPSILON_SHARD_AVX2
+  // AVX2 has no 64 bit multiply, so this builds one from 32 bit ones
+  __attribute__((target("avx2")))
+  static inline __m256i jump_step_avx2(__m256i key) {
+    auto m_lo = _mm256_set1_epi64x(static_cast<int64_t>(jump_mult & 0xffffffff));
+    auto m_hi = _mm256_set1_epi64x(static_cast<int64_t>(jump_mult >> 32));
+    auto lo = _mm256_mul_epu32(key, m_lo);
+    auto cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(key, 32), m_lo), _mm256_mul_epu32(key, m_hi));
+    return _mm256_add_epi64(_mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32)), _mm256_set1_epi64x(1));
+  }
+
+  // Four lanes of the scalar loop, with b and j held as doubles, which is exact as they stay
+  // below 2^53, and which does the same divisions and multiplications in the same order
+  __attribute__((target("avx2")))
+  static void jump_shard_avx2(const uint64_t* keys, size_t n_keys, uint32_t n_shards, uint32_t* output) {
+    const auto n = _mm256_set1_pd(static_cast<double>(n_shards));
+    const auto scale = _mm256_set1_pd(jump_scale);
+    const auto one = _mm256_set1_pd(1.0);
+    // The low halves of each lane, once (key >> 33) has cleared the high ones
+    const auto low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    for (size_t pos = 0; pos + 4 <= n_keys; pos += 4) {
+      auto key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + pos));
+      auto b = _mm256_set1_pd(-1.0);
+      auto j = _mm256_setzero_pd();
+      auto active = _mm256_cmp_pd(j, n, _CMP_LT_OQ);
+
+      while (_mm256_movemask_pd(active)) {
+        b = _mm256_blendv_pd(b, j, active);
+        key = jump_step_avx2(key);
+        auto top = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(key, 33), low_halves);
+        auto divisor = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(top)), one);
+        j = _mm256_round_pd(_mm256_mul_pd(_mm256_add_pd(b, one), _mm256_div_pd(scale, divisor)),
+                            _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        active = _mm256_and_pd(active, _mm256_cmp_pd(j, n, _CMP_LT_OQ));
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + pos), _mm256_cvttpd_epi32(b));
+    }
+  }
+
+#endif
+
+  static bool jump_avx2() {
+    static const bool ret = std::string_view{choose_backend(algorithm_family::utility,
+                                                            static_cast<uint16_t>(utility_algorithm::jump_shard), {
+#ifdef C3_UPSILON_SHARD_AVX2
+      { "avx2", { cpu_feature::avx2 } },
+#endif
+      { "portable", {} },
+    })} == "avx2";
+    return ret;
+  }
+
+  void jump_shard(gsl::span<const uint64_t> keys, uint32_t n_shards, gsl::span<uint32_t> output) {
+    if (n_shards == 0)
+      throw std::invalid_argument("Cannot shard over no shards");
+    if (output.size() < keys.size())
+      throw std::invalid_argument("Output too small for the number of keys");
+
+    size_t n_keys = keys.size();
+    size_t done = 0;
+    [[maybe_unused]] bool avx2 = jump_avx2();
+#ifdef C3_UPSILON_SHARD_AVX2
+    // The lanes are converted back through int32
+    if (avx2 && n_shards <= (uint32_t{1} << 31)) {
+      jump_shard_avx2(keys.data(), n_keys, n_shards, output.data());
+      done = n_keys & ~size_t{3};
+    }
+#endif
+    for (; done < n_keys; ++done)
+      output[done] = jump_shard(keys[done], n_shards);
+  }
+
+  // MurmurHash3's finaliser: the key is already uniform, this only has to decorrelate it per node
+  static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // Schindelhauer and Schomaker's weighted score, -w / ln(u) for u uniform in (0, 1),
+  // under which each node wins in proportion to its weight
+  static inline double hrw_score(uint64_t key, uint64_t node_seed, double weight) {
+    auto u = (static_cast<double>(mix64(key ^ node_seed) >> 11) + 0.5) * 0x1p-53;
+    return -weight / std::log(u);
+  }
+
+  // seed(i) gives mix64 of node i's id, which tables work out once rather than per key
+  template<typename SeedFunc>
+  static uint64_t hrw_route(uint64_t key, const std::vector<shard_node>& nodes, SeedFunc&& seed) {
+    size_t best = 0;
+    double best_score = hrw_score(key, seed(0), nodes[0].weight);
+    for (size_t i = 1; i < nodes.size(); ++i) {
+      auto score = hrw_score(key, seed(i), nodes[i].weight);
+      if (score > best_score || (score == best_score && nodes[i].id < nodes[best].id)) {
+        best = i;
+        best_score = score;
+      }
+    }
+    return nodes[best].id;
+  }
+
+  static std::vector<uint64_t> hrw_seeds(const std::vector<shard_node>& nodes) {
+    std::vector<uint64_t> ret;
+    ret.reserve(nodes.size());
+    for (auto& i : nodes)
+      ret.push_back(mix64(i.id));
+    return ret;
+  }
+
+  void rendezvous_ring::add(shard_node node) {
+    if (!(node.weight > 0) || !std::isfinite(node.weight))
+      throw std::invalid_argument("Node weight must be positive");
+    for (auto& i : _nodes)
+      if (i.id == node.id)
+        throw std::invalid_argument("Node is already in the ring");
+    _nodes.push_back(node);
+  }
+
+  void rendezvous_ring::remove(uint64_t id) {
+    auto iter = std::find_if(_nodes.begin(), _nodes.end(), [id](auto& i) { return i.id == id; });
+    if (iter == _nodes.end())
+      throw std::invalid_argument("Node is not in the ring");
+    _nodes.erase(iter);
+  }
+
+  uint64_t rendezvous_ring::route(uint64_t key) const {
+    if (_nodes.empty())
+      throw std::logic_error("Cannot route on an empty ring");
+    return hrw_route(key, _nodes, [this](size_t i) { return mix64(_nodes[i].id); });
+  }
+
+  size_t shard_table::rebuild(const rendezvous_ring& ring) {
+    if (ring.empty())
+      throw std::logic_error("Cannot route on an empty ring");
+
+    auto seeds = hrw_seeds(ring.nodes());
+    std::vector<uint64_t> slots(size_t{1} << _bits);
+    size_t n_moved = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      // The middle of the range of keys the slot covers
+      auto key = (static_cast<uint64_t>(i) << (64 - _bits)) | (uint64_t{1} << (63 - _bits));
+      slots[i] = hrw_route(key, ring.nodes(), [&seeds](size_t n) { return seeds[n]; });
+      if (_slots.empty() || _slots[i] != slots[i])
+        ++n_moved;
+    }
+    _slots = std::move(slots);
+    return n_moved;
+  }
+
+  shard_table::shard_table(const rendezvous_ring& ring, unsigned bits) : _bits{bits} {
+    if (bits < 1 || bits > 24)
+      throw std::invalid_argument("Shard tables must have between 1 and 24 bits");
+    rebuild(ring);
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace c3::upsilon {
+  /// A replaceable global that hot paths can read without touching the shared_ptr's lock
+  ///
+  /// Each thread keeps its own reference, and only refreshes it when the generation moves on,
+  /// so a replaced value lives until every thread that saw it has looked again
+  template<typename T>
+  class shared_global {
+  private:
+    std::shared_ptr<T> _ptr;
+    std::atomic<uint64_t> _generation = 0;
+
+  public:
+    inline void set(std::shared_ptr<T> ptr) {
+      std::atomic_store(&_ptr, std::move(ptr));
+      _generation.fetch_add(1, std::memory_order_release);
+    }
+    inline std::shared_ptr<T> get_shared() const { return std::atomic_load(&_ptr); }
+
+    /// Only valid until the calling thread next calls get
+    inline T* get() {
+      // One per instantiation, so each T may only have one shared_global
+      thread_local std::shared_ptr<T> local;
+      thread_local uint64_t local_generation = 0;
+
+      auto generation = _generation.load(std::memory_order_acquire);
+      if (generation != local_generation) {
+        local = get_shared();
+        local_generation = generation;
+      }
+      return local.get();
+    }
+  };
+}
@@ -0,0 +1,221 @@
+#include "c3/upsilon/static_hasher.hpp"
+
+#include "blake2.hpp"
+#include "endian.hpp"
+#include "instrument.hpp"
+
+#include <botan/sha2_32.h>
+#include <botan/sha2_64.h>
+#include <botan/sha3.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace c3::upsilon {
+  namespace {
+    constexpr std::array<uint32_t, 8> sha2_224_iv = {
+      0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+    };
+    constexpr std::array<uint32_t, 8> sha2_256_iv = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    constexpr std::array<uint64_t, 8> sha2_384_iv = {
+      0xcbbb9d5dc1059ed8, 0x629a292a367cd507, 0x9159015a3070dd17, 0x152fecd8f70e5939,
+      0x67332667ffc00b31, 0x8eb44a8768581511, 0xdb0c2e0d64f98fa7, 0x47b5481dbefa4fa4
+    };
+    constexpr std::array<uint64_t, 8> sha2_512_iv = {
+      0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+      0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179
+    };
+
+    // Merkle-Damgard padding around Botan's compression function, which picks SHA-NI and the like
+    // itself. It takes its digest as a secure_vector, so each thread keeps one to reuse
+    template<typename Word, size_t BlockSize>
+    class sha2 {
+    private:
+      using compress_func = void(*)(Botan::secure_vector<Word>&, const uint8_t[], size_t);
+      // SHA-512's length field is 128 bits, of which only the low 64 are ever set here
+      static constexpr size_t length_size = 2 * sizeof(Word);
+
+    private:
+      compress_func _compress;
+      Botan::secure_vector<Word>& _digest;
+      std::array<uint8_t, BlockSize> _buf;
+      size_t _buf_len = 0;
+      uint64_t _total = 0;
+
+    public:
+      inline void update(const uint8_t* input, size_t len) {
+        _total += len;
+        if (_buf_len) {
+          size_t n = std::min(len, BlockSize - _buf_len);
+          std::copy(input, input + n, _buf.begin() + _buf_len);
+          _buf_len += n;
+          input += n;
+          len -= n;
+          if (_buf_len < BlockSize)
+            return;
+          _compress(_digest, _buf.data(), 1);
+          _buf_len = 0;
+        }
+        if (len >= BlockSize) {
+          _compress(_digest, input, len / BlockSize);
+          input += len - len % BlockSize;
+          len %= BlockSize;
+        }
+        std::copy(input, input + len, _buf.begin());
+        _buf_len = len;
+      }
+
+      inline void final(uint8_t* output, size_t out_len) {
+        _buf[_buf_len++] = 0x80;
+        if (_buf_len > BlockSize - length_size) {
+          std::fill(_buf.begin() + _buf_len, _buf.end(), 0);
+          _compress(_digest, _buf.data(), 1);
+          _buf_len = 0;
+        }
+        std::fill(_buf.begin() + _buf_len, _buf.end(), 0);
+        uint64_t bits = _total * 8;
+        for (size_t i = 0; i < 8; ++i, bits >>= 8)
+          _buf[BlockSize - 1 - i] = static_cast<uint8_t>(bits);
+        _compress(_digest, _buf.data(), 1);
+
+        for (size_t i = 0; i < out_len; ++i)
+          output[i] = static_cast<uint8_t>(_digest[i / sizeof(Word)] >> (8 * (sizeof(Word) - 1 - i % sizeof(Word))));
+      }
+
+    public:
+      sha2(compress_func compress, Botan::secure_vector<Word>& digest, const std::array<Word, 8>& iv) :
+        _compress{compress}, _digest{digest} {
+        _digest.assign(iv.begin(), iv.end());
+      }
+    };
+
+    // The sponge around Botan's Keccak-f, with the state on the stack
+    class sha3 {
+    private:
+      std::array<uint64_t, 25> _state = {};
+      size_t _rate;
+      size_t _pos = 0;
+
+    private:
+      inline void _xor_byte(size_t pos, uint8_t b) {
+        _state[pos / 8] ^= static_cast<uint64_t>(b) << (8 * (pos % 8));
+      }
+
+      inline void _xor_lanes(const uint8_t* input, size_t n_lanes) {
+        for (size_t i = 0; i < n_lanes; ++i) {
+          uint64_t w;
+          std::memcpy(&w, input + i * 8, 8);
+          _state[_pos / 8 + i] ^= le64toh(w);
+        }
+      }
+
+    public:
+      inline void update(const uint8_t* input, size_t len) {
+        // Bytes up to the next lane
+        for (; len > 0 && _pos % 8; ++input, --len) {
+          _xor_byte(_pos++, *input);
+          if (_pos == _rate) {
+            Botan::SHA_3::permute(_state.data());
+            _pos = 0;
+          }
+        }
+
+        // Whole lanes, which is whole blocks once the state is at the start of one.
+        // Every rate is a multiple of 8, so lanes never straddle a block
+        while (len >= 8) {
+          size_t n_lanes = std::min(len / 8, (_rate - _pos) / 8);
+          _xor_lanes(input, n_lanes);
+          _pos += n_lanes * 8;
+          input += n_lanes * 8;
+          len -= n_lanes * 8;
+          if (_pos == _rate) {
+            Botan::SHA_3::permute(_state.data());
+            _pos = 0;
+          }
+        }
+
+        // Less than a lane, so it can't fill the block
+        for (; len > 0; ++input, --len)
+          _xor_byte(_pos++, *input);
+      }
+
+      inline void final(uint8_t* output, size_t out_len) {
+        _xor_byte(_pos, 0x06);
+        _xor_byte(_rate - 1, 0x80);
+        Botan::SHA_3::permute(_state.data());
+        // Outputs are never longer than the rate, so one squeeze does
+        for (size_t i = 0; i < out_len; ++i)
+          output[i] = static_cast<uint8_t>(_state[i / 8] >> (8 * (i % 8)));
+      }
+
+    public:
+      sha3(size_t max_output) : _rate{200 - 2 * max_output} {}
+    };
+
+    template<typename Impl>
+    inline void run(Impl& impl, nu::data_const_ref input, nu::data_const_ref salt, uint8_t* output, size_t out_len) {
+      impl.update(salt.data(), salt.size());
+      impl.update(input.data(), input.size());
+      impl.final(output, out_len);
+    }
+  }
+
+  template<hash_algorithm Alg>
+  void static_hash(nu::data_const_ref input, nu::data_const_ref salt, nu::data_ref output) {
+    constexpr auto props = get_hash_properties<Alg>();
+    C3_UPSILON_MEASURE(hash, Alg, input.size() + salt.size());
+
+    auto out_len = static_cast<size_t>(output.size());
+    if (out_len > props.max_output)
+      throw std::range_error("Too many bytes requested from hash");
+
+    if constexpr (Alg == hash_algorithm::SHA2_224 || Alg == hash_algorithm::SHA2_256) {
+      thread_local Botan::secure_vector<uint32_t> digest(8);
+      sha2<uint32_t, 64> impl{&Botan::SHA_256::compress_digest, digest,
+                              Alg == hash_algorithm::SHA2_224 ? sha2_224_iv : sha2_256_iv};
+      run(impl, input, salt, output.data(), out_len);
+    }
+    else if constexpr (Alg == hash_algorithm::SHA2_384 || Alg == hash_algorithm::SHA2_512) {
+      thread_local Botan::secure_vector<uint64_t> digest(8);
+      sha2<uint64_t, 128> impl{&Botan::SHA_512::compress_digest, digest,
+                               Alg == hash_algorithm::SHA2_384 ? sha2_384_iv : sha2_512_iv};
+      run(impl, input, salt, output.data(), out_len);
+    }
+    else if constexpr (Alg == hash_algorithm::SHA3_224 || Alg == hash_algorithm::SHA3_256 ||
+                       Alg == hash_algorithm::SHA3_384 || Alg == hash_algorithm::SHA3_512) {
+      sha3 impl{props.max_output};
+      run(impl, input, salt, output.data(), out_len);
+    }
+    else {
+      // BLAKE2b's output length is a parameter, so shorter outputs are truncated rather than asked for
+      blake2::blake2b impl{props.max_output};
+      impl.update(salt.data(), salt.size());
+      impl.update(input.data(), input.size());
+      if (out_len == props.max_output) {
+        impl.final(output.data());
+      }
+      else {
+        std::array<uint8_t, props.max_output> tmp;
+        impl.final(tmp.data());
+        std::copy(tmp.begin(), tmp.begin() + out_len, output.begin());
+      }
+    }
+  }
+
+  template void static_hash<hash_algorithm::SHA2_224>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA2_256>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA2_384>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA2_512>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+
+  template void static_hash<hash_algorithm::SHA3_224>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA3_256>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA3_384>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::SHA3_512>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+
+  template void static_hash<hash_algorithm::BLAKE2b_128>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::BLAKE2b_256>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+  template void static_hash<hash_algorithm::BLAKE2b_512>(nu::data_const_ref, nu::data_const_ref, nu::data_ref);
+}
@@ -1,7 +1,13 @@
 #include "c3/upsilon/symmetric.hpp"
 
+#include "dispatch.hpp"
+#include "instrument.hpp"
+#include "iovec.hpp"
+
 #include <botan/stream_cipher.h>
 
+#include <stdexcept>
+
 // Botan requires unique_ptr or manual implementation, so this is simpler
 
 #define C3_UPSILON_DEF_SYM_BOTAN(CLASS_NAME, SYM_ALG, BOTAN_SYM_NAME) \
@@ -11,18 +17,48 @@
     inline CLASS_NAME(key_const_ref<SYM_ALG> key, iv_const_ref<SYM_ALG> iv) : \
       botan_impl{BOTAN_SYM_NAME, key, iv} {} \
   }; \
-  static auto __##CLASS_NAME##_registered = \
-    _symmetric_functions.emplace(SYM_ALG, \
-                                [](auto a, auto b){ \
-                                    return std::make_unique<CLASS_NAME>(a, b); \
-                                });
+  static std::unique_ptr<symmetric_function> CLASS_NAME##_make(nu::data_const_ref key, nu::data_const_ref iv) { \
+    return std::make_unique<CLASS_NAME>(key, iv); \
+  }
 
 namespace c3::upsilon {
-  std::map<symmetric_algorithm, symmetric_properties> _symmetric_properties;
+  template<typename Span>
+  static uint64_t total_size(gsl::span<const Span> bufs) {
+    uint64_t ret = 0;
+    for (auto& i : bufs)
+      ret += static_cast<uint64_t>(i.size());
+    return ret;
+  }
 
-  std::map<symmetric_algorithm,
-           std::function<std::unique_ptr<symmetric_function>(nu::data_const_ref,
-                                                             nu::data_const_ref)>> _symmetric_functions;
+  // Botan's ciphers keep the rest of a keystream block for the next call,
+  // so going a piece at a time wastes none of it
+  void symmetric_function::encryptv(gsl::span<const nu::data_ref> inout) {
+    for (auto& i : inout)
+      encrypt(i);
+  }
+  uint64_t symmetric_function::encryptv(gsl::span<const nu::data_const_ref> input,
+                                        gsl::span<const nu::data_ref> output) {
+    return for_each_common_run(input, output, [this](const uint8_t* in, uint8_t* out, size_t n) {
+      encrypt(nu::data_const_ref{in, static_cast<std::ptrdiff_t>(n)}, nu::data_ref{out, static_cast<std::ptrdiff_t>(n)});
+    });
+  }
+  void symmetric_function::encryptv(const iovec* iov, size_t n) {
+    for_each_iovec_chunk<nu::data_ref>(iov, n, [this](gsl::span<const nu::data_ref> chunk) { encryptv(chunk); });
+  }
+
+  void symmetric_function::decryptv(gsl::span<const nu::data_ref> inout) {
+    for (auto& i : inout)
+      decrypt(i);
+  }
+  uint64_t symmetric_function::decryptv(gsl::span<const nu::data_const_ref> input,
+                                        gsl::span<const nu::data_ref> output) {
+    return for_each_common_run(input, output, [this](const uint8_t* in, uint8_t* out, size_t n) {
+      decrypt(nu::data_const_ref{in, static_cast<std::ptrdiff_t>(n)}, nu::data_ref{out, static_cast<std::ptrdiff_t>(n)});
+    });
+  }
+  void symmetric_function::decryptv(const iovec* iov, size_t n) {
+    for_each_iovec_chunk<nu::data_ref>(iov, n, [this](gsl::span<const nu::data_ref> chunk) { decryptv(chunk); });
+  }
 
   // XXX: Assumes F(F(M)) = M
   template<symmetric_algorithm Alg>
@@ -32,7 +68,7 @@ namespace c3::upsilon {
     uint64_t stream_pos = 0;
   public:
     inline botan_impl(const char* botan_sym_name, key_const_ref<Alg> key, iv_const_ref<Alg> iv) :
-      cipher{Botan::StreamCipher::create(botan_sym_name)} {
+      cipher{create_botan<Botan::StreamCipher>(algorithm_family::symmetric, static_cast<uint16_t>(Alg), botan_sym_name)} {
       cipher->set_key(key.data(), key.size()); \
       cipher->set_iv(iv.data(), iv.size()); \
     }
@@ -40,11 +76,13 @@ namespace c3::upsilon {
   public:
     void encrypt(nu::data_ref inout) override {
       size_t n_todo = static_cast<size_t>(inout.size());
+      C3_UPSILON_MEASURE(encrypt, Alg, n_todo);
       cipher->cipher(inout.data(), inout.data(), n_todo);
       stream_pos += n_todo;
     }
     uint64_t encrypt(nu::data_const_ref input, nu::data_ref output) override {
       size_t n_todo = static_cast<size_t>(std::min(input.size(), output.size()));
+      C3_UPSILON_MEASURE(encrypt, Alg, n_todo);
       cipher->cipher(input.data(), output.data(), n_todo);
       stream_pos += n_todo;
       return n_todo;
@@ -52,20 +90,65 @@ namespace c3::upsilon {
 
     void decrypt(nu::data_ref inout) override {
       size_t n_todo = static_cast<size_t>(inout.size());
+      C3_UPSILON_MEASURE(decrypt, Alg, n_todo);
       cipher->cipher(inout.data(), inout.data(), n_todo);
       stream_pos += n_todo;
     }
     uint64_t decrypt(nu::data_const_ref input, nu::data_ref output) override {
       size_t n_todo = static_cast<size_t>(std::min(input.size(), output.size()));
+      C3_UPSILON_MEASURE(decrypt, Alg, n_todo);
       cipher->cipher(input.data(), output.data(), n_todo);
       stream_pos += n_todo;
       return n_todo;
     }
+    // One measurement for the lot, and Botan's cipher called directly on each piece
+    void encryptv(gsl::span<const nu::data_ref> inout) override {
+      C3_UPSILON_MEASURE(encrypt, Alg, total_size(inout));
+      for (auto& i : inout)
+        cipher->cipher(i.data(), i.data(), static_cast<size_t>(i.size()));
+      stream_pos += total_size(inout);
+    }
+    uint64_t encryptv(gsl::span<const nu::data_const_ref> input, gsl::span<const nu::data_ref> output) override {
+      C3_UPSILON_MEASURE(encrypt, Alg, std::min(total_size(input), total_size(output)));
+      auto n_done = for_each_common_run(input, output, [this](const uint8_t* in, uint8_t* out, size_t n) {
+        cipher->cipher(in, out, n);
+      });
+      stream_pos += n_done;
+      return n_done;
+    }
+
+    void decryptv(gsl::span<const nu::data_ref> inout) override {
+      C3_UPSILON_MEASURE(decrypt, Alg, total_size(inout));
+      for (auto& i : inout)
+        cipher->cipher(i.data(), i.data(), static_cast<size_t>(i.size()));
+      stream_pos += total_size(inout);
+    }
+    uint64_t decryptv(gsl::span<const nu::data_const_ref> input, gsl::span<const nu::data_ref> output) override {
+      C3_UPSILON_MEASURE(decrypt, Alg, std::min(total_size(input), total_size(output)));
+      auto n_done = for_each_common_run(input, output, [this](const uint8_t* in, uint8_t* out, size_t n) {
+        cipher->cipher(in, out, n);
+      });
+      stream_pos += n_done;
+      return n_done;
+    }
+
     void seek(uint64_t new_pos) override {
       stream_pos = new_pos;
       cipher->seek(stream_pos);
     }
     size_t pos() const noexcept override { return stream_pos; }
+    void set_iv(nu::data_const_ref iv) override {
+      if (static_cast<size_t>(iv.size()) != get_symmetric_properties<Alg>().iv_size)
+        throw std::invalid_argument("Wrong IV size");
+      cipher->set_iv(iv.data(), iv.size());
+      stream_pos = 0;
+    }
+    void rekey(nu::data_const_ref key, nu::data_const_ref iv) override {
+      if (static_cast<size_t>(key.size()) != get_symmetric_properties<Alg>().key_size)
+        throw std::invalid_argument("Wrong key size");
+      cipher->set_key(key.data(), key.size());
+      set_iv(iv);
+    }
     symmetric_algorithm alg() const noexcept override { return Alg; }
   };
 
@@ -79,6 +162,20 @@ namespace c3::upsilon {
   // Botan differentiates based on IV,
   // so since we have set a minimum required IV size, this is abstracted away
   C3_UPSILON_DEF_SYM_BOTAN(xchacha20_8 , symmetric_algorithm::XChaCha20_8 , "ChaCha(8)");
-  C3_UPSILON_DEF_SYM_BOTAN(xchacha20_12, symmetric_algorithm::XChaCha20_8 , "ChaCha(12)");
-  C3_UPSILON_DEF_SYM_BOTAN(xchacha20_20, symmetric_algorithm::XChaCha20_8 , "ChaCha(20)");
+  C3_UPSILON_DEF_SYM_BOTAN(xchacha20_12, symmetric_algorithm::XChaCha20_12, "ChaCha(12)");
+  C3_UPSILON_DEF_SYM_BOTAN(xchacha20_20, symmetric_algorithm::XChaCha20_20, "ChaCha(20)");
+
+  constexpr registry<symmetric_algorithm,
+                     std::unique_ptr<symmetric_function>(*)(nu::data_const_ref, nu::data_const_ref)> _symmetric_functions = {
+    { symmetric_algorithm::AES128, aes128_make },
+    { symmetric_algorithm::AES256, aes256_make },
+
+    { symmetric_algorithm::ChaCha20_8 , chacha20_8_make  },
+    { symmetric_algorithm::ChaCha20_12, chacha20_12_make },
+    { symmetric_algorithm::ChaCha20_20, chacha20_20_make },
+
+    { symmetric_algorithm::XChaCha20_8 , xchacha20_8_make  },
+    { symmetric_algorithm::XChaCha20_12, xchacha20_12_make },
+    { symmetric_algorithm::XChaCha20_20, xchacha20_20_make },
+  };
 }
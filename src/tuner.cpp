@@ -0,0 +1,245 @@
+#include "c3/upsilon/tuner.hpp"
+#include "c3/upsilon/cpu.hpp"
+
+#include "dispatch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace c3::upsilon {
+  namespace {
+    using clock = std::chrono::steady_clock;
+
+    // Big enough that per-call setup doesn't decide the order, small enough to stay in L2
+    constexpr size_t buf_size = 16 * 1024;
+    constexpr int n_rounds = 5;
+    constexpr auto round_time = std::chrono::milliseconds{1};
+
+    /// The best of a few rounds, so that a badly timed interrupt doesn't reorder anything
+    template<typename Func>
+    double ns_per_byte(Func&& f) {
+      f();
+
+      double best = std::numeric_limits<double>::infinity();
+      for (int round = 0; round < n_rounds; ++round) {
+        size_t reps = 0;
+        auto start = clock::now();
+        clock::duration elapsed;
+        do {
+          f();
+          ++reps;
+          elapsed = clock::now() - start;
+        } while (elapsed < round_time);
+
+        std::chrono::duration<double, std::nano> ns = elapsed;
+        best = std::min(best, ns.count() / static_cast<double>(reps * buf_size));
+      }
+      return best;
+    }
+
+    template<typename Alg>
+    std::vector<Alg> rank(std::vector<std::pair<double, Alg>> timed) {
+      std::stable_sort(timed.begin(), timed.end(),
+                       [](auto& a, auto& b) { return a.first < b.first; });
+      std::vector<Alg> ret;
+      for (auto& i : timed)
+        ret.push_back(i.second);
+      return ret;
+    }
+
+    template<typename Alg, typename Entry>
+    std::vector<Alg> registered(const registry<Alg, Entry>& reg) {
+      std::vector<Alg> ret;
+      reg.for_each([&](Alg alg, auto&) { ret.push_back(alg); });
+      std::sort(ret.begin(), ret.end());
+      return ret;
+    }
+
+    std::string cache_path() {
+      if (auto path = std::getenv("C3_UPSILON_TUNING_CACHE"))
+        return path;
+      if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return std::string{xdg} + "/c3-upsilon/tuning";
+      if (auto home = std::getenv("HOME"); home && *home)
+        return std::string{home} + "/.cache/c3-upsilon/tuning";
+      return {};
+    }
+
+    // The overrides on the families that are tuned, e.g. "hash/0x0010=openssl", skipping
+    // anything that would break the cache's tab and newline separated lines
+    template<typename Alg, typename Entry>
+    void append_forced(std::string& ret, algorithm_family family, const registry<Alg, Entry>& reg) {
+      reg.for_each([&](Alg alg, auto) {
+        auto& forced = forced_backend(family, static_cast<uint16_t>(alg));
+        if (forced.empty())
+          return;
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "0x%04x", static_cast<unsigned>(alg));
+        ret += std::string{ret.empty() ? "" : ","} + algorithm_family_name(family) + '/' + buf + '=';
+        for (char c : forced)
+          if (static_cast<unsigned char>(c) >= 0x20)
+            ret += c;
+      });
+    }
+
+    std::string cache_key() {
+      // Disabled features and forced backends change the ranking as much as a different CPU would
+      std::string forced;
+      append_forced(forced, algorithm_family::hash, _hash_funcs);
+      append_forced(forced, algorithm_family::symmetric, _symmetric_functions);
+      return cpu_model_name() + " [" + enabled_cpu_features().to_string() + "]" +
+             (forced.empty() ? "" : " {" + forced + "}");
+    }
+
+    template<typename Alg>
+    std::string format_list(const std::vector<Alg>& algs) {
+      std::string ret;
+      for (auto alg : algs) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "0x%04x", static_cast<unsigned>(alg));
+        ret += (ret.empty() ? "" : ",") + std::string{buf};
+      }
+      return ret;
+    }
+
+    /// Only accepts a list holding exactly the algorithms registered now
+    template<typename Alg, typename Entry>
+    bool parse_list(const std::string& s, const registry<Alg, Entry>& reg, std::vector<Alg>& out) {
+      std::vector<Alg> ret;
+      std::stringstream ss{s};
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+        char* end;
+        auto value = std::strtoul(item.c_str(), &end, 0);
+        if (*end || value > std::numeric_limits<uint16_t>::max())
+          return false;
+        ret.push_back(static_cast<Alg>(value));
+      }
+
+      auto sorted = ret;
+      std::sort(sorted.begin(), sorted.end());
+      if (sorted != registered(reg))
+        return false;
+      out = std::move(ret);
+      return true;
+    }
+
+    // Lines are key<TAB>family<TAB>algorithms, with one host per pair of lines
+
+    bool load(const std::string& path, const std::string& key, algorithm_ranking& out) {
+      std::ifstream in{path};
+      algorithm_ranking ret;
+      bool got_hash = false, got_symmetric = false;
+      std::string line;
+      while (std::getline(in, line)) {
+        auto tab1 = line.find('\t');
+        auto tab2 = line.find('\t', tab1 + 1);
+        if (tab2 == std::string::npos || line.compare(0, tab1, key) != 0 || tab1 != key.size())
+          continue;
+        auto family = line.substr(tab1 + 1, tab2 - tab1 - 1);
+        auto list = line.substr(tab2 + 1);
+        if (family == "hash")
+          got_hash = parse_list(list, _hash_funcs, ret.hash);
+        else if (family == "symmetric")
+          got_symmetric = parse_list(list, _symmetric_functions, ret.symmetric);
+      }
+      if (!got_hash || !got_symmetric)
+        return false;
+      out = std::move(ret);
+      return true;
+    }
+
+    void make_parents(const std::string& path) {
+      for (auto slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        ::mkdir(path.substr(0, slash).c_str(), 0700);
+    }
+
+    /// Best effort: a cache that can't be written just means tuning again next time
+    void store(const std::string& path, const std::string& key, const algorithm_ranking& ranking) {
+      std::string others;
+      {
+        std::ifstream in{path};
+        std::string line;
+        while (std::getline(in, line))
+          if (line.compare(0, key.size() + 1, key + '\t') != 0)
+            others += line + '\n';
+      }
+
+      make_parents(path);
+      // Written aside and renamed over, so another process never reads half a file
+      auto tmp = path + ".tmp" + std::to_string(::getpid());
+      {
+        std::ofstream out{tmp, std::ios::trunc};
+        out << others
+            << key << "\thash\t" << format_list(ranking.hash) << '\n'
+            << key << "\tsymmetric\t" << format_list(ranking.symmetric) << '\n';
+        if (!out.flush()) {
+          std::remove(tmp.c_str());
+          return;
+        }
+      }
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        std::remove(tmp.c_str());
+    }
+
+    template<typename Alg>
+    Alg preferred(const std::vector<Alg>& ranking, const std::vector<Alg>& offered, const char* family) {
+      for (auto alg : ranking)
+        if (std::find(offered.begin(), offered.end(), alg) != offered.end())
+          return alg;
+      throw std::invalid_argument(std::string{"None of the offered "} + family + " algorithms are implemented");
+    }
+  }
+
+  algorithm_ranking tune_algorithms() {
+    nu::data buf(buf_size);
+
+    std::vector<std::pair<double, hash_algorithm>> hashes;
+    _hash_funcs.for_each([&](hash_algorithm alg, const hash_function* f) {
+      nu::data out(f->properties()->max_output);
+      hashes.emplace_back(ns_per_byte([&]() { f->compute_hash(buf, out); }), alg);
+    });
+
+    std::vector<std::pair<double, symmetric_algorithm>> ciphers;
+    _symmetric_functions.for_each([&](symmetric_algorithm alg, auto make) {
+      auto props = get_symmetric_properties(alg);
+      auto f = make(nu::data(props.key_size), nu::data(props.iv_size));
+      ciphers.emplace_back(ns_per_byte([&]() { f->encrypt(nu::data_ref{buf}); }), alg);
+    });
+
+    return { rank(std::move(hashes)), rank(std::move(ciphers)) };
+  }
+
+  const algorithm_ranking& tuned_algorithms() {
+    static const algorithm_ranking ret = []() {
+      auto path = cache_path();
+      auto key = cache_key();
+
+      algorithm_ranking ret;
+      if (!path.empty() && load(path, key, ret))
+        return ret;
+
+      ret = tune_algorithms();
+      if (!path.empty())
+        store(path, key, ret);
+      return ret;
+    }();
+    return ret;
+  }
+
+  hash_algorithm preferred_algorithm(const std::vector<hash_algorithm>& offered) {
+    return preferred(tuned_algorithms().hash, offered, "hash");
+  }
+
+  symmetric_algorithm preferred_algorithm(const std::vector<symmetric_algorithm>& offered) {
+    return preferred(tuned_algorithms().symmetric, offered, "symmetric");
+  }
+}
@@ -0,0 +1,218 @@
+#include "c3/upsilon/vanity.hpp"
+#include "c3/upsilon/csprng.hpp"
+#include "c3/upsilon/nuker.hpp"
+#include "c3/upsilon/registry.hpp"
+#include "c3/upsilon/static_hasher.hpp"
+
+#include "endian.hpp"
+
+#include <botan/ed25519.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace c3::upsilon {
+  namespace {
+    /// Turns a seed into the public key get_signer would give for it, without building a signer
+    struct vanity_keygen {
+      size_t seed_size;
+      size_t public_size;
+      void (*derive)(const uint8_t* seed, uint8_t* public_key);
+    };
+
+    void ed25519_derive(const uint8_t* seed, uint8_t* public_key) {
+      uint8_t secret[64];
+      Botan::ed25519_gen_keypair(public_key, secret, seed);
+      nuke(secret, sizeof(secret));
+    }
+
+    constexpr registry<signature_algorithm, vanity_keygen> _vanity_keygens = {
+      { signature_algorithm::Curve25519, { 32, 32, ed25519_derive } },
+    };
+
+    constexpr size_t max_seed_size = 32;
+    constexpr size_t max_public_size = 32;
+    // Workers add to the shared count this often, so they aren't all fighting over one cache line
+    constexpr uint64_t attempts_per_flush = 256;
+
+    struct search_state {
+      const vanity_keygen* keygen;
+      const hash_function* fingerprint_func;
+      size_t fingerprint_size;
+      nu::data_const_ref prefix;
+      size_t prefix_bits;
+
+      std::atomic<bool> stop = false;
+      std::atomic<uint64_t> attempts = 0;
+
+      std::mutex lock;
+      std::condition_variable done;
+      bool found = false;
+      std::array<uint8_t, max_seed_size> seed;
+      std::exception_ptr error;
+    };
+
+    bool matches(const uint8_t* digest, nu::data_const_ref prefix, size_t prefix_bits) {
+      size_t whole = prefix_bits / 8;
+      if (std::memcmp(digest, prefix.data(), whole) != 0)
+        return false;
+      size_t rest = prefix_bits % 8;
+      if (!rest)
+        return true;
+      uint8_t mask = static_cast<uint8_t>(0xFF << (8 - rest));
+      return ((digest[whole] ^ prefix[whole]) & mask) == 0;
+    }
+
+    void search(search_state& state) {
+      // Seeds are BLAKE2b(key || counter), so one draw from the csprng covers the whole run
+      std::array<uint8_t, 32> key;
+      std::generate(key.begin(), key.end(), std::ref(csprng::standard));
+
+      std::array<uint8_t, max_seed_size> seed;
+      std::array<uint8_t, max_public_size> public_key;
+      std::array<uint8_t, 64> digest;
+      auto seed_ref = nu::data_ref{seed}.first(state.keygen->seed_size);
+      auto public_ref = nu::data_const_ref{public_key}.first(state.keygen->public_size);
+      auto digest_ref = nu::data_ref{digest}.first(state.fingerprint_size);
+
+      uint64_t counter = 0;
+      uint64_t unflushed = 0;
+      while (!state.stop.load(std::memory_order_relaxed)) {
+        uint64_t counter_le = htole64(counter++);
+        static_hash<hash_algorithm::BLAKE2b_256>(
+          nu::data_const_ref{reinterpret_cast<const uint8_t*>(&counter_le), sizeof(counter_le)}, key, seed_ref);
+        state.keygen->derive(seed.data(), public_key.data());
+        state.fingerprint_func->compute_hash(public_ref, digest_ref);
+
+        if (++unflushed == attempts_per_flush) {
+          state.attempts.fetch_add(unflushed, std::memory_order_relaxed);
+          unflushed = 0;
+        }
+
+        if (matches(digest.data(), state.prefix, state.prefix_bits)) {
+          std::lock_guard lock{state.lock};
+          if (!state.found) {
+            state.found = true;
+            state.seed = seed;
+          }
+          state.stop = true;
+          state.done.notify_all();
+        }
+      }
+      state.attempts.fetch_add(unflushed, std::memory_order_relaxed);
+
+      nuke(key.data(), key.size());
+      nuke(seed.data(), seed.size());
+    }
+  }
+
+  hash<> fingerprint(const identity& id, hash_algorithm alg) {
+    auto serialised = id.serialise();
+    auto public_key = identity_view::parse(serialised).public_key;
+    auto func = get_hash_function(alg);
+
+    hash<> ret;
+    ret.value.resize(func->properties()->max_output);
+    func->compute_hash(public_key, ret.value);
+    return ret;
+  }
+
+  std::optional<owned_identity> vanity_search(signature_algorithm sig_alg, hash_algorithm msg_hash_alg,
+                                              nu::data_const_ref prefix, size_t prefix_bits,
+                                              const vanity_config& conf) {
+    using clock = std::chrono::steady_clock;
+
+    search_state state;
+    state.keygen = &_vanity_keygens.get(sig_alg);
+    state.fingerprint_func = get_hash_function(conf.fingerprint_alg);
+    state.fingerprint_size = state.fingerprint_func->properties()->max_output;
+    state.prefix = prefix;
+    state.prefix_bits = prefix_bits;
+
+    if (prefix_bits > static_cast<size_t>(prefix.size()) * 8)
+      throw std::invalid_argument("Prefix is shorter than the number of bits to match");
+    if (prefix_bits > state.fingerprint_size * 8)
+      throw std::invalid_argument("Prefix is longer than the fingerprint");
+    // Checked here as well, so get_signer can't turn down the seed after all the work is done
+    get_hasher(msg_hash_alg);
+
+    std::vector<std::thread> workers;
+    workers.reserve(std::max<size_t>(conf.n_workers, 1));
+    for (size_t i = 0; i < std::max<size_t>(conf.n_workers, 1); ++i)
+      workers.emplace_back([&state]() {
+        try {
+          search(state);
+        }
+        catch (...) {
+          std::lock_guard lock{state.lock};
+          if (!state.error)
+            state.error = std::current_exception();
+          state.stop = true;
+          state.done.notify_all();
+        }
+      });
+
+    double expected = std::ldexp(1.0, static_cast<int>(prefix_bits));
+    auto start = clock::now();
+    {
+      std::unique_lock lock{state.lock};
+      while (!state.stop) {
+        if (!conf.on_progress) {
+          state.done.wait(lock, [&]() { return state.stop.load(); });
+          break;
+        }
+        if (state.done.wait_for(lock, conf.report_interval, [&]() { return state.stop.load(); }))
+          break;
+
+        vanity_progress progress;
+        progress.attempts = state.attempts.load(std::memory_order_relaxed);
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        progress.attempts_per_sec = elapsed.count() > 0 ? progress.attempts / elapsed.count() : 0;
+        progress.expected_attempts = expected;
+        progress.eta = std::chrono::duration<double>{
+          progress.attempts_per_sec > 0 && progress.attempts < expected
+            ? (expected - progress.attempts) / progress.attempts_per_sec : 0
+        };
+
+        // Workers that find a match wait on the lock, so it isn't held while the caller runs
+        lock.unlock();
+        bool go_on = false;
+        try {
+          go_on = conf.on_progress(progress);
+        }
+        catch (...) {
+          // Rethrown once the workers have been joined
+          lock.lock();
+          if (!state.error)
+            state.error = std::current_exception();
+          state.stop = true;
+          break;
+        }
+        lock.lock();
+        if (!go_on)
+          state.stop = true;
+      }
+    }
+
+    for (auto& i : workers)
+      i.join();
+
+    if (state.error)
+      std::rethrow_exception(state.error);
+    if (!state.found)
+      return std::nullopt;
+
+    auto seed = nu::data_const_ref{state.seed}.first(state.keygen->seed_size);
+    owned_identity ret{ sig_alg, get_hasher(msg_hash_alg), get_signer(sig_alg, seed) };
+    nuke(state.seed.data(), state.seed.size());
+    return ret;
+  }
+}
@@ -0,0 +1,27 @@
+#include "c3/upsilon/agreement.hpp"
+
+constexpr auto agreement_alg = c3::upsilon::agreement_algorithm::Curve25519;
+constexpr auto kdf_alg = c3::upsilon::kdf_algorithm::Shake256;
+
+constexpr size_t out_len = 64;
+
+int main() {
+  auto alice = c3::upsilon::agreer::gen<kdf_alg, agreement_alg>();
+  auto bob = c3::upsilon::agreer::gen(kdf_alg, agreement_alg);
+
+  alice.enable_cache(4);
+
+  auto bob_k = bob.derive_shared_secret<out_len>(alice.get_public());
+
+  auto alice_k_miss = alice.derive_shared_secret<out_len>(bob.get_public());
+  auto alice_k_hit = alice.derive_shared_secret<out_len>(bob.get_public());
+
+  if (alice_k_miss != bob_k || alice_k_hit != bob_k)
+    throw std::runtime_error("Cached agreement did not match");
+
+  auto stats = alice.cache()->get_stats();
+  if (stats.hits != 1 || stats.misses != 1)
+    throw std::runtime_error("Unexpected cache statistics");
+
+  return 0;
+}
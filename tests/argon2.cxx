@@ -0,0 +1,94 @@
+#include "c3/upsilon/argon2.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  // RFC 9106 section 5.3
+  {
+    nu::data password(32, 0x01), salt(16, 0x02), secret(8, 0x03), associated(12, 0x04);
+    nu::data expected = {
+      0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+      0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59
+    };
+
+    // The thread count must not change the output
+    for (uint32_t threads : { 1, 2, 4 }) {
+      argon2_params params;
+      params.memory = 32;
+      params.iterations = 3;
+      params.lanes = 4;
+      params.threads = threads;
+
+      nu::data output(32);
+      argon2id(password, salt, output, params, secret, associated);
+      if (output != expected)
+        throw std::runtime_error("Argon2id did not match RFC 9106");
+    }
+  }
+
+  {
+    argon2_params params;
+    params.memory = 256;
+    params.iterations = 1;
+    params.lanes = 2;
+    auto k = make_argon2id_kdf(nu::serialise("per-user salt"), params);
+    auto password = nu::serialise("correct horse battery staple");
+
+    auto expected = k->expand(password, 100);
+    if (k->extract(password)->expand({}, 100) != expected)
+      throw std::runtime_error("Argon2id extract then expand did not match expand");
+
+    auto reader = k->begin_expand(password);
+    nuking_data a(30), b(70);
+    reader->squeeze(a);
+    reader->squeeze(b);
+    a.insert(a.end(), b.begin(), b.end());
+    if (a != expected)
+      throw std::runtime_error("Argon2id squeezed output did not match expand");
+
+    if (k->extract(password, nu::serialise("some other salt"))->expand({}, 100) == expected)
+      throw std::runtime_error("Argon2id salt made no difference");
+  }
+
+  // Cancelled part way, whether or not the lanes are threaded
+  for (uint32_t threads : { 1, 2 }) {
+    argon2_params params;
+    params.memory = 256;
+    params.iterations = 2;
+    params.lanes = 2;
+    params.threads = threads;
+    nu::data output(32, 0);
+    size_t checks = 0;
+    if (argon2id(nu::data(8), nu::data(16), output, params, {}, {}, [&]() { return ++checks == 3; }))
+      throw std::runtime_error("Argon2id was not cancelled");
+    if (checks != 3)
+      throw std::runtime_error("Argon2id kept checking after it was cancelled");
+    if (output != nu::data(32, 0))
+      throw std::runtime_error("Cancelled Argon2id wrote its output");
+
+    checks = 0;
+    if (!argon2id(nu::data(8), nu::data(16), output, params, {}, {}, [&]() { ++checks; return false; }))
+      throw std::runtime_error("Argon2id was cancelled without being asked");
+    if (output != argon2id(nu::data(8), nu::data(16), 32, params))
+      throw std::runtime_error("Argon2id with a cancel check did not match without");
+    if (checks != 2 * 4)
+      throw std::runtime_error("Argon2id did not check at every slice");
+  }
+
+  bool threw = false;
+  try { argon2id(nu::data(8), nu::data(4), 32); }
+  catch (const std::invalid_argument&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("Argon2id accepted a short salt");
+
+  threw = false;
+  try { make_argon2id_kdf(nu::data(4)); }
+  catch (const std::invalid_argument&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("Argon2id kdf accepted a short salt");
+
+  return 0;
+}
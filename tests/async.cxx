@@ -0,0 +1,132 @@
+#include "c3/upsilon/async.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>) && __has_include(<stop_token>)
+struct task {
+  struct promise_type {
+    task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+static hash<> hash_directly(const hasher& h, nu::data_const_ref b) {
+  auto partial = h.begin_hash();
+  partial.process(b);
+  return partial.finish();
+}
+
+static task run(std::promise<void>& done) {
+  std::exception_ptr error;
+  try {
+    auto h = get_hasher<hash_algorithm::SHA2_256>();
+    nu::data small(16, 1);
+    nu::data big(3 * async_chunk_size + 5, 2);
+
+    auto caller = std::this_thread::get_id();
+    auto small_hash = co_await async_hash(h, small);
+    if (std::this_thread::get_id() != caller)
+      throw std::runtime_error("Small input was offloaded");
+    if (small_hash.value != hash_directly(h, small).value)
+      throw std::runtime_error("Inline hash is wrong");
+
+    auto big_hash = co_await async_hash(h, big);
+    if (big_hash.value != hash_directly(h, big).value)
+      throw std::runtime_error("Offloaded hash is wrong");
+
+    // Resuming through a hook, as an event loop would
+    std::atomic<bool> hooked = false;
+    nu::data key(32), iv(8);
+    auto original = big;
+    auto enc = get_symmetric_function(symmetric_algorithm::ChaCha20, key, iv);
+    async_options hook;
+    hook.resume_on = [&](std::coroutine_handle<> c) {
+      hooked = true;
+      c.resume();
+    };
+    co_await async_encrypt(*enc, big, std::move(hook));
+    if (!hooked)
+      throw std::runtime_error("resume_on was not used");
+    auto dec = get_symmetric_function(symmetric_algorithm::ChaCha20, key, iv);
+    co_await async_decrypt(*dec, big);
+    if (big != original)
+      throw std::runtime_error("Offloaded encryption did not round trip");
+
+    std::stop_source stop;
+    stop.request_stop();
+    async_options stopped;
+    stopped.stop = stop.get_token();
+    bool cancelled = false;
+    try {
+      co_await async_hash(h, big, std::move(stopped));
+    }
+    catch (const operation_cancelled&) {
+      cancelled = true;
+    }
+    if (!cancelled)
+      throw std::runtime_error("Stopped hash was not cancelled");
+
+    // Stopped part way, which would otherwise take many seconds
+    std::stop_source argon2_stop;
+    async_options argon2_opts;
+    argon2_opts.stop = argon2_stop.get_token();
+    argon2_params params;
+    params.memory = 64 * 1024;
+    params.iterations = 1000;
+    params.lanes = 2;
+    nu::data password(16, 3), salt(16, 4), output(32, 0);
+    std::thread stopper{[&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      argon2_stop.request_stop();
+    }};
+    cancelled = false;
+    try {
+      co_await async_argon2id(password, salt, output, params, std::move(argon2_opts));
+    }
+    catch (const operation_cancelled&) {
+      cancelled = true;
+    }
+    stopper.join();
+    if (!cancelled)
+      throw std::runtime_error("Stopped Argon2id was not cancelled");
+    if (output != nu::data(32, 0))
+      throw std::runtime_error("Cancelled Argon2id wrote its output");
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+
+  if (error)
+    done.set_exception(error);
+  else
+    done.set_value();
+}
+#endif
+
+int main() {
+  std::atomic<int> n_run = 0;
+  {
+    worker_pool pool{2};
+    for (int i = 0; i < 100; ++i)
+      pool.submit([&]() { ++n_run; });
+  }
+  if (n_run != 100)
+    throw std::runtime_error("Worker pool dropped jobs");
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>) && __has_include(<stop_token>)
+  std::promise<void> done;
+  auto finished = done.get_future();
+  run(done);
+  finished.get();
+#endif
+}
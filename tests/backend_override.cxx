@@ -0,0 +1,70 @@
+#include "c3/upsilon/argon2.hpp"
+#include "c3/upsilon/cpu.hpp"
+#include "c3/upsilon/filter.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/kdf.hpp"
+#include "c3/upsilon/shard.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  // Read on first use, which nothing before main does
+  setenv("C3_UPSILON_BACKEND",
+         "kdf=no-such-backend,kdf/0x0440=no-such-backend,hash/0x0230=no-such-backend,"
+         "utility/0x0001=no-such-backend,kdf/nonsense=x,utility/",
+         1);
+
+  // Nothing in the kdf family has it, so the family-wide override leaves them be
+  argon2_params params;
+  params.memory = 64;
+  params.iterations = 1;
+  params.lanes = 1;
+  argon2id(nu::data(8), nu::data(16), 32, params);
+  get_kdf(kdf_algorithm::Shake256)->expand(nu::data(16), 32);
+  get_kdf(kdf_algorithm::HKDF_SHA2_256)->expand(nu::data(16), 32);
+  if (active_backend(algorithm_family::kdf, static_cast<uint16_t>(kdf_algorithm::Argon2id)).empty())
+    throw std::runtime_error("Argon2id recorded no backend");
+
+  // But naming the algorithm is an error
+  bool threw = false;
+  try { get_kdf(kdf_algorithm::BLAKE2b)->expand(nu::data(16), 32); }
+  catch (const std::invalid_argument&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("BLAKE2b ignored an override naming it");
+
+  // A hash throws on each use, without taking the other hashes on this thread down with it
+  nu::static_data<48> digest;
+  for (int i = 0; i < 2; ++i) {
+    threw = false;
+    try { get_hash_function<hash_algorithm::SHA2_384>()->compute_hash(nu::data(16), digest); }
+    catch (const std::invalid_argument&) { threw = true; }
+    if (!threw)
+      throw std::runtime_error("SHA-384 ignored an override naming it");
+  }
+  threw = false;
+  try { get_hash_function<hash_algorithm::SHA2_384>()->begin_hash(); }
+  catch (const std::invalid_argument&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("Partial SHA-384 ignored an override naming it");
+  get_hash_function<hash_algorithm::SHA2_256>()->compute_hash(nu::data(16), nu::data_ref{digest}.first(32));
+
+  uint64_t keys[4] = { 1, 2, 3, 4 };
+  uint32_t shards[4];
+  threw = false;
+  try { jump_shard(keys, 10, shards); }
+  catch (const std::invalid_argument&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("jump_shard ignored an override naming it");
+
+  // Malformed entries are skipped
+  bloom_filter bloom{100};
+  bloom.insert(filter_key{1, 2});
+  if (!bloom.contains(filter_key{1, 2}))
+    throw std::runtime_error("Bloom filter lost a key");
+}
@@ -0,0 +1,28 @@
+#include "c3/upsilon/cpu.hpp"
+#include "c3/upsilon/hash.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <stdexcept>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  if (!detected_cpu_features().has(enabled_cpu_features()))
+    throw std::runtime_error("Enabled a CPU feature that was not detected");
+
+  auto hf = get_hash_function<hash_algorithm::SHA2_256>();
+  nu::static_data<32> out;
+  hf->compute_hash(nu::serialise("Hello, world!"), out);
+  if (active_backend(algorithm_family::hash, static_cast<uint16_t>(hash_algorithm::SHA2_256)).empty())
+    throw std::runtime_error("Used hash has no backend");
+
+  auto backends = active_backends();
+  _hash_funcs.for_each([&](hash_algorithm alg, auto) {
+    for (auto& i : backends)
+      if (i.family == algorithm_family::hash && i.alg == static_cast<uint16_t>(alg) && !i.backend.empty())
+        return;
+    throw std::runtime_error("A registered hash is missing from active_backends");
+  });
+}
@@ -0,0 +1,150 @@
+#include "c3/upsilon/filter.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+static hash<32> make_hash(uint64_t i) {
+  hash<32> ret;
+  uint64_t x = (i + 1) * 0x9e3779b97f4a7c15ULL;
+  for (size_t j = 0; j < ret.value.size(); ++j) {
+    x ^= x >> 29;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    ret.value[j] = static_cast<uint8_t>(x >> 56);
+  }
+  return ret;
+}
+
+int main() {
+  constexpr size_t n_items = 20000;
+  std::vector<hash<32>> present, absent;
+  for (size_t i = 0; i < n_items; ++i) {
+    present.push_back(make_hash(i));
+    absent.push_back(make_hash(i + n_items));
+  }
+
+  // Bloom, with inserts from several threads at once
+  bloom_filter bloom{n_items, 0.01};
+  {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t)
+      threads.emplace_back([&, t]() {
+        for (size_t i = t; i < n_items; i += 4)
+          bloom.insert(present[i]);
+      });
+    for (auto& i : threads)
+      i.join();
+  }
+  if (bloom.insert(present[0]))
+    throw std::runtime_error("Bloom filter forgot an insert");
+
+  std::vector<uint8_t> results_buf(n_items);
+  gsl::span<bool> results{reinterpret_cast<bool*>(results_buf.data()), static_cast<std::ptrdiff_t>(n_items)};
+  if (bloom.contains(gsl::span<const hash<32>>{present}, results) != n_items)
+    throw std::runtime_error("Bloom filter has a false negative");
+  auto n_false = bloom.contains(gsl::span<const hash<32>>{absent}, results);
+  if (n_false > n_items / 50)
+    throw std::runtime_error("Bloom filter false positive rate is too high");
+  for (size_t i = 0; i < n_items; ++i)
+    if (results[i] != bloom.contains(absent[i]))
+      throw std::runtime_error("Bulk Bloom probe disagrees with single");
+
+  // Round trips, both through a copy and mapped in place
+  auto bloom_bytes = bloom.serialise();
+  auto bloom_copy = bloom_filter::deserialise(bloom_bytes);
+  auto file = "c3-upsilon-filter-test";
+  std::ofstream{file, std::ios::binary}.write(reinterpret_cast<const char*>(bloom_bytes.data()),
+                                              static_cast<std::streamsize>(bloom_bytes.size()));
+  {
+    mapped_file mapped{file};
+    auto view = bloom_filter_view::parse(mapped.data());
+    for (size_t i = 0; i < n_items; ++i) {
+      if (!view.contains(present[i]) || !bloom_copy.contains(present[i]))
+        throw std::runtime_error("Loaded Bloom filter has a false negative");
+      if (view.contains(absent[i]) != bloom.contains(absent[i]))
+        throw std::runtime_error("Loaded Bloom filter disagrees with the original");
+    }
+  }
+  std::remove(file);
+
+  bloom_bytes[0] ^= 1;
+  try {
+    bloom_filter_view::parse(bloom_bytes);
+    throw std::runtime_error("Parsed a Bloom filter with bad magic");
+  }
+  catch (const nu::serialisation_failure&) {}
+
+  // Cuckoo, where the first items go in alone and must stay visible while the rest are inserted
+  // from several threads, kicking them between buckets
+  constexpr size_t n_anchors = 1000;
+  cuckoo_filter cuckoo{n_items};
+  for (size_t i = 0; i < n_anchors; ++i)
+    cuckoo.insert(present[i]);
+  {
+    std::atomic<bool> writing = true, failed = false, lost = false;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t)
+      threads.emplace_back([&, t]() {
+        for (size_t i = n_anchors + t; i < n_items; i += 4)
+          if (!cuckoo.insert(present[i]))
+            failed = true;
+      });
+    std::thread reader{[&]() {
+      while (writing)
+        for (size_t i = 0; i < n_anchors; ++i)
+          if (!cuckoo.contains(present[i]))
+            lost = true;
+    }};
+    for (auto& i : threads)
+      i.join();
+    writing = false;
+    reader.join();
+
+    if (failed)
+      throw std::runtime_error("Cuckoo filter ran out of room early");
+    if (lost)
+      throw std::runtime_error("Cuckoo filter lost an item mid-move");
+  }
+  if (cuckoo.size() != n_items)
+    throw std::runtime_error("Cuckoo filter miscounted");
+
+  size_t n_cuckoo_false = 0;
+  for (size_t i = 0; i < n_items; ++i) {
+    if (!cuckoo.contains(present[i]))
+      throw std::runtime_error("Cuckoo filter has a false negative");
+    n_cuckoo_false += cuckoo.contains(absent[i]);
+  }
+  if (n_cuckoo_false > n_items / 500)
+    throw std::runtime_error("Cuckoo filter false positive rate is too high");
+
+  auto cuckoo_copy = cuckoo_filter::deserialise(cuckoo.serialise());
+  auto cuckoo_bytes = cuckoo.serialise();
+  auto cuckoo_view = cuckoo_filter_view::parse(cuckoo_bytes);
+  for (size_t i = 0; i < n_items; i += 2) {
+    if (!cuckoo.erase(present[i]))
+      throw std::runtime_error("Cuckoo filter failed to erase");
+    if (!cuckoo_view.contains(present[i]) || !cuckoo_copy.contains(present[i]))
+      throw std::runtime_error("Loaded cuckoo filter has a false negative");
+  }
+  for (size_t i = 1; i < n_items; i += 2)
+    if (!cuckoo.contains(present[i]))
+      throw std::runtime_error("Erasing lost a neighbour");
+  if (cuckoo.size() != n_items / 2 || cuckoo_copy.size() != n_items)
+    throw std::runtime_error("Cuckoo filter miscounted after erasing");
+
+  // Filling until it refuses must leave what was there alone
+  cuckoo_filter small{16};
+  size_t n_in = 0;
+  while (small.insert(absent[n_in]))
+    ++n_in;
+  for (size_t i = 0; i < n_in; ++i)
+    if (!small.contains(absent[i]))
+      throw std::runtime_error("A refused insert disturbed the cuckoo filter");
+  if (n_in > small.capacity())
+    throw std::runtime_error("Cuckoo filter took more than it has room for");
+}
@@ -0,0 +1,193 @@
+#include "c3/upsilon/handshake.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+static nu::data bytes(const std::string& s) {
+  return { s.begin(), s.end() };
+}
+
+static bool same(nu::data_const_ref a, nu::data_const_ref b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end());
+}
+
+// Sends one handshake message from a to b, checking the payload arrives
+static nu::data pass(noise_handshake& a, noise_handshake& b, const std::string& payload) {
+  if (!a.is_my_turn() || b.is_my_turn())
+    throw std::runtime_error("Handshake turns are wrong");
+
+  auto pt = bytes(payload);
+  nu::data msg(pt.size() + a.message_overhead());
+  if (a.write_message(pt, msg) != msg.size())
+    throw std::runtime_error("Handshake message was not the advertised size");
+
+  nu::data out(msg.size());
+  out.resize(b.read_message(msg, out));
+  if (out != pt)
+    throw std::runtime_error("Handshake payload did not survive");
+  return msg;
+}
+
+static void check_session(noise_session& a, noise_session& b) {
+  if (!same(a.handshake_hash(), b.handshake_hash()))
+    throw std::runtime_error("Sides disagree on the handshake hash");
+
+  nu::data pt(1000);
+  std::iota(pt.begin(), pt.end(), 0);
+  nu::data record(pt.size() + noise_session::record_overhead), out(pt.size());
+  for (size_t i = 0; i < 10; ++i) {
+    for (auto [from, to] : { std::pair{&a, &b}, std::pair{&b, &a} }) {
+      if (from->encrypt(pt, record) != record.size())
+        throw std::runtime_error("Record was not the advertised size");
+      if (to->decrypt(record, out) != pt.size() || out != pt)
+        throw std::runtime_error("Record did not survive");
+    }
+  }
+
+  // A bad record is refused, and leaves the stream where it was
+  a.encrypt(pt, record);
+  record[3] ^= 1;
+  try {
+    b.decrypt(record, out);
+    throw std::runtime_error("Tampered record was accepted");
+  }
+  catch (const noise_error&) {}
+  record[3] ^= 1;
+  b.decrypt(record, out);
+
+  // Replays don't get through either
+  try {
+    b.decrypt(record, out);
+    throw std::runtime_error("Replayed record was accepted");
+  }
+  catch (const noise_error&) {}
+}
+
+int main() {
+  // The AEAD, against the reference construction of RFC 8439 with Noise's nonce layout
+  {
+    nu::data key(32);
+    std::iota(key.begin(), key.end(), 0x80);
+    noise_cipher_state cs;
+    cs.initialise_key(symmetric_algorithm::ChaCha20, key);
+    cs.set_nonce(7);
+    auto pt = bytes("Cryptographic Forum Research Group");
+    nu::data ct(pt.size() + noise_cipher_state::tag_size);
+    cs.encrypt_with_ad(bytes("upsilon"), pt, ct);
+    if (ct != nu::data{
+      0xb3, 0x92, 0x06, 0x93, 0xbe, 0x2d, 0x0e, 0xd7, 0x6a, 0xca, 0xea, 0x9a, 0x05, 0xa1, 0x4b, 0x99,
+      0x95, 0xd9, 0x28, 0x33, 0x65, 0xcf, 0x2f, 0xc7, 0x36, 0x2c, 0x42, 0x02, 0x7e, 0x1f, 0xfc, 0x2c,
+      0x27, 0x00, 0x26, 0xa0, 0xef, 0xbe, 0xc9, 0x07, 0x1e, 0x6d, 0x89, 0x9d, 0xf5, 0x48, 0xb0, 0x8e,
+      0x19, 0xcf
+    })
+      throw std::runtime_error("AEAD did not match its test vector");
+
+    cs.rekey();
+    nu::data tag(noise_cipher_state::tag_size);
+    cs.encrypt_with_ad({}, {}, tag);
+    if (tag != nu::data{
+      0xa1, 0x72, 0x5b, 0x48, 0x40, 0x2c, 0x4a, 0x8f, 0x87, 0x7e, 0x48, 0x85, 0x76, 0x80, 0x97, 0x29
+    })
+      throw std::runtime_error("Rekey did not match its test vector");
+  }
+
+  auto alice_s = gen_agreement_function(agreement_algorithm::Curve25519);
+  auto bob_s = gen_agreement_function(agreement_algorithm::Curve25519);
+  auto prologue = bytes("c3-upsilon test");
+
+  // XX, learning each other's keys as it goes
+  for (auto kdf_alg : { kdf_algorithm::HKDF_SHA2_256, kdf_algorithm::HKDF_SHA2_512 }) {
+    noise_suite suite;
+    suite.kdf = kdf_alg;
+    auto alice = noise_handshake::initiator(handshake_pattern::XX, *alice_s, {}, prologue, suite);
+    auto bob = noise_handshake::responder(handshake_pattern::XX, *bob_s, prologue, suite);
+
+    pass(alice, bob, "hello");
+    pass(bob, alice, "hello yourself");
+    if (!same(alice.remote_static(), bob_s->serialise_public()))
+      throw std::runtime_error("XX initiator did not learn the responder's key");
+    pass(alice, bob, "");
+    if (!same(bob.remote_static(), alice_s->serialise_public()))
+      throw std::runtime_error("XX responder did not learn the initiator's key");
+
+    if (!alice.finished() || !bob.finished())
+      throw std::runtime_error("XX did not finish after three messages");
+    auto alice_session = alice.split();
+    auto bob_session = bob.split();
+    check_session(alice_session, bob_session);
+  }
+
+  // IK, with the first payload already secret
+  {
+    auto bob_public = bob_s->serialise_public();
+    auto alice = noise_handshake::initiator(handshake_pattern::IK, *alice_s, bob_public, prologue);
+    auto bob = noise_handshake::responder(handshake_pattern::IK, *bob_s, prologue);
+
+    auto secret = std::string(64, 'x');
+    auto first = pass(alice, bob, secret);
+    if (std::search(first.begin(), first.end(), secret.begin(), secret.end()) != first.end())
+      throw std::runtime_error("IK sent its first payload in the clear");
+    if (!same(bob.remote_static(), alice_s->serialise_public()))
+      throw std::runtime_error("IK responder did not learn the initiator's key");
+    pass(bob, alice, "ok");
+
+    if (!alice.finished() || !bob.finished())
+      throw std::runtime_error("IK did not finish after one round trip");
+    auto alice_session = alice.split(4);
+    auto bob_session = bob.split(4);
+    check_session(alice_session, bob_session);
+
+    // Rekeying on one side only must break the stream
+    nu::data record(noise_session::record_overhead), out;
+    alice_session.rekey_send();
+    alice_session.encrypt({}, record);
+    try {
+      bob_session.decrypt(record, out);
+      throw std::runtime_error("Record decrypted under the old key");
+    }
+    catch (const noise_error&) {}
+  }
+
+  // IK against the wrong responder key fails on the responder's side
+  {
+    auto eve_s = gen_agreement_function(agreement_algorithm::Curve25519);
+    auto alice = noise_handshake::initiator(handshake_pattern::IK, *alice_s, eve_s->serialise_public());
+    auto bob = noise_handshake::responder(handshake_pattern::IK, *bob_s);
+
+    nu::data msg(alice.message_overhead()), out;
+    alice.write_message({}, msg);
+    try {
+      bob.read_message(msg, out);
+      throw std::runtime_error("IK accepted a message for another key");
+    }
+    catch (const noise_error&) {}
+  }
+
+  // Prologues that differ must not agree
+  {
+    auto alice = noise_handshake::initiator(handshake_pattern::XX, *alice_s, {}, bytes("one"));
+    auto bob = noise_handshake::responder(handshake_pattern::XX, *bob_s, bytes("two"));
+    pass(alice, bob, "");
+    nu::data msg(bob.message_overhead()), out;
+    bob.write_message({}, msg);
+    try {
+      alice.read_message(msg, out);
+      throw std::runtime_error("Handshake ignored the prologue");
+    }
+    catch (const noise_error&) {}
+  }
+
+  // IK can't start without the key
+  try {
+    noise_handshake::initiator(handshake_pattern::IK, *alice_s);
+    throw std::runtime_error("IK started without the responder's key");
+  }
+  catch (const std::invalid_argument&) {}
+}
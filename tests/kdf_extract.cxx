@@ -0,0 +1,90 @@
+#include "c3/upsilon/kdf.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  // RFC 5869 test case 1
+  {
+    nu::data ikm(22, 0x0b);
+    nu::data salt = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
+    nu::data info = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9 };
+    nuking_data expected = {
+      0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64, 0xd0, 0x36,
+      0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a, 0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56,
+      0xec, 0xc4, 0xc5, 0xbf, 0x34, 0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65
+    };
+
+    auto prk = get_kdf(kdf_algorithm::HKDF_SHA2_256)->extract(ikm, salt);
+    if (prk->expand(info, expected.size()) != expected)
+      throw std::runtime_error("HKDF-SHA256 did not match RFC 5869");
+  }
+
+  for (auto alg : { kdf_algorithm::Shake128, kdf_algorithm::Shake256,
+                    kdf_algorithm::HKDF_SHA2_256, kdf_algorithm::HKDF_SHA2_512,
+                    kdf_algorithm::BLAKE2b }) {
+    auto* k = get_kdf(alg);
+    auto secret = nu::serialise("Hello, world!");
+
+    auto prk = k->extract(secret);
+    if (prk->expand({}, 100) != k->expand(secret, 100))
+      throw std::runtime_error("Extract then expand did not match expand");
+
+    auto enc = prk->expand(nu::serialise("enc"), 32);
+    auto mac = prk->expand(nu::serialise("mac"), 32);
+    if (enc == mac)
+      throw std::runtime_error("Different labels gave the same subkey");
+    // Expanding must not disturb the prk
+    if (prk->expand(nu::serialise("enc"), 32) != enc)
+      throw std::runtime_error("Repeated expand gave a different subkey");
+
+    if (k->extract(secret, nu::serialise("salt"))->expand(nu::serialise("enc"), 32) == enc)
+      throw std::runtime_error("Salt made no difference");
+
+    // The same bytes split differently between the fields must not collide
+    nu::data abc = { 'a', 'b', 'c' }, ab = { 'a', 'b' }, bc = { 'b', 'c' }, a = { 'a' }, c = { 'c' };
+    if (k->extract(bc, a)->expand({}, 32) == k->extract(c, ab)->expand({}, 32))
+      throw std::runtime_error("Moving bytes from input to salt gave the same key");
+    if (k->extract(ab, abc)->expand(c, 32) == k->extract(abc, abc)->expand({}, 32))
+      throw std::runtime_error("Moving bytes from info to input gave the same key");
+  }
+
+  // NIST SP 800-185 cSHAKE samples 1 and 3, which the SHAKE kdfs' length prefixing rests on
+  {
+    nu::data input = { 0x00, 0x01, 0x02, 0x03 };
+    nu::data expected128 = {
+      0xc1, 0xc3, 0x69, 0x25, 0xb6, 0x40, 0x9a, 0x04, 0xf1, 0xb5, 0x04, 0xfc, 0xbc, 0xa9, 0xd8, 0x2b,
+      0x40, 0x17, 0x27, 0x7c, 0xb5, 0xed, 0x2b, 0x20, 0x65, 0xfc, 0x1d, 0x38, 0x14, 0xd5, 0xaa, 0xf5
+    };
+    nu::data expected256 = {
+      0xd0, 0x08, 0x82, 0x8e, 0x2b, 0x80, 0xac, 0x9d, 0x22, 0x18, 0xff, 0xee, 0x1d, 0x07, 0x0c, 0x48,
+      0xb8, 0xe4, 0xc8, 0x7b, 0xff, 0x32, 0xc9, 0x69, 0x9d, 0x5b, 0x68, 0x96, 0xee, 0xe0, 0xed, 0xd1,
+      0x64, 0x02, 0x0e, 0x2b, 0xe0, 0x56, 0x08, 0x58, 0xd9, 0xc0, 0x0c, 0x03, 0x7e, 0x34, 0xa9, 0x69,
+      0x37, 0xc5, 0x61, 0xa7, 0x4c, 0x41, 0x2b, 0xb4, 0xc7, 0x46, 0x46, 0x95, 0x27, 0x28, 0x1c, 0x8c
+    };
+
+    auto cshake128 = begin_cshake(kdf_algorithm::Shake128, "Email Signature");
+    cshake128->absorb(input);
+    nu::data out128(expected128.size());
+    cshake128->squeeze(out128);
+    if (out128 != expected128)
+      throw std::runtime_error("cSHAKE128 did not match SP 800-185");
+
+    auto cshake256 = begin_cshake(kdf_algorithm::Shake256, "Email Signature");
+    cshake256->absorb(input);
+    nu::data out256(expected256.size());
+    cshake256->squeeze(out256);
+    if (out256 != expected256)
+      throw std::runtime_error("cSHAKE256 did not match SP 800-185");
+  }
+
+  bool threw = false;
+  try { get_kdf(kdf_algorithm::HKDF_SHA2_256)->extract({})->expand({}, 255 * 32 + 1); }
+  catch (const std::range_error&) { threw = true; }
+  if (!threw)
+    throw std::runtime_error("HKDF allowed more than 255 blocks");
+
+  return 0;
+}
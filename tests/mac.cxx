@@ -0,0 +1,109 @@
+#include "c3/upsilon/mac.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+static nu::data bytes(const std::string& s) {
+  return { s.begin(), s.end() };
+}
+
+static void check(mac_algorithm alg, nu::data_const_ref key, nu::data_const_ref msg, const nu::data& expected) {
+  auto k = get_mac_key(alg, key);
+  if (k->tag(msg) != expected)
+    throw std::runtime_error("MAC did not match its test vector");
+  if (k->properties()->one_time)
+    k = get_mac_key(alg, key);
+  if (!k->verify(msg, expected))
+    throw std::runtime_error("MAC did not verify its test vector");
+}
+
+int main() {
+  nu::data key(64);
+  std::iota(key.begin(), key.end(), 0);
+  nu::data counting(256);
+  std::iota(counting.begin(), counting.end(), 0);
+
+  // RFC 4231 test case 2
+  check(mac_algorithm::HMAC_SHA2_256, bytes("Jefe"), bytes("what do ya want for nothing?"), {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43
+  });
+
+  // RFC 8439 section 2.5.2
+  check(mac_algorithm::Poly1305, nu::data{
+    0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+    0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+  }, bytes("Cryptographic Forum Research Group"), {
+    0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+  });
+
+  // The reference implementation's keyed test vectors
+  check(mac_algorithm::BLAKE2b_512, key, {}, {
+    0x10, 0xeb, 0xb6, 0x77, 0x00, 0xb1, 0x86, 0x8e, 0xfb, 0x44, 0x17, 0x98, 0x7a, 0xcf, 0x46, 0x90,
+    0xae, 0x9d, 0x97, 0x2f, 0xb7, 0xa5, 0x90, 0xc2, 0xf0, 0x28, 0x71, 0x79, 0x9a, 0xaa, 0x47, 0x86,
+    0xb5, 0xe9, 0x96, 0xe8, 0xf0, 0xf4, 0xeb, 0x98, 0x1f, 0xc2, 0x14, 0xb0, 0x05, 0xf4, 0x2d, 0x2f,
+    0xf4, 0x23, 0x34, 0x99, 0x39, 0x16, 0x53, 0xdf, 0x7a, 0xef, 0xcb, 0xc1, 0x3f, 0xc5, 0x15, 0x68
+  });
+  check(mac_algorithm::BLAKE2s_256, nu::data_const_ref{key}.first(32), counting, {
+    0x52, 0x11, 0xd1, 0xae, 0xfc, 0x00, 0x25, 0xbe, 0x7f, 0x85, 0xc0, 0x6b, 0x3e, 0x14, 0xe0, 0xfc,
+    0x64, 0x5a, 0xe1, 0x2b, 0xd4, 0x17, 0x46, 0x48, 0x5e, 0xa6, 0xd8, 0xa3, 0x64, 0xa2, 0xea, 0xee
+  });
+
+  // Batches must match one message at a time, whichever lanes the messages end up in
+  std::vector<nu::data> msgs;
+  for (size_t len : { 0, 1, 127, 128, 129, 1000, 1000, 300, 5, 256, 257, 3000 })
+    msgs.emplace_back(len, static_cast<uint8_t>(len));
+  std::vector<nu::data_const_ref> refs(msgs.begin(), msgs.end());
+
+  _mac_functions.for_each([&](mac_algorithm, const mac_function* f) {
+    auto props = f->properties();
+    if (props->one_time)
+      return;
+    auto k = f->make_key(nu::data_const_ref{key}.first(std::min<size_t>(32, props->max_key)));
+
+    nu::data tags(msgs.size() * props->tag_size);
+    k->tag_batch(refs, tags);
+
+    std::vector<mac_batch_entry> entries;
+    for (size_t i = 0; i < msgs.size(); ++i) {
+      auto tag = nu::data_const_ref{tags}.subspan(i * props->tag_size, props->tag_size);
+      if (k->tag(msgs[i]) != nu::data(tag.begin(), tag.end()))
+        throw std::runtime_error("Batch tag differs from a single one");
+      entries.push_back({ msgs[i], tag });
+    }
+
+    bool results[12];
+    if (!k->verify_batch(entries, results))
+      throw std::runtime_error("Batch did not verify its own tags");
+    tags[props->tag_size] ^= 1;
+    if (k->verify_batch(entries, results) || !results[0] || results[1])
+      throw std::runtime_error("Batch verification missed a bad tag");
+  });
+
+  // A one-time key must not take several messages
+  auto one_time = get_mac_key(mac_algorithm::Poly1305, nu::data_const_ref{key}.first(32));
+  std::vector<nu::data_const_ref> two{ refs[0], refs[1] };
+  nu::data two_tags(32);
+  try {
+    one_time->tag_batch(two, two_tags);
+    throw std::runtime_error("Tagged two messages with a one-time key");
+  }
+  catch (const std::logic_error&) {}
+
+  // Nor the same key twice, one message at a time
+  one_time->tag(msgs[0]);
+  for (auto reuse : { +[](mac_key& k, const nu::data& msg) { k.tag(msg); },
+                      +[](mac_key& k, const nu::data& msg) { k.verify(msg, nu::data(16)); } }) {
+    try {
+      reuse(*one_time, msgs[1]);
+      throw std::runtime_error("Reused a one-time key");
+    }
+    catch (const std::logic_error&) {}
+  }
+}
@@ -0,0 +1,80 @@
+#include "c3/upsilon/metrics.hpp"
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <stdexcept>
+#include <thread>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+static metrics::counters find(metrics::operation op, uint16_t alg) {
+  for (auto& i : metrics::snapshot())
+    if (i.op == op && i.alg == alg)
+      return i.value;
+  return {};
+}
+
+int main() {
+  auto msg = nu::serialise("Hello, world!");
+  auto hf = get_hash_function<hash_algorithm::SHA2_256>();
+  nu::static_data<32> out;
+
+  // The rest needs a build with C3_UPSILON_METRICS on, so this reports itself skipped to CTest
+  if (!metrics::enabled()) {
+    hf->compute_hash(msg, out);
+    if (!metrics::snapshot().empty())
+      throw std::runtime_error("Counted without C3_UPSILON_METRICS");
+    return 77;
+  }
+
+  auto hash_alg = static_cast<uint16_t>(hash_algorithm::SHA2_256);
+  auto before = find(metrics::operation::hash, hash_alg);
+
+  // Counts from a thread that has exited must survive it
+  std::thread t{[&]() {
+    for (int i = 0; i < 10; ++i)
+      hf->compute_hash(msg, out);
+  }};
+  t.join();
+  for (int i = 0; i < 10; ++i)
+    hf->compute_hash(msg, out);
+
+  auto after = find(metrics::operation::hash, hash_alg);
+  if (after.ops - before.ops != 20 || after.bytes - before.bytes != 20 * msg.size())
+    throw std::runtime_error("Hash calls were miscounted");
+
+  uint64_t n_timed = 0;
+  for (auto i : after.latency)
+    n_timed += i;
+  if (n_timed != after.ops)
+    throw std::runtime_error("Latency histogram does not match the call count");
+
+  // A failed verification is an error
+  auto me = owned_identity::gen(signature_algorithm::Curve25519, hash_algorithm::BLAKE2b_256);
+  auto sig = me.sign(msg);
+  sig[0] ^= 1;
+  me.verify(msg, sig);
+
+  auto verify = find(metrics::operation::verify, static_cast<uint16_t>(signature_algorithm::Curve25519));
+  if (verify.ops == 0 || verify.errors == 0)
+    throw std::runtime_error("Failed verification was not counted");
+  if (find(metrics::operation::sign, static_cast<uint16_t>(signature_algorithm::Curve25519)).ops == 0)
+    throw std::runtime_error("Signing was not counted");
+
+  // A batch counts each entry as a verify of its own
+  auto pub = nu::deserialise<identity>(me.serialise_public());
+  auto good = me.sign(msg);
+  identity_batch_entry entries[3] = { { &pub, msg, good }, { &pub, msg, sig }, { &pub, msg, good } };
+  bool results[3];
+  auto batch_before = find(metrics::operation::verify, static_cast<uint16_t>(signature_algorithm::Curve25519));
+  verify_batch(entries, results);
+  auto batch_after = find(metrics::operation::verify, static_cast<uint16_t>(signature_algorithm::Curve25519));
+  uint64_t batch_timed = 0;
+  for (size_t i = 0; i < batch_after.latency.size(); ++i)
+    batch_timed += batch_after.latency[i] - batch_before.latency[i];
+  if (batch_after.ops - batch_before.ops != 3 || batch_timed != 3 || batch_after.errors - batch_before.errors != 1)
+    throw std::runtime_error("Batch verification was miscounted");
+}
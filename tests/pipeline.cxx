@@ -0,0 +1,46 @@
+#include "c3/upsilon/pipeline.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+int main() {
+  pipeline::config conf;
+  conf.n_workers = 2;
+  conf.queue_capacity = 4;
+  pipeline p{conf};
+
+  auto me = owned_identity::gen<sig_alg, hash_alg>();
+  auto me_pub = static_cast<identity>(me);
+
+  std::vector<nu::data> msgs;
+  std::vector<std::future<nu::data>> sigs;
+  for (int i = 0; i < 16; ++i) {
+    msgs.push_back(nu::serialise(std::to_string(i)));
+    sigs.push_back(p.sign(me, msgs.back()));
+  }
+
+  std::vector<std::future<bool>> good;
+  std::vector<std::future<bool>> bad;
+  for (int i = 0; i < 16; ++i) {
+    auto sig = sigs[i].get();
+    good.push_back(p.verify(me_pub, msgs[i], sig));
+    bad.push_back(p.verify(me_pub, msgs[(i + 1) % 16], sig));
+  }
+
+  for (auto& i : good)
+    if (!i.get())
+      throw std::runtime_error("Failed to verify own signature");
+  for (auto& i : bad)
+    if (i.get())
+      throw std::runtime_error("Incorrectly verified signature of other message");
+
+  if (p.get_stats().jobs_completed != 48)
+    throw std::runtime_error("Unexpected job count");
+
+  return 0;
+}
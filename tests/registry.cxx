@@ -0,0 +1,55 @@
+#include "c3/upsilon/agreement.hpp"
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+// The tables are built at compile time, so they can be read at compile time too
+static_assert(_hash_properties.contains(hash_algorithm::SHA2_256));
+static_assert(_hash_properties.find(hash_algorithm::SHA2_256)->max_output == 32);
+static_assert(_symmetric_properties.find(symmetric_algorithm::XChaCha20_12)->iv_size == 24);
+
+template<typename Alg, typename Func>
+void expect_not_implemented(Func f) {
+  try { f(); }
+  catch (const algorithm_not_implemented<Alg>&) { return; }
+  throw std::runtime_error("Lookup of an unknown algorithm did not throw");
+}
+
+int main() {
+  for (auto alg : { hash_algorithm::SHA2_256, hash_algorithm::SHA3_512, hash_algorithm::BLAKE2b_128 })
+    if (get_hash_function(alg)->properties()->alg != alg)
+      throw std::runtime_error("Hash lookup returned the wrong function");
+
+  for (auto alg : { kdf_algorithm::Shake128, kdf_algorithm::Shake256, kdf_algorithm::HKDF_SHA2_256,
+                    kdf_algorithm::HKDF_SHA2_512, kdf_algorithm::BLAKE2b })
+    if (get_kdf(alg)->alg() != alg)
+      throw std::runtime_error("Kdf lookup returned the wrong kdf");
+
+  for (auto alg : { symmetric_algorithm::AES128, symmetric_algorithm::AES256,
+                    symmetric_algorithm::ChaCha20_8, symmetric_algorithm::ChaCha20_12, symmetric_algorithm::ChaCha20_20,
+                    symmetric_algorithm::XChaCha20_8, symmetric_algorithm::XChaCha20_12, symmetric_algorithm::XChaCha20_20 }) {
+    auto props = get_symmetric_properties(alg);
+    nu::data key(props.key_size), iv(props.iv_size);
+    if (get_symmetric_function(alg, key, iv)->alg() != alg)
+      throw std::runtime_error("Symmetric lookup returned the wrong cipher");
+  }
+
+  auto sig = gen_signer(signature_algorithm::Curve25519);
+  get_verifier(signature_algorithm::Curve25519, sig->serialise_pub());
+  get_signer(signature_algorithm::Curve25519, sig->serialise_priv());
+
+  auto ag = gen_agreement_function(agreement_algorithm::Curve25519);
+  get_agreement_function(agreement_algorithm::Curve25519, ag->serialise_private());
+
+  expect_not_implemented<hash_algorithm>([]() { get_hash_function(hash_algorithm::BLAKE2s_256); });
+  expect_not_implemented<kdf_algorithm>([]() { get_kdf(static_cast<kdf_algorithm>(0x1234)); });
+  // Too costly to let a peer pick
+  expect_not_implemented<kdf_algorithm>([]() { get_kdf(kdf_algorithm::Argon2id); });
+  expect_not_implemented<symmetric_algorithm>([]() { get_symmetric_properties(static_cast<symmetric_algorithm>(0x0111)); });
+  expect_not_implemented<signature_algorithm>([]() { gen_signer(static_cast<signature_algorithm>(0x0040)); });
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include "c3/upsilon/nuker.hpp"
+#include "c3/upsilon/secure_arena.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+using namespace c3::upsilon;
+
+int main() {
+  // Small enough to run out
+  secure_arena arena{4};
+
+  // A freed block is scrubbed past the free list link
+  auto* small = static_cast<uint8_t*>(arena.allocate(64));
+  auto* neighbour = static_cast<uint8_t*>(arena.allocate(64));
+  std::fill(small, small + 64, 0xaa);
+  arena.deallocate(small, 64);
+  if (std::any_of(small + sizeof(void*), small + 64, [](uint8_t b) { return b != 0; }))
+    throw std::runtime_error("Block was not nuked on free");
+  if (arena.allocate(64) != small)
+    throw std::runtime_error("Freed block was not reused");
+  arena.deallocate(small, 64);
+  arena.deallocate(neighbour, 64);
+
+  std::vector<std::pair<uint8_t*, size_t>> blocks;
+  for (size_t len : { 1, 16, 17, 100, 2048, 3000, 20000 }) {
+    auto* p = static_cast<uint8_t*>(arena.allocate(len));
+    std::fill(p, p + len, 0xaa);
+    blocks.emplace_back(p, len);
+  }
+
+  auto stats = arena.get_stats();
+  if (stats.live_blocks + stats.live_large != blocks.size())
+    throw std::runtime_error("Lost count of allocations");
+
+  // Fill past the end of the region, which has to fall back to separate mappings
+  for (size_t i = 0; i < 64; ++i)
+    blocks.emplace_back(static_cast<uint8_t*>(arena.allocate(512)), 512);
+  if (arena.get_stats().live_large == 0)
+    throw std::runtime_error("Expected the arena to overflow");
+
+  for (auto& [p, len] : blocks)
+    arena.deallocate(p, len);
+
+  stats = arena.get_stats();
+  if (stats.live_blocks != 0 || stats.live_large != 0 || stats.slabs_in_use != 0)
+    throw std::runtime_error("Arena did not empty");
+
+  // And through the allocator, growing through every size class
+  nuking_data d;
+  for (size_t i = 0; i < 10000; ++i)
+    d.push_back(static_cast<uint8_t>(i));
+  for (size_t i = 0; i < d.size(); ++i)
+    if (d[i] != static_cast<uint8_t>(i))
+      throw std::runtime_error("nuking_data lost its contents while growing");
+
+  nuking_data e{d};
+  if (e != d)
+    throw std::runtime_error("nuking_data copy differs");
+}
@@ -0,0 +1,107 @@
+#include "c3/upsilon/identity.hpp"
+#include "c3/upsilon/agreement.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <stdexcept>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+template<typename T>
+void check_into(const T& t, const char* name) {
+  auto expected = nu::serialise(t);
+  if (t.serialised_size() != expected.size())
+    throw std::runtime_error(std::string{name} + ": serialised_size disagrees with serialise");
+
+  // Trailing space must be left alone
+  nu::data buf(expected.size() + 8, 0xaa);
+  if (t.serialise_into(buf) != expected.size())
+    throw std::runtime_error(std::string{name} + ": serialise_into wrote the wrong amount");
+  if (!std::equal(expected.begin(), expected.end(), buf.begin()))
+    throw std::runtime_error(std::string{name} + ": serialise_into disagrees with serialise");
+  for (size_t i = expected.size(); i < buf.size(); ++i)
+    if (buf[i] != 0xaa)
+      throw std::runtime_error(std::string{name} + ": serialise_into overran");
+
+  nu::data small(expected.size() - 1);
+  try {
+    t.serialise_into(small);
+    throw std::runtime_error(std::string{name} + ": serialise_into accepted a short buffer");
+  }
+  catch (const std::invalid_argument&) {}
+}
+
+int main() {
+  auto msg = nu::serialise("Hello, world!");
+
+  auto me = owned_identity::gen(signature_algorithm::Curve25519, hash_algorithm::BLAKE2b_256);
+  auto sig = me.sign(msg);
+
+  // identity
+  auto pub = me.serialise_public();
+  auto pub_view = identity_view::parse(pub);
+  if (pub_view.sig_alg != me.alg() || pub_view.hash_alg != hash_algorithm::BLAKE2b_256)
+    throw std::runtime_error("identity_view read the wrong algorithms");
+  if (pub_view.public_key.data() < pub.data() || pub_view.public_key.data() >= pub.data() + pub.size())
+    throw std::runtime_error("identity_view copied the key");
+  auto bob = pub_view.to_identity();
+  if (!bob.verify(msg, sig))
+    throw std::runtime_error("Identity from a view failed to verify");
+  check_into(bob, "identity");
+  if (nu::serialise(bob) != pub)
+    throw std::runtime_error("Identity changed on a round trip");
+
+  // owned_identity
+  auto priv = nu::serialise(me);
+  auto me_reloaded = owned_identity_view::parse(priv).to_owned_identity();
+  if (!me_reloaded.verify(msg, sig))
+    throw std::runtime_error("Owned identity from a view failed to verify");
+  check_into(me, "owned_identity");
+
+  // agreer and remote_agreer
+  auto alice = agreer::gen(kdf_algorithm::Shake256, agreement_algorithm::Curve25519);
+  auto carol = agreer::gen(kdf_algorithm::Shake256, agreement_algorithm::Curve25519);
+  remote_agreer alice_remote{kdf_algorithm::Shake256, agreement_algorithm::Curve25519, alice.get_public()};
+  check_into(alice_remote, "remote_agreer");
+  check_into(alice, "agreer");
+
+  auto alice_remote_ser = nu::serialise(alice_remote);
+  auto remote_view = remote_agreer_view::parse(alice_remote_ser);
+  if (remote_view.to_remote_agreer().shared_secret != alice.get_public())
+    throw std::runtime_error("remote_agreer_view read the wrong public value");
+
+  auto alice_ser = nu::serialise(alice);
+  auto alice_reloaded = agreer_view::parse(alice_ser).to_agreer();
+  if (alice_reloaded.derive_shared_secret(carol.get_public(), 32) !=
+      alice.derive_shared_secret(carol.get_public(), 32))
+    throw std::runtime_error("Agreer from a view agreed differently");
+
+  // safe_hash<nu::dynamic_size>
+  auto h = get_hasher(hash_algorithm::BLAKE2b_256).get_hash<nu::dynamic_size>(msg);
+  safe_hash<nu::dynamic_size> sh{std::move(h), hash_algorithm::BLAKE2b_256};
+  check_into(sh, "safe_hash");
+  auto sh_ser = nu::serialise(sh);
+  if (safe_hash_view::parse(sh_ser).to_safe_hash() != sh)
+    throw std::runtime_error("safe_hash changed on a round trip");
+
+  // Too long for the algorithm
+  safe_hash<nu::dynamic_size> bad{get_hasher(hash_algorithm::BLAKE2b_256).get_hash<nu::dynamic_size>(msg),
+                                  hash_algorithm::BLAKE2b_256};
+  bad.value.value.resize(65);
+  auto bad_ser = nu::serialise(bad);
+  try {
+    safe_hash_view::parse(bad_ser);
+    throw std::runtime_error("safe_hash_view accepted an overlong hash");
+  }
+  catch (const nu::serialisation_failure&) {}
+
+  // Empty
+  bad.value.value.clear();
+  auto empty_ser = nu::serialise(bad);
+  try {
+    safe_hash_view::parse(empty_ser);
+    throw std::runtime_error("safe_hash_view accepted an empty hash");
+  }
+  catch (const nu::serialisation_failure&) {}
+}
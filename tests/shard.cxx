@@ -0,0 +1,97 @@
+#include "c3/upsilon/shard.hpp"
+
+#include <map>
+#include <stdexcept>
+
+using namespace c3::upsilon;
+
+static hash<32> make_hash(uint64_t i) {
+  hash<32> ret;
+  // Spread the bits over the whole key, as a real digest would
+  i = (i + 1) * 0x9e3779b97f4a7c15ULL;
+  for (size_t j = 0; j < ret.value.size(); ++j)
+    ret.value[j] = static_cast<uint8_t>((i >> ((j % 8) * 8)) ^ j);
+  return ret;
+}
+
+int main() {
+  constexpr size_t n_keys = 10001;
+  std::vector<hash<32>> hashes;
+  for (size_t i = 0; i < n_keys; ++i)
+    hashes.push_back(make_hash(i));
+
+  // Jump: bulk matches single, and growing only moves keys onto the new shard
+  std::vector<uint32_t> before(n_keys), after(n_keys);
+  jump_shard(gsl::span<const hash<32>>{hashes}, 10, before);
+  jump_shard(gsl::span<const hash<32>>{hashes}, 11, after);
+  size_t n_moved = 0;
+  for (size_t i = 0; i < n_keys; ++i) {
+    if (before[i] != jump_shard(hashes[i], 10) || after[i] != jump_shard(hashes[i], 11))
+      throw std::runtime_error("Bulk jump hash disagrees with single");
+    if (before[i] >= 10)
+      throw std::runtime_error("Jump hash out of range");
+    if (before[i] != after[i]) {
+      if (after[i] != 10)
+        throw std::runtime_error("Jump hash moved a key between old shards");
+      ++n_moved;
+    }
+  }
+  if (n_moved < n_keys / 11 / 2 || n_moved > n_keys / 11 * 2)
+    throw std::runtime_error("Jump hash moved the wrong share of keys");
+
+  try {
+    jump_shard(uint64_t{1}, 0);
+    throw std::runtime_error("Sharded over no shards");
+  }
+  catch (const std::invalid_argument&) {}
+
+  // Rendezvous: weights are respected, and only the departing node's keys move
+  rendezvous_ring ring{ { 1, 1.0 }, { 2, 1.0 }, { 3, 2.0 } };
+  std::map<uint64_t, size_t> counts;
+  std::vector<uint64_t> owners;
+  for (auto& i : hashes) {
+    owners.push_back(ring.route(i));
+    ++counts[owners.back()];
+  }
+  if (counts[3] < counts[1] * 3 / 2 || counts[3] < counts[2] * 3 / 2)
+    throw std::runtime_error("Rendezvous ignored the weights");
+
+  ring.remove(2);
+  for (size_t i = 0; i < n_keys; ++i)
+    if (owners[i] != 2 && ring.route(hashes[i]) != owners[i])
+      throw std::runtime_error("Rendezvous moved a key off a node that stayed");
+
+  try {
+    ring.add({ 1, 1.0 });
+    throw std::runtime_error("Added a node twice");
+  }
+  catch (const std::invalid_argument&) {}
+
+  // Tables route as the ring does, and rebuilding moves only the slots the new node takes
+  shard_table table{ring, 12};
+  for (size_t i = 0; i < table.slots().size(); ++i) {
+    auto key = (uint64_t{i} << 52) | (uint64_t{1} << 51);
+    if (table.route(key) != ring.route(key))
+      throw std::runtime_error("Table disagrees with its ring");
+  }
+
+  auto old_slots = table.slots();
+  ring.add({ 4, 1.0 });
+  auto n_rebuilt = table.rebuild(ring);
+  size_t n_taken = 0;
+  for (size_t i = 0; i < old_slots.size(); ++i) {
+    if (table.slots()[i] == old_slots[i])
+      continue;
+    if (table.slots()[i] != 4)
+      throw std::runtime_error("Rebuild moved a slot between old nodes");
+    ++n_taken;
+  }
+  if (n_taken != n_rebuilt || n_taken == 0)
+    throw std::runtime_error("Rebuild miscounted the moved slots");
+
+  std::vector<uint64_t> routed(n_keys);
+  table.route(gsl::span<const hash<32>>{hashes}, routed);
+  for (size_t i = 0; i < n_keys; ++i)
+    if (routed[i] != table.route(hashes[i]))
+      throw std::runtime_error("Bulk table routing disagrees with single");
+}
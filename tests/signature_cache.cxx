@@ -0,0 +1,36 @@
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+int main() {
+  auto cache = std::make_shared<signature_cache>(1024);
+  set_signature_cache(cache);
+
+  auto me = owned_identity::gen<sig_alg, hash_alg>();
+  auto me_pub = nu::deserialise<identity>(me.serialise_public());
+
+  auto msg = nu::serialise("Hello, world!");
+  auto other_msg = nu::serialise("Hello, World!");
+  auto sig = me.sign(msg);
+
+  if (!me_pub.verify(msg, sig) || !me_pub.verify(msg, sig))
+    throw std::runtime_error("Failed to verify with signature cache");
+
+  if (me_pub.verify(other_msg, sig) || me_pub.verify(other_msg, sig))
+    throw std::runtime_error("Signature cache accepted a bad signature");
+
+  auto stats = cache->get_stats();
+  // Bad signatures are never remembered, so both of those miss
+  if (stats.hits != 1 || stats.misses != 3 || stats.insertions != 1)
+    throw std::runtime_error("Unexpected cache statistics");
+
+  set_signature_cache(nullptr);
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include "c3/upsilon/static_hasher.hpp"
+
+#include <stdexcept>
+#include <string>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+template<hash_algorithm Alg>
+void check(const char* name) {
+  auto fast = get_static_hasher<Alg>();
+  hasher slow = fast;
+
+  // Lengths either side of every block and padding boundary
+  for (size_t len : { 0, 1, 55, 56, 64, 111, 112, 128, 135, 136, 137, 1000 }) {
+    nu::data input(len);
+    for (size_t i = 0; i < len; ++i)
+      input[i] = static_cast<uint8_t>(i * 7 + 1);
+    nu::data salt(len % 3, 0x42);
+
+    if (fast.get_hash(input) != slow.get_hash(input))
+      throw std::runtime_error(std::string{name} + ": static hash differs");
+    if (fast.get_hash(input, salt) != slow.get_hash(input, salt))
+      throw std::runtime_error(std::string{name} + ": static salted hash differs");
+    if (fast.template get_hash<16>(input) != slow.get_hash<16>(input))
+      throw std::runtime_error(std::string{name} + ": truncated static hash differs");
+    if (fast.template get_hash<nu::dynamic_size>(input) != slow.get_hash(input))
+      throw std::runtime_error(std::string{name} + ": dynamic static hash differs");
+  }
+
+  static_assert(std::is_same_v<decltype(fast.get_hash(nu::data{})), hash<get_hash_properties<Alg>().max_output>>,
+                "static_hasher should default to the full digest");
+}
+
+int main() {
+  check<hash_algorithm::SHA2_224>("SHA2_224");
+  check<hash_algorithm::SHA2_256>("SHA2_256");
+  check<hash_algorithm::SHA2_384>("SHA2_384");
+  check<hash_algorithm::SHA2_512>("SHA2_512");
+  check<hash_algorithm::SHA3_224>("SHA3_224");
+  check<hash_algorithm::SHA3_256>("SHA3_256");
+  check<hash_algorithm::SHA3_384>("SHA3_384");
+  check<hash_algorithm::SHA3_512>("SHA3_512");
+  check<hash_algorithm::BLAKE2b_128>("BLAKE2b_128");
+  check<hash_algorithm::BLAKE2b_256>("BLAKE2b_256");
+  check<hash_algorithm::BLAKE2b_512>("BLAKE2b_512");
+
+  nu::data too_long(65);
+  try {
+    static_hash<hash_algorithm::SHA2_512>(nu::data{}, {}, too_long);
+    throw std::runtime_error("Static hash gave more than max_output");
+  }
+  catch (const std::range_error&) {}
+}
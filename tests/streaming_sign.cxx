@@ -0,0 +1,51 @@
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <cstdio>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+int main() {
+  auto me = owned_identity::gen<sig_alg, hash_alg>();
+  auto me_pub = nu::deserialise<identity>(me.serialise_public());
+
+  std::vector<nu::data> chunks;
+  nu::data whole;
+  for (int i = 0; i < 64; ++i) {
+    chunks.emplace_back(nu::serialise(std::to_string(i * i)));
+    whole.insert(whole.end(), chunks.back().begin(), chunks.back().end());
+  }
+
+  // Ed25519 is deterministic, so streaming has to give exactly the same signature
+  auto sig = me.sign(whole);
+  if (me.sign(chunks.begin(), chunks.end()) != sig)
+    throw std::runtime_error("Chunked signature differed");
+  if (!me_pub.verify(chunks.begin(), chunks.end(), sig))
+    throw std::runtime_error("Failed to verify chunked message");
+
+  auto message = me_pub.begin_message();
+  message.process(whole);
+  if (!me_pub.verify(std::move(message), sig))
+    throw std::runtime_error("Failed to verify partial_hasher");
+
+  FILE* f = std::tmpfile();
+  if (!f || std::fwrite(whole.data(), 1, whole.size(), f) != whole.size() || std::fflush(f) != 0)
+    throw std::runtime_error("Failed to write temporary file");
+
+  std::rewind(f);
+  if (me.sign_fd(fileno(f)) != sig)
+    throw std::runtime_error("File signature differed");
+
+  std::rewind(f);
+  if (!me_pub.verify_fd(fileno(f), sig))
+    throw std::runtime_error("Failed to verify file");
+
+  std::fclose(f);
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include "c3/upsilon/tuner.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using namespace c3::upsilon;
+
+int main() {
+  auto cache = "c3-upsilon-tuning-test";
+  std::remove(cache);
+  setenv("C3_UPSILON_TUNING_CACHE", cache, 1);
+  // Hashes without a base backend keep their own under a family-wide override, so this only changes the key
+  setenv("C3_UPSILON_BACKEND", "hash=base", 1);
+
+  auto& ranking = tuned_algorithms();
+
+  size_t n_hash = 0, n_symmetric = 0;
+  _hash_funcs.for_each([&](auto alg, auto) {
+    ++n_hash;
+    if (std::count(ranking.hash.begin(), ranking.hash.end(), alg) != 1)
+      throw std::runtime_error("Hash missing from the ranking");
+  });
+  _symmetric_functions.for_each([&](auto alg, auto) {
+    ++n_symmetric;
+    if (std::count(ranking.symmetric.begin(), ranking.symmetric.end(), alg) != 1)
+      throw std::runtime_error("Symmetric algorithm missing from the ranking");
+  });
+  if (ranking.hash.size() != n_hash || ranking.symmetric.size() != n_symmetric)
+    throw std::runtime_error("Ranking has extra algorithms");
+
+  std::ifstream cached{cache};
+  if (!cached)
+    throw std::runtime_error("Tuning was not cached");
+  std::string line;
+  std::getline(cached, line);
+  if (line.find("=base") == std::string::npos)
+    throw std::runtime_error("Forced backends are missing from the cache key");
+  cached.close();
+  std::remove(cache);
+
+  auto picked = preferred_algorithm({ hash_algorithm::SHA2_256, hash_algorithm::BLAKE2b_256 });
+  if (picked != hash_algorithm::SHA2_256 && picked != hash_algorithm::BLAKE2b_256)
+    throw std::runtime_error("Picked a hash that was not offered");
+
+  try {
+    preferred_algorithm(std::vector<symmetric_algorithm>{});
+    throw std::runtime_error("Picked from nothing");
+  }
+  catch (const std::invalid_argument&) {}
+}
@@ -0,0 +1,52 @@
+#include "c3/upsilon/vanity.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <stdexcept>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  nu::data prefix = { 0xc3, 0xff };
+
+  // A whole byte and a few bits of the next, under a fingerprint other than the default
+  vanity_config conf;
+  conf.fingerprint_alg = hash_algorithm::BLAKE2b_256;
+  auto found = vanity_search(signature_algorithm::Curve25519, hash_algorithm::SHA2_256, prefix, 11, conf);
+  if (!found)
+    throw std::runtime_error("Search gave up without being cancelled");
+
+  auto fp = fingerprint(*found, hash_algorithm::BLAKE2b_256);
+  if (fp.value[0] != 0xc3 || (fp.value[1] & 0xe0) != 0xe0)
+    throw std::runtime_error("Found identity does not match the prefix");
+
+  // It is a working identity, and survives serialisation with its key
+  nu::data msg = { 1, 2, 3 };
+  auto sig = found->sign(msg);
+  auto restored = nu::deserialise<owned_identity>(found->serialise());
+  if (!static_cast<identity>(restored).verify(msg, sig) ||
+      fingerprint(restored, hash_algorithm::BLAKE2b_256).value != fp.value)
+    throw std::runtime_error("Found identity does not round trip");
+
+  // A prefix nobody will find in a test's lifetime, cancelled from the progress callback
+  nu::data impossible(32, 0);
+  size_t reports = 0;
+  conf.n_workers = 2;
+  conf.report_interval = std::chrono::milliseconds{10};
+  conf.on_progress = [&](const vanity_progress& p) {
+    if (p.expected_attempts != 0x1p256 || (p.eta.count() <= 0 && p.attempts_per_sec > 0))
+      throw std::runtime_error("Progress report is off");
+    return ++reports < 3;
+  };
+  if (vanity_search(signature_algorithm::Curve25519, hash_algorithm::SHA2_256, impossible, conf))
+    throw std::runtime_error("Cancelled search still found something");
+  if (reports != 3)
+    throw std::runtime_error("Search did not stop when the callback asked");
+
+  try {
+    vanity_search(signature_algorithm::Curve25519, hash_algorithm::SHA2_256, prefix, 17);
+    throw std::runtime_error("Prefix shorter than its bit count was accepted");
+  }
+  catch (const std::invalid_argument&) {}
+}
@@ -0,0 +1,99 @@
+#include "c3/upsilon/hash.hpp"
+#include "c3/upsilon/symmetric.hpp"
+
+#include <c3/nu/data.hpp>
+
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/uio.h>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+// Uneven, and not on block boundaries, with an empty one thrown in
+static const std::vector<size_t> fragment_sizes = { 1, 15, 64, 7, 0, 300, 613 };
+static constexpr size_t total = 1000;
+
+template<typename Span, typename Data>
+static std::vector<Span> split(Data& b, const std::vector<size_t>& sizes) {
+  std::vector<Span> ret;
+  size_t pos = 0;
+  for (auto i : sizes) {
+    ret.push_back(Span{b.data() + pos, static_cast<std::ptrdiff_t>(i)});
+    pos += i;
+  }
+  return ret;
+}
+
+static std::vector<iovec> to_iovec(const std::vector<nu::data_ref>& bufs) {
+  std::vector<iovec> ret;
+  for (auto& i : bufs)
+    ret.push_back({ i.data(), static_cast<size_t>(i.size()) });
+  return ret;
+}
+
+int main() {
+  nu::data plaintext(total);
+  std::iota(plaintext.begin(), plaintext.end(), 0);
+
+  _symmetric_functions.for_each([&](symmetric_algorithm alg, auto make) {
+    auto props = get_symmetric_properties(alg);
+    nu::data key(props.key_size, 0x36), iv(props.iv_size, 0x5c);
+    auto expected = make(key, iv)->encrypt(nu::data_const_ref{plaintext});
+
+    // In place, with the keystream running on across fragments
+    auto buf = plaintext;
+    auto fn = make(key, iv);
+    fn->encryptv(split<nu::data_ref>(buf, fragment_sizes));
+    if (buf != expected || fn->pos() != total)
+      throw std::runtime_error("In place encryptv differs from encrypt");
+
+    // Gathered into buffers split somewhere else
+    nu::data out(total);
+    fn = make(key, iv);
+    if (fn->encryptv(split<nu::data_const_ref>(plaintext, fragment_sizes), split<nu::data_ref>(out, { 500, 500 })) != total)
+      throw std::runtime_error("encryptv did not encrypt everything");
+    if (out != expected)
+      throw std::runtime_error("encryptv differs from encrypt");
+
+    // The shorter side decides how much is done
+    fn = make(key, iv);
+    if (fn->encryptv(split<nu::data_const_ref>(plaintext, fragment_sizes), split<nu::data_ref>(out, { 100, 500 })) != 600 ||
+        fn->pos() != 600)
+      throw std::runtime_error("encryptv did not stop at the end of its output");
+
+    // And back, through iovecs
+    fn = make(key, iv);
+    auto iov = to_iovec(split<nu::data_ref>(buf, fragment_sizes));
+    fn->decryptv(iov.data(), iov.size());
+    if (buf != plaintext)
+      throw std::runtime_error("decryptv over iovecs did not decrypt");
+  });
+
+  auto fragments = split<nu::data_const_ref>(plaintext, fragment_sizes);
+  nu::data salt(16, 0x42);
+  for (auto alg : { hash_algorithm::SHA2_256, hash_algorithm::SHA3_256, hash_algorithm::BLAKE2b_256 }) {
+    auto h = get_hasher(alg);
+
+    auto p = h.begin_hash();
+    p.processv(fragments);
+    if (p.finish() != h.get_hash(plaintext))
+      throw std::runtime_error("processv differs from hashing in one go");
+
+    auto salted = h.begin_hash(salt);
+    salted.processv(fragments);
+    auto reference = h.begin_hash(salt);
+    reference.process(plaintext);
+    if (salted.finish() != reference.finish())
+      throw std::runtime_error("Salted processv differs from process");
+
+    auto buf = plaintext;
+    auto iov = to_iovec(split<nu::data_ref>(buf, fragment_sizes));
+    auto from_iov = h.begin_hash();
+    from_iov.processv(iov.data(), iov.size());
+    if (from_iov.finish() != h.get_hash(plaintext))
+      throw std::runtime_error("processv over iovecs differs from hashing in one go");
+  }
+}
@@ -0,0 +1,40 @@
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+int main() {
+  auto cache = std::make_shared<verifier_cache>(1 << 16);
+  set_verifier_cache(cache);
+
+  auto me = owned_identity::gen<sig_alg, hash_alg>();
+  auto msg = nu::serialise("Hello, world!");
+  auto sig = me.sign(msg);
+
+  auto first = nu::deserialise<identity>(me.serialise_public());
+  auto second = nu::deserialise<identity>(me.serialise_public());
+
+  if (!first.verify(msg, sig) || !second.verify(msg, sig))
+    throw std::runtime_error("Failed to verify with cached verifier");
+
+  auto stats = cache->get_stats();
+  if (stats.hits != 1 || stats.misses != 1)
+    throw std::runtime_error("Unexpected cache statistics");
+
+  // Converting an owned identity interns the same verifier, rather than sharing out the signer
+  auto converted = static_cast<identity>(me);
+  if (!converted.verify(msg, sig))
+    throw std::runtime_error("Failed to verify with a converted identity");
+  stats = cache->get_stats();
+  if (stats.hits != 2 || stats.misses != 1)
+    throw std::runtime_error("Converting an owned identity skipped the cache");
+
+  set_verifier_cache(nullptr);
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include "c3/upsilon/identity.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+constexpr auto hash_alg = hash_algorithm::BLAKE2b_256;
+constexpr auto sig_alg = signature_algorithm::Curve25519;
+
+int main() {
+  auto alice = owned_identity::gen<sig_alg, hash_alg>();
+  auto bob = owned_identity::gen<sig_alg, hash_alg>();
+
+  auto alice_pub = nu::deserialise<identity>(alice.serialise_public());
+  auto bob_pub = nu::deserialise<identity>(bob.serialise_public());
+
+  std::vector<nu::data> msgs;
+  std::vector<nu::data> sigs;
+  std::vector<identity_batch_entry> entries;
+  for (int i = 0; i < 8; ++i) {
+    msgs.push_back(nu::serialise(std::to_string(i)));
+    sigs.push_back((i < 4 ? alice : bob).sign(msgs.back()));
+  }
+  for (int i = 0; i < 8; ++i)
+    entries.push_back({ i < 4 ? &alice_pub : &bob_pub, msgs[i], sigs[i] });
+
+  bool results[8];
+  if (!verify_batch(entries, results))
+    throw std::runtime_error("Failed to verify valid batch");
+
+  // Attribute one of alice's signatures to bob
+  entries[5].sig = sigs[2];
+  if (verify_batch(entries, results))
+    throw std::runtime_error("Incorrectly verified bad batch");
+
+  for (int i = 0; i < 8; ++i)
+    if (results[i] != (i != 5))
+      throw std::runtime_error("Bad entry was not identified");
+
+  // A run long enough to be checked as one, and then bisected, with one signature over another message
+  constexpr int n_run = 40;
+  constexpr int forged = 23;
+  std::vector<nu::data> run_msgs;
+  std::vector<nu::data> run_sigs;
+  std::vector<identity_batch_entry> run;
+  for (int i = 0; i < n_run; ++i) {
+    run_msgs.push_back(nu::serialise("run " + std::to_string(i)));
+    run_sigs.push_back(alice.sign(run_msgs.back()));
+  }
+  for (int i = 0; i < n_run; ++i)
+    run.push_back({ &alice_pub, run_msgs[i], run_sigs[i] });
+
+  bool run_results[n_run];
+  if (!verify_batch(run, run_results))
+    throw std::runtime_error("Failed to verify valid run");
+
+  run[forged].sig = run_sigs[forged + 1];
+  if (verify_batch(run, run_results))
+    throw std::runtime_error("Incorrectly verified run with a forged signature");
+
+  for (int i = 0; i < n_run; ++i)
+    if (run_results[i] != (i != forged))
+      throw std::runtime_error("Forged signature was not the only one flagged");
+
+  return 0;
+}
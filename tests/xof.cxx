@@ -0,0 +1,37 @@
+#include "c3/upsilon/kdf.hpp"
+
+#include <c3/nu/data.hpp>
+
+using namespace c3::upsilon;
+using namespace c3;
+
+int main() {
+  for (auto alg : { kdf_algorithm::Shake128, kdf_algorithm::Shake256,
+                    kdf_algorithm::HKDF_SHA2_256, kdf_algorithm::HKDF_SHA2_512,
+                    kdf_algorithm::BLAKE2b }) {
+    auto* k = get_kdf(alg);
+    auto input = nu::serialise("Hello, world!");
+
+    // Enough to cross several blocks of either rate
+    auto expected = k->expand(input, 1000);
+
+    auto reader = k->begin_expand(input);
+    for (int round = 0; round < 2; ++round) {
+      nuking_data squeezed;
+      for (size_t len : { 1, 7, 200, 168, 624 }) {
+        nu::data piece(len);
+        reader->squeeze(piece);
+        squeezed.insert(squeezed.end(), piece.begin(), piece.end());
+      }
+
+      if (squeezed != expected)
+        throw std::runtime_error("Squeezed output did not match expand");
+
+      // Should behave identically after a reset
+      reader->reset();
+      reader->absorb(input);
+    }
+  }
+
+  return 0;
+}